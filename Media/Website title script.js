@@ -7,16 +7,17 @@ var url = "http://www.mishira.com";
 // Temporary display some static text while we are processing
 updateText("Please wait...");
 
-// Fetch the HTML of the specified website
-var html = readHttpGet(url);
+// Fetch the HTML of the specified website. The function is called once the
+// website has replied.
+readHttpGet(url, function(html) {
+    // Find the `<title>` tag using regular expression
+    var matches = html.match(/<title>(.*)<\/title>/);
+    var title;
+    if(matches != null)
+        title = matches[1];
+    else
+        title = "No <title> found";
 
-// Find the `<title>` tag using regular expression
-var matches = html.match(/<title>(.*)<\/title>/);
-var title;
-if(matches != null)
-    title = matches[1];
-else
-    title = "No <title> found";
-
-// Display the title
-updateText(title);
+    // Display the title
+    updateText(title);
+});
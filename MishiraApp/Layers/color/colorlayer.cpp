@@ -125,6 +125,11 @@ void ColorLayer::render(
 	vidgfx_context_draw_buf(gfx, m_vertBuf);
 }
 
+bool ColorLayer::hasStaticOutput() const
+{
+	return true;
+}
+
 quint32 ColorLayer::getTypeId() const
 {
 	return (quint32)LyrColorLayerTypeId;
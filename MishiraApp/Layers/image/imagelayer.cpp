@@ -135,6 +135,9 @@ void ImageLayer::updateResources(VidgfxContext *gfx)
 		if(m_filename.isEmpty())
 			return; // No file specified
 		m_imgTex = new FileImageTexture(m_filename);
+	} else if(m_imgTex != NULL) {
+		// The layer might have been resized or rescaled
+		m_imgTex->releasePreparedTexture();
 	}
 
 	// Update the vertex buffer and visability rectangle
@@ -143,6 +146,8 @@ void ImageLayer::updateResources(VidgfxContext *gfx)
 
 void ImageLayer::textureMaybeChanged()
 {
+	setOutputDirty();
+
 	// Update vertex buffer and visible rectangle
 	if(m_imgTex == NULL) {
 		setVisibleRect(QRect()); // Layer is invisible
@@ -176,19 +181,15 @@ void ImageLayer::render(
 {
 	if(m_imgTex == NULL)
 		return; // Nothing to render
-	VidgfxTex *tex = m_imgTex->getTexture();
-	if(tex == NULL)
+	if(m_imgTex->getTexture() == NULL)
 		return; // Image not loaded yet or an error occurred during load
 
-	// Prepare texture for render. TODO: If the image doesn't have animation
-	// then we can optimize rendering by caching the prepared texture data. We
-	// still need to keep the original though just in case the user resizes the
-	// layer.
+	// Prepare texture for render. The prepared texture of static images is
+	// cached until the layer is resized.
 	// TODO: Filter mode selection and orientation
 	QPointF pxSize, botRight;
-	tex = vidgfx_context_prepare_tex(
-		gfx, tex, getVisibleRect().size(), GfxBilinearFilter, true,
-		pxSize, botRight);
+	VidgfxTex *tex = m_imgTex->getPreparedTexture(
+		gfx, getVisibleRect().size(), GfxBilinearFilter, pxSize, botRight);
 	vidgfx_texdecalbuf_set_tex_uv(
 		m_vertBuf, QPointF(), botRight, GfxUnchangedOrient);
 	vidgfx_context_set_tex(gfx, tex);
@@ -211,6 +212,13 @@ void ImageLayer::render(
 	}
 }
 
+bool ImageLayer::hasStaticOutput() const
+{
+	// Animated images mark themselves as dirty whenever their frame changes
+	// but scrolling changes the output every frame
+	return m_scrollSpeed.isNull();
+}
+
 quint32 ImageLayer::getTypeId() const
 {
 	return (quint32)LyrImageLayerTypeId;
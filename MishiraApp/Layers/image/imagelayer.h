@@ -58,6 +58,7 @@ public: // Interface ----------------------------------------------------------
 	virtual void	destroyResources(VidgfxContext *gfx);
 	virtual void	render(
 		VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped);
+	virtual bool	hasStaticOutput() const;
 
 	virtual quint32	getTypeId() const;
 
@@ -24,10 +24,18 @@
 
 const QString LOG_CAT = QStringLiteral("Scene");
 
+// The number of upcoming images that are loaded before they are displayed
+const int NUM_PRELOAD_IMAGES = 2;
+
 SlideshowLayer::SlideshowLayer(LayerGroup *parent)
 	: Layer(parent)
 	, m_vertBufs()
 	, m_imgTexs()
+	, m_imgFailed()
+	, m_imgLastUsed()
+	, m_useCounter(0)
+	, m_upcomingIds()
+	, m_memUsage(0)
 	, m_filenamesChanged(true)
 	, m_curId(-1)
 	, m_prevId(-1)
@@ -40,6 +48,7 @@ SlideshowLayer::SlideshowLayer(LayerGroup *parent)
 	, m_transitionTime(4.0f)
 	, m_transitionStyle(InThenOutStyle)
 	, m_order(SequentialOrder)
+	, m_memoryBudget(256)
 {
 	// As `render()` can be called multiple times on the same layer (Switching
 	// scenes with a shared layer) we must do time-based calculations
@@ -115,6 +124,29 @@ void SlideshowLayer::setOrder(SlideshowOrder order)
 	m_parent->layerChanged(this); // Remote emit
 }
 
+void SlideshowLayer::setMemoryBudget(int budget)
+{
+	if(m_memoryBudget == budget)
+		return; // No change
+	m_memoryBudget = budget;
+
+	updateResourcesIfLoaded();
+	m_parent->layerChanged(this); // Remote emit
+}
+
+/// <summary>
+/// Returns the number of images that are currently loaded or being loaded.
+/// </summary>
+int SlideshowLayer::getNumLoadedImages() const
+{
+	int count = 0;
+	for(int i = 0; i < m_imgTexs.size(); i++) {
+		if(m_imgTexs.at(i) != NULL)
+			count++;
+	}
+	return count;
+}
+
 void SlideshowLayer::showEvent()
 {
 	// Reset to the "first" image and reset all timers and animation
@@ -123,6 +155,7 @@ void SlideshowLayer::showEvent()
 	m_curId = -1;
 	m_prevId = -1;
 	m_transition = 1.0f;
+	m_upcomingIds.clear();
 
 	// Immediately switch to an image
 	switchToFirstImage();
@@ -134,7 +167,8 @@ void SlideshowLayer::hideEvent()
 	// images to be extra safe
 	for(int i = 0; i < m_imgTexs.size(); i++) {
 		FileImageTexture *imgTex = m_imgTexs.at(i);
-		imgTex->setAnimationPaused(true);
+		if(imgTex != NULL)
+			imgTex->setAnimationPaused(true);
 	}
 }
 
@@ -180,12 +214,7 @@ void SlideshowLayer::updateResources(VidgfxContext *gfx)
 		m_filenamesChanged = false;
 
 		// Destroy existing buffers and textures
-		for(int i = 0; i < m_vertBufs.size(); i++)
-			vidgfx_texdecalbuf_destroy(m_vertBufs.at(i));
-		m_vertBufs.clear();
-		for(int i = 0; i < m_imgTexs.size(); i++)
-			delete m_imgTexs.at(i);
-		m_imgTexs.clear();
+		destroyAllImages();
 
 		// Reset state
 		m_curId = -1;
@@ -196,16 +225,27 @@ void SlideshowLayer::updateResources(VidgfxContext *gfx)
 		if(m_filenames.isEmpty())
 			return; // No files specified
 
-		// Create new buffers and textures
-		for(int i = 0; i < m_filenames.size(); i++) {
+		// Create new buffers. Textures are only created when the image is
+		// about to be displayed in `updateResidency()`.
+		const int numImgs = m_filenames.size();
+		m_vertBufs.reserve(numImgs);
+		for(int i = 0; i < numImgs; i++)
 			m_vertBufs.append(vidgfx_texdecalbuf_new(gfx));
-			FileImageTexture *imgTex = new FileImageTexture(m_filenames.at(i));
-			imgTex->setAnimationPaused(true);
-			m_imgTexs.append(imgTex);
-		}
+		m_imgTexs.fill(NULL, numImgs);
+		m_imgFailed.fill(false, numImgs);
+		m_imgLastUsed.fill(0, numImgs);
 
 		// Immediately switch to an image
 		switchToFirstImage();
+	} else {
+		// The memory budget might have changed
+		updateResidency();
+
+		// The layer might have been resized or rescaled
+		for(int i = 0; i < m_imgTexs.size(); i++) {
+			if(m_imgTexs.at(i) != NULL)
+				m_imgTexs.at(i)->releasePreparedTexture();
+		}
 	}
 
 	// Update vertex buffers when the user resizes or changes layer properties
@@ -224,75 +264,193 @@ void SlideshowLayer::switchToFirstImage()
 }
 
 /// <summary>
-/// Begin switching to the next image taking into account transition time and
-/// display order.
+/// Destroys all vertex buffers and textures and forgets everything that we
+/// know about the images.
 /// </summary>
-void SlideshowLayer::switchToNextImage(bool immediately)
+void SlideshowLayer::destroyAllImages()
+{
+	for(int i = 0; i < m_vertBufs.size(); i++)
+		vidgfx_texdecalbuf_destroy(m_vertBufs.at(i));
+	m_vertBufs.clear();
+	for(int i = 0; i < m_imgTexs.size(); i++)
+		delete m_imgTexs.at(i);
+	m_imgTexs.clear();
+	m_imgFailed.clear();
+	m_imgLastUsed.clear();
+	m_upcomingIds.clear();
+	m_memUsage = 0;
+}
+
+/// <summary>
+/// Decides which images will be displayed next taking into account the
+/// display order so that they can be loaded before they are needed. Images
+/// that are known to have failed to load are never chosen.
+/// </summary>
+void SlideshowLayer::planUpcomingImages()
+{
+	// Forget about images that failed to load
+	for(int i = m_upcomingIds.size() - 1; i >= 0; i--) {
+		if(m_imgFailed.at(m_upcomingIds.at(i)))
+			m_upcomingIds.remove(i);
+	}
+
+	// We never need to plan the current image
+	int maxUpcoming = m_imgTexs.size();
+	if(m_curId >= 0)
+		maxUpcoming--;
+	maxUpcoming = qMin(maxUpcoming, NUM_PRELOAD_IMAGES);
+
+	while(m_upcomingIds.size() < maxUpcoming) {
+		int afterId =
+			m_upcomingIds.isEmpty() ? m_curId : m_upcomingIds.last();
+		int id = chooseUpcomingImage(afterId);
+		if(id < 0)
+			break; // No valid image found
+		m_upcomingIds.append(id);
+	}
+}
+
+/// <summary>
+/// Chooses the image to display after the specified image taking into account
+/// the display order.
+/// </summary>
+/// <returns>-1 if there is no valid image to display</returns>
+int SlideshowLayer::chooseUpcomingImage(int afterId) const
 {
 	const int numImgs = m_imgTexs.size();
 	switch(m_order) {
 	default:
 	case SequentialOrder: {
-		// Switch to the next loaded image sequentially
-		int nextId = m_curId;
-		for(;;) {
-			nextId++;
-			if(nextId >= numImgs) {
-				nextId = 0;
-				if(m_curId < 0)
-					break; // No valid image found
-			}
-			if(nextId == m_curId)
+		// Choose the next image sequentially
+		int nextId = afterId;
+		for(int i = 0; i < numImgs; i++) {
+			nextId = (nextId + 1) % numImgs;
+			if(nextId == m_curId || m_upcomingIds.contains(nextId))
 				break; // No valid image found
-			if(switchToImage(nextId, immediately))
-				break;
+			if(!m_imgFailed.at(nextId))
+				return nextId;
 		}
 		break; }
 	case RandomOrder: {
-		// Switch to a random image that isn't the current one that is already
-		// loaded. If we have more than two images then also don't choose the
-		// previous one.
+		// Choose a random image that isn't the current one. If we have more
+		// than two images then also don't choose the previous one.
 
 		// Generate a list of all valid images that we can switch to except the
 		// current and previous ones
 		QVector<int> validImgs;
 		validImgs.reserve(numImgs);
 		for(int i = 0; i < numImgs; i++) {
-			if(i != m_curId && i != m_prevId)
+			if(i != m_curId && i != m_prevId && !m_imgFailed.at(i) &&
+				!m_upcomingIds.contains(i))
+			{
 				validImgs.append(i);
+			}
+		}
+		if(!validImgs.isEmpty())
+			return validImgs.at(qrand32() % validImgs.size());
+
+		// If there are no other images then we only have one choice left: The
+		// previous image.
+		if(m_prevId >= 0 && m_prevId < numImgs && !m_imgFailed.at(m_prevId) &&
+			!m_upcomingIds.contains(m_prevId))
+		{
+			return m_prevId;
 		}
+		break; }
+	}
+	return -1;
+}
 
-		// Try to switch to one of the images in the list
-		bool switched = false;
-		while(!validImgs.isEmpty()) {
-			// Choose a random image from the list
-			int index = qrand32() % validImgs.size();
-			int nextId = validImgs.at(index);
-
-			// Try switching to that image
-			if(switchToImage(nextId, immediately)) {
-				// Successfully switched image
-				switched = true;
-				break;
-			}
+/// <summary>
+/// Makes sure that the current, previous and upcoming images are loaded or
+/// being loaded and unloads the least recently displayed images that are not
+/// needed if we are using more memory than our budget allows.
+/// </summary>
+void SlideshowLayer::updateResidency()
+{
+	if(m_imgTexs.isEmpty())
+		return; // Nothing to do
 
-			// We failed to switch to the image, remove it from the list and
-			// try the next one
-			validImgs.remove(index);
+	// Release images that failed to load and calculate our memory usage
+	m_memUsage = 0;
+	for(int i = 0; i < m_imgTexs.size(); i++) {
+		FileImageTexture *imgTex = m_imgTexs.at(i);
+		if(imgTex == NULL)
+			continue;
+		if(!imgTex->isLoaded() && !imgTex->isLoading()) {
+			m_imgFailed[i] = true;
+			delete imgTex;
+			m_imgTexs[i] = NULL;
+			continue;
 		}
+		m_memUsage += imgTex->getMemoryUsage();
+	}
+
+	// Begin loading any images that we need in the background
+	QVector<int> requiredIds = m_upcomingIds;
+	if(m_curId >= 0)
+		requiredIds.append(m_curId);
+	if(m_prevId >= 0)
+		requiredIds.append(m_prevId);
+	for(int i = 0; i < requiredIds.size(); i++) {
+		int id = requiredIds.at(i);
+		if(m_imgTexs.at(id) != NULL || m_imgFailed.at(id))
+			continue; // Already loaded or cannot be loaded
+		// Images that are about to be displayed are loaded before prefetches
+		IOPriority priority = IOPrefetchPriority;
+		if(id == m_curId || id == m_prevId)
+			priority = IOVisiblePriority;
+		FileImageTexture *imgTex =
+			new FileImageTexture(m_filenames.at(id), priority);
+		imgTex->setAnimationPaused(true);
+		m_imgTexs[id] = imgTex;
+	}
 
-		// If we didn't successfully switch to another image then we only have
-		// one choice left: The previous image. We can't just add this to the
-		// list above as we might have more than two images in our list but
-		// only two are actually loaded due to errors.
-		if(!switched) {
-			if(m_prevId >= 0 && m_prevId < numImgs)
-				switchToImage(m_prevId, immediately);
-			// If the above fails then we just keep the current image displayed
+	// Unload the least recently displayed images until we are within budget
+	const quint64 budget = (quint64)m_memoryBudget * 1024ULL * 1024ULL;
+	while(m_memUsage > budget) {
+		int lruId = -1;
+		for(int i = 0; i < m_imgTexs.size(); i++) {
+			if(m_imgTexs.at(i) == NULL || requiredIds.contains(i))
+				continue;
+			if(lruId < 0 || m_imgLastUsed.at(i) < m_imgLastUsed.at(lruId))
+				lruId = i;
 		}
+		if(lruId < 0)
+			break; // Every loaded image is required
+		FileImageTexture *imgTex = m_imgTexs.at(lruId);
+		m_memUsage -= imgTex->getMemoryUsage();
+		delete imgTex;
+		m_imgTexs[lruId] = NULL;
+	}
+}
 
-		break; }
+/// <summary>
+/// Begin switching to the next image taking into account transition time and
+/// display order. If the next image hasn't finished loading yet then we keep
+/// displaying the current image and the caller should try again later.
+/// </summary>
+void SlideshowLayer::switchToNextImage(bool immediately)
+{
+	for(;;) {
+		planUpcomingImages();
+		updateResidency();
+		if(m_upcomingIds.isEmpty())
+			return; // No valid image found
+		int id = m_upcomingIds.first();
+		if(m_imgFailed.at(id))
+			continue; // Failed to load, try the image after it instead
+		FileImageTexture *imgTex = m_imgTexs.at(id);
+		if(imgTex == NULL || !imgTex->isLoaded())
+			return; // Image isn't loaded yet
+		m_upcomingIds.remove(0);
+		switchToImage(id, immediately);
+		break;
 	}
+
+	// Begin loading the image after this one
+	planUpcomingImages();
+	updateResidency();
 }
 
 /// <summary>
@@ -307,7 +465,7 @@ bool SlideshowLayer::switchToImage(int id, bool immediately)
 	if(id < 0 || id >= m_imgTexs.size())
 		return false; // Invalid image
 	FileImageTexture *imgTex = m_imgTexs.at(id);
-	if(!imgTex->isLoaded())
+	if(imgTex == NULL || !imgTex->isLoaded())
 		return false; // Image isn't loaded yet
 
 	// An immediate transition time is the same as always immediately
@@ -318,13 +476,16 @@ bool SlideshowLayer::switchToImage(int id, bool immediately)
 	// animations disabled. This is mostly for safety.
 	if(m_prevId >= 0 && m_prevId < m_imgTexs.size()) {
 		FileImageTexture *prevImgTex = m_imgTexs.at(m_prevId);
-		prevImgTex->setAnimationPaused(true);
+		if(prevImgTex != NULL)
+			prevImgTex->setAnimationPaused(true);
 	}
 
 	// Do the actual switch
 	m_prevId = m_curId;
 	m_curId = id;
 	m_timeSinceLastSwitch = 0.0f;
+	m_useCounter++;
+	m_imgLastUsed[id] = m_useCounter;
 
 	// Enable animation for the image to make visible if it has any and fully
 	// reset it to the first frame.
@@ -349,7 +510,8 @@ bool SlideshowLayer::switchToImage(int id, bool immediately)
 	// transition completes.
 	if(immediately && m_prevId >= 0 && m_prevId < m_imgTexs.size()) {
 		FileImageTexture *prevImgTex = m_imgTexs.at(m_prevId);
-		prevImgTex->setAnimationPaused(true);
+		if(prevImgTex != NULL)
+			prevImgTex->setAnimationPaused(true);
 	}
 
 	return true;
@@ -359,6 +521,8 @@ void SlideshowLayer::textureMaybeChanged(int id)
 {
 	if(id < 0 || id >= m_imgTexs.size())
 		return; // Invalid image
+	if(id == m_curId || id == m_prevId)
+		setOutputDirty();
 	FileImageTexture *imgTex = m_imgTexs.at(id);
 	VidgfxTexDecalBuf *vertBuf = m_vertBufs.at(id);
 
@@ -385,12 +549,7 @@ void SlideshowLayer::destroyResources(VidgfxContext *gfx)
 	appLog(LOG_CAT)
 		<< "Destroying hardware resources for layer " << getIdString();
 
-	for(int i = 0; i < m_vertBufs.size(); i++)
-		vidgfx_texdecalbuf_destroy(m_vertBufs.at(i));
-	m_vertBufs.clear();
-	for(int i = 0; i < m_imgTexs.size(); i++)
-		delete m_imgTexs.at(i);
-	m_imgTexs.clear();
+	destroyAllImages();
 }
 
 void SlideshowLayer::renderImage(VidgfxContext *gfx, int id, float opacity)
@@ -401,19 +560,17 @@ void SlideshowLayer::renderImage(VidgfxContext *gfx, int id, float opacity)
 		return; // Invalid image
 	VidgfxTexDecalBuf *texVertBuf = m_vertBufs.at(id);
 	FileImageTexture *imgTex = m_imgTexs.at(id);
-	VidgfxTex *tex = imgTex->getTexture();
-	if(tex == NULL)
+	if(imgTex == NULL)
+		return; // Image not loaded
+	if(imgTex->getTexture() == NULL)
 		return; // Image not loaded yet or an error occurred during load
 
-	// Prepare texture for render. TODO: If the image doesn't have animation
-	// then we can optimize rendering by caching the prepared texture data. We
-	// still need to keep the original though just in case the user resizes the
-	// layer.
+	// Prepare texture for render. The prepared texture of static images is
+	// cached until the layer is resized.
 	// TODO: Filter mode selection
 	QPointF pxSize, botRight;
-	tex = vidgfx_context_prepare_tex(
-		gfx, tex, getVisibleRect().size(), GfxBilinearFilter, true,
-		pxSize, botRight);
+	VidgfxTex *tex = imgTex->getPreparedTexture(
+		gfx, getVisibleRect().size(), GfxBilinearFilter, pxSize, botRight);
 	vidgfx_texdecalbuf_set_tex_uv(
 		texVertBuf, QPointF(), botRight, GfxUnchangedOrient);
 	vidgfx_context_set_tex(gfx, tex);
@@ -472,6 +629,13 @@ void SlideshowLayer::render(
 	}
 }
 
+bool SlideshowLayer::hasStaticOutput() const
+{
+	// We switch to the first image in `render()` and transitions change the
+	// output every frame
+	return m_curId >= 0 && m_transition.atEnd();
+}
+
 quint32 SlideshowLayer::getTypeId() const
 {
 	return (quint32)LyrSlideshowLayerTypeId;
@@ -492,7 +656,7 @@ void SlideshowLayer::serialize(QDataStream *stream) const
 	Layer::serialize(stream);
 
 	// Write data version number
-	*stream << (quint32)0;
+	*stream << (quint32)1;
 
 	// Save our data
 	*stream << m_filenames;
@@ -500,6 +664,7 @@ void SlideshowLayer::serialize(QDataStream *stream) const
 	*stream << m_transitionTime;
 	*stream << (quint32)m_transitionStyle;
 	*stream << (quint32)m_order;
+	*stream << (qint32)m_memoryBudget;
 }
 
 bool SlideshowLayer::unserialize(QDataStream *stream)
@@ -513,8 +678,9 @@ bool SlideshowLayer::unserialize(QDataStream *stream)
 	*stream >> version;
 
 	// Read our data
-	if(version == 0) {
+	if(version >= 0 && version <= 1) {
 		quint32 uint32Data;
+		qint32 int32Data;
 
 		*stream >> m_filenames;
 		*stream >> m_delayTime;
@@ -523,6 +689,11 @@ bool SlideshowLayer::unserialize(QDataStream *stream)
 		m_transitionStyle = (SlideTransStyle)uint32Data;
 		*stream >> uint32Data;
 		m_order = (SlideshowOrder)uint32Data;
+		if(version >= 1) {
+			*stream >> int32Data;
+			m_memoryBudget = int32Data;
+		} else
+			m_memoryBudget = 256;
 	} else {
 		appLog(LOG_CAT, Log::Warning)
 			<< "Unknown version number in slideshow layer serialized data, "
@@ -543,6 +714,8 @@ void SlideshowLayer::queuedFrameEvent(uint frameNum, int numDropped)
 	// signal processing order
 	for(int i = 0; i < m_imgTexs.size(); i++) {
 		FileImageTexture *imgTex = m_imgTexs.at(i);
+		if(imgTex == NULL)
+			continue; // Image not loaded
 		if(imgTex->processFrameEvent(frameNum, numDropped))
 			textureMaybeChanged(i);
 	}
@@ -550,12 +723,21 @@ void SlideshowLayer::queuedFrameEvent(uint frameNum, int numDropped)
 	// Increment our transition timer
 	Fraction framerate = App->getProfile()->getVideoFramerate();
 	float period = 1.0f / framerate.asFloat();
-	m_transition.addTime((float)(numDropped + 1) * period);
+	if(!m_transition.atEnd()) {
+		// The final step of a transition makes our output static again so
+		// make sure that the scene renders it instead of repeating the
+		// partially transitioned frame
+		m_transition.addTime((float)(numDropped + 1) * period);
+		setOutputDirty();
+	}
 
 	// If the previous image is no longer visible then disable its animation if
 	// it has any
-	if(m_transition.atEnd() && m_prevId >= 0)
+	if(m_transition.atEnd() && m_prevId >= 0 &&
+		m_imgTexs.at(m_prevId) != NULL)
+	{
 		m_imgTexs.at(m_prevId)->setAnimationPaused(true);
+	}
 
 	// If it's time to switch to the next image then do so
 	m_timeSinceLastSwitch += (float)(numDropped + 1) * period;
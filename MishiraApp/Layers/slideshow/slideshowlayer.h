@@ -38,6 +38,14 @@ enum SlideshowOrder {
 };
 
 //=============================================================================
+/// <summary>
+/// Displays a sequence of images. Only the current, previous and next few
+/// images are guaranteed to be loaded at any time. The upcoming images are
+/// chosen in advance so that they can be loaded in the background long before
+/// they are displayed. Images that are no longer needed are kept in memory
+/// until the layer's memory budget is exceeded at which point the least
+/// recently displayed ones are unloaded first.
+/// </summary>
 class SlideshowLayer : public Layer
 {
 	friend class SlideshowLayerFactory;
@@ -48,7 +56,12 @@ private: // Datatypes ---------------------------------------------------------
 
 private: // Members -----------------------------------------------------------
 	TexDecalVertBufList	m_vertBufs;
-	FileImgTexList		m_imgTexs;
+	FileImgTexList		m_imgTexs; // NULL if not loaded
+	QVector<bool>		m_imgFailed;
+	QVector<quint64>	m_imgLastUsed;
+	quint64				m_useCounter;
+	QVector<int>		m_upcomingIds;
+	quint64				m_memUsage;
 	bool				m_filenamesChanged;
 	int					m_curId;
 	int					m_prevId;
@@ -61,6 +74,7 @@ private: // Members -----------------------------------------------------------
 	float				m_transitionTime;
 	SlideTransStyle		m_transitionStyle;
 	SlideshowOrder		m_order;
+	int					m_memoryBudget; // MB
 
 private: // Constructor/destructor --------------------------------------------
 	SlideshowLayer(LayerGroup *parent);
@@ -77,8 +91,16 @@ public: // Methods ------------------------------------------------------------
 	SlideTransStyle	getTransitionStyle() const;
 	void			setOrder(SlideshowOrder order);
 	SlideshowOrder	getOrder() const;
+	void			setMemoryBudget(int budget);
+	int				getMemoryBudget() const;
+	quint64			getMemoryUsage() const;
+	int				getNumLoadedImages() const;
 
 private:
+	void			destroyAllImages();
+	void			planUpcomingImages();
+	int				chooseUpcomingImage(int afterId) const;
+	void			updateResidency();
 	void			switchToFirstImage();
 	void			switchToNextImage(bool immediately = false);
 	bool			switchToImage(int id, bool immediately);
@@ -91,6 +113,7 @@ public: // Interface ----------------------------------------------------------
 	virtual void	destroyResources(VidgfxContext *gfx);
 	virtual void	render(
 		VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped);
+	virtual bool	hasStaticOutput() const;
 
 	virtual quint32	getTypeId() const;
 
@@ -137,6 +160,20 @@ inline SlideshowOrder SlideshowLayer::getOrder() const
 	return m_order;
 }
 
+inline int SlideshowLayer::getMemoryBudget() const
+{
+	return m_memoryBudget;
+}
+
+/// <summary>
+/// Returns the approximate amount of memory in bytes that is used by all the
+/// images that are currently loaded.
+/// </summary>
+inline quint64 SlideshowLayer::getMemoryUsage() const
+{
+	return m_memUsage;
+}
+
 //=============================================================================
 class SlideshowLayerFactory : public LayerFactory
 {
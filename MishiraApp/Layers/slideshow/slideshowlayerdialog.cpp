@@ -30,6 +30,7 @@ SlideshowLayerDialog::SlideshowLayerDialog(
 	// Setup custom widgets
 	m_ui.delayEdit->setUnits(tr("secs"));
 	m_ui.transitionEdit->setUnits(tr("secs"));
+	m_ui.memoryEdit->setUnits(tr("MB"));
 
 	// Setup file dialog and connect it to the add image button
 	//m_fileDialog.setFileMode(FileOpenDialog::ExistingFile);
@@ -62,12 +63,17 @@ SlideshowLayerDialog::SlideshowLayerDialog(
 		this, &SlideshowLayerDialog::delayEditChanged);
 	connect(m_ui.transitionEdit, &QLineEdit::textChanged,
 		this, &SlideshowLayerDialog::transitionEditChanged);
+	m_ui.memoryEdit->setValidator(new QIntValidator(16, 16384, this));
+	connect(m_ui.memoryEdit, &QLineEdit::textChanged,
+		this, &SlideshowLayerDialog::memoryEditChanged);
 
 	// Notify the dialog when settings change
 	connect(m_ui.delayEdit, &QLineEdit::textChanged,
 		this, &LayerDialog::settingModified);
 	connect(m_ui.transitionEdit, &QLineEdit::textChanged,
 		this, &LayerDialog::settingModified);
+	connect(m_ui.memoryEdit, &QLineEdit::textChanged,
+		this, &LayerDialog::settingModified);
 	connect(m_ui.inThenOutBtn, &QAbstractButton::clicked,
 		this, &LayerDialog::settingModified);
 	connect(m_ui.inAndOutBtn, &QAbstractButton::clicked,
@@ -98,6 +104,13 @@ void SlideshowLayerDialog::loadSettings()
 	// Text fields
 	m_ui.delayEdit->setText(QString::number(layer->getDelayTime()));
 	m_ui.transitionEdit->setText(QString::number(layer->getTransitionTime()));
+	m_ui.memoryEdit->setText(QString::number(layer->getMemoryBudget()));
+
+	// Resource usage
+	m_ui.memoryUsageLbl->setText(tr("%L1 MB (%L2 of %L3 images loaded)")
+		.arg((layer->getMemoryUsage() + 512ULL * 1024ULL) / (1024ULL * 1024ULL))
+		.arg(layer->getNumLoadedImages())
+		.arg(filenames.count()));
 
 	// Radio buttons
 	switch(layer->getTransitionStyle()) {
@@ -141,6 +154,8 @@ void SlideshowLayerDialog::applySettings()
 		layer->setDelayTime(m_ui.delayEdit->text().toFloat());
 	if(m_ui.transitionEdit->hasAcceptableInput())
 		layer->setTransitionTime(m_ui.transitionEdit->text().toFloat());
+	if(m_ui.memoryEdit->hasAcceptableInput())
+		layer->setMemoryBudget(m_ui.memoryEdit->text().toInt());
 
 	// Radio buttons
 	if(m_ui.inThenOutBtn->isChecked())
@@ -211,3 +226,9 @@ void SlideshowLayerDialog::transitionEditChanged(const QString &text)
 	doQLineEditValidate(m_ui.transitionEdit);
 	//emit validityMaybeChanged(isValid());
 }
+
+void SlideshowLayerDialog::memoryEditChanged(const QString &text)
+{
+	doQLineEditValidate(m_ui.memoryEdit);
+	//emit validityMaybeChanged(isValid());
+}
@@ -50,6 +50,7 @@ Q_SLOTS: // Slots -------------------------------------------------------------
 
 	void			delayEditChanged(const QString &text);
 	void			transitionEditChanged(const QString &text);
+	void			memoryEditChanged(const QString &text);
 };
 //=============================================================================
 
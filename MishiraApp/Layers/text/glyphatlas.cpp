@@ -0,0 +1,326 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "glyphatlas.h"
+#include <QtGui/QPainter>
+#include <QtGui/QPainterPathStroker>
+
+const QString LOG_CAT = QStringLiteral("Scene");
+
+// Number of transparent pixels between glyphs to prevent bleeding when the
+// texture is sampled with bilinear filtering
+const int GLYPH_GUTTER = 1;
+
+//=============================================================================
+// GlyphAtlas class
+
+QHash<QString, GlyphAtlas *> GlyphAtlas::s_atlases;
+
+/// <summary>
+/// Returns the atlas for the specified font and stroke, creating it if it
+/// doesn't already exist. Every call must be matched by a call to
+/// `derefAtlas()`.
+/// </summary>
+GlyphAtlas *GlyphAtlas::refAtlas(
+	const QRawFont &font, int strokeSize, const QColor &strokeColor)
+{
+	QString key = getKey(font, strokeSize, strokeColor);
+	GlyphAtlas *atlas = s_atlases.value(key, NULL);
+	if(atlas == NULL) {
+		atlas = new GlyphAtlas(key, font, strokeSize, strokeColor);
+		s_atlases[key] = atlas;
+	}
+	atlas->m_ref++;
+	return atlas;
+}
+
+/// <summary>
+/// Releases a reference to the atlas and deletes it and its texture once it
+/// is no longer used.
+/// </summary>
+void GlyphAtlas::derefAtlas(GlyphAtlas *atlas, VidgfxContext *gfx)
+{
+	if(atlas == NULL)
+		return;
+	atlas->m_ref--;
+	if(atlas->m_ref > 0)
+		return;
+	s_atlases.remove(atlas->m_key);
+	atlas->destroyTexture(gfx);
+	delete atlas;
+}
+
+QString GlyphAtlas::getKey(
+	const QRawFont &font, int strokeSize, const QColor &strokeColor)
+{
+	return QStringLiteral("%1|%2|%3|%4|%5|%6|%7")
+		.arg(font.familyName())
+		.arg(font.styleName())
+		.arg(font.pixelSize())
+		.arg(font.weight())
+		.arg((int)font.style())
+		.arg(strokeSize)
+		.arg(strokeColor.rgba());
+}
+
+GlyphAtlas::GlyphAtlas(
+	const QString &key, const QRawFont &font, int strokeSize,
+	const QColor &strokeColor)
+	: m_key(key)
+	, m_ref(0)
+	, m_font(font)
+	, m_strokeSize(strokeSize)
+	, m_strokeColor(strokeColor)
+	, m_image(GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, QImage::Format_ARGB32)
+	, m_tex(NULL)
+	, m_uploadTex(NULL)
+	, m_dirtyRect()
+	, m_generation(0)
+	, m_glyphs()
+	, m_strokes()
+	, m_shelfPos(0, 0)
+	, m_shelfHeight(0)
+{
+	m_image.fill(Qt::transparent);
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+	if(m_tex != NULL || m_uploadTex != NULL) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Glyph atlas deleted without destroying its texture";
+	}
+}
+
+/// <summary>
+/// Returns the position of the fill of the specified glyph relative to its
+/// origin and its location in the atlas texture in normalized coordinates,
+/// rasterising it if it isn't already in the atlas. Returns an empty rectangle
+/// for glyphs that have nothing to display and `false` if the glyph cannot be
+/// added to the atlas. Adding glyphs can clear the atlas which invalidates all
+/// previously returned locations.
+/// </summary>
+bool GlyphAtlas::getGlyph(
+	quint32 glyphIndex, const QColor &color, QRectF *rectOut, QRectF *uvOut)
+{
+	quint64 key = ((quint64)color.rgba() << 32) | (quint64)glyphIndex;
+	Glyph glyph;
+	if(m_glyphs.contains(key))
+		glyph = m_glyphs.value(key);
+	else {
+		if(!rasterizeGlyph(glyphIndex, color, false, &glyph))
+			return false;
+		m_glyphs[key] = glyph;
+	}
+	getGlyphRects(glyph, rectOut, uvOut);
+	return true;
+}
+
+/// <summary>
+/// Identical to `getGlyph()` except it returns the outline of the glyph in the
+/// atlas' stroke colour. Returns an empty rectangle if the atlas has no
+/// stroke.
+/// </summary>
+bool GlyphAtlas::getStroke(
+	quint32 glyphIndex, QRectF *rectOut, QRectF *uvOut)
+{
+	Glyph glyph;
+	if(m_strokes.contains(glyphIndex))
+		glyph = m_strokes.value(glyphIndex);
+	else {
+		if(!rasterizeGlyph(glyphIndex, m_strokeColor, true, &glyph))
+			return false;
+		m_strokes[glyphIndex] = glyph;
+	}
+	getGlyphRects(glyph, rectOut, uvOut);
+	return true;
+}
+
+void GlyphAtlas::getGlyphRects(
+	const Glyph &glyph, QRectF *rectOut, QRectF *uvOut)
+{
+	if(glyph.atlasRect.isEmpty()) {
+		*rectOut = QRectF();
+		*uvOut = QRectF();
+		return;
+	}
+	*rectOut = QRectF(glyph.offset, glyph.atlasRect.size());
+	*uvOut = QRectF(
+		(qreal)glyph.atlasRect.x() / (qreal)GLYPH_ATLAS_SIZE,
+		(qreal)glyph.atlasRect.y() / (qreal)GLYPH_ATLAS_SIZE,
+		(qreal)glyph.atlasRect.width() / (qreal)GLYPH_ATLAS_SIZE,
+		(qreal)glyph.atlasRect.height() / (qreal)GLYPH_ATLAS_SIZE);
+}
+
+/// <summary>
+/// Uploads any new glyphs to the GPU and returns the atlas texture.
+/// </summary>
+VidgfxTex *GlyphAtlas::prepareTexture(VidgfxContext *gfx)
+{
+	if(m_tex == NULL) {
+		// Upload the entire atlas when the texture is first created
+		m_tex = vidgfx_context_new_tex(gfx, m_image, false);
+		m_dirtyRect = QRect();
+		return m_tex;
+	}
+	if(m_dirtyRect.isEmpty())
+		return m_tex;
+	if(!uploadDirtyRect(gfx)) {
+		// Fall back to recreating the entire texture
+		vidgfx_context_destroy_tex(gfx, m_tex);
+		m_tex = vidgfx_context_new_tex(gfx, m_image, false);
+	}
+	m_dirtyRect = QRect();
+	return m_tex;
+}
+
+/// <summary>
+/// Copies only the area of the atlas that changed since the last upload to
+/// the GPU. The pixels are written to the top-left corner of a writable
+/// texture which is then copied into the atlas texture on the GPU.
+/// </summary>
+/// <returns>False if the upload texture could not be created</returns>
+bool GlyphAtlas::uploadDirtyRect(VidgfxContext *gfx)
+{
+	if(m_uploadTex == NULL) {
+		m_uploadTex = vidgfx_context_new_tex(
+			gfx, m_image.size(), true, false);
+		if(m_uploadTex == NULL)
+			return false;
+	}
+
+	// Copy each row separately as the dirty area is narrower than the image
+	const QRect &rect = m_dirtyRect;
+	quint8 *dst = static_cast<quint8 *>(vidgfx_tex_map(m_uploadTex));
+	if(dst == NULL)
+		return false;
+	const int dstStride = vidgfx_tex_get_stride(m_uploadTex);
+	const int rowSize = rect.width() * sizeof(QRgb);
+	for(int y = rect.top(); y <= rect.bottom(); y++) {
+		const uchar *src =
+			m_image.constScanLine(y) + rect.left() * sizeof(QRgb);
+		memcpy(dst, src, rowSize);
+		dst += dstStride;
+	}
+	vidgfx_tex_unmap(m_uploadTex);
+
+	vidgfx_context_copy_tex_data(gfx, m_tex, m_uploadTex, rect.topLeft(),
+		QRect(QPoint(0, 0), rect.size()));
+	return true;
+}
+
+void GlyphAtlas::destroyTexture(VidgfxContext *gfx)
+{
+	if(vidgfx_context_is_valid(gfx)) {
+		if(m_tex != NULL)
+			vidgfx_context_destroy_tex(gfx, m_tex);
+		if(m_uploadTex != NULL)
+			vidgfx_context_destroy_tex(gfx, m_uploadTex);
+	}
+	m_tex = NULL;
+	m_uploadTex = NULL;
+	m_dirtyRect = QRect();
+}
+
+/// <summary>
+/// Finds space in the atlas for a rectangle of the specified size using a
+/// simple shelf packer.
+/// </summary>
+bool GlyphAtlas::allocateRect(const QSize &size, QRect *rectOut)
+{
+	if(size.width() > GLYPH_ATLAS_SIZE || size.height() > GLYPH_ATLAS_SIZE)
+		return false;
+
+	// Start a new shelf if this one is full
+	if(m_shelfPos.x() + size.width() > GLYPH_ATLAS_SIZE) {
+		m_shelfPos = QPoint(0, m_shelfPos.y() + m_shelfHeight);
+		m_shelfHeight = 0;
+	}
+	if(m_shelfPos.y() + size.height() > GLYPH_ATLAS_SIZE)
+		return false; // Atlas is full
+
+	*rectOut = QRect(m_shelfPos, size);
+	m_shelfPos.rx() += size.width() + GLYPH_GUTTER;
+	m_shelfHeight = qMax(m_shelfHeight, size.height() + GLYPH_GUTTER);
+	return true;
+}
+
+void GlyphAtlas::clear()
+{
+	m_glyphs.clear();
+	m_strokes.clear();
+	m_image.fill(Qt::transparent);
+	m_shelfPos = QPoint(0, 0);
+	m_shelfHeight = 0;
+	m_dirtyRect = m_image.rect();
+	m_generation++;
+}
+
+/// <summary>
+/// Rasterises either the fill or the outline of a glyph into a free area of
+/// the atlas.
+/// </summary>
+bool GlyphAtlas::rasterizeGlyph(
+	quint32 glyphIndex, const QColor &color, bool isStroke, Glyph *glyphOut)
+{
+	QPainterPath path = m_font.pathForGlyph(glyphIndex);
+	if(isStroke && m_strokeSize > 0) {
+		QPainterPathStroker stroker;
+		stroker.setWidth(m_strokeSize * 2);
+		stroker.setJoinStyle(Qt::RoundJoin);
+		path = stroker.createStroke(path);
+	} else if(isStroke)
+		path = QPainterPath(); // Atlas has no outline
+	if(path.isEmpty()) {
+		// Glyph has nothing to display (E.g. whitespace)
+		glyphOut->atlasRect = QRect();
+		glyphOut->offset = QPoint();
+		return true;
+	}
+
+	// Determine the size of the glyph including an extra pixel for
+	// antialiasing. The bounds of the outline already include the stroke.
+	int padding = 1;
+	QRect bounds = path.boundingRect().toAlignedRect().adjusted(
+		-padding, -padding, padding, padding);
+
+	// Find space for the glyph, clearing the atlas if it is full
+	QRect rect;
+	if(!allocateRect(bounds.size(), &rect)) {
+		if(m_glyphs.isEmpty())
+			return false; // Glyph is larger than the atlas
+		appLog(LOG_CAT)
+			<< "Glyph atlas for \"" << m_font.familyName() << "\" at "
+			<< m_font.pixelSize() << "px is full, clearing";
+		clear();
+		if(!allocateRect(bounds.size(), &rect))
+			return false;
+	}
+
+	// Render the glyph
+	QPainter p(&m_image);
+	p.setRenderHint(QPainter::Antialiasing, true);
+	p.setClipRect(rect);
+	p.translate(rect.topLeft() - bounds.topLeft());
+	p.fillPath(path, color);
+	p.end();
+	m_dirtyRect = m_dirtyRect.united(rect);
+
+	glyphOut->atlasRect = rect;
+	glyphOut->offset = bounds.topLeft();
+	return true;
+}
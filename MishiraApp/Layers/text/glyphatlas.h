@@ -0,0 +1,116 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include "common.h"
+#include <QtCore/QHash>
+#include <QtGui/QImage>
+#include <QtGui/QRawFont>
+
+const int GLYPH_ATLAS_SIZE = 1024;
+
+//=============================================================================
+/// <summary>
+/// A cache of rasterised glyphs and their outlines for a single font, font
+/// size and stroke that is shared between all text layers that use it. Glyphs
+/// are rasterised on first use and packed into a single texture so that text
+/// which changes frequently can be displayed without rasterising or
+/// reallocating anything. If the atlas fills up then it is cleared and its
+/// generation number is incremented so that users know that they need to
+/// request their glyphs again.
+///
+/// The outline of a glyph is stored separately from its fill so that users
+/// can draw the outlines of all their glyphs before any of the fills. This
+/// prevents the outline of a glyph from covering the fill of its neighbours.
+/// Only the area of the atlas that changed is uploaded to the GPU.
+/// </summary>
+class GlyphAtlas
+{
+private: // Datatypes ---------------------------------------------------------
+	struct Glyph {
+		QRect	atlasRect; // Empty for glyphs that are invisible
+		QPoint	offset; // Relative to the glyph's origin
+	};
+
+private: // Static members ----------------------------------------------------
+	static QHash<QString, GlyphAtlas *>	s_atlases;
+
+private: // Members -----------------------------------------------------------
+	QString					m_key;
+	int						m_ref;
+	QRawFont				m_font;
+	int						m_strokeSize;
+	QColor					m_strokeColor;
+	QImage					m_image;
+	VidgfxTex *				m_tex;
+	VidgfxTex *				m_uploadTex;
+	QRect					m_dirtyRect; // Area not yet uploaded to `m_tex`
+	int						m_generation;
+	QHash<quint64, Glyph>	m_glyphs; // Fills keyed by colour and index
+	QHash<quint32, Glyph>	m_strokes;
+	QPoint					m_shelfPos;
+	int						m_shelfHeight;
+
+public: // Static methods -----------------------------------------------------
+	static GlyphAtlas *	refAtlas(
+		const QRawFont &font, int strokeSize, const QColor &strokeColor);
+	static void			derefAtlas(GlyphAtlas *atlas, VidgfxContext *gfx);
+
+private: // Constructor/destructor --------------------------------------------
+	GlyphAtlas(
+		const QString &key, const QRawFont &font, int strokeSize,
+		const QColor &strokeColor);
+	~GlyphAtlas();
+
+public: // Methods ------------------------------------------------------------
+	int			getGeneration() const;
+	int			getNumGlyphs() const;
+	bool		getGlyph(
+		quint32 glyphIndex, const QColor &color, QRectF *rectOut,
+		QRectF *uvOut);
+	bool		getStroke(
+		quint32 glyphIndex, QRectF *rectOut, QRectF *uvOut);
+	VidgfxTex *	prepareTexture(VidgfxContext *gfx);
+	void		destroyTexture(VidgfxContext *gfx);
+
+private:
+	static QString	getKey(
+		const QRawFont &font, int strokeSize, const QColor &strokeColor);
+	bool		allocateRect(const QSize &size, QRect *rectOut);
+	void		clear();
+	bool		rasterizeGlyph(
+		quint32 glyphIndex, const QColor &color, bool isStroke,
+		Glyph *glyphOut);
+	static void	getGlyphRects(
+		const Glyph &glyph, QRectF *rectOut, QRectF *uvOut);
+	bool		uploadDirtyRect(VidgfxContext *gfx);
+};
+//=============================================================================
+
+inline int GlyphAtlas::getGeneration() const
+{
+	return m_generation;
+}
+
+inline int GlyphAtlas::getNumGlyphs() const
+{
+	return m_glyphs.count() + m_strokes.count();
+}
+
+#endif // GLYPHATLAS_H
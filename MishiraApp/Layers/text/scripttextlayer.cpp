@@ -16,16 +16,13 @@
 //*****************************************************************************
 
 #include "scripttextlayer.h"
-#include "constants.h"
+#include "application.h"
 #include "layergroup.h"
+#include "scriptservice.h"
 #include "scripttextlayerdialog.h"
 #include <QtCore/QDateTime>
-#include <QtNetwork/QNetworkAccessManager>
-#include <QtNetwork/QNetworkReply>
-#include <QtNetwork/QNetworkRequest>
 
 const QString LOG_CAT_SCENE = QStringLiteral("Scene");
-const QString LOG_CAT_SCRIPT = QStringLiteral("Script");
 
 //=============================================================================
 // Default example script
@@ -68,471 +65,14 @@ QString defaultExampleScript()
 		).arg(nowStr);
 }
 
-//=============================================================================
-// ParentDummy class
-
-ParentDummy::ParentDummy(ScriptThread *realParent)
-	: QObject()
-	, m_parent(realParent)
-{
-}
-
-ParentDummy::~ParentDummy()
-{
-}
-
-void ParentDummy::timerEvent(QTimerEvent *ev)
-{
-	// Timers can only be created in the same thread as the QObject which means
-	// that we cannot create them in the `ScriptThread` object.
-	m_parent->threadTimerEvent(ev);
-}
-
-//=============================================================================
-// ScriptThread class
-
-QScriptValue jsLog(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 1) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 1 argument"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isString()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a string"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	obj->log(context->argument(0).toString());
-	return QScriptValue(QScriptValue::UndefinedValue);
-}
-
-QScriptValue jsSetTimeout(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 2) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 2 arguments"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isString() &&
-		!context->argument(0).isFunction())
-	{
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a string or a function"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-	if(!context->argument(1).isNumber()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 2 should be a number"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	int ret = obj->setTimeout(
-		context->argument(0), context->argument(1).toInt32());
-	return QScriptValue(ret);
-}
-
-QScriptValue jsClearTimeout(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 1) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 1 argument"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isNumber()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a number"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	obj->clearTimeout(context->argument(0).toInt32());
-	return QScriptValue(QScriptValue::UndefinedValue);
-}
-
-QScriptValue jsSetInterval(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 2) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 2 arguments"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isString() &&
-		!context->argument(0).isFunction())
-	{
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a string or a function"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-	if(!context->argument(1).isNumber()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 2 should be a number"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	int ret = obj->setInterval(
-		context->argument(0), context->argument(1).toInt32());
-	return QScriptValue(ret);
-}
-
-QScriptValue jsClearInterval(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 1) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 1 argument"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isNumber()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a number"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	obj->clearInterval(context->argument(0).toInt32());
-	return QScriptValue(QScriptValue::UndefinedValue);
-}
-
-QScriptValue jsReadFile(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 1) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 1 argument"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isString()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a string"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	QString ret = obj->readFile(context->argument(0).toString());
-	return QScriptValue(ret);
-}
-
-QScriptValue jsReadHttpGet(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 1) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 1 argument"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isString()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a string"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	QString ret = obj->readHttpGet(context->argument(0).toString());
-	return QScriptValue(ret);
-}
-
-QScriptValue jsUpdateText(QScriptContext *context, QScriptEngine *engine)
-{
-	ScriptThread *obj =
-		static_cast<ParentDummy *>(engine->parent())->getRealParent();
-
-	// Verify argument count
-	if(context->argumentCount() < 1) {
-		context->throwError(QScriptContext::SyntaxError,
-			"Function expects 1 argument"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	// Verify argument types
-	if(!context->argument(0).isString()) {
-		context->throwError(QScriptContext::TypeError,
-			"Argument 1 should be a string"); // TODO: `tr()`
-		return QScriptValue(QScriptValue::UndefinedValue);
-	}
-
-	obj->updateText(context->argument(0).toString());
-	return QScriptValue(QScriptValue::UndefinedValue);
-}
-
-//-----------------------------------------------------------------------------
-
-ScriptThread::ScriptThread(const QString &script)
-	: QThread()
-	, m_dummy(NULL)
-	, m_engine(NULL)
-	, m_mutex(QMutex::Recursive)
-	, m_safeToAbort(false)
-	, m_script(script)
-	, m_timeoutTimers()
-	, m_intervalTimers()
-{
-	m_timeoutTimers.reserve(32);
-	m_intervalTimers.reserve(32);
-}
-
-ScriptThread::~ScriptThread()
-{
-	// WARNING: Object is destructed in the main thread
-}
-
-void ScriptThread::run()
-{
-	// As Qt only allows QObjects to be parents of another object that is in
-	// the same thread we must create a dummy parent in order to pass a pointer
-	// back to this object out-of-band.
-	m_dummy = new ParentDummy(this);
-	m_engine = new QScriptEngine(m_dummy);
-
-	// Add our callback functions to the global object
-	QScriptValue value;
-	value = m_engine->newFunction(jsLog);
-	m_engine->globalObject().setProperty(
-		"log", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsSetTimeout);
-	m_engine->globalObject().setProperty(
-		"setTimeout", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsClearTimeout);
-	m_engine->globalObject().setProperty(
-		"clearTimeout", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsSetInterval);
-	m_engine->globalObject().setProperty(
-		"setInterval", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsClearInterval);
-	m_engine->globalObject().setProperty(
-		"clearInterval", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsReadFile);
-	m_engine->globalObject().setProperty(
-		"readFile", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsReadHttpGet);
-	m_engine->globalObject().setProperty(
-		"readHttpGet", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-	value = m_engine->newFunction(jsUpdateText);
-	m_engine->globalObject().setProperty(
-		"updateText", value,
-		QScriptValue::ReadOnly | QScriptValue::Undeletable);
-
-	m_mutex.lock();
-	m_safeToAbort = true;
-	m_mutex.unlock();
-
-	// Evaluate the script
-	m_engine->evaluate(m_script);
-	testForException();
-
-	// Enter the thread main loop
-	exec();
-
-	m_mutex.lock();
-	m_safeToAbort = false;
-	m_mutex.unlock();
-
-	// Clean up
-	delete m_engine;
-	m_engine = NULL;
-	delete m_dummy;
-	m_dummy = NULL;
-}
-
-void ScriptThread::testForException() const
-{
-	if(m_engine == NULL)
-		return;
-	if(m_engine->hasUncaughtException()) {
-		int line = m_engine->uncaughtExceptionLineNumber();
-		appLog(LOG_CAT_SCRIPT, Log::Warning)
-			<< "Uncaught exception at line " << line << ": "
-			<< m_engine->uncaughtException().toString();
-		m_engine->clearExceptions();
-	}
-}
-
-void ScriptThread::threadTimerEvent(QTimerEvent *ev)
-{
-	if(m_dummy == NULL)
-		return;
-
-	// Get corresponding timer expression
-	int id = ev->timerId();
-	QScriptValue expression = m_intervalTimers.value(id);
-	if(!expression.isValid()) {
-		expression = m_timeoutTimers.value(id);
-		if(expression.isValid())
-			m_dummy->threadKillTimer(id); // `setTimeout()` only triggers once
-	}
-
-	// Evaluate expression
-	if(expression.isString())
-		m_engine->evaluate(expression.toString());
-	else if(expression.isFunction())
-		expression.call();
-
-	testForException();
-}
-
-void ScriptThread::abortScript()
-{
-	m_mutex.lock();
-	if(!m_safeToAbort) {
-		m_mutex.unlock();
-		return;
-	}
-	if(m_engine != NULL)
-		m_engine->abortEvaluation();
-	m_mutex.unlock();
-}
-
-void ScriptThread::log(const QString &text)
-{
-	// TODO: "Script:0x____" category
-	//if(!text.isEmpty())
-	appLog(LOG_CAT_SCRIPT) << text;
-	// TODO: Status bar as well?
-}
-
-int ScriptThread::setTimeout(const QScriptValue &expression, int delay)
-{
-	if(m_dummy == NULL)
-		return -1;
-	if(expression.isString() || expression.isFunction()) {
-		int timerId = m_dummy->threadStartTimer(delay);
-		m_timeoutTimers.insert(timerId, expression);
-		return timerId;
-	}
-	return -1;
-}
-
-void ScriptThread::clearTimeout(int timerId)
-{
-	if(m_dummy == NULL)
-		return;
-	m_dummy->threadKillTimer(timerId);
-	m_timeoutTimers.remove(timerId);
-}
-
-int ScriptThread::setInterval(const QScriptValue &expression, int delay)
-{
-	if(m_dummy == NULL)
-		return -1;
-	if(expression.isString() || expression.isFunction()) {
-		int timerId = m_dummy->threadStartTimer(delay);
-		m_intervalTimers.insert(timerId, expression);
-		return timerId;
-	}
-	return -1;
-}
-
-void ScriptThread::clearInterval(int timerId)
-{
-	if(m_dummy == NULL)
-		return;
-	m_dummy->threadKillTimer(timerId);
-	m_intervalTimers.remove(timerId);
-}
-
-QString ScriptThread::readFile(const QString &filename)
-{
-	QFile file(filename);
-	if(!file.open(QIODevice::ReadOnly)) {
-		appLog(LOG_CAT_SCRIPT, Log::Warning) << QStringLiteral(
-			"Error reading file \"%1\"")
-			.arg(filename);
-		// TODO: Status bar as well?
-		return QString();
-	}
-	QString data = QString::fromUtf8(file.readAll());
-	file.close();
-	return data;
-}
-
-QString ScriptThread::readHttpGet(const QString &url)
-{
-	// Setup the request and transmit it
-	QNetworkAccessManager mgr;
-	QNetworkRequest req;
-	req.setUrl(QUrl(url));
-	req.setRawHeader("User-Agent",
-		QStringLiteral("%1/%2").arg(APP_NAME).arg(APP_VER_STR).toUtf8());
-	QNetworkReply *reply = mgr.get(req);
-
-	// Block until we get a reply
-	QEventLoop loop;
-	connect(reply, &QNetworkReply::finished,
-		&loop, &QEventLoop::quit);
-	loop.exec();
-
-	// Read the reply
-	if(reply->error() != QNetworkReply::NoError) {
-		appLog(LOG_CAT_SCRIPT, Log::Warning) << QStringLiteral(
-			"Error during HTTP GET of \"%1\": %2")
-			.arg(url)
-			.arg(reply->errorString());
-		// TODO: Status bar as well?
-		delete reply;
-		return QString();
-	}
-	QString ret = QString::fromUtf8(reply->readAll());
-
-	// Clean up and return
-	delete reply;
-	return ret;
-}
-
-void ScriptThread::updateText(const QString &text)
-{
-	emit textUpdated(text);
-}
-
 //=============================================================================
 // ScriptTextLayer class
 
 ScriptTextLayer::ScriptTextLayer(LayerGroup *parent)
 	: TextLayer(parent)
-	, m_thread(NULL)
+	, m_context(NULL)
 	, m_cachedText()
+	, m_cachedHtml()
 	, m_ignoreUpdate(false)
 
 	// Settings
@@ -629,35 +169,23 @@ void ScriptTextLayer::resetScript()
 	// Create the new script
 	if(m_script.isEmpty())
 		return; // Nothing to do
-	m_thread = new ScriptThread(m_script);
-	connect(m_thread, &ScriptThread::textUpdated,
+	ScriptService *service = App->getScriptService();
+	m_context = service->createScript(m_script);
+	if(m_context == NULL)
+		return;
+	connect(m_context, &ScriptContext::textUpdated,
 		this, &ScriptTextLayer::textUpdated);
-	m_thread->start();
+	service->startScript(m_context);
 }
 
 void ScriptTextLayer::stopScript()
 {
-	if(m_thread == NULL)
+	if(m_context == NULL)
 		return; // Already deleted
 
-	// Brute force script termination
-	for(int i = 0; i < 40; i++) {
-		m_thread->exit();
-		m_thread->abortScript();
-		m_thread->wait(50); // msec
-		if(m_thread->isFinished())
-			break;
-	}
-	if(!m_thread->isFinished()) {
-		// WARNING: Terminating may result in crashes!
-		appLog(LOG_CAT_SCRIPT, Log::Warning) << QStringLiteral(
-			"Terminating script uncleanly, might crash!");
-		m_thread->terminate();
-		m_thread->wait();
-	}
-
-	delete m_thread;
-	m_thread = NULL;
+	// The script is aborted and deleted by its worker thread without blocking
+	App->getScriptService()->destroyScript(m_context);
+	m_context = NULL;
 }
 
 void ScriptTextLayer::initializeResources(VidgfxContext *gfx)
@@ -705,7 +233,7 @@ void ScriptTextLayer::serialize(QDataStream *stream) const
 	// WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING
 
 	// Write data version number
-	*stream << (quint32)0;
+	*stream << (quint32)1;
 
 	// Save our data
 	*stream << m_script;
@@ -721,6 +249,7 @@ void ScriptTextLayer::serialize(QDataStream *stream) const
 	*stream << m_strokeColor;
 	*stream << m_wordWrap;
 	*stream << m_scrollSpeed;
+	*stream << m_useGlyphAtlas;
 }
 
 bool ScriptTextLayer::unserialize(QDataStream *stream)
@@ -741,7 +270,7 @@ bool ScriptTextLayer::unserialize(QDataStream *stream)
 	*stream >> version;
 
 	// Read our data
-	if(version == 0) {
+	if(version >= 0 && version <= 1) {
 		bool boolData;
 		qint32 int32Data;
 		QString stringData;
@@ -766,6 +295,10 @@ bool ScriptTextLayer::unserialize(QDataStream *stream)
 		*stream >> boolData;
 		setWordWrap(boolData);
 		*stream >> m_scrollSpeed;
+		if(version >= 1)
+			*stream >> m_useGlyphAtlas;
+		else
+			m_useGlyphAtlas = false;
 
 		resetScript();
 	} else {
@@ -844,6 +377,15 @@ void ScriptTextLayer::textUpdated(const QString &text)
 		.arg(m_fontColor.blue())
 		.arg(alignment)
 		.arg(newText);
+
+	// Scripts often set the same text over and over again. Only mark the
+	// layer as changed if the text or its display settings actually changed
+	// so that our output can be cached while it stays the same.
+	// `setDocumentHtml()` cannot test this itself as the document normalises
+	// the HTML that we give it.
+	if(html == m_cachedHtml)
+		return;
+	m_cachedHtml = html;
 	m_ignoreUpdate = true;
 	setDocumentHtml(html);
 	m_ignoreUpdate = false;
@@ -19,96 +19,8 @@
 #define SCRIPTTEXTLAYER_H
 
 #include "textlayer.h"
-#include <QtCore/QMutex>
-#include <QtCore/QThread>
-#include <QtScript/QScriptable>
-#include <QtScript/QScriptEngine>
 
-class ScriptThread;
-
-//=============================================================================
-class ParentDummy : public QObject
-{
-	Q_OBJECT
-
-private: // Members -----------------------------------------------------------
-	ScriptThread *	m_parent;
-
-public: // Constructor/destructor ---------------------------------------------
-	ParentDummy(ScriptThread *realParent);
-	~ParentDummy();
-
-public: // Methods ------------------------------------------------------------
-	ScriptThread *	getRealParent() const;
-	int				threadStartTimer(
-		int interval, Qt::TimerType timerType = Qt::CoarseTimer);
-	void			threadKillTimer(int id);
-
-protected:
-	virtual void	timerEvent(QTimerEvent *ev);
-};
-//=============================================================================
-
-inline ScriptThread *ParentDummy::getRealParent() const
-{
-	return m_parent;
-}
-
-inline int ParentDummy::threadStartTimer(int interval, Qt::TimerType timerType)
-{
-	return startTimer(interval, timerType);
-}
-
-inline void ParentDummy::threadKillTimer(int id)
-{
-	killTimer(id);
-}
-
-//=============================================================================
-class ScriptThread : public QThread
-{
-	Q_OBJECT
-
-private: // Members -----------------------------------------------------------
-	ParentDummy *				m_dummy;
-	QScriptEngine *				m_engine;
-	QMutex						m_mutex;
-	bool						m_safeToAbort;
-	QString						m_script;
-	QHash<int, QScriptValue>	m_timeoutTimers;
-	QHash<int, QScriptValue>	m_intervalTimers;
-
-public: // Constructor/destructor ---------------------------------------------
-	ScriptThread(const QString &script);
-	~ScriptThread();
-
-public: // Methods ------------------------------------------------------------
-	void			threadTimerEvent(QTimerEvent *ev);
-	void			abortScript();
-
-private:
-	void			testForException() const;
-
-protected:
-	virtual void	run();
-
-public: // Scriptable methods -------------------------------------------------
-	void	log(const QString &text);
-
-	int		setTimeout(const QScriptValue &expression, int delay);
-	void	clearTimeout(int timerId);
-	int		setInterval(const QScriptValue &expression, int delay);
-	void	clearInterval(int timerId);
-
-	QString	readFile(const QString &filename);
-	QString	readHttpGet(const QString &url);
-
-	void	updateText(const QString &text);
-
-Q_SIGNALS: // Signals ---------------------------------------------------------
-	void	textUpdated(const QString &text);
-};
-//=============================================================================
+class ScriptContext;
 
 //=============================================================================
 class ScriptTextLayer : public TextLayer
@@ -117,8 +29,9 @@ class ScriptTextLayer : public TextLayer
 	Q_OBJECT
 
 private: // Members -----------------------------------------------------------
-	ScriptThread *	m_thread;
+	ScriptContext *	m_context;
 	QString			m_cachedText;
+	QString			m_cachedHtml;
 	bool			m_ignoreUpdate;
 
 	// Settings
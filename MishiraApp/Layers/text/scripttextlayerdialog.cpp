@@ -55,6 +55,10 @@ ScriptTextLayerDialog::ScriptTextLayerDialog(
 		this, &LayerDialog::settingModified);
 	connect(m_ui.noWordWrapBtn, &QPushButton::clicked,
 		this, &LayerDialog::settingModified);
+	connect(m_ui.textureRenderBtn, &QPushButton::clicked,
+		this, &LayerDialog::settingModified);
+	connect(m_ui.glyphRenderBtn, &QPushButton::clicked,
+		this, &LayerDialog::settingModified);
 	connect(m_ui.xScrollEdit, &QLineEdit::textChanged,
 		this, &LayerDialog::settingModified);
 	connect(m_ui.yScrollEdit, &QLineEdit::textChanged,
@@ -83,6 +87,8 @@ void ScriptTextLayerDialog::loadSettings()
 	m_ui.strokeColorBtn->setColor(layer->getStrokeColor());
 	m_ui.wordWrapBtn->setChecked(layer->getWordWrap());
 	m_ui.noWordWrapBtn->setChecked(!layer->getWordWrap());
+	m_ui.textureRenderBtn->setChecked(!layer->getUseGlyphAtlas());
+	m_ui.glyphRenderBtn->setChecked(layer->getUseGlyphAtlas());
 	m_ui.xScrollEdit->setText(QString::number(layer->getScrollSpeed().x()));
 	m_ui.yScrollEdit->setText(QString::number(layer->getScrollSpeed().y()));
 }
@@ -104,6 +110,7 @@ void ScriptTextLayerDialog::applySettings()
 		layer->setStrokeSize(m_ui.strokeSizeEdit->text().toInt());
 	layer->setStrokeColor(m_ui.strokeColorBtn->getColor());
 	layer->setWordWrap(m_ui.wordWrapBtn->isChecked());
+	layer->setUseGlyphAtlas(m_ui.glyphRenderBtn->isChecked());
 
 	// Scroll speed
 	QPoint scrollSpeed;
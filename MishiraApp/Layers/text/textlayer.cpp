@@ -17,61 +17,20 @@
 
 #include "textlayer.h"
 #include "application.h"
+#include "glyphatlas.h"
 #include "layergroup.h"
 #include "profile.h"
 #include "textlayerdialog.h"
-#include <QtGui/QPainter>
+#include "textrendertask.h"
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+#include <QtGui/QGlyphRun>
+#include <QtGui/QGuiApplication>
 #include <QtGui/QTextBlock>
 #include <QtGui/QTextLayout>
 
 const QString LOG_CAT = QStringLiteral("Scene");
 
-//=============================================================================
-// Helpers
-
-/// <summary>
-/// Calculates the distance from the specified pixel to the closest opaque
-/// pixel. Takes into account semi-transparent pixels to produce a more
-/// accurate result.
-/// </summary>
-float getDistance(const QImage &img, int x, int y, int maxDist)
-{
-	// Fast out if the pixel is fully covered
-	if(qAlpha(img.pixel(x, y)) == 255)
-		return 0.0f;
-
-	int startX = qMax(0, x - maxDist);
-	int startY = qMax(0, y - maxDist);
-	int endX = qMin(img.width(), x + maxDist + 1); // Just outside
-	int endY = qMin(img.height(), y + maxDist + 1); // Just outside
-	float dist = (float)maxDist;
-	float distSq = dist * dist; // Minimize the amount of sqrt() calls
-
-	// TODO: This loop could be optimized by moving outwards from the center
-	for(int j = startY; j < endY; j++) {
-		for(int i = startX; i < endX; i++) {
-			int alpha = qAlpha(img.pixel(i, j));
-			if(alpha == 0)
-				continue;
-			int dx = qAbs(x - i);
-			int dy = qAbs(y - j);
-			int dsq = dx * dx + dy * dy;
-			if(dsq >= distSq)
-				continue;
-
-			// Ignore semi-transparent pixels
-			distSq = dsq;
-			dist = sqrtf(dsq);
-			continue;
-
-			// Take into account semi-transparent pixels
-			// TODO
-		}
-	}
-
-	return dist;
-}
-
 //=============================================================================
 // TextLayer class
 
@@ -80,12 +39,20 @@ TextLayer::TextLayer(LayerGroup *parent)
 	, m_vertBuf(vidgfx_texdecalbuf_new())
 	, m_texture(NULL)
 	, m_isTexDirty(true)
+	, m_renderTask(NULL)
+	, m_texTextWidth(0.0)
+	, m_texStrokeSize(0)
 	, m_document(this)
 	, m_strokeSize(0)
 	, m_strokeColor(0, 0, 0)
 	, m_wordWrap(true)
 	, m_dialogBgColor(255, 255, 255)
 	, m_scrollSpeed()
+	, m_useGlyphAtlas(false)
+	, m_isUsingGlyphs(false)
+	, m_glyphBlocks()
+	, m_atlases()
+	, m_atlasGenerations()
 {
 	//-------------------------------------------------------------------------
 	// Setup document rendering settings
@@ -119,6 +86,14 @@ TextLayer::TextLayer(LayerGroup *parent)
 
 TextLayer::~TextLayer()
 {
+	// Discard any render that is in progress without waiting for it
+	if(m_renderTask != NULL) {
+		disconnect(m_renderTask, &TextRenderTask::finished,
+			this, &TextLayer::renderTaskFinished);
+		m_renderTask->release();
+		m_renderTask = NULL;
+	}
+
 	vidgfx_texdecalbuf_destroy(m_vertBuf);
 }
 
@@ -191,6 +166,17 @@ void TextLayer::setScrollSpeed(const QPoint &speed)
 	m_parent->layerChanged(this); // Remote emit
 }
 
+void TextLayer::setUseGlyphAtlas(bool useAtlas)
+{
+	if(m_useGlyphAtlas == useAtlas)
+		return; // Nothing to do
+	m_useGlyphAtlas = useAtlas;
+	m_isTexDirty = true;
+
+	updateResourcesIfLoaded();
+	m_parent->layerChanged(this); // Remote emit
+}
+
 QFont TextLayer::getDefaultFont() const
 {
 #ifdef Q_OS_WIN
@@ -223,259 +209,395 @@ void TextLayer::recreateTexture(VidgfxContext *gfx)
 {
 	if(!m_isTexDirty)
 		return; // Don't waste any time if it hasn't changed
+	if(m_renderTask != NULL)
+		return; // Will be recreated once the current render has completed
 	m_isTexDirty = false;
 
-	// Delete existing texture if one exists
+	// Rasterising text is slow so do it in the global thread pool. We
+	// continue to display the existing texture until the new image is ready.
+	// Any changes that are made while the task is running are coalesced into
+	// a single render that is started once the current one completes.
+	m_texTextWidth = m_rect.width();
+	m_renderTask = new TextRenderTask(
+		&m_document, m_texTextWidth, m_strokeSize, m_strokeColor);
+	connect(m_renderTask, &TextRenderTask::finished,
+		this, &TextLayer::renderTaskFinished);
+	QThreadPool::globalInstance()->start(m_renderTask);
+}
+
+void TextLayer::renderTaskFinished()
+{
+	if(m_renderTask == NULL)
+		return;
+	QImage img = m_renderTask->getImage();
+	int strokeSize = m_renderTask->getStrokeSize();
+	m_renderTask->release();
+	m_renderTask = NULL;
+
+	// Discard the image if our hardware resources were destroyed or we
+	// switched to rendering with the glyph atlas while the task was running
+	VidgfxContext *gfx = App->getGraphicsContext();
+	if(!isLoaded() || m_isUsingGlyphs || !vidgfx_context_is_valid(gfx))
+		return;
+
+	// Swap the texture
 	if(m_texture != NULL)
 		vidgfx_context_destroy_tex(gfx, m_texture);
 	m_texture = NULL;
+	if(!img.isNull())
+		m_texture = vidgfx_context_new_tex(gfx, img);
+	m_texStrokeSize = strokeSize;
+	setOutputDirty();
+
+	// Update the vertex buffer. If the layer was modified while the task was
+	// running then this also starts the next render.
+	TextLayer::updateResources(gfx);
+}
 
-	// Determine texture size. We need to keep in mind that the text in the
-	// document might extend outside of the layer's bounds.
-	m_document.setTextWidth(m_rect.width());
-	QSize size(
-		(int)ceilf(m_document.size().width()),
-		(int)ceilf(m_document.size().height()));
+/// <summary>
+/// Returns the alignment of the document within the layer. We never scale
+/// the document and always align it to the left (The user needs to set the
+/// alignment in the text document itself).
+/// </summary>
+LyrAlignment TextLayer::getDocumentAlignment() const
+{
+	switch(m_alignment) {
+	default:
+	case LyrTopLeftAlign:
+	case LyrTopCenterAlign:
+	case LyrTopRightAlign:
+		return LyrTopLeftAlign;
+	case LyrMiddleLeftAlign:
+	case LyrMiddleCenterAlign:
+	case LyrMiddleRightAlign:
+		return LyrMiddleLeftAlign;
+	case LyrBottomLeftAlign:
+	case LyrBottomCenterAlign:
+	case LyrBottomRightAlign:
+		return LyrBottomLeftAlign;
+	}
+}
 
-	if(m_document.isEmpty() || size.isEmpty()) {
-		// Nothing to display
-		return;
+/// <summary>
+/// References the glyph atlas for the specified font and our current stroke
+/// settings if this layer isn't already using it.
+/// </summary>
+GlyphAtlas *TextLayer::refGlyphAtlas(
+	VidgfxContext *gfx, const QRawFont &font)
+{
+	GlyphAtlas *atlas =
+		GlyphAtlas::refAtlas(font, m_strokeSize, m_strokeColor);
+	if(m_atlases.contains(atlas)) {
+		// We already have a reference
+		GlyphAtlas::derefAtlas(atlas, gfx);
+		return atlas;
+	}
+	m_atlases.append(atlas);
+	m_atlasGenerations.append(atlas->getGeneration());
+	return atlas;
+}
+
+/// <summary>
+/// Returns a key that contains everything that affects the position and
+/// appearance of the glyphs of a text block so that we can tell if the block
+/// needs to be laid out again. `blockPos` is the position of the block within
+/// the layer.
+/// </summary>
+QByteArray TextLayer::getGlyphBlockKey(
+	const QTextBlock &block, const QPointF &blockPos) const
+{
+	QByteArray key;
+	QDataStream stream(&key, QIODevice::WriteOnly);
+	stream << blockPos << m_strokeSize << m_strokeColor << block.text();
+	for(QTextBlock::iterator it = block.begin(); !it.atEnd(); it++) {
+		QTextFragment frag = it.fragment();
+		if(!frag.isValid())
+			continue;
+		stream << (frag.position() - block.position()) << frag.charFormat();
 	}
 
-	// Create temporary canvas. We need to be careful here as text is rendered
-	// differently on premultiplied vs non-premultiplied pixel formats. On a
-	// premultiplied format text is rendered with subpixel rendering enabled
-	// while on a non-premultiplied format it is not. As we don't want subpixel
-	// rendering we use the standard ARGB32 format.
-	QSize imgSize(
-		size.width() + m_strokeSize * 2, size.height() + m_strokeSize * 2);
-	QImage img(imgSize, QImage::Format_ARGB32);
-	img.fill(Qt::transparent);
-	QPainter p(&img);
-	p.setRenderHint(QPainter::Antialiasing, true);
-
-	// Render text
-	//m_document.drawContents(&p);
-
-	// Render stroke
-	if(m_strokeSize > 0) {
-#define STROKE_TECHNIQUE 0
-#if STROKE_TECHNIQUE == 0
-		// Technique 0: Use QTextDocument's built-in text outliner
-		//quint64 timeStart = App->getUsecSinceExec();
-
-		QTextDocument *outlineDoc = m_document.clone(this);
-
-		QTextCharFormat format;
-		QPen pen(m_strokeColor, (double)(m_strokeSize * 2));
-		pen.setJoinStyle(Qt::RoundJoin);
-		format.setTextOutline(pen);
-		QTextCursor cursor(outlineDoc);
-		cursor.select(QTextCursor::Document);
-		cursor.mergeCharFormat(format);
-
-		// Take into account the stroke offset
-		p.translate(m_strokeSize, m_strokeSize);
-
-		//quint64 timePath = App->getUsecSinceExec();
-		outlineDoc->drawContents(&p);
-		delete outlineDoc;
-
-		//quint64 timeEnd = App->getUsecSinceExec();
-		//appLog() << "Path time = " << (timePath - timeStart) << " usec";
-		//appLog() << "Render time = " << (timeEnd - timePath) << " usec";
-		//appLog() << "Full time = " << (timeEnd - timeStart) << " usec";
-#elif STROKE_TECHNIQUE == 1
-		// Technique 1: Create a text QPainterPath and stroke it
-		quint64 timeStart = App->getUsecSinceExec();
-
-		// Create the path for the text's stroke
-		QPainterPath path;
-		QTextBlock &block = m_document.firstBlock();
-		int numBlocks = m_document.blockCount();
-		for(int i = 0; i < numBlocks; i++) {
-			QTextLayout *layout = block.layout();
-			for(int j = 0; j < layout->lineCount(); j++) {
-				QTextLine &line = layout->lineAt(j);
-				const QString text = block.text().mid(
-					line.textStart(), line.textLength());
-				QPointF pos = layout->position() + line.position();
-				pos.ry() += line.ascent();
-				//appLog() << pos << ": " << text;
-				path.addText(pos, block.charFormat().font(), text);
-			}
-			block = block.next();
+	// Line breaks and alignment
+	QTextLayout *layout = block.layout();
+	if(layout != NULL) {
+		for(int i = 0; i < layout->lineCount(); i++) {
+			QTextLine line = layout->lineAt(i);
+			stream << line.textStart() << line.naturalTextRect();
 		}
+	}
+	return key;
+}
 
-		quint64 timePath = App->getUsecSinceExec();
-		path = path.simplified(); // Fixes gaps with large stroke sizes
-		quint64 timeSimplify = App->getUsecSinceExec();
-
-		// Render the path
-		//p.strokePath(path, QPen(m_strokeColor, m_strokeSize));
-
-		// Convert it to a stroke
-		QPainterPathStroker stroker;
-		stroker.setWidth(m_strokeSize);
-		//stroker.setCurveThreshold(2.0);
-		stroker.setJoinStyle(Qt::RoundJoin);
-		path = stroker.createStroke(path);
-
-		// Render the path
-		p.fillPath(path, m_strokeColor);
-
-		quint64 timeEnd = App->getUsecSinceExec();
-		appLog() << "Path time = " << (timePath - timeStart) << " usec";
-		appLog() << "Simplify time = " << (timeSimplify - timePath) << " usec";
-		appLog() << "Render time = " << (timeEnd - timeSimplify) << " usec";
-		appLog() << "Full time = " << (timeEnd - timeStart) << " usec";
-#elif STROKE_TECHNIQUE == 2
-		// Technique 2: Similar to technique 1 but do each block separately
-		quint64 timeStart = App->getUsecSinceExec();
-		quint64 timeTotalSimplify = 0;
-		quint64 timeTotalRender = 0;
-
-		// Create the path for the text's stroke
-		QTextBlock &block = m_document.firstBlock();
-		int numBlocks = m_document.blockCount();
-		for(int i = 0; i < numBlocks; i++) {
-			// Convert this block to a painter path
-			QPainterPath path;
-			QTextLayout *layout = block.layout();
-			for(int j = 0; j < layout->lineCount(); j++) {
-				QTextLine &line = layout->lineAt(j);
-				const QString text = block.text().mid(
-					line.textStart(), line.textLength());
-				QPointF pos = layout->position() + line.position() +
-					QPointF(m_strokeSize, m_strokeSize);
-				pos.ry() += line.ascent();
-				//appLog() << pos << ": " << text;
-				path.addText(pos, block.charFormat().font(), text);
-			}
-
-			// Prevent gaps appearing at larger stroke sizes
-			quint64 timeA = App->getUsecSinceExec();
-			path = path.simplified();
-			quint64 timeB = App->getUsecSinceExec();
-			timeTotalSimplify += timeB - timeA;
-
-			// Render the path
-			QPen pen(m_strokeColor, m_strokeSize * 2);
-			pen.setJoinStyle(Qt::RoundJoin);
-			p.strokePath(path, pen);
-			timeA = App->getUsecSinceExec();
-			timeTotalRender += timeA - timeB;
-
-			// Iterate
-			block = block.next();
+/// <summary>
+/// Positions a quad for the outline and the fill of every visible glyph in the
+/// document. Only text blocks that changed since the last time that the
+/// document was laid out are processed. Returns `false` if the document
+/// contains something that cannot be displayed using the glyph atlas.
+/// </summary>
+bool TextLayer::layoutGlyphs(
+	VidgfxContext *gfx, const QPointF &docPos, QRectF *boundsOut)
+{
+	QRectF bounds;
+	int index = 0;
+	for(QTextBlock block = m_document.begin(); block.isValid();
+		block = block.next(), index++)
+	{
+		QPointF blockPos = docPos;
+		QTextLayout *layout = block.layout();
+		if(layout != NULL)
+			blockPos += layout->position();
+
+		if(index >= m_glyphBlocks.count())
+			m_glyphBlocks.append(GlyphBlock());
+		GlyphBlock *glyphs = &m_glyphBlocks[index];
+		QByteArray key = getGlyphBlockKey(block, blockPos);
+		if(glyphs->key != key) {
+			glyphs->key = QByteArray(); // Invalid until it succeeds
+			if(!layoutGlyphBlock(gfx, block, blockPos, glyphs))
+				return false;
+			glyphs->key = key;
 		}
+		bounds = bounds.united(glyphs->bounds);
+	}
 
-		// Make the final draw take into account the stroke offset
-		p.translate(m_strokeSize, m_strokeSize);
-
-		quint64 timeEnd = App->getUsecSinceExec();
-		appLog() << "Simplify time = " << timeTotalSimplify << " usec";
-		appLog() << "Render time = " << timeTotalRender << " usec";
-		appLog() << "Full time = " << (timeEnd - timeStart) << " usec";
-#elif STROKE_TECHNIQUE == 3
-		// Technique 3: Raster brute-force where for each destination pixel
-		// we measure the distance to the closest opaque source pixel
-		quint64 timeStart = App->getUsecSinceExec();
-
-		// Get bounding region based on text line bounding rects
-		QRegion region;
-		QTextBlock &block = m_document.firstBlock();
-		int numBlocks = m_document.blockCount();
-		for(int i = 0; i < numBlocks; i++) {
-			QTextLayout *layout = block.layout();
-			for(int j = 0; j < layout->lineCount(); j++) {
-				QTextLine &line = layout->lineAt(j);
-				const QString text = block.text().mid(
-					line.textStart(), line.textLength());
-				QRect rect = line.naturalTextRect()
-					.translated(layout->position()).toAlignedRect();
-				if(rect.isEmpty())
-					continue; // Don't add empty rectangles
-				rect.adjust(0, 0, 1, 0); // QTextLine is incorrect?
-				rect.adjust(
-					-m_strokeSize, -m_strokeSize,
-					m_strokeSize, m_strokeSize);
-				//appLog() << rect;
-				region += rect;
-			}
+	// Release the quads of blocks that no longer exist
+	while(m_glyphBlocks.count() > index) {
+		destroyGlyphQuads(gfx, &m_glyphBlocks.last());
+		m_glyphBlocks.removeLast();
+	}
 
-			// Iterate
-			block = block.next();
+	*boundsOut = bounds;
+	return true;
+}
+
+/// <summary>
+/// Positions the quads of a single text block, reusing the vertex buffers of
+/// the previous layout of the block where possible. Returns `false` if the
+/// block contains something that cannot be displayed using the glyph atlas.
+/// </summary>
+bool TextLayer::layoutGlyphBlock(
+	VidgfxContext *gfx, const QTextBlock &block, const QPointF &blockPos,
+	GlyphBlock *glyphsOut)
+{
+	const QColor defaultColor =
+		QGuiApplication::palette().color(QPalette::Text);
+	glyphsOut->bounds = QRectF();
+	int numQuads = 0;
+	for(QTextBlock::iterator it = block.begin(); !it.atEnd(); it++) {
+		QTextFragment frag = it.fragment();
+		if(!frag.isValid())
+			continue;
+
+		// We only support plain coloured text
+		QTextCharFormat format = frag.charFormat();
+		if(format.isImageFormat() ||
+			format.background().style() != Qt::NoBrush ||
+			format.hasProperty(QTextFormat::TextOutline))
+		{
+			return false;
 		}
-		quint64 timeRegion = App->getUsecSinceExec();
-
-#if 0
-		// Debug bounding region
-		QPainterPath regionPath;
-		regionPath.addRegion(region);
-		regionPath.setFillRule(Qt::WindingFill);
-		p.fillPath(regionPath, QColor(255, 0, 0, 128));
-#endif // 0
-
-		// We cannot read and write to the same image at the same time so
-		// create a second one. Note that this is not premultiplied.
-		QImage imgOut(size, QImage::Format_ARGB32);
-		imgOut.fill(Qt::transparent);
-
-		// Do distance calculation. We assume that non-fully transparent
-		// pixels are always next to a fully opaque one so if the closest
-		// "covered" pixel is not fully opaque then we can use that pixel's
-		// opacity to determine the distance to the shape's edge.
-		for(int y = 0; y < img.height(); y++) {
-			for(int x = 0; x < img.width(); x++) {
-				if(!region.contains(QPoint(x, y)))
-					continue;
-				float dist = getDistance(img, x, y, m_strokeSize);
-
-				// We fake antialiasing by blurring the edge by 1px
-				float outEdge = (float)m_strokeSize;
-				if(dist >= outEdge)
-					continue; // Outside stroke completely
-				float opacity = qMin(1.0f, outEdge - dist);
-				QColor col = m_strokeColor;
-				col.setAlphaF(col.alphaF() * opacity);
-
-				// Blend the stroke so that it appears under the existing
-				// pixel data
-				QRgb origRgb = img.pixel(x, y);
-				QColor origCol(origRgb);
-				origCol.setAlpha(qAlpha(origRgb));
-				col = blendColors(col, origCol, 1.0f);
-				imgOut.setPixel(x, y, col.rgba());
+		QColor color = defaultColor;
+		if(format.hasProperty(QTextFormat::ForegroundBrush))
+			color = format.foreground().color();
+
+		QList<QGlyphRun> runs = frag.glyphRuns();
+		for(int i = 0; i < runs.count(); i++) {
+			const QGlyphRun &run = runs.at(i);
+			if(run.overline() || run.underline() || run.strikeOut())
+				return false; // Decorations are not supported
+			GlyphAtlas *atlas = refGlyphAtlas(gfx, run.rawFont());
+			QVector<quint32> indexes = run.glyphIndexes();
+			QVector<QPointF> positions = run.positions();
+			for(int j = 0; j < indexes.count(); j++) {
+				// Snap glyphs to pixels to prevent blurring
+				QPointF pos = blockPos + positions.at(j);
+				QPointF origin(qRound(pos.x()), qRound(pos.y()));
+
+				QRectF rect;
+				QRectF uv;
+				if(m_strokeSize > 0) {
+					if(!atlas->getStroke(indexes.at(j), &rect, &uv))
+						return false;
+					rect.translate(origin);
+					if(!addGlyphQuad(
+						gfx, glyphsOut, &numQuads, atlas, true, rect, uv))
+					{
+						return false;
+					}
+				}
+				if(!atlas->getGlyph(indexes.at(j), color, &rect, &uv))
+					return false;
+				rect.translate(origin);
+				if(!addGlyphQuad(
+					gfx, glyphsOut, &numQuads, atlas, false, rect, uv))
+				{
+					return false;
+				}
 			}
 		}
-		quint64 timeRender = App->getUsecSinceExec();
-
-		// Swap image data
-		p.end();
-		img = imgOut;
-		p.begin(&img);
-
-		quint64 timeEnd = App->getUsecSinceExec();
-		appLog() << "Region time = " << (timeRegion - timeStart) << " usec";
-		appLog() << "Render time = " << (timeRender - timeRegion) << " usec";
-		appLog() << "Swap time = " << (timeEnd - timeRender) << " usec";
-		appLog() << "Full time = " << (timeEnd - timeStart) << " usec";
-#endif // STROKE_TECHNIQUE
 	}
 
-	// Render text
-	m_document.drawContents(&p);
+	// Release any vertex buffers that are no longer needed
+	destroyGlyphQuads(gfx, glyphsOut, numQuads);
+	return true;
+}
 
-	// Convert the image to a GPU texture
-	m_texture = vidgfx_context_new_tex(gfx, img);
+/// <summary>
+/// Writes a glyph quad into the next vertex buffer of the block, creating the
+/// buffer if the block doesn't have enough of them.
+/// </summary>
+bool TextLayer::addGlyphQuad(
+	VidgfxContext *gfx, GlyphBlock *glyphs, int *numQuads,
+	GlyphAtlas *atlas, bool isStroke, const QRectF &rect, const QRectF &uv)
+{
+	if(rect.isEmpty())
+		return true; // Nothing to display
+	if(*numQuads >= glyphs->quads.count()) {
+		GlyphQuad quad;
+		quad.vertBuf = vidgfx_context_new_vertbuf(
+			gfx, VIDGFX_TEX_DECAL_RECT_BUF_SIZE);
+		if(quad.vertBuf == NULL)
+			return false;
+		glyphs->quads.append(quad);
+	}
+	GlyphQuad &quad = glyphs->quads[*numQuads];
+	(*numQuads)++;
+	quad.atlas = atlas;
+	quad.isStroke = isStroke;
+	vidgfx_create_tex_decal_rect(quad.vertBuf, rect,
+		uv.topLeft(), uv.topRight(), uv.bottomLeft(), uv.bottomRight());
+	glyphs->bounds = glyphs->bounds.united(rect);
+	return true;
+}
+
+/// <summary>
+/// Destroys the vertex buffers of every quad of the block starting at
+/// `firstQuad`.
+/// </summary>
+void TextLayer::destroyGlyphQuads(
+	VidgfxContext *gfx, GlyphBlock *glyphs, int firstQuad)
+{
+	for(int i = firstQuad; i < glyphs->quads.count(); i++)
+		vidgfx_context_destroy_vertbuf(gfx, glyphs->quads.at(i).vertBuf);
+	glyphs->quads.resize(firstQuad);
+}
+
+/// <summary>
+/// Releases our reference to every atlas that none of our quads use anymore.
+/// </summary>
+void TextLayer::releaseUnusedAtlases(VidgfxContext *gfx)
+{
+	QSet<GlyphAtlas *> usedAtlases;
+	for(int i = 0; i < m_glyphBlocks.count(); i++) {
+		const QVector<GlyphQuad> &quads = m_glyphBlocks.at(i).quads;
+		for(int j = 0; j < quads.count(); j++)
+			usedAtlases.insert(quads.at(j).atlas);
+	}
+	for(int i = m_atlases.count() - 1; i >= 0; i--) {
+		if(usedAtlases.contains(m_atlases.at(i)))
+			continue;
+		GlyphAtlas::derefAtlas(m_atlases.at(i), gfx);
+		m_atlases.remove(i);
+		m_atlasGenerations.remove(i);
+	}
+}
 
-	// Preview texture for debugging
-	//img.save(App->getDataDirectory().filePath("Preview.png"));
+/// <summary>
+/// Lays out the document using the shared glyph atlases instead of
+/// rasterising the entire document into a texture. Each glyph quad has its
+/// own small vertex buffer that is only rewritten when the text block that it
+/// belongs to changes so that changing a single line of a large document is
+/// cheap. Returns `false` if the document cannot be displayed using the glyph
+/// atlas.
+/// </summary>
+bool TextLayer::updateGlyphs(VidgfxContext *gfx)
+{
+	m_document.setTextWidth(m_rect.width());
+	m_texTextWidth = m_rect.width();
+	QSize size(
+		(int)ceilf(m_document.size().width()),
+		(int)ceilf(m_document.size().height()));
+	m_isUsingGlyphs = true;
+
+	setVisibleRect(QRect()); // Invisible by default
+	if(m_document.isEmpty() || size.isEmpty()) {
+		// Nothing to display
+		destroyGlyphs(gfx);
+		m_isUsingGlyphs = true;
+		return true;
+	}
+	QRectF docRect = createScaledRectInBounds(
+		size, m_rect, LyrActualScale, getDocumentAlignment());
+
+	// If an atlas fills up while we are adding glyphs to it then it is
+	// cleared and the glyphs that we have already positioned become invalid.
+	// When this happens we lay out every block again and try one more time
+	// before giving up. Atlases that we no longer need are only released
+	// afterwards so that glyphs that are shared are not discarded.
+	bool success = false;
+	QRectF bounds;
+	for(int attempt = 0; attempt < 2 && !success; attempt++) {
+		if(isGlyphAtlasOutdated()) {
+			for(int i = 0; i < m_glyphBlocks.count(); i++)
+				m_glyphBlocks[i].key = QByteArray();
+		}
+		for(int i = 0; i < m_atlases.count(); i++)
+			m_atlasGenerations[i] = m_atlases.at(i)->getGeneration();
+		if(!layoutGlyphs(gfx, docRect.topLeft(), &bounds))
+			break;
+		success = !isGlyphAtlasOutdated();
+	}
+	if(!success) {
+		destroyGlyphs(gfx);
+		return false;
+	}
+	releaseUnusedAtlases(gfx);
+
+	setVisibleRect(bounds.toAlignedRect());
+	return true;
+}
+
+/// <summary>
+/// Returns `true` if any of the atlases that we use were cleared since we
+/// last positioned our glyphs.
+/// </summary>
+bool TextLayer::isGlyphAtlasOutdated() const
+{
+	for(int i = 0; i < m_atlases.count(); i++) {
+		if(m_atlases.at(i)->getGeneration() != m_atlasGenerations.at(i))
+			return true;
+	}
+	return false;
+}
+
+void TextLayer::destroyGlyphs(VidgfxContext *gfx)
+{
+	for(int i = 0; i < m_glyphBlocks.count(); i++)
+		destroyGlyphQuads(gfx, &m_glyphBlocks[i]);
+	m_glyphBlocks.clear();
+	for(int i = 0; i < m_atlases.count(); i++)
+		GlyphAtlas::derefAtlas(m_atlases.at(i), gfx);
+	m_atlases.clear();
+	m_atlasGenerations.clear();
+	m_isUsingGlyphs = false;
 }
 
 void TextLayer::updateResources(VidgfxContext *gfx)
 {
+	// Use the glyph atlas if it is enabled and the document is supported. We
+	// cannot scroll the text when using the atlas.
+	if(m_useGlyphAtlas && m_scrollSpeed.isNull()) {
+		if(updateGlyphs(gfx)) {
+			// Make sure that the texture is recreated if we switch back
+			if(m_texture != NULL)
+				vidgfx_context_destroy_tex(gfx, m_texture);
+			m_texture = NULL;
+			m_isTexDirty = true;
+			return;
+		}
+	}
+	if(m_isUsingGlyphs)
+		destroyGlyphs(gfx);
+
 	// Completely recreate texture if needed
 	recreateTexture(gfx);
 
@@ -486,33 +608,13 @@ void TextLayer::updateResources(VidgfxContext *gfx)
 	if(m_texture == NULL)
 		return;
 
-	// Never scale our texture and always align it to the left (The user
-	// needs to set the alignment in the text document itself)
-	LyrAlignment alignment;
-	switch(m_alignment) {
-	default:
-	case LyrTopLeftAlign:
-	case LyrTopCenterAlign:
-	case LyrTopRightAlign:
-		alignment = LyrTopLeftAlign;
-		break;
-	case LyrMiddleLeftAlign:
-	case LyrMiddleCenterAlign:
-	case LyrMiddleRightAlign:
-		alignment = LyrMiddleLeftAlign;
-		break;
-	case LyrBottomLeftAlign:
-	case LyrBottomCenterAlign:
-	case LyrBottomRightAlign:
-		alignment = LyrBottomLeftAlign;
-		break;
-	}
 	QSize exStrokeSize = vidgfx_tex_get_size(m_texture);
-	exStrokeSize.rwidth() -= m_strokeSize * 2;
-	exStrokeSize.rheight() -= m_strokeSize * 2;
+	exStrokeSize.rwidth() -= m_texStrokeSize * 2;
+	exStrokeSize.rheight() -= m_texStrokeSize * 2;
 	QRectF rect = createScaledRectInBounds(
-		exStrokeSize, m_rect, LyrActualScale, alignment);
-	rect.adjust(-m_strokeSize, -m_strokeSize, m_strokeSize, m_strokeSize);
+		exStrokeSize, m_rect, LyrActualScale, getDocumentAlignment());
+	rect.adjust(
+		-m_texStrokeSize, -m_texStrokeSize, m_texStrokeSize, m_texStrokeSize);
 
 	vidgfx_texdecalbuf_set_rect(m_vertBuf, rect);
 	vidgfx_texdecalbuf_set_tex_uv(
@@ -525,6 +627,7 @@ void TextLayer::destroyResources(VidgfxContext *gfx)
 	appLog(LOG_CAT)
 		<< "Destroying hardware resources for layer " << getIdString();
 
+	destroyGlyphs(gfx);
 	vidgfx_texdecalbuf_destroy_vert_buf(m_vertBuf);
 	vidgfx_texdecalbuf_set_context(m_vertBuf, NULL);
 	vidgfx_context_destroy_tex(gfx, m_texture);
@@ -535,10 +638,18 @@ void TextLayer::render(
 	VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped)
 {
 	// Has the layer width changed since we rendered the document texture?
-	if(m_rect.width() != m_document.textWidth()) {
+	if(m_rect.width() != m_texTextWidth) {
 		// It has, we need to repaint the document texture
 		m_isTexDirty = true;
 		updateResources(gfx);
+	} else if(m_isUsingGlyphs && isGlyphAtlasOutdated()) {
+		// Another layer caused one of our atlases to be cleared
+		TextLayer::updateResources(gfx);
+	}
+
+	if(m_isUsingGlyphs) {
+		renderGlyphs(gfx);
+		return;
 	}
 
 	VidgfxVertBuf *vertBuf = vidgfx_texdecalbuf_get_vert_buf(m_vertBuf);
@@ -558,6 +669,60 @@ void TextLayer::render(
 	vidgfx_context_set_tex_decal_mod_color(gfx, prevCol);
 }
 
+void TextLayer::renderGlyphs(VidgfxContext *gfx)
+{
+	if(m_glyphBlocks.isEmpty())
+		return; // Nothing to render
+
+	vidgfx_context_set_shader(gfx, GfxTexDecalShader);
+	vidgfx_context_set_topology(gfx, GfxTriangleStripTopology);
+	vidgfx_context_set_blending(gfx, GfxAlphaBlending);
+	QColor prevCol = vidgfx_context_get_tex_decal_mod_color(gfx);
+	vidgfx_context_set_tex_decal_mod_color(
+		gfx, QColor(255, 255, 255, (int)(getOpacity() * 255.0f)));
+	vidgfx_context_set_tex_filter(gfx, GfxBilinearFilter);
+
+	// Draw the outlines of every glyph before any of the fills so that an
+	// outline never covers the fill of a neighbouring glyph. Glyphs that are
+	// next to each other almost always use the same atlas so we only switch
+	// textures when the atlas changes.
+	for(int pass = 0; pass < 2; pass++) {
+		const bool isStrokePass = (pass == 0);
+		GlyphAtlas *atlas = NULL;
+		VidgfxTex *tex = NULL;
+		for(int i = 0; i < m_glyphBlocks.count(); i++) {
+			const QVector<GlyphQuad> &quads = m_glyphBlocks.at(i).quads;
+			for(int j = 0; j < quads.count(); j++) {
+				const GlyphQuad &quad = quads.at(j);
+				if(quad.isStroke != isStrokePass)
+					continue;
+				if(quad.atlas != atlas) {
+					atlas = quad.atlas;
+					tex = atlas->prepareTexture(gfx);
+					if(tex != NULL)
+						vidgfx_context_set_tex(gfx, tex);
+				}
+				if(tex == NULL)
+					continue;
+				vidgfx_context_draw_buf(gfx, quad.vertBuf);
+			}
+		}
+	}
+	vidgfx_context_set_tex_decal_mod_color(gfx, prevCol);
+}
+
+bool TextLayer::hasStaticOutput() const
+{
+	// Scrolling changes the output every frame and if another layer caused
+	// one of our atlases to be cleared then we need to lay out our glyphs
+	// again in `render()`
+	if(!m_scrollSpeed.isNull())
+		return false;
+	if(m_isUsingGlyphs && isGlyphAtlasOutdated())
+		return false;
+	return true;
+}
+
 quint32 TextLayer::getTypeId() const
 {
 	return (quint32)LyrTextLayerTypeId;
@@ -578,7 +743,7 @@ void TextLayer::serialize(QDataStream *stream) const
 	Layer::serialize(stream);
 
 	// Write data version number
-	*stream << (quint32)2;
+	*stream << (quint32)3;
 
 	// WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING
 	//-------------------------------------------------------------------------
@@ -594,6 +759,7 @@ void TextLayer::serialize(QDataStream *stream) const
 	*stream << m_wordWrap;
 	*stream << m_dialogBgColor;
 	*stream << m_scrollSpeed;
+	*stream << m_useGlyphAtlas;
 }
 
 bool TextLayer::unserialize(QDataStream *stream)
@@ -613,7 +779,7 @@ bool TextLayer::unserialize(QDataStream *stream)
 	// WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING
 
 	// Read our data
-	if(version >= 0 && version <= 2) {
+	if(version >= 0 && version <= 3) {
 		bool boolData;
 		QString stringData;
 
@@ -631,6 +797,10 @@ bool TextLayer::unserialize(QDataStream *stream)
 			*stream >> m_scrollSpeed;
 		else
 			m_scrollSpeed = QPoint(0, 0);
+		if(version >= 3)
+			*stream >> m_useGlyphAtlas;
+		else
+			m_useGlyphAtlas = false;
 	} else {
 		appLog(LOG_CAT, Log::Warning)
 			<< "Unknown version number in text layer serialized data, "
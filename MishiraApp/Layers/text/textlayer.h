@@ -23,7 +23,11 @@
 #include <QtGui/QColor>
 #include <QtGui/QTextDocument>
 
+class GlyphAtlas;
 class LayerDialog;
+class QRawFont;
+class QTextBlock;
+class TextRenderTask;
 
 //=============================================================================
 class TextLayer : public Layer
@@ -31,10 +35,25 @@ class TextLayer : public Layer
 	friend class TextLayerFactory;
 	friend class ScriptTextLayer;
 
+private: // Datatypes ---------------------------------------------------------
+	struct GlyphQuad {
+		GlyphAtlas *	atlas;
+		bool			isStroke;
+		VidgfxVertBuf *	vertBuf;
+	};
+	struct GlyphBlock {
+		QByteArray			key; // Empty if the quads are invalid
+		QVector<GlyphQuad>	quads;
+		QRectF				bounds;
+	};
+
 private: // Members -----------------------------------------------------------
 	VidgfxTexDecalBuf *	m_vertBuf;
 	VidgfxTex *			m_texture;
 	bool				m_isTexDirty;
+	TextRenderTask *	m_renderTask;
+	qreal				m_texTextWidth;
+	int					m_texStrokeSize;
 	QTextDocument		m_document;
 	int					m_strokeSize;
 	QColor				m_strokeColor;
@@ -42,6 +61,13 @@ private: // Members -----------------------------------------------------------
 	QColor				m_dialogBgColor;
 	QPoint				m_scrollSpeed; // Pixels per second
 
+	// Glyph atlas rendering
+	bool					m_useGlyphAtlas;
+	bool					m_isUsingGlyphs;
+	QVector<GlyphBlock>		m_glyphBlocks; // One for each text block
+	QVector<GlyphAtlas *>	m_atlases;
+	QVector<int>			m_atlasGenerations;
+
 private: // Constructor/destructor --------------------------------------------
 	TextLayer(LayerGroup *parent);
 	~TextLayer();
@@ -59,12 +85,35 @@ public: // Methods ------------------------------------------------------------
 	QColor			getDialogBgColor() const;
 	void			setScrollSpeed(const QPoint &speed);
 	QPoint			getScrollSpeed() const;
+	void			setUseGlyphAtlas(bool useAtlas);
+	bool			getUseGlyphAtlas() const;
+	bool			isUsingGlyphAtlas() const;
 
 	QFont			getDefaultFont() const;
 	void			setDefaultFontSettings(QTextDocument *document);
 
 private:
 	void			recreateTexture(VidgfxContext *gfx);
+	LyrAlignment	getDocumentAlignment() const;
+	GlyphAtlas *	refGlyphAtlas(VidgfxContext *gfx, const QRawFont &font);
+	QByteArray		getGlyphBlockKey(
+		const QTextBlock &block, const QPointF &blockPos) const;
+	bool			layoutGlyphs(
+		VidgfxContext *gfx, const QPointF &docPos, QRectF *boundsOut);
+	bool			layoutGlyphBlock(
+		VidgfxContext *gfx, const QTextBlock &block, const QPointF &blockPos,
+		GlyphBlock *glyphsOut);
+	bool			addGlyphQuad(
+		VidgfxContext *gfx, GlyphBlock *glyphs, int *numQuads,
+		GlyphAtlas *atlas, bool isStroke, const QRectF &rect,
+		const QRectF &uv);
+	void			destroyGlyphQuads(
+		VidgfxContext *gfx, GlyphBlock *glyphs, int firstQuad = 0);
+	void			releaseUnusedAtlases(VidgfxContext *gfx);
+	bool			updateGlyphs(VidgfxContext *gfx);
+	bool			isGlyphAtlasOutdated() const;
+	void			destroyGlyphs(VidgfxContext *gfx);
+	void			renderGlyphs(VidgfxContext *gfx);
 
 public: // Interface ----------------------------------------------------------
 	virtual void	initializeResources(VidgfxContext *gfx);
@@ -72,6 +121,7 @@ public: // Interface ----------------------------------------------------------
 	virtual void	destroyResources(VidgfxContext *gfx);
 	virtual void	render(
 		VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped);
+	virtual bool	hasStaticOutput() const;
 
 	virtual quint32	getTypeId() const;
 
@@ -84,6 +134,10 @@ public: // Interface ----------------------------------------------------------
 	public
 Q_SLOTS: // Slots -------------------------------------------------------------
 	void			queuedFrameEvent(uint frameNum, int numDropped);
+
+	private
+Q_SLOTS:
+	void			renderTaskFinished();
 };
 //=============================================================================
 
@@ -122,6 +176,21 @@ inline QPoint TextLayer::getScrollSpeed() const
 	return m_scrollSpeed;
 }
 
+inline bool TextLayer::getUseGlyphAtlas() const
+{
+	return m_useGlyphAtlas;
+}
+
+/// <summary>
+/// Returns `true` if the layer is currently being displayed using the glyph
+/// atlas. The layer falls back to rendering a full texture if the document
+/// uses features that the atlas does not support.
+/// </summary>
+inline bool TextLayer::isUsingGlyphAtlas() const
+{
+	return m_isUsingGlyphs;
+}
+
 //=============================================================================
 class TextLayerFactory : public LayerFactory
 {
@@ -145,6 +145,10 @@ TextLayerDialog::TextLayerDialog(TextLayer *layer, QWidget *parent)
 		this, &LayerDialog::settingModified);
 	connect(m_ui.noWordWrapBtn, &QPushButton::clicked,
 		this, &LayerDialog::settingModified);
+	connect(m_ui.textureRenderBtn, &QPushButton::clicked,
+		this, &LayerDialog::settingModified);
+	connect(m_ui.glyphRenderBtn, &QPushButton::clicked,
+		this, &LayerDialog::settingModified);
 	connect(m_ui.xScrollEdit, &QLineEdit::textChanged,
 		this, &LayerDialog::settingModified);
 	connect(m_ui.yScrollEdit, &QLineEdit::textChanged,
@@ -236,6 +240,8 @@ void TextLayerDialog::loadSettings()
 	m_ui.strokeColorBtn->setColor(layer->getStrokeColor());
 	m_ui.wordWrapBtn->setChecked(layer->getWordWrap());
 	m_ui.noWordWrapBtn->setChecked(!layer->getWordWrap());
+	m_ui.textureRenderBtn->setChecked(!layer->getUseGlyphAtlas());
+	m_ui.glyphRenderBtn->setChecked(layer->getUseGlyphAtlas());
 	m_ui.bgColorBtn->setIsA(
 		layer->getDialogBgColor() != m_ui.bgColorBtn->getColorB());
 	bgColorChanged(m_ui.bgColorBtn->getCurrentColor());
@@ -253,6 +259,7 @@ void TextLayerDialog::applySettings()
 		layer->setStrokeSize(m_ui.strokeSizeEdit->text().toInt());
 	layer->setStrokeColor(m_ui.strokeColorBtn->getColor());
 	layer->setWordWrap(m_ui.wordWrapBtn->isChecked());
+	layer->setUseGlyphAtlas(m_ui.glyphRenderBtn->isChecked());
 	layer->setDialogBgColor(m_ui.bgColorBtn->getCurrentColor());
 
 	// Scroll speed
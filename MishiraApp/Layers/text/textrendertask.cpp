@@ -0,0 +1,514 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "textrendertask.h"
+#include "application.h"
+#include "appsettings.h"
+#include "threadpolicy.h"
+#include <QtCore/QElapsedTimer>
+#include <QtGui/QPainter>
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextCursor>
+#include <QtGui/QTextDocument>
+#include <QtGui/QTextLayout>
+
+//=============================================================================
+// Helpers
+
+/// <summary>
+/// Calculates the distance from the specified pixel to the closest opaque
+/// pixel. Takes into account semi-transparent pixels to produce a more
+/// accurate result.
+/// </summary>
+float getDistance(const QImage &img, int x, int y, int maxDist)
+{
+	// Fast out if the pixel is fully covered
+	if(qAlpha(img.pixel(x, y)) == 255)
+		return 0.0f;
+
+	int startX = qMax(0, x - maxDist);
+	int startY = qMax(0, y - maxDist);
+	int endX = qMin(img.width(), x + maxDist + 1); // Just outside
+	int endY = qMin(img.height(), y + maxDist + 1); // Just outside
+	float dist = (float)maxDist;
+	float distSq = dist * dist; // Minimize the amount of sqrt() calls
+
+	// TODO: This loop could be optimized by moving outwards from the center
+	for(int j = startY; j < endY; j++) {
+		for(int i = startX; i < endX; i++) {
+			int alpha = qAlpha(img.pixel(i, j));
+			if(alpha == 0)
+				continue;
+			int dx = qAbs(x - i);
+			int dy = qAbs(y - j);
+			int dsq = dx * dx + dy * dy;
+			if(dsq >= distSq)
+				continue;
+
+			// Ignore semi-transparent pixels
+			distSq = dsq;
+			dist = sqrtf(dsq);
+			continue;
+
+			// Take into account semi-transparent pixels
+			// TODO
+		}
+	}
+
+	return dist;
+}
+
+/// <summary>
+/// Calculates the one-dimensional squared Euclidean distance transform of `f`
+/// using the lower envelope of parabolas algorithm by Felzenszwalb and
+/// Huttenlocher. `v` and `z` are scratch buffers of size `n` and `n + 1`.
+/// </summary>
+static void distanceTransform1D(
+	const float *f, int n, float *d, int *v, float *z)
+{
+	const float INF = 1e20f;
+	int k = 0;
+	v[0] = 0;
+	z[0] = -INF;
+	z[1] = INF;
+	for(int q = 1; q < n; q++) {
+		float s = ((f[q] + (float)(q * q)) - (f[v[k]] + (float)(v[k] * v[k])))
+			/ (float)(2 * q - 2 * v[k]);
+		while(s <= z[k]) {
+			k--;
+			s = ((f[q] + (float)(q * q)) - (f[v[k]] + (float)(v[k] * v[k])))
+				/ (float)(2 * q - 2 * v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = INF;
+	}
+	k = 0;
+	for(int q = 0; q < n; q++) {
+		while(z[k + 1] < (float)q)
+			k++;
+		float dq = (float)(q - v[k]);
+		d[q] = dq * dq + f[v[k]];
+	}
+}
+
+/// <summary>
+/// Calculates the squared Euclidean distance from every pixel of `img` to the
+/// closest pixel that is at least half covered in linear time by doing a
+/// separable distance transform on the columns and then the rows.
+/// </summary>
+static QVector<float> distanceTransform(const QImage &img)
+{
+	const float INF = 1e20f;
+	const int width = img.width();
+	const int height = img.height();
+	const int maxDim = qMax(width, height);
+	QVector<float> dist(width * height);
+	QVector<float> f(maxDim);
+	QVector<float> d(maxDim);
+	QVector<int> v(maxDim);
+	QVector<float> z(maxDim + 1);
+
+	// Initialize from the alpha channel
+	for(int y = 0; y < height; y++) {
+		const QRgb *line = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+		float *out = &dist[y * width];
+		for(int x = 0; x < width; x++)
+			out[x] = (qAlpha(line[x]) >= 128) ? 0.0f : INF;
+	}
+
+	// Transform columns
+	for(int x = 0; x < width; x++) {
+		for(int y = 0; y < height; y++)
+			f[y] = dist[y * width + x];
+		distanceTransform1D(f.data(), height, d.data(), v.data(), z.data());
+		for(int y = 0; y < height; y++)
+			dist[y * width + x] = d[y];
+	}
+
+	// Transform rows
+	for(int y = 0; y < height; y++) {
+		float *row = &dist[y * width];
+		distanceTransform1D(row, width, d.data(), v.data(), z.data());
+		memcpy(row, d.constData(), width * sizeof(float));
+	}
+
+	return dist;
+}
+
+//=============================================================================
+// TextRenderTask class
+
+TextRenderTask::TextRenderTask(
+	QTextDocument *document, qreal textWidth, int strokeSize,
+	const QColor &strokeColor)
+	: QObject()
+	, QRunnable()
+	, m_html(document->toHtml())
+	, m_defaultFont(document->defaultFont())
+	, m_textOption(document->defaultTextOption())
+	, m_textWidth(textWidth)
+	, m_strokeSize(strokeSize)
+	, m_strokeColor(strokeColor)
+	, m_strokeTechnique(App->getAppSettings()->getTextStrokeTechnique())
+	, m_image()
+	, m_stateMutex()
+	, m_isDone(false)
+	, m_isReleased(false)
+{
+	setAutoDelete(false); // We manage our own lifetime
+}
+
+TextRenderTask::~TextRenderTask()
+{
+}
+
+/// <summary>
+/// Releases the task. If it is still running then the result is discarded
+/// and the object deletes itself once it completes. The task must not be used
+/// by the caller again.
+/// </summary>
+void TextRenderTask::release()
+{
+	m_stateMutex.lock();
+	m_isReleased = true;
+	bool isDone = m_isDone;
+	m_stateMutex.unlock();
+	if(isDone)
+		delete this;
+}
+
+/// <summary>
+/// Renders the specified document and its outline into a new non-premultiplied
+/// image that has `strokeSize` pixels of padding on every side. Returns a null
+/// image if there is nothing to display. This method is safe to call from any
+/// thread as long as the document belongs to the calling thread.
+/// </summary>
+QImage TextRenderTask::renderDocument(
+	QTextDocument *document, int strokeSize, const QColor &strokeColor,
+	TxtStrokeTechnique technique)
+{
+	// Determine image size. We need to keep in mind that the text in the
+	// document might extend outside of the layer's bounds.
+	QSize size(
+		(int)ceilf(document->size().width()),
+		(int)ceilf(document->size().height()));
+
+	if(document->isEmpty() || size.isEmpty()) {
+		// Nothing to display
+		return QImage();
+	}
+
+	// Create temporary canvas. We need to be careful here as text is rendered
+	// differently on premultiplied vs non-premultiplied pixel formats. On a
+	// premultiplied format text is rendered with subpixel rendering enabled
+	// while on a non-premultiplied format it is not. As we don't want subpixel
+	// rendering we use the standard ARGB32 format.
+	QSize imgSize(
+		size.width() + strokeSize * 2, size.height() + strokeSize * 2);
+	QImage img(imgSize, QImage::Format_ARGB32);
+	img.fill(Qt::transparent);
+
+	// Render stroke
+	if(strokeSize > 0) {
+		switch(technique) {
+		case TxtOutlineStroke:
+			strokeWithOutline(img, document, strokeSize, strokeColor);
+			break;
+		case TxtPathStroke:
+			strokeWithPath(img, document, strokeSize, strokeColor, false);
+			break;
+		case TxtBlockPathStroke:
+			strokeWithPath(img, document, strokeSize, strokeColor, true);
+			break;
+		case TxtBruteForceStroke:
+			strokeWithBruteForce(img, document, strokeSize, strokeColor);
+			break;
+		default:
+		case TxtDistanceStroke:
+			strokeWithDistance(img, document, strokeSize, strokeColor);
+			break;
+		}
+	}
+
+	// Render text over the top of the stroke taking into account the stroke
+	// offset
+	QPainter p(&img);
+	p.setRenderHint(QPainter::Antialiasing, true);
+	p.translate(strokeSize, strokeSize);
+	document->drawContents(&p);
+	p.end();
+
+	// Preview texture for debugging
+	//img.save(App->getDataDirectory().filePath("Preview.png"));
+
+	return img;
+}
+
+/// <summary>
+/// Renders the text of the document by itself into a new image of the
+/// specified size offset by the stroke size so that raster techniques can
+/// determine which pixels are covered.
+/// </summary>
+QImage TextRenderTask::renderCoverage(
+	QTextDocument *document, const QSize &imgSize, int strokeSize)
+{
+	QImage coverage(imgSize, QImage::Format_ARGB32);
+	coverage.fill(Qt::transparent);
+	QPainter p(&coverage);
+	p.setRenderHint(QPainter::Antialiasing, true);
+	p.translate(strokeSize, strokeSize);
+	document->drawContents(&p);
+	p.end();
+	return coverage;
+}
+
+/// <summary>
+/// Technique 0: Use QTextDocument's built-in text outliner.
+/// </summary>
+void TextRenderTask::strokeWithOutline(
+	QImage &img, QTextDocument *document, int strokeSize,
+	const QColor &strokeColor)
+{
+	QTextDocument *outlineDoc = document->clone();
+
+	QTextCharFormat format;
+	QPen pen(strokeColor, (double)(strokeSize * 2));
+	pen.setJoinStyle(Qt::RoundJoin);
+	format.setTextOutline(pen);
+	QTextCursor cursor(outlineDoc);
+	cursor.select(QTextCursor::Document);
+	cursor.mergeCharFormat(format);
+
+	QPainter p(&img);
+	p.setRenderHint(QPainter::Antialiasing, true);
+	p.translate(strokeSize, strokeSize);
+	outlineDoc->drawContents(&p);
+	p.end();
+	delete outlineDoc;
+}
+
+/// <summary>
+/// Techniques 1 and 2: Convert the text to a QPainterPath and stroke it. The
+/// path needs to be simplified to prevent gaps at larger stroke sizes which
+/// is very slow for long text. If `perBlock` is true then each block of text
+/// is converted and simplified separately.
+/// </summary>
+void TextRenderTask::strokeWithPath(
+	QImage &img, QTextDocument *document, int strokeSize,
+	const QColor &strokeColor, bool perBlock)
+{
+	QPainter p(&img);
+	p.setRenderHint(QPainter::Antialiasing, true);
+	QPen pen(strokeColor, (double)(strokeSize * 2));
+	pen.setJoinStyle(Qt::RoundJoin);
+
+	QPainterPath path;
+	QTextBlock block = document->firstBlock();
+	int numBlocks = document->blockCount();
+	for(int i = 0; i < numBlocks; i++) {
+		// Convert this block to a painter path
+		QTextLayout *layout = block.layout();
+		for(int j = 0; j < layout->lineCount(); j++) {
+			QTextLine line = layout->lineAt(j);
+			const QString text = block.text().mid(
+				line.textStart(), line.textLength());
+			QPointF pos = layout->position() + line.position() +
+				QPointF(strokeSize, strokeSize);
+			pos.ry() += line.ascent();
+			path.addText(pos, block.charFormat().font(), text);
+		}
+		if(perBlock) {
+			p.strokePath(path.simplified(), pen);
+			path = QPainterPath();
+		}
+
+		// Iterate
+		block = block.next();
+	}
+	if(!perBlock)
+		p.strokePath(path.simplified(), pen);
+	p.end();
+}
+
+/// <summary>
+/// Technique 3: Raster brute-force where for each destination pixel we
+/// measure the distance to the closest covered pixel. The time that this
+/// takes grows with the square of the stroke size.
+/// </summary>
+void TextRenderTask::strokeWithBruteForce(
+	QImage &img, QTextDocument *document, int strokeSize,
+	const QColor &strokeColor)
+{
+	QImage coverage = renderCoverage(document, img.size(), strokeSize);
+
+	// Get bounding region based on text line bounding rects
+	QRegion region;
+	QTextBlock block = document->firstBlock();
+	int numBlocks = document->blockCount();
+	for(int i = 0; i < numBlocks; i++) {
+		QTextLayout *layout = block.layout();
+		for(int j = 0; j < layout->lineCount(); j++) {
+			QTextLine line = layout->lineAt(j);
+			QRect rect = line.naturalTextRect()
+				.translated(layout->position()).toAlignedRect();
+			if(rect.isEmpty())
+				continue; // Don't add empty rectangles
+			rect.adjust(0, 0, 1, 0); // QTextLine is incorrect?
+			rect.adjust(0, 0, strokeSize * 2, strokeSize * 2);
+			region += rect;
+		}
+
+		// Iterate
+		block = block.next();
+	}
+
+	// Do distance calculation. We fake antialiasing by blurring the edge by
+	// 1px.
+	const float outEdge = (float)strokeSize;
+	for(int y = 0; y < img.height(); y++) {
+		for(int x = 0; x < img.width(); x++) {
+			if(!region.contains(QPoint(x, y)))
+				continue;
+			float dist = getDistance(coverage, x, y, strokeSize);
+			if(dist >= outEdge)
+				continue; // Outside stroke completely
+			float opacity = qMin(1.0f, outEdge - dist);
+			QColor col = strokeColor;
+			col.setAlphaF(col.alphaF() * opacity);
+			img.setPixel(x, y, col.rgba());
+		}
+	}
+}
+
+/// <summary>
+/// Technique 4: Raster Euclidean distance transform. Render the text by
+/// itself, calculate the distance from every pixel to the closest covered
+/// pixel in linear time and then fill the stroke based on that distance. The
+/// text is then composited over the top of the stroke by QPainter like
+/// normal. Unlike the other techniques the time that this takes only depends
+/// on the size of the image.
+/// </summary>
+void TextRenderTask::strokeWithDistance(
+	QImage &img, QTextDocument *document, int strokeSize,
+	const QColor &strokeColor)
+{
+	QImage coverage = renderCoverage(document, img.size(), strokeSize);
+	QVector<float> dist = distanceTransform(coverage);
+
+	// Fill the stroke. We fake antialiasing by blurring the edge by 1px.
+	const float outEdge = (float)strokeSize;
+	const float outEdgeSq = outEdge * outEdge;
+	const QRgb strokeRgb = strokeColor.rgb() & 0x00FFFFFF;
+	const int strokeAlpha = strokeColor.alpha();
+	const int width = img.width();
+	for(int y = 0; y < img.height(); y++) {
+		const float *distLine = &dist[y * width];
+		QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+		for(int x = 0; x < width; x++) {
+			if(distLine[x] >= outEdgeSq)
+				continue; // Outside stroke completely
+			float opacity = qMin(1.0f, outEdge - sqrtf(distLine[x]));
+			line[x] = strokeRgb |
+				((uint)((float)strokeAlpha * opacity + 0.5f) << 24);
+		}
+	}
+}
+
+/// <summary>
+/// Measures how long each stroke technique takes to render a large block of
+/// outlined text at several stroke sizes and logs the results. The text is
+/// sized to fill most of a 1080p canvas which is the worst case that users
+/// are likely to hit when editing titles. Must be called from the main thread
+/// as it uses the application's fonts.
+/// </summary>
+void TextRenderTask::runStrokeBenchmark(int numIterations)
+{
+	const QString LOG_CAT = QStringLiteral("Bench");
+	const int STROKE_SIZES[] = { 2, 8, 16 };
+	const int NUM_STROKE_SIZES = sizeof(STROKE_SIZES) / sizeof(int);
+
+	QTextDocument document;
+	document.setDocumentMargin(0.0);
+	QFont font = document.defaultFont();
+	font.setPixelSize(96);
+	document.setDefaultFont(font);
+	document.setPlainText(QStringLiteral(
+		"The quick brown fox jumps over the lazy dog\n"
+		"Pack my box with five dozen liquor jugs\n"
+		"How vexingly quick daft zebras jump\n"
+		"Sphinx of black quartz, judge my vow"));
+	document.setTextWidth(1920.0);
+
+	QElapsedTimer timer;
+	for(int i = 0; i < NUM_STROKE_SIZES; i++) {
+		for(int j = 0; j < NUM_TXT_STROKE_TECHNIQUES; j++) {
+			timer.start();
+			QSize size;
+			for(int k = 0; k < numIterations; k++) {
+				size = renderDocument(
+					&document, STROKE_SIZES[i], Qt::black,
+					(TxtStrokeTechnique)j).size();
+			}
+			qint64 usec = timer.nsecsElapsed() / 1000LL /
+				(qint64)numIterations;
+			appLog(LOG_CAT) << QStringLiteral(
+				"Text stroke: %1 at %2 px on %3x%4 image = %L5 usec")
+				.arg(TxtStrokeTechniqueStrings[j])
+				.arg(STROKE_SIZES[i])
+				.arg(size.width())
+				.arg(size.height())
+				.arg(usec);
+		}
+	}
+}
+
+void TextRenderTask::run()
+{
+	// We run on a shared thread pool thread so restore its policy afterwards
+	ScopedThreadPolicy policy(
+		ThrdBackgroundClass, QStringLiteral("Text renderer"));
+	render();
+
+	// Notify our owner unless it no longer exists. The signal is emitted
+	// while holding the lock so that we cannot be deleted before it has been
+	// queued.
+	m_stateMutex.lock();
+	m_isDone = true;
+	if(m_isReleased) {
+		m_stateMutex.unlock();
+		delete this;
+		return;
+	}
+	emit finished();
+	m_stateMutex.unlock();
+}
+
+void TextRenderTask::render()
+{
+	// Recreate the document in this thread
+	QTextDocument document;
+	document.setDocumentMargin(0.0);
+	document.setDefaultFont(m_defaultFont);
+	document.setDefaultTextOption(m_textOption);
+	document.setHtml(m_html);
+	document.setTextWidth(m_textWidth);
+
+	m_image = renderDocument(
+		&document, m_strokeSize, m_strokeColor, m_strokeTechnique);
+}
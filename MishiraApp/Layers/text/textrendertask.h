@@ -0,0 +1,114 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef TEXTRENDERTASK_H
+#define TEXTRENDERTASK_H
+
+#include "common.h"
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QRunnable>
+#include <QtGui/QColor>
+#include <QtGui/QFont>
+#include <QtGui/QImage>
+#include <QtGui/QTextOption>
+
+class QTextDocument;
+
+//=============================================================================
+/// <summary>
+/// Rasterises a copy of a text document and its outline into an image in the
+/// global thread pool without blocking the main thread. As `QTextDocument`
+/// cannot be shared between threads the document is recreated from its HTML
+/// inside of the pool thread. The outline is rendered with the technique that
+/// is selected in the application settings.
+///
+/// The task is owned by the layer that created it until it is released with
+/// `release()` after which it deletes itself as soon as it is no longer
+/// running. `finished()` is never emitted after it was released.
+/// </summary>
+class TextRenderTask : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	QString			m_html;
+	QFont			m_defaultFont;
+	QTextOption		m_textOption;
+	qreal			m_textWidth;
+	int				m_strokeSize;
+	QColor			m_strokeColor;
+	TxtStrokeTechnique	m_strokeTechnique;
+	QImage			m_image;
+	QMutex			m_stateMutex;
+	bool			m_isDone; // Protected by `m_stateMutex`
+	bool			m_isReleased; // Protected by `m_stateMutex`
+
+public: // Constructor/destructor ---------------------------------------------
+	TextRenderTask(
+		QTextDocument *document, qreal textWidth, int strokeSize,
+		const QColor &strokeColor);
+private:
+	~TextRenderTask();
+
+public: // Methods ------------------------------------------------------------
+	void			release();
+	QImage			getImage() const;
+	int				getStrokeSize() const;
+
+	static QImage	renderDocument(
+		QTextDocument *document, int strokeSize, const QColor &strokeColor,
+		TxtStrokeTechnique technique = TxtDistanceStroke);
+	static void		runStrokeBenchmark(int numIterations = 3);
+
+private:
+	static QImage	renderCoverage(
+		QTextDocument *document, const QSize &imgSize, int strokeSize);
+	static void		strokeWithOutline(
+		QImage &img, QTextDocument *document, int strokeSize,
+		const QColor &strokeColor);
+	static void		strokeWithPath(
+		QImage &img, QTextDocument *document, int strokeSize,
+		const QColor &strokeColor, bool perBlock);
+	static void		strokeWithBruteForce(
+		QImage &img, QTextDocument *document, int strokeSize,
+		const QColor &strokeColor);
+	static void		strokeWithDistance(
+		QImage &img, QTextDocument *document, int strokeSize,
+		const QColor &strokeColor);
+
+	void			render();
+
+protected:
+	virtual void	run();
+
+Q_SIGNALS: // Signals ---------------------------------------------------------
+	void			finished();
+};
+//=============================================================================
+
+inline QImage TextRenderTask::getImage() const
+{
+	return m_image;
+}
+
+inline int TextRenderTask::getStrokeSize() const
+{
+	return m_strokeSize;
+}
+
+#endif // TEXTRENDERTASK_H
@@ -0,0 +1,429 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "filemuxer.h"
+#include "flvfilemuxer.h"
+#include "fragmentedmp4filemuxer.h"
+#include "mp4filemuxer.h"
+#include "audioencoder.h"
+#include "audiomixer.h"
+#include "fdkaacencoder.h"
+#include "profile.h"
+#include "videoencoder.h"
+#include "x264encoder.h"
+#include <QtCore/QtEndian>
+
+/// <summary>
+/// Returns the number of bytes that make up the Annex B start code at the
+/// beginning of the specified NAL unit (0, 3 or 4).
+/// </summary>
+static int startCodeLength(const char *data, int size)
+{
+	if(size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 &&
+		data[3] == 1)
+	{
+		return 4;
+	}
+	if(size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1)
+		return 3;
+	return 0;
+}
+
+/// <summary>
+/// Returns true if the specified file type is written by one of our own
+/// muxers instead of Libav.
+/// </summary>
+bool FileMuxer::isNativeFileType(FileTrgtType type)
+{
+	switch(type) {
+	case FileTrgtMp4Type:
+	case FileTrgtFlvType:
+	case FileTrgtFragMp4Type:
+		return true;
+	default:
+	case FileTrgtMkvType:
+		return false;
+	}
+}
+
+/// <summary>
+/// Creates a new muxer for the specified file type or NULL if the file type
+/// is not natively supported. `fragDuration` is the length of each fragment in
+/// seconds and is only used by fragmented file types.
+/// </summary>
+FileMuxer *FileMuxer::createMuxer(
+	FileTrgtType type, VideoEncoder *vEnc, AudioEncoder *aEnc,
+	int fragDuration)
+{
+	switch(type) {
+	case FileTrgtMp4Type:
+		return new Mp4FileMuxer(vEnc, aEnc);
+	case FileTrgtFlvType:
+		return new FlvFileMuxer(vEnc, aEnc);
+	case FileTrgtFragMp4Type:
+		return new FragmentedMp4FileMuxer(vEnc, aEnc, fragDuration);
+	default:
+	case FileTrgtMkvType:
+		return NULL;
+	}
+}
+
+/// <summary>
+/// Must be called from the main thread as the properties of the encoders are
+/// copied. The muxer doesn't keep a reference to the encoders.
+/// </summary>
+FileMuxer::FileMuxer(VideoEncoder *vEnc, AudioEncoder *aEnc)
+	: m_info()
+	, m_file(NULL)
+	, m_wroteHeader(false)
+	, m_isContinuation(false)
+	, m_bytesWritten(0)
+	, m_lastError()
+{
+	m_info.videoTimeBase = vEnc->getTimeBase();
+	m_info.videoFramerate = vEnc->getFramerate();
+	m_info.videoSize = vEnc->getSize();
+	m_info.videoBitrate = 0;
+	if(vEnc->getType() == VencX264Type)
+		m_info.videoBitrate = static_cast<X264Encoder *>(vEnc)->getBitrate();
+
+	m_info.hasAudio = (aEnc != NULL);
+	m_info.audioSampleRate = 0;
+	m_info.audioFrameSize = 0;
+	m_info.audioNumChannels = 0;
+	m_info.audioBitrate = 0;
+	if(aEnc != NULL) {
+		m_info.audioTimeBase = aEnc->getTimeBase();
+		m_info.audioSampleRate = aEnc->getSampleRate();
+		m_info.audioFrameSize = aEnc->getFrameSize();
+		m_info.audioNumChannels =
+			aEnc->getProfile()->getAudioMixer()->getNumChannels();
+		if(aEnc->getType() == AencFdkAacType) {
+			m_info.audioBitrate =
+				static_cast<FdkAacEncoder *>(aEnc)->getBitrate();
+		}
+		m_info.audioOutOfBand = aEnc->getOutOfBand();
+	}
+}
+
+FileMuxer::~FileMuxer()
+{
+	if(m_file != NULL)
+		delete m_file; // Closes the file
+}
+
+bool FileMuxer::open(const QString &filename)
+{
+	QFile *file = new QFile(filename);
+	if(!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		setError(file->errorString());
+		delete file;
+		return false;
+	}
+	return open(file);
+}
+
+/// <summary>
+/// Begins writing to a file that has already been opened for writing, for
+/// example by `AsyncIO::openFileForWriting()`. The muxer takes ownership of
+/// the file object.
+/// </summary>
+bool FileMuxer::open(QFile *file)
+{
+	if(m_file != NULL) {
+		delete file;
+		return setError(QStringLiteral("File already open"));
+	}
+	m_file = file;
+	m_wroteHeader = false;
+	m_bytesWritten = 0;
+	m_lastError = QString();
+	return true;
+}
+
+/// <summary>
+/// Changes the thread affinity of the opened file so that the muxer can be
+/// used by another thread. Must be called from the thread that currently owns
+/// the file.
+/// </summary>
+void FileMuxer::moveFileToThread(QThread *thread)
+{
+	if(m_file != NULL)
+		m_file->moveToThread(thread);
+}
+
+/// <summary>
+/// Finalizes and closes the file. The file is always closed even if this
+/// method returns false.
+/// </summary>
+bool FileMuxer::close()
+{
+	if(m_file == NULL)
+		return true;
+	bool ret = true;
+	if(m_wroteHeader)
+		ret = finalizeEvent();
+	m_file->close();
+	m_wroteHeader = false;
+	return ret;
+}
+
+/// <summary>
+/// Writes a single video frame to the file. The file header is written at the
+/// first keyframe and any frames before it are silently ignored.
+/// </summary>
+bool FileMuxer::writeFrame(const EncodedFrame &frame)
+{
+	if(!isOpen())
+		return false;
+	if(!m_wroteHeader) {
+		if(!frame.isKeyframe())
+			return true; // Wait for a keyframe
+		if(!writeHeaderEvent(frame))
+			return false;
+		m_wroteHeader = true;
+	}
+	return writeFrameEvent(frame);
+}
+
+/// <summary>
+/// Writes a single audio segment to the file. Segments that are received
+/// before the file header is written are silently ignored.
+/// </summary>
+bool FileMuxer::writeSegment(const EncodedSegment &segment)
+{
+	if(!isOpen())
+		return false;
+	if(!m_wroteHeader || !m_info.hasAudio)
+		return true;
+	return writeSegmentEvent(segment);
+}
+
+/// <summary>
+/// Helper that records the error and returns false.
+/// </summary>
+bool FileMuxer::setError(const QString &error)
+{
+	m_lastError = error;
+	return false;
+}
+
+bool FileMuxer::writeData(const char *data, qint64 size)
+{
+	if(size <= 0)
+		return true;
+	qint64 written = m_file->write(data, size);
+	if(written != size)
+		return setError(m_file->errorString());
+	m_bytesWritten += (quint64)size;
+	return true;
+}
+
+bool FileMuxer::writeData(const QByteArray &data)
+{
+	return writeData(data.constData(), data.size());
+}
+
+bool FileMuxer::writeUInt8(quint8 val)
+{
+	return writeData(reinterpret_cast<const char *>(&val), 1);
+}
+
+bool FileMuxer::writeUInt16(quint16 val)
+{
+	uchar buf[2];
+	qToBigEndian<quint16>(val, buf);
+	return writeData(reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+bool FileMuxer::writeUInt24(quint32 val)
+{
+	uchar buf[4];
+	qToBigEndian<quint32>(val, buf);
+	return writeData(reinterpret_cast<const char *>(&buf[1]), 3);
+}
+
+bool FileMuxer::writeUInt32(quint32 val)
+{
+	uchar buf[4];
+	qToBigEndian<quint32>(val, buf);
+	return writeData(reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+bool FileMuxer::writeUInt64(quint64 val)
+{
+	uchar buf[8];
+	qToBigEndian<quint64>(val, buf);
+	return writeData(reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+/// <summary>
+/// Overwrites previously written data at the specified absolute file position
+/// and then returns to the end of the file. Used for patching headers once
+/// sizes and durations are known.
+/// </summary>
+bool FileMuxer::overwriteAt(qint64 pos, const QByteArray &data)
+{
+	qint64 endPos = (qint64)m_bytesWritten;
+	if(!m_file->seek(pos))
+		return setError(m_file->errorString());
+	if(m_file->write(data) != data.size())
+		return setError(m_file->errorString());
+	if(!m_file->seek(endPos))
+		return setError(m_file->errorString());
+	return true;
+}
+
+/// <summary>
+/// Pushes all buffered data to the operating system so that it is not lost if
+/// the application crashes.
+/// </summary>
+bool FileMuxer::flush()
+{
+	if(!m_file->flush())
+		return setError(m_file->errorString());
+	return true;
+}
+
+/// <summary>
+/// Searches the frame for its SPS and PPS NAL units and returns their
+/// contents without their Annex B start codes.
+/// </summary>
+bool FileMuxer::findParameterSets(
+	const EncodedFrame &frame, QByteArray *spsOut, QByteArray *ppsOut)
+{
+	const EncodedPacketList &pkts = frame.getPackets();
+	bool foundSps = false;
+	bool foundPps = false;
+	for(int i = 0; i < pkts.count(); i++) {
+		const EncodedPacket &pkt = pkts.at(i);
+		if(!foundSps && pkt.ident() == PktH264Ident_SPS) {
+			*spsOut = stripStartCode(pkt.data());
+			foundSps = true;
+		} else if(!foundPps && pkt.ident() == PktH264Ident_PPS) {
+			*ppsOut = stripStartCode(pkt.data());
+			foundPps = true;
+		}
+	}
+	return foundSps && foundPps && spsOut->size() >= 4;
+}
+
+/// <summary>
+/// Returns a deep copy of the NAL unit without its Annex B start code. Only
+/// use this for small, infrequent units such as parameter sets.
+/// </summary>
+QByteArray FileMuxer::stripStartCode(const QByteArray &nal)
+{
+	int off = startCodeLength(nal.constData(), nal.size());
+	return QByteArray(nal.constData() + off, nal.size() - off);
+}
+
+/// <summary>
+/// Returns the size of the frame once it has been converted from Annex B to
+/// the length-prefixed format used by both MP4 and FLV.
+/// </summary>
+int FileMuxer::calcAvccFrameSize(const EncodedFrame &frame)
+{
+	const EncodedPacketList &pkts = frame.getPackets();
+	int size = 0;
+	for(int i = 0; i < pkts.count(); i++) {
+		const QByteArray &data = pkts.at(i).data();
+		size += 4 + data.size() -
+			startCodeLength(data.constData(), data.size());
+	}
+	return size;
+}
+
+/// <summary>
+/// Writes every NAL unit of the frame to the file as a 4-byte big-endian
+/// length followed by the NAL unit itself. The NAL data is written directly
+/// from the packet's memory.
+/// </summary>
+bool FileMuxer::writeAvccFrame(const EncodedFrame &frame)
+{
+	const EncodedPacketList &pkts = frame.getPackets();
+	for(int i = 0; i < pkts.count(); i++) {
+		QByteArray data = pkts.at(i).data(); // Shallow copy
+		int off = startCodeLength(data.constData(), data.size());
+		if(!writeUInt32(data.size() - off))
+			return false;
+		if(!writeData(data.constData() + off, data.size() - off))
+			return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Creates an "AVCDecoderConfigurationRecord" as defined by ISO/IEC 14496-15
+/// that is used in both the MP4 "avcC" box and the FLV AVC sequence header.
+/// </summary>
+QByteArray FileMuxer::createAvcConfigRecord(
+	const QByteArray &sps, const QByteArray &pps)
+{
+	QByteArray buf;
+	buf.reserve(11 + sps.size() + pps.size());
+	appendUInt8(buf, 1); // configurationVersion
+	appendUInt8(buf, (quint8)sps.at(1)); // AVCProfileIndication
+	appendUInt8(buf, (quint8)sps.at(2)); // profile_compatibility
+	appendUInt8(buf, (quint8)sps.at(3)); // AVCLevelIndication
+	appendUInt8(buf, 0xFF); // 6 bits reserved + lengthSizeMinusOne = 3
+	appendUInt8(buf, 0xE1); // 3 bits reserved + numOfSequenceParameterSets
+	appendUInt16(buf, sps.size());
+	buf.append(sps);
+	appendUInt8(buf, 1); // numOfPictureParameterSets
+	appendUInt16(buf, pps.size());
+	buf.append(pps);
+	return buf;
+}
+
+void FileMuxer::appendUInt8(QByteArray &buf, quint8 val)
+{
+	buf.append((char)val);
+}
+
+void FileMuxer::appendUInt16(QByteArray &buf, quint16 val)
+{
+	uchar tmp[2];
+	qToBigEndian<quint16>(val, tmp);
+	buf.append(reinterpret_cast<const char *>(tmp), sizeof(tmp));
+}
+
+void FileMuxer::appendUInt24(QByteArray &buf, quint32 val)
+{
+	uchar tmp[4];
+	qToBigEndian<quint32>(val, tmp);
+	buf.append(reinterpret_cast<const char *>(&tmp[1]), 3);
+}
+
+void FileMuxer::appendUInt32(QByteArray &buf, quint32 val)
+{
+	uchar tmp[4];
+	qToBigEndian<quint32>(val, tmp);
+	buf.append(reinterpret_cast<const char *>(tmp), sizeof(tmp));
+}
+
+void FileMuxer::appendUInt64(QByteArray &buf, quint64 val)
+{
+	uchar tmp[8];
+	qToBigEndian<quint64>(val, tmp);
+	buf.append(reinterpret_cast<const char *>(tmp), sizeof(tmp));
+}
+
+void FileMuxer::appendFourCC(QByteArray &buf, const char *fourCC)
+{
+	buf.append(fourCC, 4);
+}
@@ -0,0 +1,196 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef FILEMUXER_H
+#define FILEMUXER_H
+
+#include "encodedframe.h"
+#include "encodedsegment.h"
+#include "fraction.h"
+#include <QtCore/QFile>
+#include <QtCore/QSize>
+
+class AudioEncoder;
+class QThread;
+class VideoEncoder;
+
+//=============================================================================
+/// <summary>
+/// The properties of the encoded streams that a muxer needs to describe them
+/// in the file. They are copied out of the encoders when the muxer is created
+/// on the main thread so that the muxer never accesses the encoders directly
+/// and can be safely used from other threads even if the encoders are
+/// reconfigured or deleted.
+/// </summary>
+struct MuxerStreamInfo {
+	Fraction	videoTimeBase;
+	Fraction	videoFramerate;
+	QSize		videoSize;
+	int			videoBitrate; // Kb/s, 0 = Unknown
+	bool		hasAudio;
+	Fraction	audioTimeBase;
+	int			audioSampleRate;
+	int			audioFrameSize;
+	int			audioNumChannels;
+	int			audioBitrate; // Kb/s, 0 = Unknown
+	QByteArray	audioOutOfBand;
+};
+
+//=============================================================================
+/// <summary>
+/// Base class for our native container writers. Muxers consume the already
+/// interleaved output of an `AVSynchronizer` and write each packet straight
+/// from its `EncodedPacket` memory to the file without concatenating or
+/// reinterleaving anything. This means that both streams must arrive in DTS
+/// order. The file begins at the first keyframe that is received and all
+/// timestamps are written relative to it so a file can be started at any
+/// point during a recording.
+///
+/// Only H.264 video and AAC audio are supported.
+///
+/// Once a muxer has been created it doesn't reference any other object and
+/// can be moved to another thread, for example to close it in the background
+/// with `AsyncIO::closeMuxer()`. It must only be used by one thread at a time.
+/// </summary>
+class FileMuxer
+{
+protected: // Members ---------------------------------------------------------
+	MuxerStreamInfo	m_info;
+	QFile *			m_file;
+	bool			m_wroteHeader;
+	bool			m_isContinuation; // Continues a split recording
+	quint64			m_bytesWritten; // Current write position
+	QString			m_lastError;
+
+public: // Static methods -----------------------------------------------------
+	static bool			isNativeFileType(FileTrgtType type);
+	static FileMuxer *	createMuxer(
+		FileTrgtType type, VideoEncoder *vEnc, AudioEncoder *aEnc,
+		int fragDuration);
+
+protected: // Constructor/destructor ------------------------------------------
+	FileMuxer(VideoEncoder *vEnc, AudioEncoder *aEnc);
+public:
+	virtual ~FileMuxer();
+
+public: // Methods ------------------------------------------------------------
+	bool			open(const QString &filename);
+	bool			open(QFile *file);
+	bool			close();
+	bool			isOpen() const;
+	void			moveFileToThread(QThread *thread);
+	void			setContinuation(bool continuation);
+	bool			isContinuation() const;
+	bool			writeFrame(const EncodedFrame &frame);
+	bool			writeSegment(const EncodedSegment &segment);
+	bool			hasWrittenHeader() const;
+	quint64			getBytesWritten() const;
+	QString			getFilename() const;
+	QString			getLastError() const;
+	MuxerStreamInfo	getStreamInfo() const;
+
+protected:
+	bool			setError(const QString &error);
+	bool			writeData(const char *data, qint64 size);
+	bool			writeData(const QByteArray &data);
+	bool			writeUInt8(quint8 val);
+	bool			writeUInt16(quint16 val);
+	bool			writeUInt24(quint32 val);
+	bool			writeUInt32(quint32 val);
+	bool			writeUInt64(quint64 val);
+	bool			overwriteAt(qint64 pos, const QByteArray &data);
+	bool			flush();
+
+	static bool		findParameterSets(
+		const EncodedFrame &frame, QByteArray *spsOut, QByteArray *ppsOut);
+	static QByteArray	stripStartCode(const QByteArray &nal);
+	static int		calcAvccFrameSize(const EncodedFrame &frame);
+	bool			writeAvccFrame(const EncodedFrame &frame);
+	static QByteArray	createAvcConfigRecord(
+		const QByteArray &sps, const QByteArray &pps);
+
+	static void		appendUInt8(QByteArray &buf, quint8 val);
+	static void		appendUInt16(QByteArray &buf, quint16 val);
+	static void		appendUInt24(QByteArray &buf, quint32 val);
+	static void		appendUInt32(QByteArray &buf, quint32 val);
+	static void		appendUInt64(QByteArray &buf, quint64 val);
+	static void		appendFourCC(QByteArray &buf, const char *fourCC);
+
+private: // Interface ---------------------------------------------------------
+
+	/// <summary>
+	/// Called once when the first keyframe is about to be written. The frame
+	/// is guaranteed to contain the stream's SPS and PPS NAL units.
+	/// </summary>
+	virtual bool	writeHeaderEvent(const EncodedFrame &firstFrame) = 0;
+
+	virtual bool	writeFrameEvent(const EncodedFrame &frame) = 0;
+	virtual bool	writeSegmentEvent(const EncodedSegment &segment) = 0;
+
+	/// <summary>
+	/// Called just before the file is closed if the header was written. Used
+	/// to write any indices or to patch sizes and durations.
+	/// </summary>
+	virtual bool	finalizeEvent() = 0;
+};
+//=============================================================================
+
+inline bool FileMuxer::isOpen() const
+{
+	return m_file != NULL && m_file->isOpen();
+}
+
+inline void FileMuxer::setContinuation(bool continuation)
+{
+	m_isContinuation = continuation;
+}
+
+inline bool FileMuxer::isContinuation() const
+{
+	return m_isContinuation;
+}
+
+inline bool FileMuxer::hasWrittenHeader() const
+{
+	return m_wroteHeader;
+}
+
+inline quint64 FileMuxer::getBytesWritten() const
+{
+	return m_bytesWritten;
+}
+
+inline QString FileMuxer::getFilename() const
+{
+	if(m_file == NULL)
+		return QString();
+	return m_file->fileName();
+}
+
+inline QString FileMuxer::getLastError() const
+{
+	return m_lastError;
+}
+
+inline MuxerStreamInfo FileMuxer::getStreamInfo() const
+{
+	return m_info;
+}
+
+Q_DECLARE_METATYPE(FileMuxer *);
+
+#endif // FILEMUXER_H
@@ -16,25 +16,28 @@
 //*****************************************************************************
 
 #include "filetarget.h"
+#include "filemuxer.h"
 #include "application.h"
+#include "asyncio.h"
 #include "audioencoder.h"
 #include "audiomixer.h"
 #include "avsynchronizer.h"
 #include "fdkaacencoder.h"
 #include "profile.h"
 #include "stylehelper.h"
+#include "tracer.h"
 #include "videoencoder.h"
 #include "Widgets/infowidget.h"
 #include "Widgets/targetpane.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 extern "C" {
 #include <libavformat/avformat.h>
 }
 
 #define DUMP_STATS_TO_FILE 0
-#if DUMP_STATS_TO_FILE
-#include <QtCore/QFile>
-#endif
 
 const QString LOG_CAT = QStringLiteral("Target");
 
@@ -57,6 +60,22 @@ FileTarget::FileTarget(
 	, m_timeOfPrevSizeCalc(0)
 	, m_actualFilename()
 
+	// Native muxer
+	, m_muxer(NULL)
+
+	// File splitting
+	, m_segmentNum(0)
+	, m_segmentStartPts(0)
+	, m_lastFramePts(0)
+	, m_segmentBaseName()
+	, m_manifestFilename()
+	, m_beginOp(0)
+	, m_pendingItems()
+	, m_nextFile(NULL)
+	, m_nextFileOp(0)
+	, m_staleFileOps()
+	, m_closeOps()
+
 	// FFmpeg
 	, m_outFormat(NULL)
 	, m_context(NULL)
@@ -70,6 +89,9 @@ FileTarget::FileTarget(
 	, m_audioEncId(opt.audioEncId)
 	, m_filename(opt.filename)
 	, m_fileType(opt.fileType)
+	, m_fragDuration(opt.fragDuration)
+	, m_splitDuration(opt.splitDuration)
+	, m_splitSize(opt.splitSize)
 {
 #if DUMP_STATS_TO_FILE
 	dumpBuffer.reserve(512 * 1024); // 512KB
@@ -79,6 +101,13 @@ FileTarget::FileTarget(
 	// Connect signals
 	connect(&m_paneTimer, &QTimer::timeout,
 		this, &FileTarget::paneTimeout);
+	AsyncIO *asyncIo = App->getAsyncIO();
+	connect(asyncIo, &AsyncIO::beginSegmentedFileComplete,
+		this, &FileTarget::splittingBegun);
+	connect(asyncIo, &AsyncIO::openFileForWritingComplete,
+		this, &FileTarget::nextFileOpened);
+	connect(asyncIo, &AsyncIO::closeMuxerComplete,
+		this, &FileTarget::muxerClosed);
 
 	// Setup timer to refresh the pane
 	m_paneTimer.setSingleShot(false);
@@ -90,6 +119,15 @@ FileTarget::~FileTarget()
 	// Make sure we have released our resources
 	setActive(false);
 
+	// Files that are still being opened in the background are deleted once
+	// we receive their completion signal but we will never receive it once we
+	// have been deleted. Wait for the operations to complete and process their
+	// queued signals immediately so that we don't leak the files.
+	if(!m_staleFileOps.isEmpty()) {
+		App->getAsyncIO()->waitForPending();
+		QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+	}
+
 	if(m_syncer != NULL)
 		delete m_syncer;
 }
@@ -117,21 +155,17 @@ void FileTarget::initializedEvent()
 	connect(m_syncer, &AVSynchronizer::segmentReady,
 		this, &FileTarget::segmentReady);
 
+	// MP4 and FLV files are written by our own muxers and don't need Libav
+	if(FileMuxer::isNativeFileType(m_fileType))
+		return;
+
 	// Find the Libavformat output format
 	QByteArray fmtStr;
 	switch(m_fileType) {
 	default:
-	case FileTrgtMp4Type:
-		fmtStr = QByteArrayLiteral("mp4");
-		break;
 	case FileTrgtMkvType:
 		fmtStr = QByteArrayLiteral("matroska");
 		break;
-#if 0
-	case FileTrgtFlvType:
-		fmtStr = QByteArrayLiteral("flv"); // TODO: Not tested
-		break;
-#endif // 0
 	}
 	AVOutputFormat *format = av_oformat_next(NULL);
 	while(format != NULL) {
@@ -168,23 +202,88 @@ bool FileTarget::activateEvent()
 		return false;
 
 	// Determine the filename to actually save to. We don't want to override
-	// any existing files. TODO: Make asynchronous
-	QFileInfo info = getUniqueFilename(m_filename);
-	m_actualFilename = info.filePath();
+	// any existing files. Split recordings use their own naming scheme that
+	// requires several filesystem queries so their first file is determined
+	// and opened in the background instead.
+	bool split = FileMuxer::isNativeFileType(m_fileType) &&
+		(m_splitDuration > 0 || m_splitSize > 0);
+	if(split)
+		m_actualFilename = m_filename;
+	else
+		m_actualFilename = getUniqueFilename(m_filename).filePath();
 	QByteArray cFilename = m_actualFilename.toUtf8();
 
 	appLog(LOG_CAT)
 		<< "Activating file target " << getIdString()
-		<< " with target filename \"" << info.filePath() << "\"...";
+		<< " with target filename \"" << m_actualFilename << "\"...";
 
 	// Don't trigger a filesystem query immediately
 	m_cachedFilesize = 0;
 	m_timeOfPrevSizeCalc = App->getUsecSinceExec();
 
+	// Forget the timestamps of the previous recording
+	m_segmentStartPts = 0;
+	m_lastFramePts = 0;
+
 	// Reference encoders by enabling the synchroniser
 	if(!m_syncer->setActive(true))
 		return false;
 
+	if(FileMuxer::isNativeFileType(m_fileType)) {
+		if(!activateNativeMuxer(split))
+			return false;
+	} else {
+		if(!activateLibavMuxer(cFilename))
+			return false;
+	}
+
+#if DUMP_STATS_TO_FILE
+	dumpBuffer.clear();
+	dumpBuffer.append(
+		QStringLiteral("\"PTS\",\"DTS\",\"Ex. bloat\",\"Inc. bloat\",\"Inc. avg\",\"Inc. VBV buf size\"\n"));
+	dumpFilename = m_actualFilename + ".csv";
+	dumpFrameAvg = 0.0f;
+	dumpVbvFrames.clear();
+#endif
+
+	if(m_pane != NULL)
+		m_pane->setPaneState(TargetPane::LiveState);
+	appLog(LOG_CAT) << "File target activated";
+	return true;
+}
+
+/// <summary>
+/// Opens the output file using our own MP4 or FLV muxer. The file header is
+/// written by the muxer itself once it receives the first keyframe.
+/// </summary>
+bool FileTarget::activateNativeMuxer(bool split)
+{
+	m_muxer = FileMuxer::createMuxer(
+		m_fileType, m_videoEnc, m_audioEnc, m_fragDuration);
+	if(m_muxer == NULL) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Could not create muxer for target " << getIdString();
+		m_syncer->setActive(false);
+		return false;
+	}
+	if(split) {
+		// The file is opened in `splittingBegun()`
+		beginSplitting();
+		return true;
+	}
+	if(!m_muxer->open(m_actualFilename)) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Could not open file: " << m_muxer->getLastError();
+		delete m_muxer;
+		m_muxer = NULL;
+		m_syncer->setActive(false);
+		return false;
+	}
+	return true;
+}
+
+bool FileTarget::activateLibavMuxer(const QByteArray &cFilename)
+{
 	// Create the FFmpeg context
 	int res = avformat_alloc_output_context2(
 		&m_context, m_outFormat, NULL, cFilename.data());
@@ -259,19 +358,6 @@ bool FileTarget::activateEvent()
 	// need to know what "extra data" we should use (SPS and PPS in the case of
 	// H.264 video)
 	m_wroteHeader = false;
-
-#if DUMP_STATS_TO_FILE
-	dumpBuffer.clear();
-	dumpBuffer.append(
-		QStringLiteral("\"PTS\",\"DTS\",\"Ex. bloat\",\"Inc. bloat\",\"Inc. avg\",\"Inc. VBV buf size\"\n"));
-	dumpFilename = info.filePath() + ".csv";
-	dumpFrameAvg = 0.0f;
-	dumpVbvFrames.clear();
-#endif
-
-	if(m_pane != NULL)
-		m_pane->setPaneState(TargetPane::LiveState);
-	appLog(LOG_CAT) << "File target activated";
 	return true;
 
 	// Error handling
@@ -284,9 +370,7 @@ exitActivate2:
 	avformat_free_context(m_context);
 	m_context = NULL;
 exitActivate1:
-	m_videoEnc->derefActivate();
-	if(m_audioEnc != NULL)
-		m_audioEnc->derefActivate();
+	m_syncer->setActive(false);
 	return false;
 }
 
@@ -298,6 +382,43 @@ void FileTarget::deactivateEvent()
 		return; // Never activated
 	appLog(LOG_CAT) << "Deactivating file target " << getIdString() << "...";
 
+	if(m_muxer != NULL) {
+		// Writes the file index and closes the file in the background. The
+		// last frame is displayed for a single frame period.
+		closeMuxer(m_lastFramePts + 1);
+		releaseNextSegmentFile();
+		if(m_beginOp != 0) {
+			// The first file is still being opened, delete it once it has been
+			m_staleFileOps.append(m_beginOp);
+			m_beginOp = 0;
+		}
+		m_pendingItems.clear();
+		m_segmentNum = 0;
+	} else
+		deactivateLibavMuxer();
+
+	// Dereference encoders by disabling the synchroniser
+	m_syncer->setActive(false);
+
+	if(m_pane != NULL)
+		m_pane->setPaneState(TargetPane::OfflineState);
+	appLog(LOG_CAT) << "File target deactivated";
+
+#if DUMP_STATS_TO_FILE
+	QFile dumpFile(dumpFilename);
+	appLog(Log::Critical)
+		<< "Dumping video stats to file: \"" << dumpFile.fileName()
+		<< "\" (File size: " << dumpBuffer.size() << ")";
+	if(dumpFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		dumpFile.write(dumpBuffer);
+		dumpFile.close();
+		dumpBuffer.clear();
+	}
+#endif
+}
+
+void FileTarget::deactivateLibavMuxer()
+{
 	// We only write the trailer if we wrote the header (Which is done at the
 	// first keyframe)
 	if(m_wroteHeader)
@@ -320,25 +441,7 @@ void FileTarget::deactivateEvent()
 	avformat_free_context(m_context);
 	m_context = NULL;
 
-	// Dereference encoders by disabling the synchroniser
-	m_syncer->setActive(false);
-
 	m_extraVideoData.clear();
-	if(m_pane != NULL)
-		m_pane->setPaneState(TargetPane::OfflineState);
-	appLog(LOG_CAT) << "File target deactivated";
-
-#if DUMP_STATS_TO_FILE
-	QFile dumpFile(dumpFilename);
-	appLog(Log::Critical)
-		<< "Dumping video stats to file: \"" << dumpFile.fileName()
-		<< "\" (File size: " << dumpBuffer.size() << ")";
-	if(dumpFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-		dumpFile.write(dumpBuffer);
-		dumpFile.close();
-		dumpBuffer.clear();
-	}
-#endif
 }
 
 VideoEncoder *FileTarget::getVideoEncoder() const
@@ -356,13 +459,16 @@ void FileTarget::serialize(QDataStream *stream) const
 	Target::serialize(stream);
 
 	// Write data version number
-	*stream << (quint32)0;
+	*stream << (quint32)2;
 
 	// Save our data
 	*stream << m_videoEncId;
 	*stream << m_audioEncId;
 	*stream << m_filename;
 	*stream << (quint32)m_fileType;
+	*stream << (qint32)m_fragDuration;
+	*stream << (qint32)m_splitDuration;
+	*stream << (qint32)m_splitSize;
 }
 
 bool FileTarget::unserialize(QDataStream *stream)
@@ -370,18 +476,33 @@ bool FileTarget::unserialize(QDataStream *stream)
 	if(!Target::unserialize(stream))
 		return false;
 
-	quint32 uint32Data;
+	quint32	uint32Data;
+	qint32	int32Data;
 
 	// Read data version number
 	quint32 version;
 	*stream >> version;
-	if(version == 0) {
+	if(version >= 0 && version <= 2) {
 		// Read our data
 		*stream >> m_videoEncId;
 		*stream >> m_audioEncId;
 		*stream >> m_filename;
 		*stream >> uint32Data;
 		m_fileType = (FileTrgtType)uint32Data;
+		if(version >= 1) {
+			*stream >> int32Data;
+			m_fragDuration = int32Data;
+		} else
+			m_fragDuration = DEFAULT_FILE_TARGET_FRAG_DURATION;
+		if(version >= 2) {
+			*stream >> int32Data;
+			m_splitDuration = int32Data;
+			*stream >> int32Data;
+			m_splitSize = int32Data;
+		} else {
+			m_splitDuration = 0;
+			m_splitSize = 0;
+		}
 	} else {
 		appLog(LOG_CAT, Log::Warning)
 			<< "Unknown version number in file target serialized data, "
@@ -410,7 +531,10 @@ void FileTarget::updatePaneText(bool fromTimer)
 
 	// Calculate filesize once every X seconds to limit filesystem queries
 	const quint64 FILESIZE_UPDATE_PERIOD_USEC = 15000000; // 15 seconds
-	if(isActive()) {
+	if(isActive() && m_muxer != NULL) {
+		// Our own muxers know exactly how much they have written
+		m_cachedFilesize = m_muxer->getBytesWritten();
+	} else if(isActive()) {
 		quint64 now = App->getUsecSinceExec();
 		if(now > m_timeOfPrevSizeCalc + FILESIZE_UPDATE_PERIOD_USEC) {
 			QFileInfo info(m_actualFilename);
@@ -473,8 +597,26 @@ void FileTarget::frameReady(EncodedFrame frame)
 {
 	if(!m_isActive)
 		return;
+	TraceZone zone("FileTarget::frameReady");
 	//appLog() << frame.getDebugString();
 
+	// Our own muxers handle waiting for the first keyframe themselves
+	if(m_muxer != NULL) {
+		if(m_beginOp != 0) {
+			// The first file is still being opened. Keep everything from the
+			// first keyframe onwards until it is ready.
+			if(m_pendingItems.isEmpty() && !frame.isKeyframe())
+				return;
+			FileTargetItem item;
+			item.frame = frame;
+			item.frame.makePersistent();
+			m_pendingItems.append(item);
+			return;
+		}
+		writeFrameToMuxer(frame);
+		return;
+	}
+
 	// We begin the file at the first keyframe
 	const EncodedPacketList &pkts = frame.getPackets();
 	if(!m_wroteHeader) {
@@ -575,22 +717,15 @@ void FileTarget::frameReady(EncodedFrame frame)
 	pkt.stream_index = m_videoStream->index;
 	pkt.flags = frame.isKeyframe() ? AV_PKT_FLAG_KEY : 0;
 
-	// Write the video packet to the file. While the synchroniser object does
-	// its own interleaving we still use FFmpeg's interleaving method as well
-	// just to be extra sure as the target file format might use a different
-	// interleaving system. This does use more processing power and memory
-	// copies though.
-	int res = av_interleaved_write_frame(m_context, &pkt);
+	// Write the video packet to the file. The synchroniser object already
+	// interleaves our frames and segments by timestamp so there is no need to
+	// have FFmpeg buffer and reorder them a second time.
+	int res = av_write_frame(m_context, &pkt);
 	if(res < 0) {
 		QString reason = libavErrorToString(res);
 		if(res == -28)
 			reason = tr("Out of disk space");
-		appLog(LOG_CAT, Log::Warning)
-			<< "Failed to write video stream packet: "
-			<< reason;
-		App->setStatusLabel(tr("Failed to write to file (%1)")
-			.arg(reason));
-		QTimer::singleShot(0, this, SLOT(delayedSimpleDeactivate()));
+		writeFailed(reason);
 		return;
 	}
 }
@@ -599,6 +734,21 @@ void FileTarget::segmentReady(EncodedSegment segment)
 {
 	if(!m_isActive)
 		return;
+	TraceZone zone("FileTarget::segmentReady");
+	if(m_muxer != NULL) {
+		if(m_beginOp != 0) {
+			// The first file is still being opened, see `frameReady()`
+			if(m_pendingItems.isEmpty())
+				return;
+			FileTargetItem item;
+			item.segment = segment;
+			item.segment.makePersistent();
+			m_pendingItems.append(item);
+			return;
+		}
+		writeSegmentToMuxer(segment);
+		return;
+	}
 	if(!m_wroteHeader) {
 		// Should never happen as the synchroniser object will always output a
 		// video frame before the first audio segment
@@ -612,10 +762,8 @@ void FileTarget::segmentReady(EncodedSegment segment)
 	// We must pass each packet to FFmpeg separately
 	const EncodedPacketList &pkts = segment.getPackets();
 	for(int i = 0; i < pkts.count(); i++) {
-		// We must copy the byte array to the stack otherwise the memory gets
-		// deallocated before FFmpeg can use it
-		// TODO: This doesn't make sense as we should be managing the memory
-		// ourselves through EncodedPacket?
+		// Shallow copy of the packet's data. The memory stays valid until
+		// `av_write_frame()` returns as we don't let FFmpeg buffer packets.
 		QByteArray pktData = pkts.at(i).data();
 
 		// Debugging stuff
@@ -631,32 +779,250 @@ void FileTarget::segmentReady(EncodedSegment segment)
 			segment.getPTS() + i, m_audioStream->codec->time_base,
 			m_audioStream->time_base);
 		pkt.dts = pkt.pts;
-		pkt.data = reinterpret_cast<uint8_t *>(pktData.data());
+		pkt.data = reinterpret_cast<uint8_t *>(
+			const_cast<char *>(pktData.constData()));
 		pkt.size = pktData.size();
 		pkt.stream_index = m_audioStream->index;
 		pkt.flags = 0; // No need for AV_PKT_FLAG_KEY
 
-		// Write the audio packet to the file. While the synchroniser object does
-		// its own interleaving we still use FFmpeg's interleaving method as well
-		// just to be extra sure as the target file format might use a different
-		// interleaving system. This does use more processing power and memory
-		// copies though.
-		int res = av_interleaved_write_frame(m_context, &pkt);
+		// Write the audio packet to the file. See `frameReady()` for why we
+		// don't use FFmpeg's interleaving
+		int res = av_write_frame(m_context, &pkt);
 		if(res < 0) {
 			QString reason = libavErrorToString(res);
 			if(res == -28)
 				reason = tr("Out of disk space");
-			appLog(LOG_CAT, Log::Warning)
-				<< "Failed to write video stream packet: "
-				<< reason;
-			App->setStatusLabel(tr("Failed to write to file (%1)")
-				.arg(reason));
-			QTimer::singleShot(0, this, SLOT(delayedSimpleDeactivate()));
+			writeFailed(reason);
 			return;
 		}
 	}
 }
 
+/// <summary>
+/// Writes a frame to our own muxer and splits the recording if required.
+/// Returns false if writing failed and the target is being deactivated.
+/// </summary>
+bool FileTarget::writeFrameToMuxer(const EncodedFrame &frame)
+{
+	if(m_segmentNum > 0 && shouldSplitAt(frame)) {
+		if(!splitAt(frame))
+			return false;
+	}
+	bool wroteHeader = m_muxer->hasWrittenHeader();
+	if(!m_muxer->writeFrame(frame)) {
+		writeFailed(m_muxer->getLastError());
+		return false;
+	}
+	if(!wroteHeader && m_muxer->hasWrittenHeader()) {
+		// This is the first frame of the file
+		m_segmentStartPts = frame.getPTS();
+	}
+	m_lastFramePts = qMax(m_lastFramePts, frame.getPTS());
+	return true;
+}
+
+/// <summary>
+/// Writes an audio segment to our own muxer. Returns false if writing failed
+/// and the target is being deactivated.
+/// </summary>
+bool FileTarget::writeSegmentToMuxer(const EncodedSegment &segment)
+{
+	if(!m_muxer->writeSegment(segment)) {
+		writeFailed(m_muxer->getLastError());
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Finalizes and closes the current file of our own muxer in the background
+/// as regular MP4 files write their index when they are closed which can take
+/// a noticeable amount of time. If we are splitting the recording then the
+/// file is added to the manifest once it has been closed. `endPts` is the
+/// time that the next file begins at.
+/// </summary>
+void FileTarget::closeMuxer(qint64 endPts)
+{
+	QString manifestFilename;
+	QByteArray manifestLine;
+	if(m_segmentNum > 0 && m_muxer->hasWrittenHeader()) {
+		manifestFilename = m_manifestFilename;
+		manifestLine = createManifestLine(endPts);
+	}
+
+	// `AsyncIO` takes ownership of the muxer
+	AsyncIO *asyncIo = App->getAsyncIO();
+	int id = asyncIo->newOperationId();
+	m_closeOps.append(id);
+	asyncIo->closeMuxer(id, m_muxer, manifestFilename, manifestLine);
+	m_muxer = NULL;
+
+	// Continued in `muxerClosed()`
+}
+
+/// <summary>
+/// Notifies the user that we failed to write to the file and stops recording.
+/// </summary>
+void FileTarget::writeFailed(const QString &reason)
+{
+	appLog(LOG_CAT, Log::Warning)
+		<< "Failed to write to file: " << reason;
+	App->setStatusLabel(tr("Failed to write to file (%1)").arg(reason));
+	QTimer::singleShot(0, this, SLOT(delayedSimpleDeactivate()));
+}
+
+/// <summary>
+/// Prepares the target for writing the recording to multiple files. Every
+/// file of a single recording shares the same base name followed by the
+/// number of the segment. Segments are listed in a CSV manifest file as soon
+/// as they are complete so that other applications know which files are safe
+/// to process while the recording is still in progress.
+/// </summary>
+void FileTarget::beginSplitting()
+{
+	m_segmentNum = 1;
+	m_segmentBaseName = QString();
+	m_manifestFilename = QString();
+	m_pendingItems.clear();
+
+	// Finding an unused base name and creating the manifest requires several
+	// filesystem queries so do it in the background
+	AsyncIO *asyncIo = App->getAsyncIO();
+	m_beginOp = asyncIo->newOperationId();
+	asyncIo->beginSegmentedFile(
+		m_beginOp, m_filename, FileTrgtTypeExtStrings[m_fileType],
+		QByteArrayLiteral("Segment,Filename,Start (Seconds),"
+		"Duration (Seconds),Size (Bytes)\n"));
+
+	// Continued in `splittingBegun()`
+}
+
+/// <summary>
+/// Returns true if the specified frame should be the first frame of a new
+/// file. We can only split files at keyframes.
+/// </summary>
+bool FileTarget::shouldSplitAt(const EncodedFrame &frame) const
+{
+	if(!frame.isKeyframe() || !m_muxer->hasWrittenHeader())
+		return false;
+	if(m_splitSize > 0 &&
+		m_muxer->getBytesWritten() >= (quint64)m_splitSize * 1024ULL * 1024ULL)
+	{
+		return true;
+	}
+	if(m_splitDuration > 0) {
+		Fraction timeBase = m_videoEnc->getTimeBase();
+		qint64 duration = (frame.getPTS() - m_segmentStartPts) *
+			(qint64)timeBase.numerator / (qint64)timeBase.denominator;
+		if(duration >= (qint64)m_splitDuration * 60LL)
+			return true;
+	}
+	return false;
+}
+
+/// <summary>
+/// Finishes the current file and continues the recording in the file that
+/// was opened ahead of time. The specified keyframe becomes the first frame of
+/// the new file. If the new file isn't ready yet then we continue writing to
+/// the current file and try again at the next keyframe. Returns false if
+/// writing failed and the target is being deactivated.
+/// </summary>
+bool FileTarget::splitAt(const EncodedFrame &frame)
+{
+	if(m_nextFile == NULL) {
+		// Retry if the previous attempt to open the file failed
+		if(m_nextFileOp == 0)
+			requestNextSegmentFile();
+		return true;
+	}
+
+	// Finish the current file in the background
+	closeMuxer(frame.getPTS());
+
+	// Switch to the next file. The muxer takes ownership of the file object.
+	// The new file begins at the DTS of the keyframe so that the audio that
+	// we receive after this frame isn't lost, see `Mp4FileMuxer::beginMovie()`.
+	m_muxer = FileMuxer::createMuxer(
+		m_fileType, m_videoEnc, m_audioEnc, m_fragDuration);
+	m_muxer->setContinuation(true);
+	QFile *file = m_nextFile;
+	m_nextFile = NULL;
+	if(!m_muxer->open(file)) { // Takes ownership
+		writeFailed(m_muxer->getLastError()); // Logs and stops the target
+		return false;
+	}
+	m_segmentNum++;
+	m_actualFilename = m_muxer->getFilename();
+	appLog(LOG_CAT)
+		<< "Continuing recording in file \"" << m_actualFilename << "\"";
+
+	requestNextSegmentFile();
+	return true;
+}
+
+void FileTarget::requestNextSegmentFile()
+{
+	AsyncIO *asyncIo = App->getAsyncIO();
+	m_nextFileOp = asyncIo->newOperationId();
+	asyncIo->openFileForWriting(m_nextFileOp, getSegmentFilename(
+		m_segmentBaseName, m_segmentNum + 1,
+		FileTrgtTypeExtStrings[m_fileType]));
+
+	// Continued in `nextFileOpened()`
+}
+
+/// <summary>
+/// Deletes the pre-opened file of the next segment as it will never be used.
+/// </summary>
+void FileTarget::releaseNextSegmentFile()
+{
+	if(m_nextFile != NULL) {
+		discardFile(m_nextFile);
+		m_nextFile = NULL;
+	}
+	if(m_nextFileOp != 0) {
+		// The file is still being opened, delete it once it has been
+		m_staleFileOps.append(m_nextFileOp);
+		m_nextFileOp = 0;
+	}
+}
+
+/// <summary>
+/// Returns the manifest line of the current segment without its last column
+/// which is the size of the file. The size is only known once the file has
+/// been closed and is appended by `AsyncIO::closeMuxer()`.
+/// </summary>
+QByteArray FileTarget::createManifestLine(qint64 endPts) const
+{
+	Fraction timeBase = m_videoEnc->getTimeBase();
+	double start = (double)(m_segmentStartPts * (qint64)timeBase.numerator) /
+		(double)timeBase.denominator;
+	double duration =
+		(double)((endPts - m_segmentStartPts) * (qint64)timeBase.numerator) /
+		(double)timeBase.denominator;
+	QString name = QFileInfo(m_muxer->getFilename()).fileName();
+	name.replace(QChar('"'), QStringLiteral("\"\""));
+	QString line = QStringLiteral("%1,\"%2\",%3,%4,")
+		.arg(m_segmentNum)
+		.arg(name)
+		.arg(start, 0, 'f', 3)
+		.arg(duration, 0, 'f', 3);
+	return line.toUtf8();
+}
+
+/// <summary>
+/// Closes and deletes a file that was opened in the background but is no
+/// longer needed.
+/// </summary>
+void FileTarget::discardFile(QFile *file)
+{
+	if(file == NULL)
+		return;
+	QString filename = file->fileName();
+	delete file;
+	QFile::remove(filename);
+}
+
 void FileTarget::videoEncodeError(const QString &error)
 {
 	if(!isActive())
@@ -677,3 +1043,80 @@ void FileTarget::delayedSimpleDeactivate()
 		return;
 	setActive(false);
 }
+
+void FileTarget::splittingBegun(
+	int id, int errorCode, const QString &baseName, QFile *file)
+{
+	if(m_staleFileOps.contains(id)) {
+		// We no longer need the file. The empty manifest is kept so that the
+		// base name is never reused.
+		m_staleFileOps.remove(m_staleFileOps.indexOf(id));
+		discardFile(file);
+		return;
+	}
+	if(id != m_beginOp)
+		return; // Not our operation
+	m_beginOp = 0;
+	if(file == NULL) {
+		m_pendingItems.clear();
+		writeFailed(tr("Could not create file"));
+		return;
+	}
+
+	m_segmentBaseName = baseName;
+	m_manifestFilename = getSegmentManifestFilename(baseName);
+	if(!m_muxer->open(file)) { // Takes ownership
+		m_pendingItems.clear();
+		writeFailed(m_muxer->getLastError());
+		return;
+	}
+	m_actualFilename = m_muxer->getFilename();
+	appLog(LOG_CAT)
+		<< "Recording to file \"" << m_actualFilename << "\"";
+
+	// Open the file of the next segment ahead of time so that we can switch
+	// to it without blocking
+	requestNextSegmentFile();
+
+	// Write everything that we received while the file was being opened
+	FileTargetItemList items = m_pendingItems;
+	m_pendingItems.clear();
+	for(int i = 0; i < items.count(); i++) {
+		const FileTargetItem &item = items.at(i);
+		if(item.frame.isValid()) {
+			if(!writeFrameToMuxer(item.frame))
+				return;
+		} else if(!writeSegmentToMuxer(item.segment))
+			return;
+	}
+}
+
+void FileTarget::nextFileOpened(int id, int errorCode, QFile *file)
+{
+	if(m_staleFileOps.contains(id)) {
+		// We no longer need the file
+		m_staleFileOps.remove(m_staleFileOps.indexOf(id));
+		discardFile(file);
+		return;
+	}
+	if(id != m_nextFileOp)
+		return; // Not our operation
+	m_nextFileOp = 0;
+
+	// If the file failed to open then we will try again at the next split
+	m_nextFile = file;
+}
+
+void FileTarget::muxerClosed(int id, int errorCode, const QString &error)
+{
+	int index = m_closeOps.indexOf(id);
+	if(index < 0)
+		return; // Not our operation
+	m_closeOps.remove(index);
+	if(errorCode == 0)
+		return;
+
+	// The recording itself continues in the next file if there is one. The
+	// error has already been logged.
+	App->setStatusLabel(tr("Failed to finalize file (%1)").arg(error));
+}
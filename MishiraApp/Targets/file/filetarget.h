@@ -27,6 +27,18 @@ struct AVFormatContext;
 struct AVOutputFormat;
 struct AVStream;
 class AVSynchronizer; // Not a part of FFmpeg, it's our own class
+class FileMuxer;
+class QFile;
+
+/// <summary>
+/// A frame or segment that was received before the file that it belongs to
+/// was ready. Only one of the two is valid.
+/// </summary>
+struct FileTargetItem {
+	EncodedFrame	frame;
+	EncodedSegment	segment;
+};
+typedef QVector<FileTargetItem> FileTargetItemList;
 
 //=============================================================================
 class FileTarget : public Target
@@ -43,7 +55,23 @@ protected: // Members ---------------------------------------------------------
 	quint64				m_timeOfPrevSizeCalc;
 	QString				m_actualFilename;
 
-	// FFmpeg
+	// Native muxer (MP4 and FLV)
+	FileMuxer *			m_muxer;
+
+	// File splitting (Native muxer only)
+	int					m_segmentNum; // 1-based, 0 = Not splitting
+	qint64				m_segmentStartPts;
+	qint64				m_lastFramePts;
+	QString				m_segmentBaseName; // Full path without extension
+	QString				m_manifestFilename;
+	int					m_beginOp; // `AsyncIO` operation ID
+	FileTargetItemList	m_pendingItems; // Received before the first file
+	QFile *				m_nextFile; // Pre-opened file of the next segment
+	int					m_nextFileOp; // `AsyncIO` operation ID
+	QVector<int>		m_staleFileOps;
+	QVector<int>		m_closeOps;
+
+	// FFmpeg (All other formats)
 	AVOutputFormat *	m_outFormat;
 	AVFormatContext *	m_context;
 	AVStream *			m_videoStream;
@@ -56,6 +84,9 @@ protected: // Members ---------------------------------------------------------
 	quint32				m_audioEncId;
 	QString				m_filename;
 	FileTrgtType		m_fileType;
+	int					m_fragDuration;
+	int					m_splitDuration;
+	int					m_splitSize;
 
 public: // Constructor/destructor ---------------------------------------------
 	FileTarget(
@@ -65,9 +96,26 @@ public: // Constructor/destructor ---------------------------------------------
 public: // Methods ------------------------------------------------------------
 	QString			getFilename() const;
 	FileTrgtType	getFileType() const;
+	int				getFragDuration() const;
+	int				getSplitDuration() const;
+	int				getSplitSize() const;
 
 private:
 	void			updatePaneText(bool fromTimer);
+	bool			activateNativeMuxer(bool split);
+	bool			activateLibavMuxer(const QByteArray &cFilename);
+	void			deactivateLibavMuxer();
+	bool			writeFrameToMuxer(const EncodedFrame &frame);
+	bool			writeSegmentToMuxer(const EncodedSegment &segment);
+	void			closeMuxer(qint64 endPts);
+	void			writeFailed(const QString &reason);
+	void			beginSplitting();
+	bool			shouldSplitAt(const EncodedFrame &frame) const;
+	bool			splitAt(const EncodedFrame &frame);
+	void			requestNextSegmentFile();
+	void			releaseNextSegmentFile();
+	QByteArray		createManifestLine(qint64 endPts) const;
+	static void		discardFile(QFile *file);
 
 private: // Interface ---------------------------------------------------------
 	virtual void	initializedEvent();
@@ -96,6 +144,10 @@ Q_SLOTS: // Slots -------------------------------------------------------------
 	private
 Q_SLOTS:
 	void			delayedSimpleDeactivate();
+	void			splittingBegun(
+		int id, int errorCode, const QString &baseName, QFile *file);
+	void			nextFileOpened(int id, int errorCode, QFile *file);
+	void			muxerClosed(int id, int errorCode, const QString &error);
 };
 //=============================================================================
 
@@ -109,4 +161,19 @@ inline FileTrgtType FileTarget::getFileType() const
 	return m_fileType;
 }
 
+inline int FileTarget::getFragDuration() const
+{
+	return m_fragDuration;
+}
+
+inline int FileTarget::getSplitDuration() const
+{
+	return m_splitDuration;
+}
+
+inline int FileTarget::getSplitSize() const
+{
+	return m_splitSize;
+}
+
 #endif // FILETARGET_H
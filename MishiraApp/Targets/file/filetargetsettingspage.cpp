@@ -17,6 +17,7 @@
 
 #include "filetargetsettingspage.h"
 #include "common.h"
+#include "filemuxer.h"
 #include "validators.h"
 #include "wizardwindow.h"
 #include <QtCore/QDir>
@@ -83,6 +84,10 @@ void FileTargetSettingsPage::sharedReset(
 	m_ui.nameEdit->setText(defaults->name);
 	m_ui.fileTypeCombo->setCurrentIndex(defaults->fileType);
 	m_ui.filenameEdit->setText(defaults->fileFilename);
+	m_ui.fragDurationBox->setValue(defaults->fileFragDuration);
+	m_ui.splitDurationBox->setValue(defaults->fileSplitDuration);
+	m_ui.splitSizeBox->setValue(defaults->fileSplitSize);
+	updateOptionsEnabled();
 
 	// Reset validity and connect signal
 	doQLineEditValidate(m_ui.nameEdit);
@@ -105,6 +110,9 @@ void FileTargetSettingsPage::sharedNext(WizTargetSettings *settings)
 	settings->fileType =
 		(FileTrgtType)(m_ui.fileTypeCombo->currentIndex());
 	settings->fileFilename = m_ui.filenameEdit->text();
+	settings->fileFragDuration = m_ui.fragDurationBox->value();
+	settings->fileSplitDuration = m_ui.splitDurationBox->value();
+	settings->fileSplitSize = m_ui.splitSizeBox->value();
 }
 
 void FileTargetSettingsPage::updateFilterList()
@@ -125,6 +133,23 @@ void FileTargetSettingsPage::updateFilterList()
 #endif // 0
 }
 
+/// <summary>
+/// Disables the options that are not supported by the selected file type. The
+/// fragment length is only used by fragmented files and splitting is only
+/// supported by the file types that we write ourselves.
+/// </summary>
+void FileTargetSettingsPage::updateOptionsEnabled()
+{
+	FileTrgtType type = (FileTrgtType)(m_ui.fileTypeCombo->currentIndex());
+	bool enabled = (type == FileTrgtFragMp4Type);
+	m_ui.fragDurationLbl->setEnabled(enabled);
+	m_ui.fragDurationBox->setEnabled(enabled);
+	enabled = FileMuxer::isNativeFileType(type);
+	m_ui.splitLbl->setEnabled(enabled);
+	m_ui.splitDurationBox->setEnabled(enabled);
+	m_ui.splitSizeBox->setEnabled(enabled);
+}
+
 void FileTargetSettingsPage::nameEditChanged(const QString &text)
 {
 	doQLineEditValidate(m_ui.nameEdit);
@@ -146,6 +171,8 @@ void FileTargetSettingsPage::fileTypeChanged(int index)
 
 	// Update file select dialog filter
 	updateFilterList();
+
+	updateOptionsEnabled();
 }
 
 void FileTargetSettingsPage::filenameEditChanged(const QString &text)
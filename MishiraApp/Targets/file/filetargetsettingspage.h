@@ -46,6 +46,7 @@ public: // Methods ------------------------------------------------------------
 
 private:
 	void	updateFilterList();
+	void	updateOptionsEnabled();
 
 Q_SIGNALS: // Signals ---------------------------------------------------------
 	void	validityMaybeChanged(bool isValid);
@@ -0,0 +1,320 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "flvfilemuxer.h"
+#include "constants.h"
+#include <QtCore/QtEndian>
+
+// FLV tag types
+const quint8 FLV_AUDIO_TAG = 8;
+const quint8 FLV_VIDEO_TAG = 9;
+const quint8 FLV_SCRIPT_TAG = 18;
+
+const int FLV_TAG_HEADER_SIZE = 11;
+
+// AMF0 type markers
+const quint8 AMF0_NUMBER = 0x00;
+const quint8 AMF0_BOOLEAN = 0x01;
+const quint8 AMF0_STRING = 0x02;
+const quint8 AMF0_ECMA_ARRAY = 0x08;
+const quint8 AMF0_OBJECT_END = 0x09;
+
+FlvFileMuxer::FlvFileMuxer(VideoEncoder *vEnc, AudioEncoder *aEnc)
+	: FileMuxer(vEnc, aEnc)
+	, m_videoDtsOrigin(0)
+	, m_durationPos(0)
+	, m_filesizePos(0)
+	, m_lastTimestamp(0)
+{
+}
+
+FlvFileMuxer::~FlvFileMuxer()
+{
+}
+
+bool FlvFileMuxer::writeTagHeader(
+	quint8 type, int dataSize, quint32 timestamp)
+{
+	if(!writeUInt8(type))
+		return false;
+	if(!writeUInt24(dataSize))
+		return false;
+	if(!writeUInt24(timestamp & 0x00FFFFFF))
+		return false;
+	if(!writeUInt8((timestamp >> 24) & 0xFF)) // TimestampExtended
+		return false;
+	if(!writeUInt24(0)) // StreamID
+		return false;
+	if(timestamp > m_lastTimestamp)
+		m_lastTimestamp = timestamp;
+	return true;
+}
+
+bool FlvFileMuxer::writeTagFooter(int dataSize)
+{
+	return writeUInt32(FLV_TAG_HEADER_SIZE + dataSize); // PreviousTagSize
+}
+
+/// <summary>
+/// Returns the FLV timestamp of a video frame in milliseconds. FLV timestamps
+/// cannot be negative so everything is relative to the DTS of the first frame
+/// in the file. Audio is offset by the same amount to maintain sync.
+/// </summary>
+quint32 FlvFileMuxer::calcVideoTimestamp(qint64 dts) const
+{
+	Fraction timeBase = m_info.videoTimeBase;
+	return (quint64)(dts - m_videoDtsOrigin) * 1000ULL *
+		(quint64)timeBase.numerator / (quint64)timeBase.denominator;
+}
+
+/// <summary>
+/// Returns the FLV timestamp of an audio packet in milliseconds. Packets that
+/// have a negative timestamp were recorded before the file began and should
+/// not be written.
+/// </summary>
+qint64 FlvFileMuxer::calcAudioTimestamp(qint64 pts) const
+{
+	Fraction vTimeBase = m_info.videoTimeBase;
+	Fraction aTimeBase = m_info.audioTimeBase;
+	qint64 origin = m_videoDtsOrigin * 1000LL *
+		(qint64)vTimeBase.numerator / (qint64)vTimeBase.denominator;
+	return pts * 1000LL * (qint64)aTimeBase.numerator /
+		(qint64)aTimeBase.denominator - origin;
+}
+
+void FlvFileMuxer::appendAmfString(
+	QByteArray &buf, const QByteArray &str) const
+{
+	appendUInt8(buf, AMF0_STRING);
+	appendUInt16(buf, str.size());
+	buf.append(str);
+}
+
+void FlvFileMuxer::appendAmfNumber(QByteArray &buf, double val) const
+{
+	quint64 bits;
+	memcpy(&bits, &val, sizeof(bits));
+	appendUInt8(buf, AMF0_NUMBER);
+	appendUInt64(buf, bits);
+}
+
+void FlvFileMuxer::appendAmfBool(QByteArray &buf, bool val) const
+{
+	appendUInt8(buf, AMF0_BOOLEAN);
+	appendUInt8(buf, val ? 1 : 0);
+}
+
+/// <summary>
+/// Appends the name of an ECMA array property. The value must be appended
+/// immediately afterwards.
+/// </summary>
+void FlvFileMuxer::appendAmfProperty(QByteArray &buf, const char *name) const
+{
+	int len = (int)strlen(name);
+	appendUInt16(buf, len);
+	buf.append(name, len);
+}
+
+bool FlvFileMuxer::writeHeaderEvent(const EncodedFrame &firstFrame)
+{
+	QByteArray sps, pps;
+	if(!findParameterSets(firstFrame, &sps, &pps))
+		return setError(QStringLiteral("Cannot find SPS and PPS NAL units"));
+	m_videoDtsOrigin = firstFrame.getDTS();
+	m_lastTimestamp = 0;
+
+	//-------------------------------------------------------------------------
+	// File header
+
+	char header[9] = { 'F', 'L', 'V', 0x01, 0x01, 0x00, 0x00, 0x00, 0x09 };
+	if(m_info.hasAudio)
+		header[4] |= 0x04; // Has audio
+	if(!writeData(header, sizeof(header)))
+		return false;
+	if(!writeUInt32(0)) // PreviousTagSize0
+		return false;
+
+	//-------------------------------------------------------------------------
+	// "onMetaData" script tag. The duration and filesize are unknown until
+	// the file is complete so we remember where they are.
+
+	QByteArray meta;
+	appendAmfString(meta, QByteArrayLiteral("onMetaData"));
+	appendUInt8(meta, AMF0_ECMA_ARRAY);
+	appendUInt32(meta, 0); // Approximate count, unused by most readers
+	appendAmfProperty(meta, "duration");
+	int durationOff = meta.size();
+	appendAmfNumber(meta, 0.0);
+	appendAmfProperty(meta, "filesize");
+	int filesizeOff = meta.size();
+	appendAmfNumber(meta, 0.0);
+	appendAmfProperty(meta, "width");
+	appendAmfNumber(meta, (double)m_info.videoSize.width());
+	appendAmfProperty(meta, "height");
+	appendAmfNumber(meta, (double)m_info.videoSize.height());
+	appendAmfProperty(meta, "framerate");
+	appendAmfNumber(meta, (double)m_info.videoFramerate.asFloat());
+	appendAmfProperty(meta, "videocodecid");
+	appendAmfNumber(meta, 7.0); // AVC
+	if(m_info.videoBitrate > 0) {
+		appendAmfProperty(meta, "videodatarate");
+		appendAmfNumber(meta, (double)m_info.videoBitrate);
+	}
+	if(m_info.hasAudio) {
+		appendAmfProperty(meta, "audiocodecid");
+		appendAmfNumber(meta, 10.0); // AAC
+		appendAmfProperty(meta, "audiosamplerate");
+		appendAmfNumber(meta, (double)m_info.audioSampleRate);
+		appendAmfProperty(meta, "audiosamplesize");
+		appendAmfNumber(meta, 16.0);
+		appendAmfProperty(meta, "stereo");
+		appendAmfBool(meta, m_info.audioNumChannels == 2);
+		if(m_info.audioBitrate > 0) {
+			appendAmfProperty(meta, "audiodatarate");
+			appendAmfNumber(meta, (double)m_info.audioBitrate);
+		}
+	}
+	appendAmfProperty(meta, "encoder");
+	appendAmfString(meta,
+		QStringLiteral("%1/%2").arg(APP_NAME).arg(APP_VER_STR).toUtf8());
+	appendUInt16(meta, 0); // Empty property name
+	appendUInt8(meta, AMF0_OBJECT_END);
+
+	if(!writeTagHeader(FLV_SCRIPT_TAG, meta.size(), 0))
+		return false;
+	m_durationPos = (qint64)m_bytesWritten + durationOff + 1;
+	m_filesizePos = (qint64)m_bytesWritten + filesizeOff + 1;
+	if(!writeData(meta))
+		return false;
+	if(!writeTagFooter(meta.size()))
+		return false;
+
+	//-------------------------------------------------------------------------
+	// AVC sequence header
+
+	QByteArray avcc = createAvcConfigRecord(sps, pps);
+	int dataSize = 5 + avcc.size();
+	if(!writeTagHeader(FLV_VIDEO_TAG, dataSize, 0))
+		return false;
+	if(!writeUInt8(0x17)) // AVC keyframe
+		return false;
+	if(!writeUInt8(0x00)) // AVC sequence header
+		return false;
+	if(!writeUInt24(0)) // Composition time
+		return false;
+	if(!writeData(avcc))
+		return false;
+	if(!writeTagFooter(dataSize))
+		return false;
+
+	//-------------------------------------------------------------------------
+	// AAC sequence header
+
+	if(m_info.hasAudio) {
+		QByteArray oob = m_info.audioOutOfBand;
+		dataSize = 2 + oob.size();
+		if(!writeTagHeader(FLV_AUDIO_TAG, dataSize, 0))
+			return false;
+		if(!writeUInt8(0xAF)) // AAC, 44 kHz, 16-bit, stereo (Constant)
+			return false;
+		if(!writeUInt8(0x00)) // AAC sequence header
+			return false;
+		if(!writeData(oob))
+			return false;
+		if(!writeTagFooter(dataSize))
+			return false;
+	}
+
+	return true;
+}
+
+bool FlvFileMuxer::writeFrameEvent(const EncodedFrame &frame)
+{
+	// Composition time = PTS - DTS in msec
+	Fraction timeBase = m_info.videoTimeBase;
+	quint32 cts = (quint64)(frame.getPTS() - frame.getDTS()) *
+		(quint64)timeBase.numerator * 1000ULL /
+		(quint64)timeBase.denominator;
+
+	int dataSize = 5 + calcAvccFrameSize(frame);
+	if(!writeTagHeader(
+		FLV_VIDEO_TAG, dataSize, calcVideoTimestamp(frame.getDTS())))
+	{
+		return false;
+	}
+	if(!writeUInt8(frame.isKeyframe() ? 0x17 : 0x27))
+		return false;
+	if(!writeUInt8(0x01)) // AVC NALU
+		return false;
+	if(!writeUInt24(cts))
+		return false;
+	if(!writeAvccFrame(frame))
+		return false;
+	return writeTagFooter(dataSize);
+}
+
+bool FlvFileMuxer::writeSegmentEvent(const EncodedSegment &segment)
+{
+	// Every packet in the segment is a separate AAC frame with its own tag
+	const EncodedPacketList &pkts = segment.getPackets();
+	for(int i = 0; i < pkts.count(); i++) {
+		qint64 timestamp = calcAudioTimestamp(segment.getPTS() + i);
+		if(timestamp < 0)
+			continue; // Before the start of the file
+		QByteArray data = pkts.at(i).data(); // Shallow copy
+		int dataSize = 2 + data.size();
+		if(!writeTagHeader(FLV_AUDIO_TAG, dataSize, (quint32)timestamp))
+			return false;
+		if(!writeUInt8(0xAF))
+			return false;
+		if(!writeUInt8(0x01)) // AAC raw
+			return false;
+		if(!writeData(data))
+			return false;
+		if(!writeTagFooter(dataSize))
+			return false;
+	}
+	return true;
+}
+
+bool FlvFileMuxer::finalizeEvent()
+{
+	// Patch the "onMetaData" duration and filesize values now that we know
+	// what they are
+	double duration = (double)m_lastTimestamp / 1000.0;
+	double filesize = (double)m_bytesWritten;
+	quint64 bits;
+	uchar buf[8];
+
+	memcpy(&bits, &duration, sizeof(bits));
+	qToBigEndian<quint64>(bits, buf);
+	if(!overwriteAt(m_durationPos,
+		QByteArray(reinterpret_cast<const char *>(buf), sizeof(buf))))
+	{
+		return false;
+	}
+
+	memcpy(&bits, &filesize, sizeof(bits));
+	qToBigEndian<quint64>(bits, buf);
+	if(!overwriteAt(m_filesizePos,
+		QByteArray(reinterpret_cast<const char *>(buf), sizeof(buf))))
+	{
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,59 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef FLVFILEMUXER_H
+#define FLVFILEMUXER_H
+
+#include "filemuxer.h"
+
+//=============================================================================
+/// <summary>
+/// Writes H.264 and AAC to an Adobe Flash Video (FLV) file. FLV has no index
+/// so the only state that we need to keep is the location of the
+/// "onMetaData" values that are patched once the file is complete.
+/// </summary>
+class FlvFileMuxer : public FileMuxer
+{
+protected: // Members ---------------------------------------------------------
+	qint64	m_videoDtsOrigin;
+	qint64	m_durationPos; // File position of "duration" value
+	qint64	m_filesizePos; // File position of "filesize" value
+	quint32	m_lastTimestamp; // Milliseconds
+
+public: // Constructor/destructor ---------------------------------------------
+	FlvFileMuxer(VideoEncoder *vEnc, AudioEncoder *aEnc);
+	virtual ~FlvFileMuxer();
+
+private: // Methods -----------------------------------------------------------
+	bool	writeTagHeader(quint8 type, int dataSize, quint32 timestamp);
+	bool	writeTagFooter(int dataSize);
+	quint32	calcVideoTimestamp(qint64 dts) const;
+	qint64	calcAudioTimestamp(qint64 pts) const;
+	void	appendAmfString(QByteArray &buf, const QByteArray &str) const;
+	void	appendAmfNumber(QByteArray &buf, double val) const;
+	void	appendAmfBool(QByteArray &buf, bool val) const;
+	void	appendAmfProperty(QByteArray &buf, const char *name) const;
+
+private: // Interface ---------------------------------------------------------
+	virtual bool	writeHeaderEvent(const EncodedFrame &firstFrame);
+	virtual bool	writeFrameEvent(const EncodedFrame &frame);
+	virtual bool	writeSegmentEvent(const EncodedSegment &segment);
+	virtual bool	finalizeEvent();
+};
+//=============================================================================
+
+#endif // FLVFILEMUXER_H
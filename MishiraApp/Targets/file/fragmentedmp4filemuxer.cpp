@@ -0,0 +1,346 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "fragmentedmp4filemuxer.h"
+#include "application.h"
+#include "asyncio.h"
+#include <QtCore/QtEndian>
+
+// "trun" sample flags
+const quint32 SAMPLE_FLAGS_SYNC = 0x02000000; // Depends on no other sample
+const quint32 SAMPLE_FLAGS_NON_SYNC = 0x01010000; // Depends on others
+
+static void patchUInt32(QByteArray &buf, int pos, quint32 val)
+{
+	qToBigEndian<quint32>(val, reinterpret_cast<uchar *>(buf.data() + pos));
+}
+
+FragmentedMp4FileMuxer::FragmentedMp4FileMuxer(
+	VideoEncoder *vEnc, AudioEncoder *aEnc, int fragDurationSecs)
+	: Mp4FileMuxer(vEnc, aEnc)
+	, m_fragDuration(0)
+	, m_seqNum(1)
+	, m_mehdPos(0)
+	, m_fragFrames()
+	, m_fragSegments()
+	, m_fragStartTime(0)
+	, m_videoEndTime(0)
+	, m_audioEndTime(0)
+{
+	// The video track timescale is the denominator of the encoder time base
+	m_fragDuration = (quint64)qMax(1, fragDurationSecs) *
+		(quint64)m_info.videoTimeBase.denominator;
+}
+
+FragmentedMp4FileMuxer::~FragmentedMp4FileMuxer()
+{
+}
+
+/// <summary>
+/// Writes the current fragment to the file and flushes it to disk.
+/// `nextVideoTime` is the decode time of the first video frame of the next
+/// fragment and is used to calculate the duration of the last frame.
+/// </summary>
+bool FragmentedMp4FileMuxer::writeFragment(quint64 nextVideoTime)
+{
+	if(m_fragFrames.isEmpty())
+		return true;
+
+	// Build the movie fragment box. The data offsets are relative to the
+	// beginning of the "moof" box and are patched once we know its size.
+	QByteArray moof;
+	int moofPos = beginBox(moof, "moof");
+	int box = beginFullBox(moof, "mfhd", 0, 0);
+	appendUInt32(moof, m_seqNum++); // sequence_number
+	endBox(moof, box);
+	int videoOffsetPos = 0;
+	int audioOffsetPos = 0;
+	quint64 videoSize =
+		appendVideoTrafBox(moof, nextVideoTime, &videoOffsetPos);
+	quint64 audioSize = 0;
+	if(!m_fragSegments.isEmpty())
+		audioSize = appendAudioTrafBox(moof, &audioOffsetPos);
+	endBox(moof, moofPos);
+
+	// Only use a 64-bit media data box size if we actually need it
+	quint64 mdatSize = 8 + videoSize + audioSize;
+	bool useLargeSize = mdatSize > 0xFFFFFFFFULL;
+	if(useLargeSize)
+		mdatSize += 8;
+	int dataOffset = moof.size() + (useLargeSize ? 16 : 8);
+	patchUInt32(moof, videoOffsetPos, dataOffset);
+	if(!m_fragSegments.isEmpty())
+		patchUInt32(moof, audioOffsetPos, dataOffset + (quint32)videoSize);
+
+	// Media data box header
+	if(useLargeSize) {
+		appendUInt32(moof, 1); // 1 = Use "largesize"
+		appendFourCC(moof, "mdat");
+		appendUInt64(moof, mdatSize);
+	} else {
+		appendUInt32(moof, (quint32)mdatSize);
+		appendFourCC(moof, "mdat");
+	}
+	if(!writeData(moof))
+		return false;
+
+	// Write the samples directly from the packet memory
+	for(int i = 0; i < m_fragFrames.count(); i++) {
+		if(!writeAvccFrame(m_fragFrames.at(i)))
+			return false;
+	}
+	for(int i = 0; i < m_fragSegments.count(); i++) {
+		const EncodedPacketList &pkts = m_fragSegments.at(i).getPackets();
+		for(int j = 0; j < pkts.count(); j++) {
+			if(!writeData(pkts.at(j).data()))
+				return false;
+		}
+	}
+
+	// Remember where each track ended for the "mehd" box
+	m_videoEndTime = nextVideoTime;
+	if(!m_fragSegments.isEmpty()) {
+		const EncodedSegment &last = m_fragSegments.last();
+		m_audioEndTime = (quint64)calcAudioDecodeTime(
+			last.getPTS() + last.getPackets().count());
+	}
+
+	m_fragFrames.clear();
+	m_fragSegments.clear();
+
+	// Make sure that the fragment is actually on disk so that it is playable
+	// even if we crash or lose power before the next fragment is complete.
+	// Syncing can take a long time so it's done in the background.
+	if(!flush())
+		return false;
+	App->getAsyncIO()->syncFileToDisk(m_file);
+	return true;
+}
+
+/// <summary>
+/// Appends the track fragment box of the video track and returns the total
+/// size of the video samples in the fragment.
+/// </summary>
+quint64 FragmentedMp4FileMuxer::appendVideoTrafBox(
+	QByteArray &buf, quint64 nextVideoTime, int *dataOffsetPos) const
+{
+	Fraction timeBase = m_info.videoTimeBase;
+	int traf = beginBox(buf, "traf");
+
+	int box = beginFullBox(buf, "tfhd", 0, 0x020000); // default-base-is-moof
+	appendUInt32(buf, m_video.trackId);
+	endBox(buf, box);
+
+	quint64 baseTime = calcVideoDecodeTime(m_fragFrames.first().getDTS());
+	box = beginFullBox(buf, "tfdt", 1, 0);
+	appendUInt64(buf, baseTime); // baseMediaDecodeTime
+	endBox(buf, box);
+
+	// Data offset, duration, size, flags and composition time offset present
+	box = beginFullBox(buf, "trun", 0, 0x000F01);
+	appendUInt32(buf, m_fragFrames.count()); // sample_count
+	*dataOffsetPos = buf.size();
+	appendUInt32(buf, 0); // data_offset, patched later
+	quint64 totalSize = 0;
+	for(int i = 0; i < m_fragFrames.count(); i++) {
+		const EncodedFrame &frame = m_fragFrames.at(i);
+		quint64 time = calcVideoDecodeTime(frame.getDTS());
+		quint64 nextTime = nextVideoTime;
+		if(i + 1 < m_fragFrames.count())
+			nextTime = calcVideoDecodeTime(m_fragFrames.at(i + 1).getDTS());
+		quint32 delta = 1;
+		if(nextTime > time)
+			delta = (quint32)(nextTime - time);
+		int size = calcAvccFrameSize(frame);
+		totalSize += size;
+
+		appendUInt32(buf, delta); // sample_duration
+		appendUInt32(buf, size); // sample_size
+		appendUInt32(buf, frame.isKeyframe()
+			? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC); // sample_flags
+		appendUInt32(buf, (quint32)((frame.getPTS() - frame.getDTS()) *
+			(qint64)timeBase.numerator)); // sample_composition_time_offset
+	}
+	endBox(buf, box);
+
+	endBox(buf, traf);
+	return totalSize;
+}
+
+/// <summary>
+/// Appends the track fragment box of the audio track and returns the total
+/// size of the audio samples in the fragment. The duration and flags of each
+/// sample are constant and are taken from the "trex" box.
+/// </summary>
+quint64 FragmentedMp4FileMuxer::appendAudioTrafBox(
+	QByteArray &buf, int *dataOffsetPos) const
+{
+	int traf = beginBox(buf, "traf");
+
+	int box = beginFullBox(buf, "tfhd", 0, 0x020000); // default-base-is-moof
+	appendUInt32(buf, m_audio.trackId);
+	endBox(buf, box);
+
+	quint64 baseTime =
+		(quint64)calcAudioDecodeTime(m_fragSegments.first().getPTS());
+	box = beginFullBox(buf, "tfdt", 1, 0);
+	appendUInt64(buf, baseTime); // baseMediaDecodeTime
+	endBox(buf, box);
+
+	quint32 numSamples = 0;
+	for(int i = 0; i < m_fragSegments.count(); i++)
+		numSamples += m_fragSegments.at(i).getPackets().count();
+
+	// Data offset and size present
+	box = beginFullBox(buf, "trun", 0, 0x000201);
+	appendUInt32(buf, numSamples); // sample_count
+	*dataOffsetPos = buf.size();
+	appendUInt32(buf, 0); // data_offset, patched later
+	quint64 totalSize = 0;
+	for(int i = 0; i < m_fragSegments.count(); i++) {
+		const EncodedPacketList &pkts = m_fragSegments.at(i).getPackets();
+		for(int j = 0; j < pkts.count(); j++) {
+			int size = pkts.at(j).data().size();
+			totalSize += size;
+			appendUInt32(buf, size); // sample_size
+		}
+	}
+	endBox(buf, box);
+
+	endBox(buf, traf);
+	return totalSize;
+}
+
+void FragmentedMp4FileMuxer::appendMovieExtends(QByteArray &buf) const
+{
+	int mvex = beginBox(buf, "mvex");
+
+	// Total duration of the movie, patched when the file is finalized. We
+	// remember the position of the duration relative to the start of the
+	// buffer, `writeHeaderEvent()` converts it into a file position.
+	int box = beginFullBox(buf, "mehd", 1, 0);
+	m_mehdPos = buf.size();
+	appendUInt64(buf, 0); // fragment_duration
+	endBox(buf, box);
+
+	// Track defaults
+	const Track *tracks[2] = { &m_video, &m_audio };
+	int numTracks = (m_info.hasAudio) ? 2 : 1;
+	for(int i = 0; i < numTracks; i++) {
+		const Track *track = tracks[i];
+		box = beginFullBox(buf, "trex", 0, 0);
+		appendUInt32(buf, track->trackId);
+		appendUInt32(buf, 1); // default_sample_description_index
+		appendUInt32(buf, track->defaultDelta); // default_sample_duration
+		appendUInt32(buf, 0); // default_sample_size
+		appendUInt32(buf, track->isVideo
+			? SAMPLE_FLAGS_NON_SYNC : SAMPLE_FLAGS_SYNC); // default_sample_flags
+		endBox(buf, box);
+	}
+
+	endBox(buf, mvex);
+}
+
+//-----------------------------------------------------------------------------
+// Interface
+
+bool FragmentedMp4FileMuxer::writeHeaderEvent(const EncodedFrame &firstFrame)
+{
+	if(!beginMovie(firstFrame))
+		return false;
+	m_seqNum = 1;
+	m_fragFrames.clear();
+	m_fragSegments.clear();
+	m_fragStartTime = 0;
+	m_videoEndTime = 0;
+	m_audioEndTime = 0;
+
+	// File type. The "iso6" brand signals that the file is fragmented.
+	QByteArray header;
+	int box = beginBox(header, "ftyp");
+	appendFourCC(header, "iso6"); // major_brand
+	appendUInt32(header, 0x200); // minor_version
+	appendFourCC(header, "iso6"); // compatible_brands
+	appendFourCC(header, "isom");
+	appendFourCC(header, "avc1");
+	appendFourCC(header, "mp41");
+	endBox(header, box);
+
+	// Movie box with empty sample tables
+	appendMoovBox(header);
+	m_mehdPos += (qint64)m_bytesWritten;
+
+	if(!writeData(header))
+		return false;
+	return flush();
+}
+
+bool FragmentedMp4FileMuxer::writeFrameEvent(const EncodedFrame &frame)
+{
+	// Fragments always begin with a keyframe once they are long enough
+	quint64 time = calcVideoDecodeTime(frame.getDTS());
+	if(frame.isKeyframe() && !m_fragFrames.isEmpty() &&
+		time >= m_fragStartTime + m_fragDuration)
+	{
+		if(!writeFragment(time))
+			return false;
+	}
+	if(m_fragFrames.isEmpty())
+		m_fragStartTime = time;
+	m_fragFrames.append(frame);
+	return true;
+}
+
+bool FragmentedMp4FileMuxer::writeSegmentEvent(const EncodedSegment &segment)
+{
+	// The synchroniser always outputs a video frame first so we will always
+	// have an open fragment. Segments that begin before the first video frame
+	// of the file are discarded as they were recorded before the file began.
+	if(calcAudioDecodeTime(segment.getPTS()) < 0)
+		return true;
+	m_fragSegments.append(segment);
+	return true;
+}
+
+bool FragmentedMp4FileMuxer::finalizeEvent()
+{
+	// Write the remaining samples. The last frame has no following frame so
+	// we assume that it is displayed for a single frame period.
+	if(!m_fragFrames.isEmpty()) {
+		quint64 nextTime = calcVideoDecodeTime(m_fragFrames.last().getDTS()) +
+			m_video.defaultDelta;
+		if(!writeFragment(nextTime))
+			return false;
+	}
+
+	// Patch the total movie duration so that players don't need to scan
+	// every fragment to display it
+	quint64 videoTime = m_videoEndTime;
+	if(m_video.mediaTime > 0)
+		videoTime -= qMin<quint64>(videoTime, m_video.mediaTime);
+	quint64 duration = videoTime * MOVIE_TIMESCALE / m_video.timescale;
+	if(m_info.hasAudio) {
+		duration = qMax(duration,
+			m_audioEndTime * MOVIE_TIMESCALE / m_audio.timescale);
+	}
+	QByteArray data;
+	appendUInt64(data, duration);
+	if(!overwriteAt(m_mehdPos, data) || !flush())
+		return false;
+	App->getAsyncIO()->syncFileToDisk(m_file);
+	return true;
+}
@@ -0,0 +1,74 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef FRAGMENTEDMP4FILEMUXER_H
+#define FRAGMENTEDMP4FILEMUXER_H
+
+#include "mp4filemuxer.h"
+
+//=============================================================================
+/// <summary>
+/// Writes H.264 and AAC to a fragmented MPEG-4 file. The "moov" box only
+/// describes the tracks and is written at the very beginning of the file. The
+/// samples are then written in self-contained "moof"/"mdat" pairs that always
+/// begin with a video keyframe.
+///
+/// Each fragment is synced to disk as soon as it is complete so if the
+/// application crashes or the system loses power the file is still playable
+/// up until the last complete fragment. As we only ever keep the index of
+/// the current fragment in memory the memory usage doesn't grow with the
+/// length of the recording and closing the file doesn't require writing a
+/// large index.
+/// </summary>
+class FragmentedMp4FileMuxer : public Mp4FileMuxer
+{
+protected: // Members ---------------------------------------------------------
+	quint64					m_fragDuration; // In video track timescale
+	quint32					m_seqNum;
+	mutable qint64			m_mehdPos; // File position of "mehd" duration
+
+	// Current fragment
+	EncodedFrameList		m_fragFrames;
+	QVector<EncodedSegment>	m_fragSegments;
+	quint64					m_fragStartTime; // In video track timescale
+
+	// End of the last written sample of each track in its own timescale
+	quint64					m_videoEndTime;
+	quint64					m_audioEndTime;
+
+public: // Constructor/destructor ---------------------------------------------
+	FragmentedMp4FileMuxer(
+		VideoEncoder *vEnc, AudioEncoder *aEnc, int fragDurationSecs);
+	virtual ~FragmentedMp4FileMuxer();
+
+private: // Methods -----------------------------------------------------------
+	bool			writeFragment(quint64 nextVideoTime);
+	quint64			appendVideoTrafBox(
+		QByteArray &buf, quint64 nextVideoTime, int *dataOffsetPos) const;
+	quint64			appendAudioTrafBox(
+		QByteArray &buf, int *dataOffsetPos) const;
+	virtual void	appendMovieExtends(QByteArray &buf) const;
+
+private: // Interface ---------------------------------------------------------
+	virtual bool	writeHeaderEvent(const EncodedFrame &firstFrame);
+	virtual bool	writeFrameEvent(const EncodedFrame &frame);
+	virtual bool	writeSegmentEvent(const EncodedSegment &segment);
+	virtual bool	finalizeEvent();
+};
+//=============================================================================
+
+#endif // FRAGMENTEDMP4FILEMUXER_H
@@ -0,0 +1,674 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "mp4filemuxer.h"
+#include <QtCore/QDateTime>
+
+// Number of seconds between 1904-01-01 and 1970-01-01
+const quint32 MP4_EPOCH_OFFSET = 2082844800U;
+
+template <typename T>
+static void appendRun(T &list, quint32 value)
+{
+	if(!list.isEmpty() && list.last().value == value) {
+		list.last().count++;
+		return;
+	}
+	typename T::value_type run;
+	run.count = 1;
+	run.value = value;
+	list.append(run);
+}
+
+Mp4FileMuxer::Mp4FileMuxer(VideoEncoder *vEnc, AudioEncoder *aEnc)
+	: FileMuxer(vEnc, aEnc)
+	, m_video()
+	, m_audio()
+	, m_prevTrack(NULL)
+	, m_videoDtsOrigin(0)
+	, m_audioTimeOrigin(0)
+	, m_mdatPos(0)
+	, m_creationTime(0)
+	, m_avcConfig()
+{
+}
+
+Mp4FileMuxer::~Mp4FileMuxer()
+{
+}
+
+/// <summary>
+/// Initializes the movie and track state from the first keyframe of the file.
+/// </summary>
+bool Mp4FileMuxer::beginMovie(const EncodedFrame &firstFrame)
+{
+	QByteArray sps, pps;
+	if(!findParameterSets(firstFrame, &sps, &pps))
+		return setError(QStringLiteral("Cannot find SPS and PPS NAL units"));
+	m_avcConfig = createAvcConfigRecord(sps, pps);
+	m_videoDtsOrigin = firstFrame.getDTS();
+	m_creationTime =
+		QDateTime::currentDateTimeUtc().toTime_t() + MP4_EPOCH_OFFSET;
+
+	resetTrack(m_video, 1, true);
+	if(m_info.hasAudio)
+		resetTrack(m_audio, 2, false);
+	m_prevTrack = NULL;
+
+	// The first frame in the file is always decoded at time 0 but it should
+	// be presented at time 0 as well. If the first frame has a negative DTS
+	// (Caused by B-frames) then skip over the delay with an edit list.
+	//
+	// Files that continue a split recording begin at the DTS of their first
+	// frame instead. The previous file ended when this frame was received so
+	// it only contains the audio up until this frame's DTS. If we began at the
+	// PTS then the audio in between would be in neither file.
+	qint64 firstPts = firstFrame.getPTS() - m_videoDtsOrigin;
+	if(firstPts > 0 && !m_isContinuation) {
+		m_video.mediaTime =
+			firstPts * (qint64)m_info.videoTimeBase.numerator;
+	}
+
+	// Audio is presented relative to the start of the file. This is only
+	// non-zero if the file doesn't begin at the start of the recording.
+	m_audioTimeOrigin = 0;
+	if(m_info.hasAudio) {
+		Fraction timeBase = m_info.videoTimeBase;
+		qint64 startTime =
+			m_isContinuation ? firstFrame.getDTS() : firstFrame.getPTS();
+		m_audioTimeOrigin = startTime *
+			(qint64)timeBase.numerator *
+			(qint64)m_info.audioSampleRate / (qint64)timeBase.denominator;
+	}
+
+	return true;
+}
+
+void Mp4FileMuxer::resetTrack(Track &track, quint32 trackId, bool isVideo)
+{
+	track.trackId = trackId;
+	track.isVideo = isVideo;
+	if(isVideo) {
+		// One tick of the track timescale is one tick of the encoder time base
+		// numerator so that every timestamp is an exact integer
+		Fraction timeBase = m_info.videoTimeBase;
+		track.timescale = timeBase.denominator;
+		track.defaultDelta = timeBase.numerator;
+	} else {
+		// Audio uses the sample rate as its timescale as some players expect
+		track.timescale = m_info.audioSampleRate;
+		track.defaultDelta = m_info.audioFrameSize;
+	}
+	track.numSamples = 0;
+	track.duration = 0;
+	track.sampleSizes.clear();
+	track.decodeDeltas.clear();
+	track.compOffsets.clear();
+	track.hasCompOffsets = false;
+	track.syncSamples.clear();
+	track.chunkOffsets.clear();
+	track.chunkRuns.clear();
+	track.curChunkSamples = 0;
+	track.lastDecodeTime = 0;
+	track.mediaTime = -1;
+}
+
+/// <summary>
+/// Adds a sample that has just been written to the file to the track's sample
+/// tables. A new chunk is started whenever the previous sample in the file
+/// belonged to a different track.
+/// </summary>
+void Mp4FileMuxer::addSample(
+	Track &track, quint32 size, quint64 decodeTime, quint32 compOffset,
+	bool isSync, quint64 fileOffset)
+{
+	if(m_prevTrack != &track) {
+		closeChunk(track);
+		track.chunkOffsets.append(fileOffset);
+		m_prevTrack = &track;
+	}
+
+	// The decode delta of a sample is only known once the next sample arrives
+	if(track.numSamples > 0) {
+		quint32 delta = 1;
+		if(decodeTime > track.lastDecodeTime)
+			delta = (quint32)(decodeTime - track.lastDecodeTime);
+		appendRun(track.decodeDeltas, delta);
+		track.duration += delta;
+	}
+	track.lastDecodeTime = decodeTime;
+
+	if(track.isVideo) {
+		appendRun(track.compOffsets, compOffset);
+		if(compOffset != 0)
+			track.hasCompOffsets = true;
+		if(isSync)
+			track.syncSamples.append(track.numSamples + 1);
+	}
+	track.sampleSizes.append(size);
+	track.numSamples++;
+	track.curChunkSamples++;
+}
+
+void Mp4FileMuxer::closeChunk(Track &track)
+{
+	if(track.curChunkSamples == 0)
+		return;
+	if(track.chunkRuns.isEmpty() ||
+		track.chunkRuns.last().samplesPerChunk != track.curChunkSamples)
+	{
+		ChunkRun run;
+		run.firstChunk = track.chunkOffsets.count();
+		run.samplesPerChunk = track.curChunkSamples;
+		track.chunkRuns.append(run);
+	}
+	track.curChunkSamples = 0;
+}
+
+void Mp4FileMuxer::finishTrack(Track &track)
+{
+	closeChunk(track);
+	if(track.numSamples > 0) {
+		appendRun(track.decodeDeltas, track.defaultDelta);
+		track.duration += track.defaultDelta;
+	}
+}
+
+/// <summary>
+/// Converts a video DTS into the track timescale relative to the first frame
+/// in the file.
+/// </summary>
+quint64 Mp4FileMuxer::calcVideoDecodeTime(qint64 dts) const
+{
+	Fraction timeBase = m_info.videoTimeBase;
+	return (quint64)(dts - m_videoDtsOrigin) * (quint64)timeBase.numerator;
+}
+
+/// <summary>
+/// Converts an audio packet PTS into the track timescale relative to the
+/// first video frame in the file. Packets that have a negative time were
+/// recorded before the file began and should not be written.
+/// </summary>
+qint64 Mp4FileMuxer::calcAudioDecodeTime(qint64 pts) const
+{
+	return pts * (qint64)m_info.audioFrameSize - m_audioTimeOrigin;
+}
+
+/// <summary>
+/// Returns the presented duration of the track in the movie timescale.
+/// </summary>
+quint64 Mp4FileMuxer::calcMovieDuration(const Track &track) const
+{
+	quint64 duration = track.duration;
+	if(track.mediaTime > 0)
+		duration -= qMin<quint64>(duration, track.mediaTime);
+	return duration * MOVIE_TIMESCALE / (quint64)track.timescale;
+}
+
+//-----------------------------------------------------------------------------
+// Box construction
+
+/// <summary>
+/// Begins a new box and returns its position in the buffer. The size of the
+/// box is filled in by `endBox()`.
+/// </summary>
+int Mp4FileMuxer::beginBox(QByteArray &buf, const char *type)
+{
+	int pos = buf.size();
+	appendUInt32(buf, 0); // Size placeholder
+	appendFourCC(buf, type);
+	return pos;
+}
+
+int Mp4FileMuxer::beginFullBox(
+	QByteArray &buf, const char *type, quint8 version, quint32 flags)
+{
+	int pos = beginBox(buf, type);
+	appendUInt32(buf, ((quint32)version << 24) | (flags & 0x00FFFFFF));
+	return pos;
+}
+
+void Mp4FileMuxer::endBox(QByteArray &buf, int pos)
+{
+	quint32 size = buf.size() - pos;
+	buf[pos + 0] = (char)((size >> 24) & 0xFF);
+	buf[pos + 1] = (char)((size >> 16) & 0xFF);
+	buf[pos + 2] = (char)((size >> 8) & 0xFF);
+	buf[pos + 3] = (char)(size & 0xFF);
+}
+
+/// <summary>
+/// Appends an MPEG-4 system descriptor as used in the "esds" box. The size is
+/// always written in its 4-byte form for maximum compatibility.
+/// </summary>
+void Mp4FileMuxer::appendDescriptor(
+	QByteArray &buf, quint8 tag, const QByteArray &payload)
+{
+	int size = payload.size();
+	appendUInt8(buf, tag);
+	appendUInt8(buf, 0x80 | ((size >> 21) & 0x7F));
+	appendUInt8(buf, 0x80 | ((size >> 14) & 0x7F));
+	appendUInt8(buf, 0x80 | ((size >> 7) & 0x7F));
+	appendUInt8(buf, size & 0x7F);
+	buf.append(payload);
+}
+
+void Mp4FileMuxer::appendMatrix(QByteArray &buf)
+{
+	// Unity matrix
+	const quint32 matrix[9] = {
+		0x00010000, 0, 0,
+		0, 0x00010000, 0,
+		0, 0, 0x40000000 };
+	for(int i = 0; i < 9; i++)
+		appendUInt32(buf, matrix[i]);
+}
+
+void Mp4FileMuxer::appendFtypBox(QByteArray &buf) const
+{
+	int box = beginBox(buf, "ftyp");
+	appendFourCC(buf, "isom"); // major_brand
+	appendUInt32(buf, 0x200); // minor_version
+	appendFourCC(buf, "isom"); // compatible_brands
+	appendFourCC(buf, "iso2");
+	appendFourCC(buf, "avc1");
+	appendFourCC(buf, "mp41");
+	endBox(buf, box);
+}
+
+void Mp4FileMuxer::appendMoovBox(QByteArray &buf) const
+{
+	int moov = beginBox(buf, "moov");
+
+	// Movie header
+	quint64 duration = calcMovieDuration(m_video);
+	if(m_info.hasAudio)
+		duration = qMax(duration, calcMovieDuration(m_audio));
+	quint8 version = (duration > 0xFFFFFFFFULL) ? 1 : 0;
+	int box = beginFullBox(buf, "mvhd", version, 0);
+	if(version == 1) {
+		appendUInt64(buf, m_creationTime);
+		appendUInt64(buf, m_creationTime);
+		appendUInt32(buf, MOVIE_TIMESCALE);
+		appendUInt64(buf, duration);
+	} else {
+		appendUInt32(buf, m_creationTime);
+		appendUInt32(buf, m_creationTime);
+		appendUInt32(buf, MOVIE_TIMESCALE);
+		appendUInt32(buf, duration);
+	}
+	appendUInt32(buf, 0x00010000); // rate = 1.0
+	appendUInt16(buf, 0x0100); // volume = 1.0
+	appendUInt16(buf, 0); // reserved
+	appendUInt32(buf, 0); // reserved
+	appendUInt32(buf, 0);
+	appendMatrix(buf);
+	for(int i = 0; i < 6; i++)
+		appendUInt32(buf, 0); // pre_defined
+	appendUInt32(buf, m_info.hasAudio ? 3 : 2); // next_track_ID
+	endBox(buf, box);
+
+	// Tracks
+	appendTrakBox(buf, m_video);
+	if(m_info.hasAudio)
+		appendTrakBox(buf, m_audio);
+
+	appendMovieExtends(buf);
+	endBox(buf, moov);
+}
+
+void Mp4FileMuxer::appendTrakBox(QByteArray &buf, const Track &track) const
+{
+	int trak = beginBox(buf, "trak");
+
+	//-------------------------------------------------------------------------
+	// Track header
+
+	quint64 movieDuration = calcMovieDuration(track);
+	quint8 version = (movieDuration > 0xFFFFFFFFULL) ? 1 : 0;
+	int box = beginFullBox(buf, "tkhd", version, 0x000003); // Enabled+InMovie
+	if(version == 1) {
+		appendUInt64(buf, m_creationTime);
+		appendUInt64(buf, m_creationTime);
+		appendUInt32(buf, track.trackId);
+		appendUInt32(buf, 0); // reserved
+		appendUInt64(buf, movieDuration);
+	} else {
+		appendUInt32(buf, m_creationTime);
+		appendUInt32(buf, m_creationTime);
+		appendUInt32(buf, track.trackId);
+		appendUInt32(buf, 0); // reserved
+		appendUInt32(buf, movieDuration);
+	}
+	appendUInt32(buf, 0); // reserved
+	appendUInt32(buf, 0);
+	appendUInt16(buf, 0); // layer
+	appendUInt16(buf, 0); // alternate_group
+	appendUInt16(buf, track.isVideo ? 0 : 0x0100); // volume
+	appendUInt16(buf, 0); // reserved
+	appendMatrix(buf);
+	if(track.isVideo) {
+		appendUInt32(buf, m_info.videoSize.width() << 16);
+		appendUInt32(buf, m_info.videoSize.height() << 16);
+	} else {
+		appendUInt32(buf, 0);
+		appendUInt32(buf, 0);
+	}
+	endBox(buf, box);
+
+	//-------------------------------------------------------------------------
+	// Edit list. Used to hide the decode delay of the first video frame so
+	// that PTS 0 of the video and audio tracks line up.
+
+	if(track.mediaTime > 0) {
+		int edts = beginBox(buf, "edts");
+		version = (movieDuration > 0xFFFFFFFFULL ||
+			track.mediaTime > 0x7FFFFFFFLL) ? 1 : 0;
+		box = beginFullBox(buf, "elst", version, 0);
+		appendUInt32(buf, 1); // entry_count
+		if(version == 1) {
+			appendUInt64(buf, movieDuration); // segment_duration
+			appendUInt64(buf, track.mediaTime); // media_time
+		} else {
+			appendUInt32(buf, movieDuration);
+			appendUInt32(buf, track.mediaTime);
+		}
+		appendUInt16(buf, 1); // media_rate_integer
+		appendUInt16(buf, 0); // media_rate_fraction
+		endBox(buf, box);
+		endBox(buf, edts);
+	}
+
+	//-------------------------------------------------------------------------
+	// Media
+
+	int mdia = beginBox(buf, "mdia");
+
+	version = (track.duration > 0xFFFFFFFFULL) ? 1 : 0;
+	box = beginFullBox(buf, "mdhd", version, 0);
+	if(version == 1) {
+		appendUInt64(buf, m_creationTime);
+		appendUInt64(buf, m_creationTime);
+		appendUInt32(buf, track.timescale);
+		appendUInt64(buf, track.duration);
+	} else {
+		appendUInt32(buf, m_creationTime);
+		appendUInt32(buf, m_creationTime);
+		appendUInt32(buf, track.timescale);
+		appendUInt32(buf, track.duration);
+	}
+	appendUInt16(buf, 0x55C4); // language = "und"
+	appendUInt16(buf, 0); // pre_defined
+	endBox(buf, box);
+
+	box = beginFullBox(buf, "hdlr", 0, 0);
+	appendUInt32(buf, 0); // pre_defined
+	appendFourCC(buf, track.isVideo ? "vide" : "soun");
+	appendUInt32(buf, 0); // reserved
+	appendUInt32(buf, 0);
+	appendUInt32(buf, 0);
+	if(track.isVideo)
+		buf.append("VideoHandler", 13); // Includes NUL
+	else
+		buf.append("SoundHandler", 13);
+	endBox(buf, box);
+
+	int minf = beginBox(buf, "minf");
+	if(track.isVideo) {
+		box = beginFullBox(buf, "vmhd", 0, 1);
+		appendUInt16(buf, 0); // graphicsmode
+		appendUInt16(buf, 0); // opcolor
+		appendUInt16(buf, 0);
+		appendUInt16(buf, 0);
+		endBox(buf, box);
+	} else {
+		box = beginFullBox(buf, "smhd", 0, 0);
+		appendUInt16(buf, 0); // balance
+		appendUInt16(buf, 0); // reserved
+		endBox(buf, box);
+	}
+	int dinf = beginBox(buf, "dinf");
+	int dref = beginFullBox(buf, "dref", 0, 0);
+	appendUInt32(buf, 1); // entry_count
+	box = beginFullBox(buf, "url ", 0, 1); // Data is in this file
+	endBox(buf, box);
+	endBox(buf, dref);
+	endBox(buf, dinf);
+	appendSampleTables(buf, track);
+	endBox(buf, minf);
+
+	endBox(buf, mdia);
+	endBox(buf, trak);
+}
+
+void Mp4FileMuxer::appendSampleEntry(
+	QByteArray &buf, const Track &track) const
+{
+	if(track.isVideo) {
+		int avc1 = beginBox(buf, "avc1");
+		for(int i = 0; i < 6; i++)
+			appendUInt8(buf, 0); // reserved
+		appendUInt16(buf, 1); // data_reference_index
+		appendUInt16(buf, 0); // pre_defined
+		appendUInt16(buf, 0); // reserved
+		appendUInt32(buf, 0); // pre_defined
+		appendUInt32(buf, 0);
+		appendUInt32(buf, 0);
+		appendUInt16(buf, m_info.videoSize.width());
+		appendUInt16(buf, m_info.videoSize.height());
+		appendUInt32(buf, 0x00480000); // horizresolution = 72 dpi
+		appendUInt32(buf, 0x00480000); // vertresolution = 72 dpi
+		appendUInt32(buf, 0); // reserved
+		appendUInt16(buf, 1); // frame_count
+		buf.append(QByteArray(32, '\0')); // compressorname
+		appendUInt16(buf, 0x0018); // depth
+		appendUInt16(buf, 0xFFFF); // pre_defined = -1
+		int avcC = beginBox(buf, "avcC");
+		buf.append(m_avcConfig);
+		endBox(buf, avcC);
+		endBox(buf, avc1);
+		return;
+	}
+
+	quint32 bitrate = m_info.audioBitrate * 1000; // (1000 for bits)
+
+	int mp4a = beginBox(buf, "mp4a");
+	for(int i = 0; i < 6; i++)
+		appendUInt8(buf, 0); // reserved
+	appendUInt16(buf, 1); // data_reference_index
+	appendUInt32(buf, 0); // reserved
+	appendUInt32(buf, 0);
+	appendUInt16(buf, m_info.audioNumChannels); // channelcount
+	appendUInt16(buf, 16); // samplesize
+	appendUInt16(buf, 0); // pre_defined
+	appendUInt16(buf, 0); // reserved
+	appendUInt32(buf, (quint32)m_info.audioSampleRate << 16);
+
+	// Elementary stream descriptor
+	QByteArray decSpecific = m_info.audioOutOfBand;
+	QByteArray decConfig;
+	appendUInt8(decConfig, 0x40); // objectTypeIndication = MPEG-4 audio
+	appendUInt8(decConfig, 0x15); // streamType = audio, reserved = 1
+	appendUInt24(decConfig, 0); // bufferSizeDB
+	appendUInt32(decConfig, bitrate); // maxBitrate
+	appendUInt32(decConfig, bitrate); // avgBitrate
+	appendDescriptor(decConfig, 0x05, decSpecific); // DecoderSpecificInfo
+	QByteArray esDesc;
+	appendUInt16(esDesc, track.trackId); // ES_ID
+	appendUInt8(esDesc, 0); // Flags
+	appendDescriptor(esDesc, 0x04, decConfig); // DecoderConfigDescriptor
+	appendDescriptor(esDesc, 0x06, QByteArray(1, 0x02)); // SLConfigDescriptor
+	int esds = beginFullBox(buf, "esds", 0, 0);
+	appendDescriptor(buf, 0x03, esDesc); // ES_Descriptor
+	endBox(buf, esds);
+
+	endBox(buf, mp4a);
+}
+
+void Mp4FileMuxer::appendSampleTables(
+	QByteArray &buf, const Track &track) const
+{
+	int stbl = beginBox(buf, "stbl");
+
+	// Sample descriptions
+	int box = beginFullBox(buf, "stsd", 0, 0);
+	appendUInt32(buf, 1); // entry_count
+	appendSampleEntry(buf, track);
+	endBox(buf, box);
+
+	// Decoding time to sample
+	box = beginFullBox(buf, "stts", 0, 0);
+	appendUInt32(buf, track.decodeDeltas.count());
+	for(int i = 0; i < track.decodeDeltas.count(); i++) {
+		const SampleRun &run = track.decodeDeltas.at(i);
+		appendUInt32(buf, run.count);
+		appendUInt32(buf, run.value);
+	}
+	endBox(buf, box);
+
+	// Composition time to sample
+	if(track.hasCompOffsets) {
+		box = beginFullBox(buf, "ctts", 0, 0);
+		appendUInt32(buf, track.compOffsets.count());
+		for(int i = 0; i < track.compOffsets.count(); i++) {
+			const SampleRun &run = track.compOffsets.at(i);
+			appendUInt32(buf, run.count);
+			appendUInt32(buf, run.value);
+		}
+		endBox(buf, box);
+	}
+
+	// Sync samples. If this box doesn't exist then every sample is a sync
+	// sample which is the case for AAC.
+	if(track.isVideo) {
+		box = beginFullBox(buf, "stss", 0, 0);
+		appendUInt32(buf, track.syncSamples.count());
+		for(int i = 0; i < track.syncSamples.count(); i++)
+			appendUInt32(buf, track.syncSamples.at(i));
+		endBox(buf, box);
+	}
+
+	// Sample to chunk
+	box = beginFullBox(buf, "stsc", 0, 0);
+	appendUInt32(buf, track.chunkRuns.count());
+	for(int i = 0; i < track.chunkRuns.count(); i++) {
+		const ChunkRun &run = track.chunkRuns.at(i);
+		appendUInt32(buf, run.firstChunk);
+		appendUInt32(buf, run.samplesPerChunk);
+		appendUInt32(buf, 1); // sample_description_index
+	}
+	endBox(buf, box);
+
+	// Sample sizes
+	box = beginFullBox(buf, "stsz", 0, 0);
+	appendUInt32(buf, 0); // sample_size (0 = Variable)
+	appendUInt32(buf, track.sampleSizes.count());
+	for(int i = 0; i < track.sampleSizes.count(); i++)
+		appendUInt32(buf, track.sampleSizes.at(i));
+	endBox(buf, box);
+
+	// Chunk offsets. Only use 64-bit offsets if we actually need them.
+	bool useCo64 = !track.chunkOffsets.isEmpty() &&
+		track.chunkOffsets.last() > 0xFFFFFFFFULL;
+	box = beginFullBox(buf, useCo64 ? "co64" : "stco", 0, 0);
+	appendUInt32(buf, track.chunkOffsets.count());
+	for(int i = 0; i < track.chunkOffsets.count(); i++) {
+		if(useCo64)
+			appendUInt64(buf, track.chunkOffsets.at(i));
+		else
+			appendUInt32(buf, (quint32)track.chunkOffsets.at(i));
+	}
+	endBox(buf, box);
+
+	endBox(buf, stbl);
+}
+
+/// <summary>
+/// Appends any additional boxes to the end of the "moov" box. Regular MP4
+/// files don't have any.
+/// </summary>
+void Mp4FileMuxer::appendMovieExtends(QByteArray &buf) const
+{
+}
+
+//-----------------------------------------------------------------------------
+// Interface
+
+bool Mp4FileMuxer::writeHeaderEvent(const EncodedFrame &firstFrame)
+{
+	if(!beginMovie(firstFrame))
+		return false;
+
+	// Write the file type and the beginning of the media data box. We always
+	// use a 64-bit size as we don't know how large the file will become.
+	QByteArray header;
+	appendFtypBox(header);
+	m_mdatPos = (qint64)m_bytesWritten + header.size();
+	appendUInt32(header, 1); // 1 = Use "largesize"
+	appendFourCC(header, "mdat");
+	appendUInt64(header, 0); // Patched when the file is finalized
+	return writeData(header);
+}
+
+bool Mp4FileMuxer::writeFrameEvent(const EncodedFrame &frame)
+{
+	quint64 offset = m_bytesWritten;
+	int size = calcAvccFrameSize(frame);
+	if(!writeAvccFrame(frame))
+		return false;
+
+	Fraction timeBase = m_info.videoTimeBase;
+	quint32 compOffset = (quint32)((frame.getPTS() - frame.getDTS()) *
+		(qint64)timeBase.numerator);
+	addSample(m_video, size, calcVideoDecodeTime(frame.getDTS()), compOffset,
+		frame.isKeyframe(), offset);
+	return true;
+}
+
+bool Mp4FileMuxer::writeSegmentEvent(const EncodedSegment &segment)
+{
+	const EncodedPacketList &pkts = segment.getPackets();
+	for(int i = 0; i < pkts.count(); i++) {
+		qint64 time = calcAudioDecodeTime(segment.getPTS() + i);
+		if(time < 0)
+			continue; // Before the start of the file
+		QByteArray data = pkts.at(i).data(); // Shallow copy
+		quint64 offset = m_bytesWritten;
+		if(!writeData(data))
+			return false;
+		addSample(m_audio, data.size(), (quint64)time, 0, true, offset);
+	}
+	return true;
+}
+
+bool Mp4FileMuxer::finalizeEvent()
+{
+	finishTrack(m_video);
+	if(m_info.hasAudio)
+		finishTrack(m_audio);
+
+	// Patch the size of the media data box
+	QByteArray mdatSize;
+	appendUInt64(mdatSize, m_bytesWritten - (quint64)m_mdatPos);
+	if(!overwriteAt(m_mdatPos + 8, mdatSize))
+		return false;
+
+	// Write the movie index
+	QByteArray moov;
+	appendMoovBox(moov);
+	return writeData(moov);
+}
@@ -0,0 +1,124 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef MP4FILEMUXER_H
+#define MP4FILEMUXER_H
+
+#include "filemuxer.h"
+
+// Used for all movie-level durations ("mvhd", "tkhd" and "elst")
+const quint32 MOVIE_TIMESCALE = 1000;
+
+//=============================================================================
+/// <summary>
+/// Writes H.264 and AAC to an ISO base media file (MPEG-4 Part 14). Sample
+/// data is written to a single "mdat" box as it is received and the "moov"
+/// index is appended when the file is closed.
+///
+/// As recordings can be many hours long the sample tables are kept in the
+/// most compact form possible: timing and chunk tables are run-length encoded
+/// as they are built and the only per-sample state is its 32-bit size. For
+/// comparison Libav keeps a large structure for every single sample.
+/// </summary>
+class Mp4FileMuxer : public FileMuxer
+{
+protected: // Datatypes -------------------------------------------------------
+	struct SampleRun { // "stts" and "ctts" entries
+		quint32	count;
+		quint32	value;
+	};
+	typedef QVector<SampleRun> SampleRunList;
+
+	struct ChunkRun { // "stsc" entries
+		quint32	firstChunk; // 1-based
+		quint32	samplesPerChunk;
+	};
+	typedef QVector<ChunkRun> ChunkRunList;
+
+	struct Track {
+		quint32				trackId;
+		bool				isVideo;
+		quint32				timescale;
+		quint32				defaultDelta; // Used for the very last sample
+		quint32				numSamples;
+		quint64				duration; // Sum of all sample deltas
+
+		// Sample tables
+		QVector<quint32>	sampleSizes;
+		SampleRunList		decodeDeltas; // "stts"
+		SampleRunList		compOffsets; // "ctts"
+		bool				hasCompOffsets;
+		QVector<quint32>	syncSamples; // "stss", 1-based
+		QVector<quint64>	chunkOffsets; // "stco"/"co64"
+		ChunkRunList		chunkRuns; // "stsc"
+		quint32				curChunkSamples;
+
+		// State
+		quint64				lastDecodeTime;
+		qint64				mediaTime; // Edit list start, -1 = no edit list
+	};
+
+protected: // Members ---------------------------------------------------------
+	Track		m_video;
+	Track		m_audio;
+	Track *		m_prevTrack; // Track of the most recently written sample
+	qint64		m_videoDtsOrigin;
+	qint64		m_audioTimeOrigin; // In audio track timescale
+	qint64		m_mdatPos;
+	quint32		m_creationTime; // Seconds since midnight, Jan. 1, 1904 UTC
+	QByteArray	m_avcConfig; // "AVCDecoderConfigurationRecord"
+
+public: // Constructor/destructor ---------------------------------------------
+	Mp4FileMuxer(VideoEncoder *vEnc, AudioEncoder *aEnc);
+	virtual ~Mp4FileMuxer();
+
+protected: // Methods ---------------------------------------------------------
+	bool		beginMovie(const EncodedFrame &firstFrame);
+	void		resetTrack(Track &track, quint32 trackId, bool isVideo);
+	void		addSample(
+		Track &track, quint32 size, quint64 decodeTime, quint32 compOffset,
+		bool isSync, quint64 fileOffset);
+	void		closeChunk(Track &track);
+	void		finishTrack(Track &track);
+	quint64		calcVideoDecodeTime(qint64 dts) const;
+	qint64		calcAudioDecodeTime(qint64 pts) const;
+	quint64		calcMovieDuration(const Track &track) const;
+
+	// Box construction
+	static int	beginBox(QByteArray &buf, const char *type);
+	static int	beginFullBox(
+		QByteArray &buf, const char *type, quint8 version, quint32 flags);
+	static void	endBox(QByteArray &buf, int pos);
+	static void	appendDescriptor(
+		QByteArray &buf, quint8 tag, const QByteArray &payload);
+	static void	appendMatrix(QByteArray &buf);
+	void		appendFtypBox(QByteArray &buf) const;
+	void		appendMoovBox(QByteArray &buf) const;
+	void		appendTrakBox(QByteArray &buf, const Track &track) const;
+	void		appendSampleEntry(QByteArray &buf, const Track &track) const;
+	void		appendSampleTables(QByteArray &buf, const Track &track) const;
+	virtual void	appendMovieExtends(QByteArray &buf) const;
+
+private: // Interface ---------------------------------------------------------
+	virtual bool	writeHeaderEvent(const EncodedFrame &firstFrame);
+	virtual bool	writeFrameEvent(const EncodedFrame &frame);
+	virtual bool	writeSegmentEvent(const EncodedSegment &segment);
+	virtual bool	finalizeEvent();
+};
+//=============================================================================
+
+#endif // MP4FILEMUXER_H
@@ -0,0 +1,553 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "replaytarget.h"
+#include "application.h"
+#include "audioencoder.h"
+#include "avsynchronizer.h"
+#include "profile.h"
+#include "videoencoder.h"
+#include "Targets/file/filemuxer.h"
+#include "Widgets/infowidget.h"
+#include "Widgets/targetpane.h"
+
+const QString LOG_CAT = QStringLiteral("Target");
+
+//=============================================================================
+// ReplayWriterThread class
+
+ReplayWriterThread::ReplayWriterThread(
+	FileMuxer *muxer, const QString &filename, const ReplayItemList &items)
+	: QThread()
+	, m_muxer(muxer)
+	, m_filename(filename)
+	, m_items(items)
+	, m_success(false)
+	, m_error()
+{
+	Q_ASSERT(muxer != NULL);
+}
+
+ReplayWriterThread::~ReplayWriterThread()
+{
+	delete m_muxer;
+}
+
+void ReplayWriterThread::run()
+{
+	// Never overwrite an existing file or a previously saved replay
+	m_filename = getUniqueFilename(m_filename).filePath();
+	if(!m_muxer->open(m_filename)) {
+		m_error = m_muxer->getLastError();
+		return;
+	}
+
+	// The items are already interleaved and begin with a keyframe
+	for(int i = 0; i < m_items.count(); i++) {
+		const ReplayItem &item = m_items.at(i);
+		bool res;
+		if(item.frame.isValid())
+			res = m_muxer->writeFrame(item.frame);
+		else
+			res = m_muxer->writeSegment(item.segment);
+		if(!res) {
+			m_error = m_muxer->getLastError();
+			m_muxer->close();
+			return;
+		}
+	}
+	m_items.clear(); // Release memory as soon as possible
+
+	if(!m_muxer->close()) {
+		m_error = m_muxer->getLastError();
+		return;
+	}
+	m_success = true;
+}
+
+//=============================================================================
+// ReplayTarget class
+
+ReplayTarget::ReplayTarget(
+	Profile *profile, const QString &name, const ReplayTrgtOptions &opt)
+	: Target(profile, TrgtReplayType, name)
+	, m_videoEnc(NULL)
+	, m_audioEnc(NULL)
+	, m_syncer(NULL)
+	, m_pane(NULL)
+	, m_paneTimer(this)
+
+	// Replay buffer
+	, m_gops()
+	, m_bufferBytes(0)
+	, m_lastPts(0)
+	, m_writer(NULL)
+	, m_warnedMemoryLimit(false)
+
+	// Options
+	, m_videoEncId(opt.videoEncId)
+	, m_audioEncId(opt.audioEncId)
+	, m_filename(opt.filename)
+	, m_bufferDuration(opt.bufferDuration)
+	, m_maxMemory(opt.maxMemory)
+{
+	// Connect signals
+	connect(&m_paneTimer, &QTimer::timeout,
+		this, &ReplayTarget::paneTimeout);
+
+	// Setup timer to refresh the pane
+	m_paneTimer.setSingleShot(false);
+	m_paneTimer.start(500); // 500ms refresh
+}
+
+ReplayTarget::~ReplayTarget()
+{
+	// Make sure we have released our resources
+	setActive(false);
+
+	// Don't leave a partially written replay behind
+	if(m_writer != NULL) {
+		m_writer->wait();
+		delete m_writer;
+		m_writer = NULL;
+	}
+
+	if(m_syncer != NULL)
+		delete m_syncer;
+}
+
+void ReplayTarget::initializedEvent()
+{
+	// Fetch video and audio encoder
+	m_videoEnc = m_profile->getVideoEncoderById(m_videoEncId);
+	m_audioEnc = m_profile->getAudioEncoderById(m_audioEncId);
+	if(m_videoEnc == NULL) { // No audio is okay
+		appLog(LOG_CAT, Log::Warning)
+			<< "Could not find video encoder " << m_videoEncId
+			<< " for target " << getIdString();
+		return;
+	}
+
+	// Watch encoders for fatal errors
+	connect(m_videoEnc, &VideoEncoder::encodeError,
+		this, &ReplayTarget::videoEncodeError);
+
+	// Create synchroniser object and connect to its signals
+	m_syncer = new AVSynchronizer(m_videoEnc, m_audioEnc);
+	connect(m_syncer, &AVSynchronizer::frameReady,
+		this, &ReplayTarget::frameReady);
+	connect(m_syncer, &AVSynchronizer::segmentReady,
+		this, &ReplayTarget::segmentReady);
+}
+
+bool ReplayTarget::activateEvent()
+{
+	if(m_isInitializing)
+		return false;
+	if(m_videoEnc == NULL)
+		return false;
+
+	appLog(LOG_CAT)
+		<< "Activating replay target " << getIdString() << " with a "
+		<< m_bufferDuration << " second buffer...";
+
+	// Reference encoders by enabling the synchroniser
+	clearBuffer();
+	m_warnedMemoryLimit = false;
+	if(!m_syncer->setActive(true))
+		return false;
+
+	if(m_pane != NULL)
+		m_pane->setPaneState(TargetPane::LiveState);
+	appLog(LOG_CAT) << "Replay target activated";
+	return true;
+}
+
+void ReplayTarget::deactivateEvent()
+{
+	if(m_isInitializing)
+		return;
+	if(m_videoEnc == NULL)
+		return; // Never activated
+	appLog(LOG_CAT) << "Deactivating replay target " << getIdString() << "...";
+
+	// Any replay that is currently being saved has its own copy of the data
+	// and is allowed to complete
+	clearBuffer();
+
+	// Dereference encoders by disabling the synchroniser
+	m_syncer->setActive(false);
+
+	if(m_pane != NULL)
+		m_pane->setPaneState(TargetPane::OfflineState);
+	appLog(LOG_CAT) << "Replay target deactivated";
+}
+
+VideoEncoder *ReplayTarget::getVideoEncoder() const
+{
+	return m_videoEnc;
+}
+
+AudioEncoder *ReplayTarget::getAudioEncoder() const
+{
+	return m_audioEnc;
+}
+
+void ReplayTarget::serialize(QDataStream *stream) const
+{
+	Target::serialize(stream);
+
+	// Write data version number
+	*stream << (quint32)0;
+
+	// Save our data
+	*stream << m_videoEncId;
+	*stream << m_audioEncId;
+	*stream << m_filename;
+	*stream << (qint32)m_bufferDuration;
+	*stream << (qint32)m_maxMemory;
+}
+
+bool ReplayTarget::unserialize(QDataStream *stream)
+{
+	if(!Target::unserialize(stream))
+		return false;
+
+	qint32	int32Data;
+
+	// Read data version number
+	quint32 version;
+	*stream >> version;
+	if(version == 0) {
+		// Read our data
+		*stream >> m_videoEncId;
+		*stream >> m_audioEncId;
+		*stream >> m_filename;
+		*stream >> int32Data;
+		m_bufferDuration = int32Data;
+		*stream >> int32Data;
+		m_maxMemory = int32Data;
+	} else {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Unknown version number in replay target serialized data, "
+			<< "cannot load settings";
+		return false;
+	}
+
+	return true;
+}
+
+void ReplayTarget::setupTargetPane(TargetPane *pane)
+{
+	m_pane = pane;
+	m_pane->setUserEnabled(m_isEnabled);
+	m_pane->setPaneState(
+		m_isActive ? TargetPane::LiveState : TargetPane::OfflineState);
+	m_pane->setTitle(m_name);
+	m_pane->setIconPixmap(QPixmap(":/Resources/target-18x18-file.png"));
+	updatePaneText(true);
+}
+
+void ReplayTarget::updatePaneText(bool fromTimer)
+{
+	if(m_pane == NULL)
+		return;
+
+	m_pane->setItemText(
+		0, tr("Buffered:"), tr("%L1 of %L2 seconds")
+		.arg(getBufferedMsec() / 1000LL).arg(m_bufferDuration), false);
+	m_pane->setItemText(
+		1, tr("Memory usage:"), tr("%1B of %2B")
+		.arg(humanBitsBytes(m_bufferBytes))
+		.arg(humanBitsBytes((quint64)m_maxMemory * 1024ULL * 1024ULL)),
+		true);
+}
+
+void ReplayTarget::paneOutdated()
+{
+	updatePaneText(false);
+}
+
+void ReplayTarget::paneTimeout()
+{
+	updatePaneText(true);
+}
+
+void ReplayTarget::resetTargetPaneEnabled()
+{
+	if(m_pane == NULL)
+		return;
+	m_pane->setUserEnabled(m_isEnabled);
+}
+
+void ReplayTarget::setupTargetInfo(TargetInfoWidget *widget)
+{
+	widget->setTitle(m_name);
+	widget->setIconPixmap(QPixmap(":/Resources/target-160x70-file.png"));
+
+	QString setStr = tr("Error");
+	if(m_videoEnc != NULL)
+		setStr = m_videoEnc->getInfoString();
+	widget->setItemText(0, tr("Video settings:"), setStr, false);
+
+	setStr = tr("No audio");
+	if(m_audioEnc != NULL)
+		setStr = m_audioEnc->getInfoString();
+	widget->setItemText(1, tr("Audio settings:"), setStr, false);
+
+	widget->setItemText(2, tr("Replay length:"),
+		tr("%L1 seconds").arg(m_bufferDuration), false);
+	widget->setItemText(3, tr("Filename:"), m_filename, true);
+}
+
+/// <summary>
+/// Returns the amount of video that is currently buffered in milliseconds.
+/// </summary>
+qint64 ReplayTarget::getBufferedMsec() const
+{
+	if(m_gops.isEmpty())
+		return 0;
+	return ptsToMsec(m_lastPts - m_gops.first().startPts);
+}
+
+qint64 ReplayTarget::ptsToMsec(qint64 pts) const
+{
+	if(m_videoEnc == NULL)
+		return 0;
+	Fraction timeBase = m_videoEnc->getTimeBase();
+	return pts * (qint64)timeBase.numerator * 1000LL /
+		(qint64)timeBase.denominator;
+}
+
+quint64 ReplayTarget::calcPacketBytes(const EncodedPacketList &pkts)
+{
+	quint64 numBytes = 0;
+	for(int i = 0; i < pkts.count(); i++)
+		numBytes += (quint64)pkts.at(i).data().size();
+	return numBytes;
+}
+
+/// <summary>
+/// Creates new packet objects that share the same persistent data. This is a
+/// shallow copy of the data itself: unlike our own reference counting the
+/// reference counting of `QByteArray` is atomic so the copies can be safely
+/// used by another thread while the buffer continues to use the originals.
+/// </summary>
+EncodedPacketList ReplayTarget::copyPackets(const EncodedPacketList &pkts)
+{
+	EncodedPacketList copies;
+	copies.reserve(pkts.count());
+	for(int i = 0; i < pkts.count(); i++) {
+		const EncodedPacket &pkt = pkts.at(i);
+		void *encoder = pkt.videoEncoder();
+		if(pkt.type() == PktAudioType)
+			encoder = pkt.audioEncoder();
+		copies.append(EncodedPacket(
+			encoder, pkt.type(), pkt.priority(), pkt.ident(), pkt.isBloat(),
+			pkt.data()));
+	}
+	return copies;
+}
+
+/// <summary>
+/// Adds a frame or segment to the end of the buffer. A new group of pictures
+/// is started at every keyframe and anything that is received before the
+/// first keyframe is discarded.
+/// </summary>
+void ReplayTarget::appendToBuffer(const ReplayItem &item, quint64 numBytes)
+{
+	if(item.frame.isValid() && item.frame.isKeyframe()) {
+		ReplayGop gop;
+		gop.startPts = item.frame.getPTS();
+		gop.numBytes = 0;
+		m_gops.append(gop);
+	}
+	if(m_gops.isEmpty())
+		return; // Waiting for a keyframe
+
+	ReplayGop &gop = m_gops.last();
+	gop.items.append(item);
+	gop.numBytes += numBytes;
+	m_bufferBytes += numBytes;
+	if(item.frame.isValid())
+		m_lastPts = qMax(m_lastPts, item.frame.getPTS());
+
+	trimBuffer();
+}
+
+/// <summary>
+/// Discards the oldest groups of pictures while the remaining groups are long
+/// enough by themselves or while the buffer uses too much memory.
+/// </summary>
+void ReplayTarget::trimBuffer()
+{
+	const quint64 maxBytes = (quint64)m_maxMemory * 1024ULL * 1024ULL;
+	const qint64 durationMsec = (qint64)m_bufferDuration * 1000LL;
+	while(m_gops.count() > 1) {
+		bool isTooLong =
+			ptsToMsec(m_lastPts - m_gops.at(1).startPts) >= durationMsec;
+		if(!isTooLong && m_bufferBytes <= maxBytes)
+			break;
+		m_bufferBytes -= m_gops.first().numBytes;
+		m_gops.removeFirst();
+	}
+
+	// If the memory limit is smaller than a single keyframe interval then we
+	// would never have anything to save. Always keep the group of pictures
+	// that is currently being recorded which effectively raises the limit to
+	// a single keyframe interval.
+	if(m_gops.count() == 1 && m_bufferBytes > maxBytes &&
+		!m_warnedMemoryLimit)
+	{
+		appLog(LOG_CAT, Log::Warning)
+			<< "Replay buffer memory limit of " << m_maxMemory << " MB is "
+			<< "smaller than a single keyframe interval, the buffer will "
+			<< "always contain one keyframe interval";
+		m_warnedMemoryLimit = true;
+	}
+}
+
+void ReplayTarget::clearBuffer()
+{
+	m_gops.clear();
+	m_bufferBytes = 0;
+	m_lastPts = 0;
+}
+
+/// <summary>
+/// Saves the current contents of the replay buffer to a new file. The file is
+/// written in a separate thread and the buffer continues to be filled while
+/// it's being saved. Returns false if there is nothing to save or if a replay
+/// is already being saved.
+/// </summary>
+bool ReplayTarget::saveReplay()
+{
+	if(m_writer != NULL) {
+		App->setStatusLabel(tr("A replay is already being saved"));
+		return false;
+	}
+	if(m_gops.isEmpty()) {
+		App->setStatusLabel(tr("Replay buffer is empty"));
+		return false;
+	}
+
+	// Take a snapshot of the buffer that is owned by the writer thread
+	ReplayItemList items;
+	for(int i = 0; i < m_gops.count(); i++) {
+		const ReplayItemList &gopItems = m_gops.at(i).items;
+		for(int j = 0; j < gopItems.count(); j++) {
+			const ReplayItem &item = gopItems.at(j);
+			ReplayItem copy;
+			if(item.frame.isValid()) {
+				const EncodedFrame &frame = item.frame;
+				copy.frame = EncodedFrame(
+					frame.encoder(), copyPackets(frame.getPackets()),
+					frame.isKeyframe(), frame.getPriority(),
+					frame.getTimestampMsec(), frame.getPTS(), frame.getDTS());
+			} else {
+				const EncodedSegment &segment = item.segment;
+				copy.segment = EncodedSegment(
+					segment.encoder(), copyPackets(segment.getPackets()),
+					segment.isKeyframe(), segment.getTimestampMsec(),
+					segment.getPTS());
+			}
+			items.append(copy);
+		}
+	}
+
+	FileMuxer *muxer = FileMuxer::createMuxer(
+		FileTrgtMp4Type, m_videoEnc, m_audioEnc, 0);
+	if(muxer == NULL)
+		return false;
+
+	appLog(LOG_CAT)
+		<< "Saving " << getBufferedMsec() << " msec replay from target "
+		<< getIdString() << "...";
+	App->setStatusLabel(tr("Saving replay..."));
+
+	m_writer = new ReplayWriterThread(muxer, m_filename, items);
+	connect(m_writer, &QThread::finished,
+		this, &ReplayTarget::writerFinished);
+	m_writer->start(QThread::LowPriority);
+	return true;
+}
+
+void ReplayTarget::frameReady(EncodedFrame frame)
+{
+	if(!m_isActive)
+		return;
+
+	// Make sure that the frame stays valid while it's in our buffer
+	frame.makePersistent();
+
+	ReplayItem item;
+	item.frame = frame;
+	appendToBuffer(item, calcPacketBytes(frame.getPackets()));
+}
+
+void ReplayTarget::segmentReady(EncodedSegment segment)
+{
+	if(!m_isActive)
+		return;
+
+	// Make sure that the segment stays valid while it's in our buffer
+	segment.makePersistent();
+
+	ReplayItem item;
+	item.segment = segment;
+	appendToBuffer(item, calcPacketBytes(segment.getPackets()));
+}
+
+void ReplayTarget::videoEncodeError(const QString &error)
+{
+	if(!isActive())
+		return;
+	// Immediately stop encoding and notify the user
+	App->setStatusLabel(error);
+	QTimer::singleShot(0, this, SLOT(delayedSimpleDeactivate()));
+}
+
+/// <summary>
+/// If we deactive the target from within an encoder signal then it may result
+/// in the encoder being deleted by the time we exit the signal. For this
+/// reason we must delay all deactivations.
+/// </summary>
+void ReplayTarget::delayedSimpleDeactivate()
+{
+	if(!isActive())
+		return;
+	setActive(false);
+}
+
+void ReplayTarget::writerFinished()
+{
+	if(m_writer == NULL)
+		return;
+	if(m_writer->wasSuccessful()) {
+		appLog(LOG_CAT)
+			<< "Saved replay to \"" << m_writer->getFilename() << "\"";
+		App->setStatusLabel(tr("Saved replay to \"%1\"")
+			.arg(m_writer->getFilename()));
+	} else {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Failed to save replay: " << m_writer->getLastError();
+		App->setStatusLabel(tr("Failed to save replay (%1)")
+			.arg(m_writer->getLastError()));
+	}
+	m_writer->deleteLater();
+	m_writer = NULL;
+}
@@ -0,0 +1,214 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef REPLAYTARGET_H
+#define REPLAYTARGET_H
+
+#include "encodedframe.h"
+#include "encodedsegment.h"
+#include "target.h"
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+
+class AVSynchronizer;
+class FileMuxer;
+
+//=============================================================================
+/// <summary>
+/// A single video frame or audio segment in the order that it was emitted by
+/// the synchroniser. Only one of the two is valid.
+/// </summary>
+struct ReplayItem {
+	EncodedFrame	frame;
+	EncodedSegment	segment;
+};
+typedef QVector<ReplayItem> ReplayItemList;
+
+//=============================================================================
+/// <summary>
+/// Writes a snapshot of a replay buffer to a file without blocking the main
+/// thread. The thread has its own frame, segment and packet objects as their
+/// reference counting is not thread-safe but the packet data itself is shared
+/// with the buffer through `QByteArray`'s atomic reference counting. The
+/// muxer only uses stream properties that were copied when it was created on
+/// the main thread so the encoders can change while the thread is running.
+/// </summary>
+class ReplayWriterThread : public QThread
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	FileMuxer *		m_muxer;
+	QString			m_filename;
+	ReplayItemList	m_items;
+	bool			m_success;
+	QString			m_error;
+
+public: // Constructor/destructor ---------------------------------------------
+	ReplayWriterThread(
+		FileMuxer *muxer, const QString &filename,
+		const ReplayItemList &items);
+	~ReplayWriterThread();
+
+public: // Methods ------------------------------------------------------------
+	QString			getFilename() const;
+	bool			wasSuccessful() const;
+	QString			getLastError() const;
+
+protected:
+	virtual void	run();
+};
+//=============================================================================
+
+inline QString ReplayWriterThread::getFilename() const
+{
+	return m_filename;
+}
+
+inline bool ReplayWriterThread::wasSuccessful() const
+{
+	return m_success;
+}
+
+inline QString ReplayWriterThread::getLastError() const
+{
+	return m_error;
+}
+
+//=============================================================================
+/// <summary>
+/// A target that continuously keeps the last few seconds of the encoded video
+/// and audio in memory so that the user can save something that just happened
+/// after the fact (An "instant replay"). The buffer is made up of groups of
+/// pictures so that it always begins at a keyframe and whole groups are
+/// discarded from the front once the buffer is longer than the requested
+/// duration or uses more memory than allowed. Saving a replay writes a copy of
+/// the buffer to a new MP4 file in a separate thread while the buffer
+/// continues to be filled.
+/// </summary>
+class ReplayTarget : public Target
+{
+	Q_OBJECT
+
+protected: // Datatypes -------------------------------------------------------
+	struct ReplayGop {
+		ReplayItemList	items; // Begins with a keyframe
+		qint64			startPts;
+		quint64			numBytes;
+	};
+
+protected: // Members ---------------------------------------------------------
+	VideoEncoder *			m_videoEnc;
+	AudioEncoder *			m_audioEnc;
+	AVSynchronizer *		m_syncer;
+	TargetPane *			m_pane;
+	QTimer					m_paneTimer;
+
+	// Replay buffer
+	QList<ReplayGop>		m_gops;
+	quint64					m_bufferBytes;
+	qint64					m_lastPts;
+	ReplayWriterThread *	m_writer;
+	bool					m_warnedMemoryLimit;
+
+	// Options
+	quint32					m_videoEncId;
+	quint32					m_audioEncId;
+	QString					m_filename;
+	int						m_bufferDuration;
+	int						m_maxMemory;
+
+public: // Constructor/destructor ---------------------------------------------
+	ReplayTarget(
+		Profile *profile, const QString &name, const ReplayTrgtOptions &opt);
+	virtual ~ReplayTarget();
+
+public: // Methods ------------------------------------------------------------
+	QString			getFilename() const;
+	int				getBufferDuration() const;
+	int				getMaxMemory() const;
+	bool			isSavingReplay() const;
+	qint64			getBufferedMsec() const;
+	quint64			getBufferedBytes() const;
+
+private:
+	void			updatePaneText(bool fromTimer);
+	void			appendToBuffer(const ReplayItem &item, quint64 numBytes);
+	void			trimBuffer();
+	void			clearBuffer();
+	qint64			ptsToMsec(qint64 pts) const;
+	static quint64	calcPacketBytes(const EncodedPacketList &pkts);
+	static EncodedPacketList	copyPackets(const EncodedPacketList &pkts);
+
+private: // Interface ---------------------------------------------------------
+	virtual void	initializedEvent();
+	virtual bool	activateEvent();
+	virtual void	deactivateEvent();
+
+public:
+	virtual VideoEncoder *	getVideoEncoder() const;
+	virtual AudioEncoder *	getAudioEncoder() const;
+
+	virtual void	serialize(QDataStream *stream) const;
+	virtual bool	unserialize(QDataStream *stream);
+
+	virtual void	setupTargetPane(TargetPane *pane);
+	virtual void	resetTargetPaneEnabled();
+	virtual void	setupTargetInfo(TargetInfoWidget *widget);
+
+	public
+Q_SLOTS: // Slots -------------------------------------------------------------
+	bool			saveReplay();
+	void			paneOutdated();
+	void			paneTimeout();
+	void			frameReady(EncodedFrame frame);
+	void			segmentReady(EncodedSegment segment);
+	void			videoEncodeError(const QString &error);
+
+	private
+Q_SLOTS:
+	void			delayedSimpleDeactivate();
+	void			writerFinished();
+};
+//=============================================================================
+
+inline QString ReplayTarget::getFilename() const
+{
+	return m_filename;
+}
+
+inline int ReplayTarget::getBufferDuration() const
+{
+	return m_bufferDuration;
+}
+
+inline int ReplayTarget::getMaxMemory() const
+{
+	return m_maxMemory;
+}
+
+inline bool ReplayTarget::isSavingReplay() const
+{
+	return m_writer != NULL;
+}
+
+inline quint64 ReplayTarget::getBufferedBytes() const
+{
+	return m_bufferBytes;
+}
+
+#endif // REPLAYTARGET_H
@@ -0,0 +1,128 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "replaytargetsettingspage.h"
+#include "common.h"
+#include "validators.h"
+#include "wizardwindow.h"
+#include <QtCore/QFileInfo>
+
+ReplayTargetSettingsPage::ReplayTargetSettingsPage(QWidget *parent)
+	: QWidget(parent)
+	, m_ui()
+	, m_fileDialog(this)
+{
+	m_ui.setupUi(this);
+
+	// Setup file dialog and connect it to the filename QLineEdit. Replays are
+	// always saved as regular MP4 files.
+	QStringList filters;
+	filters << FileTrgtTypeFilterStrings[FileTrgtMp4Type];
+	filters << "All files (*.*)";
+	m_fileDialog.setNameFilters(filters);
+	m_fileDialog.setShowOverwriteMessage(false);
+	connect(&m_fileDialog, &FileSaveDialog::fileSelected,
+		this, &ReplayTargetSettingsPage::fileDialogSelected);
+	connect(m_ui.filenameBtn, &QPushButton::clicked,
+		&m_fileDialog, &FileSaveDialog::open);
+
+	// Setup validators. Target name must start with a non-whitespace character
+	// and be no longer than 24 characters total
+	m_ui.nameEdit->setValidator(new QRegExpValidator(
+		QRegExp(QStringLiteral("\\S.{,23}")), this));
+	m_ui.filenameEdit->setValidator(new SaveFileValidator(this));
+	connect(m_ui.nameEdit, &QLineEdit::textChanged,
+		this, &ReplayTargetSettingsPage::nameEditChanged);
+	connect(m_ui.filenameEdit, &QLineEdit::textChanged,
+		this, &ReplayTargetSettingsPage::filenameEditChanged);
+}
+
+ReplayTargetSettingsPage::~ReplayTargetSettingsPage()
+{
+}
+
+bool ReplayTargetSettingsPage::isValid() const
+{
+	if(!m_ui.nameEdit->hasAcceptableInput())
+		return false;
+	if(!m_ui.filenameEdit->hasAcceptableInput())
+		return false;
+	return true;
+}
+
+/// <summary>
+/// Reset button code for the page that is shared between multiple controllers.
+/// </summary>
+void ReplayTargetSettingsPage::sharedReset(
+	WizardWindow *wizWin, WizTargetSettings *defaults)
+{
+	setUpdatesEnabled(false);
+
+	// Update fields
+	m_ui.nameEdit->setText(defaults->name);
+	m_ui.filenameEdit->setText(defaults->fileFilename);
+	m_ui.durationBox->setValue(defaults->replayDuration);
+	m_ui.maxMemoryBox->setValue(defaults->replayMaxMemory);
+
+	// Reset validity and connect signal
+	doQLineEditValidate(m_ui.nameEdit);
+	doQLineEditValidate(m_ui.filenameEdit);
+	wizWin->setCanContinue(isValid());
+	connect(this, &ReplayTargetSettingsPage::validityMaybeChanged,
+		wizWin, &WizardWindow::setCanContinue,
+		Qt::UniqueConnection);
+
+	setUpdatesEnabled(true);
+}
+
+/// <summary>
+/// Next button code for the page that is shared between multiple controllers.
+/// </summary>
+void ReplayTargetSettingsPage::sharedNext(WizTargetSettings *settings)
+{
+	// Save fields
+	settings->name = m_ui.nameEdit->text().trimmed();
+	settings->fileFilename = m_ui.filenameEdit->text();
+	settings->replayDuration = m_ui.durationBox->value();
+	settings->replayMaxMemory = m_ui.maxMemoryBox->value();
+}
+
+void ReplayTargetSettingsPage::nameEditChanged(const QString &text)
+{
+	doQLineEditValidate(m_ui.nameEdit);
+	emit validityMaybeChanged(isValid());
+}
+
+void ReplayTargetSettingsPage::filenameEditChanged(const QString &text)
+{
+	m_fileDialog.setInitialFilename(text);
+	doQLineEditValidate(m_ui.filenameEdit);
+	emit validityMaybeChanged(isValid());
+}
+
+void ReplayTargetSettingsPage::fileDialogSelected(const QString &text)
+{
+	QFileInfo info(text);
+	if(info.suffix().isEmpty()) {
+		// Add the default file extension if the user didn't enter one
+		m_ui.filenameEdit->setText(QStringLiteral("%1.%2")
+			.arg(text)
+			.arg(FileTrgtTypeExtStrings[FileTrgtMp4Type]));
+	} else
+		m_ui.filenameEdit->setText(text);
+	// `filenameEditChanged()` is automatically called
+}
@@ -0,0 +1,63 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef REPLAYTARGETSETTINGSPAGE_H
+#define REPLAYTARGETSETTINGSPAGE_H
+
+#include "fileselectdialog.h"
+#include "ui_replaytargetsettingspage.h"
+
+class WizardWindow;
+struct WizTargetSettings;
+
+//=============================================================================
+class ReplayTargetSettingsPage : public QWidget
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	Ui_ReplayTargetSettingsPage	m_ui;
+	FileSaveDialog				m_fileDialog;
+
+public: // Constructor/destructor ---------------------------------------------
+	ReplayTargetSettingsPage(QWidget *parent = NULL);
+	~ReplayTargetSettingsPage();
+
+public: // Methods ------------------------------------------------------------
+	Ui_ReplayTargetSettingsPage *	getUi();
+	bool							isValid() const;
+
+	void	sharedReset(WizardWindow *wizWin, WizTargetSettings *defaults);
+	void	sharedNext(WizTargetSettings *settings);
+
+Q_SIGNALS: // Signals ---------------------------------------------------------
+	void	validityMaybeChanged(bool isValid);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void	nameEditChanged(const QString &text);
+	void	filenameEditChanged(const QString &text);
+	void	fileDialogSelected(const QString &text);
+};
+//=============================================================================
+
+inline Ui_ReplayTargetSettingsPage *ReplayTargetSettingsPage::getUi()
+{
+	return &m_ui;
+}
+
+#endif // REPLAYTARGETSETTINGSPAGE_H
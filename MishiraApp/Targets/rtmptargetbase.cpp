@@ -22,7 +22,9 @@
 #include "avsynchronizer.h"
 #include "constants.h"
 #include "fdkaacencoder.h"
+#include "metrics.h"
 #include "profile.h"
+#include "tracer.h"
 #include "videoencoder.h"
 #include "x264encoder.h"
 #include "Widgets/infowidget.h"
@@ -66,6 +68,12 @@ RTMPTargetBase::RTMPTargetBase(
 	, m_prevDroppedPadding(0)
 	, m_prevDroppedFrames(0)
 
+	// Metric names
+	, m_bytesOutMetric()
+	, m_outQueueMetric()
+	, m_droppedFramesMetric()
+	, m_droppedPaddingMetric()
+
 	// State
 	, m_syncQueue()
 	, m_audioPktsInSyncQueue(0)
@@ -188,6 +196,19 @@ bool RTMPTargetBase::rtmpActivate(const RTMPTargetInfo &info)
 	m_firstReconnectAttempt = true;
 	m_allowReconnect = false;
 
+	// Build the names of our metrics once instead of every time that they are
+	// reported
+	const QString key = QStringLiteral("target");
+	m_bytesOutMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_target_bytes_out_total"), key, m_name);
+	m_outQueueMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_target_out_queue_packets"), key, m_name);
+	m_droppedFramesMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_target_dropped_frames_total"), key, m_name);
+	m_droppedPaddingMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_target_dropped_padding_bytes_total"), key,
+		m_name);
+
 	// Set average upload speed for gamer mode throttling. Needs to be as close
 	// to the actual average as possible for accurate behaviour.
 	int avgUpload = m_videoEnc->getAvgBitrateForCongestion();
@@ -1076,6 +1097,8 @@ void RTMPTargetBase::processFrameDropping()
 			.arg(droppedBytesTotal);
 #endif // 0
 
+		App->getMetrics()->addToCounter(
+			m_droppedPaddingMetric, droppedBytesTotal);
 		emit rtmpDroppedPadding(droppedBytesTotal);
 	}
 
@@ -1139,6 +1162,8 @@ void RTMPTargetBase::processFrameDropping()
 			.arg(numDropped[3]);
 #endif // 0
 
+		App->getMetrics()->addToCounter(
+			m_droppedFramesMetric, numDroppedTotal);
 		emit rtmpDroppedFrames(numDroppedTotal);
 	}
 }
@@ -1232,6 +1257,12 @@ void RTMPTargetBase::writeToPublisher()
 	//	<< QStringLiteral("Wrote %1 packets (%L2 bytes) to network")
 	//	.arg(numWrote).arg(bytesWritten);
 
+	// Report network throughput and how much is still waiting to be sent
+	MetricsRegistry *metrics = App->getMetrics();
+	if(bytesWritten > 0)
+		metrics->addToCounter(m_bytesOutMetric, bytesWritten);
+	metrics->setGauge(m_outQueueMetric, m_outQueue.size());
+
 	// Record bytes written to the network so we can determine upload speed
 	// after trimming the statistics log
 	quint64 now = App->getUsecSinceExec();
@@ -1395,6 +1426,7 @@ void RTMPTargetBase::frameReady(EncodedFrame frame)
 {
 	if(!m_isActive)
 		return;
+	TraceZone zone("RTMPTargetBase::frameReady");
 	//appLog() << frame.getDebugString();
 
 	// If this is the first frame ever received record its DTS so we can give
@@ -1463,6 +1495,7 @@ void RTMPTargetBase::segmentReady(EncodedSegment segment)
 {
 	if(!m_isActive)
 		return;
+	TraceZone zone("RTMPTargetBase::segmentReady");
 	//appLog() << segment.getDebugString();
 
 	// As we shift the DTS of the video so the first frame has a DTS of 0 we
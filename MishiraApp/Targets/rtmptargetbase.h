@@ -74,6 +74,12 @@ protected: // Members ---------------------------------------------------------
 	int					m_prevDroppedPadding;
 	int					m_prevDroppedFrames;
 
+	// Metric names that include our target name
+	QString				m_bytesOutMetric;
+	QString				m_outQueueMetric;
+	QString				m_droppedFramesMetric;
+	QString				m_droppedPaddingMetric;
+
 	// State
 	QVector<QueuedData>	m_syncQueue; // Data waiting be to synced in sending order
 	int					m_audioPktsInSyncQueue;
@@ -143,7 +143,7 @@ void GraphicsWidget::initializeScreen(
 	// Watch profile for canvas changes
 	Profile *profile = App->getProfile();
 	connect(profile, &Profile::frameRendered,
-		this, &GraphicsWidget::canvasChanged);
+		this, &GraphicsWidget::canvasFrameRendered);
 	connect(profile, &Profile::canvasSizeChanged,
 		this, &GraphicsWidget::canvasSizeChanged);
 
@@ -1348,6 +1348,14 @@ void GraphicsWidget::canvasChanged()
 	setDirty(true);
 }
 
+void GraphicsWidget::canvasFrameRendered()
+{
+	// Don't repaint the screen if the canvas is identical to the last frame
+	if(App->getProfile()->isFrameRepeated())
+		return;
+	canvasChanged();
+}
+
 void GraphicsWidget::canvasSizeChanged(const QSize &oldSize)
 {
 	VidgfxContext *gfx = App->getGraphicsContext();
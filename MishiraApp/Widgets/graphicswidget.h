@@ -166,6 +166,7 @@ Q_SLOTS: // Slots -------------------------------------------------------------
 	void	setAutoZoomEnabled(bool enabled);
 	void	realTimeTickEvent(int numDropped, int lateByUsec);
 	void	canvasChanged();
+	void	canvasFrameRendered();
 	void	canvasSizeChanged(const QSize &oldSize);
 	void	graphicsContextInitialized(VidgfxContext *gfx);
 	void	graphicsContextDestroyed(VidgfxContext *gfx);
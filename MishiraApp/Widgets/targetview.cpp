@@ -20,6 +20,7 @@
 #include "profile.h"
 #include "target.h"
 #include "wizardwindow.h"
+#include "Targets/replay/replaytarget.h"
 #include "Widgets/targetpane.h"
 #include "Wizards/newedittargetcontroller.h"
 #include <QtWidgets/QScrollBar>
@@ -33,6 +34,8 @@ TargetView::TargetView(QWidget *parent)
 	// Right-click context menu
 	, m_contextTarget(NULL)
 	, m_contextMenu(this)
+	, m_saveReplayAction(NULL)
+	, m_replaySeparator(NULL)
 	, m_modifyTargetAction(NULL)
 	, m_moveTargetUpAction(NULL)
 	, m_moveTargetDownAction(NULL)
@@ -55,6 +58,9 @@ TargetView::TargetView(QWidget *parent)
 	setWidgetResizable(true);
 
 	// Populate right-click context menu
+	m_saveReplayAction = m_contextMenu.addAction(tr(
+		"Save instant replay"));
+	m_replaySeparator = m_contextMenu.addSeparator();
 	m_modifyTargetAction = m_contextMenu.addAction(tr(
 		"Modify target..."));
 	m_contextMenu.addSeparator();
@@ -136,6 +142,13 @@ bool TargetView::eventFilter(QObject *watched, QEvent *ev)
 void TargetView::showTargetContextMenu(Target *target)
 {
 	m_contextTarget = target;
+
+	// Replay targets can be saved while broadcasting
+	bool isReplay = (target->getType() == TrgtReplayType);
+	m_saveReplayAction->setVisible(isReplay);
+	m_saveReplayAction->setEnabled(isReplay && target->isActive());
+	m_replaySeparator->setVisible(isReplay);
+
 	m_contextMenu.popup(QCursor::pos());
 }
 
@@ -175,7 +188,12 @@ void TargetView::targetContextTriggered(QAction *action)
 {
 	if(m_contextTarget == NULL)
 		return;
-	if(action == m_modifyTargetAction) {
+	if(action == m_saveReplayAction) {
+		// Save the contents of the replay buffer to a file
+		if(m_contextTarget->getType() != TrgtReplayType)
+			return;
+		static_cast<ReplayTarget *>(m_contextTarget)->saveReplay();
+	} else if(action == m_modifyTargetAction) {
 		// Modify target dialog
 		if(App->isBroadcasting()) {
 			App->showBasicWarningDialog(
@@ -38,6 +38,8 @@ private: // Members -----------------------------------------------------------
 	// Right-click context menu
 	Target *		m_contextTarget;
 	QMenu			m_contextMenu;
+	QAction *		m_saveReplayAction;
+	QAction *		m_replaySeparator;
 	QAction *		m_modifyTargetAction;
 	QAction *		m_moveTargetUpAction;
 	QAction *		m_moveTargetDownAction;
@@ -28,6 +28,8 @@
 #include "Targets/file/filetargetsettingspage.h"
 #include "Targets/hitbox/hitboxtarget.h"
 #include "Targets/hitbox/hitboxtargetsettingspage.h"
+#include "Targets/replay/replaytarget.h"
+#include "Targets/replay/replaytargetsettingspage.h"
 #include "Targets/rtmp/rtmptarget.h"
 #include "Targets/rtmp/rtmptargetsettingspage.h"
 #include "Targets/twitch/twitchtarget.h"
@@ -155,6 +157,9 @@ void NewEditTargetController::prepareModifyTarget(
 		FileTarget *fileTarget = static_cast<FileTarget *>(target);
 		settings->fileFilename = fileTarget->getFilename();
 		settings->fileType = fileTarget->getFileType();
+		settings->fileFragDuration = fileTarget->getFragDuration();
+		settings->fileSplitDuration = fileTarget->getSplitDuration();
+		settings->fileSplitSize = fileTarget->getSplitSize();
 		break; }
 	case TrgtRtmpType: {
 		RTMPTarget *rtmpTarget = static_cast<RTMPTarget *>(target);
@@ -185,6 +190,12 @@ void NewEditTargetController::prepareModifyTarget(
 		settings->rtmpHideStreamName = true;
 		settings->rtmpPadVideo = true;
 		break; }
+	case TrgtReplayType: {
+		ReplayTarget *replayTarget = static_cast<ReplayTarget *>(target);
+		settings->fileFilename = replayTarget->getFilename();
+		settings->replayDuration = replayTarget->getBufferDuration();
+		settings->replayMaxMemory = replayTarget->getMaxMemory();
+		break; }
 	}
 }
 
@@ -270,6 +281,9 @@ void NewEditTargetController::setPageBasedOnTargetType()
 	case TrgtHitboxType:
 		m_curPage = WizHitboxTargetSettingsPage;
 		break;
+	case TrgtReplayType:
+		m_curPage = WizReplayTargetSettingsPage;
+		break;
 	}
 	m_wizWin->setPage(m_curPage);
 }
@@ -511,6 +525,14 @@ void NewEditTargetController::resetHitboxTargetPage()
 	page->sharedReset(m_wizWin, m_defaults);
 }
 
+void NewEditTargetController::resetReplayTargetPage()
+{
+	// Use common "reset" button code for this page
+	ReplayTargetSettingsPage *page =
+		static_cast<ReplayTargetSettingsPage *>(m_wizWin->getActivePage());
+	page->sharedReset(m_wizWin, m_defaults);
+}
+
 void NewEditTargetController::resetPage()
 {
 	// Reset whatever page we are currently on
@@ -542,6 +564,9 @@ void NewEditTargetController::resetPage()
 	case WizHitboxTargetSettingsPage:
 		resetHitboxTargetPage();
 		break;
+	case WizReplayTargetSettingsPage:
+		resetReplayTargetPage();
+		break;
 	}
 }
 
@@ -580,6 +605,7 @@ void NewEditTargetController::backPage()
 	case WizTwitchTargetSettingsPage:
 	case WizUstreamTargetSettingsPage:
 	case WizHitboxTargetSettingsPage:
+	case WizReplayTargetSettingsPage:
 		m_curPage = WizAudioSettingsPage;
 		m_wizWin->setPage(m_curPage);
 		resetPage();
@@ -748,6 +774,24 @@ void NewEditTargetController::nextHitboxTargetPage()
 		m_wizWin->controllerFinished();
 }
 
+void NewEditTargetController::nextReplayTargetPage()
+{
+	// Use common "next" button code for this page
+	ReplayTargetSettingsPage *page =
+		static_cast<ReplayTargetSettingsPage *>(m_wizWin->getActivePage());
+	page->sharedNext(&m_settings);
+
+	// Create/edit actual target
+	recreateTarget();
+
+	// Our wizard has completed, close the wizard window or return to previous
+	// controller depending on the shared settings
+	if(m_shared->netReturnToEditTargets)
+		m_wizWin->setController(WizEditTargetsController);
+	else
+		m_wizWin->controllerFinished();
+}
+
 void NewEditTargetController::nextPage()
 {
 	// Save and continue from whatever page we are currently on
@@ -779,6 +823,9 @@ void NewEditTargetController::nextPage()
 	case WizHitboxTargetSettingsPage:
 		nextHitboxTargetPage();
 		break;
+	case WizReplayTargetSettingsPage:
+		nextReplayTargetPage();
+		break;
 	}
 }
 
@@ -805,6 +852,9 @@ void NewEditTargetController::recreateTarget()
 		opt.audioEncId = (audEnc == NULL) ? 0 : audEnc->getId();
 		opt.filename = m_settings.fileFilename;
 		opt.fileType = m_settings.fileType;
+		opt.fragDuration = m_settings.fileFragDuration;
+		opt.splitDuration = m_settings.fileSplitDuration;
+		opt.splitSize = m_settings.fileSplitSize;
 		target = profile->createFileTarget(m_settings.name, opt, before);
 		break; }
 	case TrgtRtmpType: {
@@ -844,6 +894,15 @@ void NewEditTargetController::recreateTarget()
 		opt.username = m_settings.username;
 		target = profile->createHitboxTarget(m_settings.name, opt, before);
 		break; }
+	case TrgtReplayType: {
+		ReplayTrgtOptions opt;
+		opt.videoEncId = (vidEnc == NULL) ? 0 : vidEnc->getId();
+		opt.audioEncId = (audEnc == NULL) ? 0 : audEnc->getId();
+		opt.filename = m_settings.fileFilename;
+		opt.bufferDuration = m_settings.replayDuration;
+		opt.maxMemory = m_settings.replayMaxMemory;
+		target = profile->createReplayTarget(m_settings.name, opt, before);
+		break; }
 	}
 	if(target != NULL) {
 		if(wasEnabled)
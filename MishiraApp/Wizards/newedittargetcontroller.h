@@ -60,6 +60,7 @@ private: // Methods -----------------------------------------------------------
 	void			resetTwitchTargetPage();
 	void			resetUstreamTargetPage();
 	void			resetHitboxTargetPage();
+	void			resetReplayTargetPage();
 
 	void			nextTargetTypePage();
 	void			nextVideoPage();
@@ -69,6 +70,7 @@ private: // Methods -----------------------------------------------------------
 	void			nextTwitchTargetPage();
 	void			nextUstreamTargetPage();
 	void			nextHitboxTargetPage();
+	void			nextReplayTargetPage();
 
 	void			recreateTarget();
 	VideoEncoder *	getOrCreateVideoEncoder();
@@ -1040,6 +1040,9 @@ void NewProfileController::createProfile()
 		opt.audioEncId = (audEnc == NULL) ? 0 : audEnc->getId();
 		opt.filename = m_targetSettings.fileFilename;
 		opt.fileType = m_targetSettings.fileType;
+		opt.fragDuration = m_targetSettings.fileFragDuration;
+		opt.splitDuration = m_targetSettings.fileSplitDuration;
+		opt.splitSize = m_targetSettings.fileSplitSize;
 		target = profile->createFileTarget(m_targetSettings.name, opt);
 		break; }
 	case TrgtRtmpType: {
@@ -1633,19 +1636,28 @@ void NewProfileController::doNextBenchmarkTest()
 	// Get CPU usage of previous test
 	float totalAvgCpu = 0.0f;
 	float ourAvgCpu = 0.0f;
+	float mainThreadCpu = 0.0f;
 	if(m_curUsage != NULL) {
 		// End monitoring CPU usage
 		ourAvgCpu = m_curUsage->getAvgUsage(&totalAvgCpu);
+		m_curUsage->update();
+		mainThreadCpu =
+			m_curUsage->getRecentThreadUsage(QStringLiteral("Main"));
 		delete m_curUsage;
 		m_curUsage = NULL;
 	}
 
 	// Did the CPU usage exceed our limit? If the system's CPU usage is above
 	// 90% then it's dangerous for us to use the result even if we were below
-	// our own limit so we discard the test result.
+	// our own limit so we discard the test result. The same applies if our
+	// main thread is saturated as it will cause dropped frames no matter how
+	// many other cores are idle.
 	bool exceededCpuLimit = false;
-	if(ourAvgCpu > m_maxCpuUsage || totalAvgCpu > 0.9f)
+	if(ourAvgCpu > m_maxCpuUsage || totalAvgCpu > 0.9f ||
+		mainThreadCpu > 0.9f)
+	{
 		exceededCpuLimit = true;
+	}
 
 	if(m_curEncoder != NULL) {
 		// Destroy encoder object
@@ -1677,9 +1689,10 @@ void NewProfileController::doNextBenchmarkTest()
 		if(exceededCpuLimit)
 			result = QStringLiteral("CPU usage exceeded limits");
 		appLog() << QStringLiteral(
-			"Our CPU usage = %1%; System CPU usage = %2%; %3")
+			"Our CPU usage = %1%; System CPU usage = %2%; Main thread usage = %3%; %4")
 			.arg(qRound(ourAvgCpu * 100.0f))
 			.arg(qRound(totalAvgCpu * 100.0f))
+			.arg(qRound(mainThreadCpu * 100.0f))
 			.arg(result);
 	}
 
@@ -97,6 +97,14 @@ void TargetTypePage::sharedReset(
 		layout, TrgtRtmpType, tr("Other RTMP"),
 		QPixmap(":/Resources/target-200x100-rtmp.png"), 1, 1);
 
+	// Instant replays are only useful as an additional target and are not
+	// offered when creating a new profile
+	if(!isNewProfile) {
+		addTargetType(
+			layout, TrgtReplayType, tr("Instant replay"),
+			QPixmap(":/Resources/target-200x100-file.png"), 1, 2);
+	}
+
 	// Spacer to make sure all targets are at the top of the scroll area
 	layout->addItem(
 		new QSpacerItem(0, 0, QSizePolicy::Fixed, QSizePolicy::Expanding),
@@ -25,19 +25,26 @@
 #include "constants.h"
 #include "cpuusage.h"
 #include "darkstyle.h"
+#include "fileimagetexture.h"
+#include "imagecache.h"
 #include "layer.h"
 #include "layerfactory.h"
 #include "layerdialogwindow.h"
 #include "logfilemanager.h"
 #include "mainwindow.h"
+#include "metrics.h"
 #include "profile.h"
 #include "scaler.h"
 #include "scene.h"
 #include "sceneitem.h"
+#include "scriptservice.h"
 #include "stylehelper.h"
 #include "target.h"
+#include "threadpolicy.h"
+#include "tracer.h"
 #include "videosourcemanager.h"
 #include "wizardwindow.h"
+#include "Layers/text/textrendertask.h"
 #include "Pages/mainpage.h"
 #include <Libbroadcast/brolog.h>
 #include <Libdeskcap/caplog.h>
@@ -52,6 +59,46 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
+// Measure the cost of logging to the calling thread on startup
+#define ENABLE_LOG_BENCHMARK 0
+
+// Measure how long each text stroke technique takes on startup
+#define ENABLE_TEXT_STROKE_BENCHMARK 0
+
+// How long before the next real-time tick that Qt event processing must
+// yield back to the main loop
+const quint64 QT_EVENTS_TICK_MARGIN_USEC = 1000;
+
+// If there is less time than this until the next real-time tick then Qt
+// events are deferred so that they can be coalesced with the next pump
+const quint64 QT_EVENTS_MIN_SLICE_USEC = 2000;
+
+// The maximum amount of time that Qt events can be deferred for before they
+// are processed regardless of the next real-time tick. This keeps the user
+// interface responsive if we are constantly running late.
+const quint64 QT_EVENTS_MAX_DEFER_USEC = 50000;
+
+// Names of the metrics that are reported from the main loop. They are created
+// once so that reporting them every frame doesn't construct new strings.
+const QString RT_FRAMES_DROPPED_METRIC =
+	QStringLiteral("mishira_realtime_frames_dropped_total");
+const QString RT_FRAME_LATENESS_METRIC =
+	QStringLiteral("mishira_realtime_frame_lateness_usec");
+const QString RT_TICKS_DROPPED_METRIC =
+	QStringLiteral("mishira_realtime_ticks_dropped_total");
+const QString RT_TICK_LATENESS_METRIC =
+	QStringLiteral("mishira_realtime_tick_lateness_usec");
+const QString QUEUED_FRAMES_METRIC = QStringLiteral("mishira_queued_frames");
+const QString QUEUED_FRAMES_DROPPED_METRIC =
+	QStringLiteral("mishira_queued_frames_dropped_total");
+const QString QUEUED_FRAME_USEC_METRIC =
+	QStringLiteral("mishira_queued_frame_usec");
+const QString TICKS_DELAYED_BY_QT_METRIC =
+	QStringLiteral("mishira_ticks_delayed_by_qt_total");
+const QString QT_EVENTS_USEC_METRIC = QStringLiteral("mishira_qt_events_usec");
+const QString REPEATED_FRAME_RATIO_METRIC =
+	QStringLiteral("mishira_canvas_repeated_frame_ratio");
+
 //=============================================================================
 // Helpers
 
@@ -210,11 +257,15 @@ Application::Application(int &argc, char **argv, AppSharedSegment *shm)
 	, m_gfxContext(NULL)
 	, m_audioManager(NULL)
 	, m_videoManager(NULL)
+	, m_metrics(NULL)
 	, m_activeCursor(Qt::ArrowCursor)
 	, m_dataDir()
 	, m_isBroadcasting(false)
 	, m_isBroadcastingChanging(false)
 	, m_broadcastCpuUsage(NULL)
+	, m_cpuUsage(NULL)
+	, m_mainThreadSaturated(false)
+	, m_cpuThreadMetrics()
 	, m_isInLowCPUMode(false)
 
 	// Main loop
@@ -231,8 +282,11 @@ Application::Application(int &argc, char **argv, AppSharedSegment *shm)
 	, m_tickFrameMultiple(1)
 	, m_timeSinceLogFileFlush(0)
 	, m_timeSinceProfileSave(0)
+	, m_timeSinceCpuUpdate(0)
+	, m_timeSinceRepeatStatsLog(0)
 	, m_averageFrameJitter(0.0f)
 	, m_qtExecTimer(this)
+	, m_lastQtProcessTime(0)
 	, m_exiting(false)
 	, m_exitCode(1)
 	, m_deleteSettingsOnExit(false)
@@ -370,8 +424,34 @@ bool Application::initialize()
 	// Create asynchronous IO worker thread
 	m_asyncIo = AsyncIO::createWorker();
 
+	// Create shared image cache
+	m_imageCache = new ImageCache();
+
+	// Create performance metrics registry
+	m_metrics = new MetricsRegistry();
+	describeMetrics();
+
+	// Continuously monitor the CPU usage of every thread so that we can
+	// detect when a single thread is saturated
+	ThreadPolicy::applyToCurrentThread(
+		ThrdRealTimeClass, QStringLiteral("Main"));
+	m_cpuUsage = createCPUUsage();
+
+	// Create shared script execution threads
+	m_scriptService = new ScriptService();
+
 	// Initialize application settings from file
 	m_appSettings = new AppSettings(m_dataDir.filePath("Application.config"));
+	ThreadPolicy::setEncoderCoreMask(m_appSettings->getEncoderCoreMask());
+
+	// Only allow the metrics registry to be scraped if the user enabled it
+	if(m_appSettings->getMetricsEnabled())
+		m_metrics->listen(m_appSettings->getMetricsPort());
+
+	// Record a performance timeline so that the user can save it if they
+	// experience stuttering. Only done if the user enabled it.
+	if(m_appSettings->getTracingEnabled())
+		Tracer::initialize();
 
 	// Initialize translations, TODO
 
@@ -412,6 +492,7 @@ bool Application::initialize()
 
 	// Log system information
 	logSystemInfo();
+	ThreadPolicy::logPolicy();
 
 	// Create audio source manager
 	m_audioManager = new AudioSourceManager();
@@ -493,6 +574,16 @@ bool Application::initialize()
 	// Hide the splash screen
 	hideLauncherSplash();
 
+	// Format and write log messages in the background from now on so that
+	// logging never stalls the real-time threads
+	Log::startThread();
+#if ENABLE_LOG_BENCHMARK
+	Log::runBenchmark(10000);
+#endif // ENABLE_LOG_BENCHMARK
+#if ENABLE_TEXT_STROKE_BENCHMARK
+	TextRenderTask::runStrokeBenchmark();
+#endif // ENABLE_TEXT_STROKE_BENCHMARK
+
 	// Load our profile
 	bool profileCreated = false;
 	changeActiveProfile(m_appSettings->getActiveProfile(), &profileCreated,
@@ -506,6 +597,178 @@ bool Application::initialize()
 	return true;
 }
 
+/// <summary>
+/// Adds help text to the metrics that are reported by the application and its
+/// subsystems. Metrics that are not described here are still exported but
+/// without any help text.
+/// </summary>
+void Application::describeMetrics()
+{
+	// Main loop
+	m_metrics->describe(
+		RT_FRAMES_DROPPED_METRIC,
+		MetricsRegistry::Counter,
+		QStringLiteral("Real-time video frames that were skipped"));
+	m_metrics->describe(
+		RT_FRAME_LATENESS_METRIC,
+		MetricsRegistry::Histogram,
+		QStringLiteral("How late real-time video frames were dispatched"));
+	m_metrics->describe(
+		RT_TICKS_DROPPED_METRIC,
+		MetricsRegistry::Counter,
+		QStringLiteral("Real-time ticks that were skipped"));
+	m_metrics->describe(
+		RT_TICK_LATENESS_METRIC,
+		MetricsRegistry::Histogram,
+		QStringLiteral("How late real-time ticks were dispatched"));
+	m_metrics->describe(
+		QUEUED_FRAMES_METRIC,
+		MetricsRegistry::Gauge,
+		QStringLiteral("Queued frames that are waiting to be processed"));
+	m_metrics->describe(
+		QUEUED_FRAMES_DROPPED_METRIC,
+		MetricsRegistry::Counter,
+		QStringLiteral("Queued frames that were dropped"));
+	m_metrics->describe(
+		QUEUED_FRAME_USEC_METRIC,
+		MetricsRegistry::Histogram,
+		QStringLiteral("Time taken to process a single queued frame"));
+
+	m_metrics->describe(
+		QStringLiteral("mishira_main_loop_wake_lateness_usec"),
+		MetricsRegistry::Histogram,
+		QStringLiteral("How late the main loop woke up after sleeping"));
+	m_metrics->describe(
+		TICKS_DELAYED_BY_QT_METRIC,
+		MetricsRegistry::Counter,
+		QStringLiteral("Real-time ticks delayed by processing Qt events"));
+	m_metrics->describe(
+		QT_EVENTS_USEC_METRIC,
+		MetricsRegistry::Histogram,
+		QStringLiteral("Time taken to process a single slice of Qt events"));
+
+	// Rendering
+	m_metrics->describe(
+		QStringLiteral("mishira_canvas_frames_rendered_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Canvas frames that were rendered"));
+	m_metrics->describe(
+		QStringLiteral("mishira_canvas_frames_repeated_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Canvas frames that were repeated without rendering"));
+	m_metrics->describe(
+		QStringLiteral("mishira_canvas_repeated_frame_ratio"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Frames repeated without rendering during broadcast"));
+
+	m_metrics->describe(
+		QStringLiteral("mishira_image_prepared_texture_hits_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Scaled image textures that were already cached"));
+	m_metrics->describe(
+		QStringLiteral("mishira_image_prepared_texture_misses_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Scaled image textures that had to be prepared"));
+
+	// CPU usage
+	m_metrics->describe(
+		QStringLiteral("mishira_cpu_process_usage_ratio"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Recent CPU usage of our process vs the whole system"));
+	m_metrics->describe(
+		QStringLiteral("mishira_cpu_system_usage_ratio"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Recent CPU usage of the whole system"));
+	m_metrics->describe(
+		QStringLiteral("mishira_cpu_thread_usage_ratio"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Recent CPU usage of a thread relative to one core"));
+
+	// File IO
+	m_metrics->describe(
+		QStringLiteral("mishira_io_queue_latency_usec"),
+		MetricsRegistry::Histogram,
+		QStringLiteral("Time file reads spent waiting in the queue"));
+	m_metrics->describe(
+		QStringLiteral("mishira_io_read_usec"),
+		MetricsRegistry::Histogram,
+		QStringLiteral("Time taken to read and decode a single file"));
+	m_metrics->describe(
+		QStringLiteral("mishira_io_read_bytes_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Bytes read from files"));
+	m_metrics->describe(
+		QStringLiteral("mishira_io_mapped_bytes_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Bytes read from files using memory mapping"));
+	m_metrics->describe(
+		QStringLiteral("mishira_io_cancelled_reads_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("File reads that were cancelled before completing"));
+	m_metrics->describe(
+		QStringLiteral("mishira_io_pending_reads"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("File reads that are queued or in progress"));
+
+	// Video encoders
+	m_metrics->describe(
+		QStringLiteral("mishira_encoder_frames_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Video frames that were sent to an encoder"));
+	m_metrics->describe(
+		QStringLiteral("mishira_encoder_bytes_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Encoded video bytes output by an encoder"));
+	m_metrics->describe(
+		QStringLiteral("mishira_encoder_frame_usec"),
+		MetricsRegistry::Histogram,
+		QStringLiteral("Time taken to submit a single frame to an encoder"));
+	m_metrics->describe(
+		QStringLiteral("mishira_encoder_low_cpu_mode_entries_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Times an encoder entered low CPU usage mode"));
+	m_metrics->describe(
+		QStringLiteral("mishira_encoder_low_cpu_mode_frames_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Video frames encoded in low CPU usage mode"));
+
+	// Audio
+	m_metrics->describe(
+		QStringLiteral("mishira_audio_output_rms_volume"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Linear RMS volume of the master audio output"));
+	m_metrics->describe(
+		QStringLiteral("mishira_audio_output_peak_volume"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Linear peak volume of the master audio output"));
+	m_metrics->describe(
+		QStringLiteral("mishira_audio_input_rms_volume"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Linear RMS volume of a filtered audio input"));
+	m_metrics->describe(
+		QStringLiteral("mishira_audio_input_peak_volume"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Linear peak volume of a filtered audio input"));
+
+	// Network targets
+	m_metrics->describe(
+		QStringLiteral("mishira_target_bytes_out_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Bytes written to a target's network socket"));
+	m_metrics->describe(
+		QStringLiteral("mishira_target_dropped_frames_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Frames dropped due to network congestion"));
+	m_metrics->describe(
+		QStringLiteral("mishira_target_dropped_padding_bytes_total"),
+		MetricsRegistry::Counter,
+		QStringLiteral("Padding bytes dropped due to network congestion"));
+	m_metrics->describe(
+		QStringLiteral("mishira_target_out_queue_packets"),
+		MetricsRegistry::Gauge,
+		QStringLiteral("Packets waiting to be written to the network"));
+}
+
 void Application::processOurEvents(bool fromQtExecTimer)
 {
 	// We have three types of events to dispatch: Real-time ticks, real-time
@@ -551,9 +814,14 @@ void Application::processOurEvents(bool fromQtExecTimer)
 			// "Low jitter" slots must execute as quickly as possible to ensure
 			// that other "low jitter" slots are actually low jitter as well.
 			//appLog() << "*** Real-time frame ***";
-			emit lowJitterRealTimeFrameEvent(dropped, lateBy);
-			emit realTimeFrameEvent(dropped, lateBy);
+			{
+				TraceZone zone("realTimeFrameEvent");
+				emit lowJitterRealTimeFrameEvent(dropped, lateBy);
+				emit realTimeFrameEvent(dropped, lateBy);
+			}
 			processedSomething = true;
+			m_metrics->addToCounter(RT_FRAMES_DROPPED_METRIC, dropped);
+			m_metrics->observe(RT_FRAME_LATENESS_METRIC, lateBy);
 
 			// Measure average jitter for debug purposes. WARNING: We misuse
 			// the term "jitter" as we're actually measuring how late we are
@@ -583,8 +851,11 @@ void Application::processOurEvents(bool fromQtExecTimer)
 			m_nextRTTickNum = latest + 1; // Next tick to process
 
 			//appLog() << "*** Real-time tick ***";
+			TraceZone zone("realTimeTickEvent");
 			emit realTimeTickEvent(dropped, lateBy);
 			processedSomething = true;
+			m_metrics->addToCounter(RT_TICKS_DROPPED_METRIC, dropped);
+			m_metrics->observe(RT_TICK_LATENESS_METRIC, lateBy);
 		}
 
 		//---------------------------------------------------------------------
@@ -597,6 +868,7 @@ void Application::processOurEvents(bool fromQtExecTimer)
 		const float NUM_SECS_UNTIL_LOW_CPU_MODE = 0.333f;
 		uint framesToProcess = m_nextRTFrameNum - m_nextQFrameNum;
 		//appLog() << framesToProcess << " queued frames to process";
+		m_metrics->setGauge(QUEUED_FRAMES_METRIC, framesToProcess);
 		if((float)framesToProcess > m_curVideoFreq.asFloat() *
 			NUM_SECS_UNTIL_LOW_CPU_MODE)
 		{
@@ -607,6 +879,8 @@ void Application::processOurEvents(bool fromQtExecTimer)
 		for(;;) {
 			if(m_nextQFrameNum >= m_nextRTFrameNum)
 				break; // No more frames to process
+			TraceZone zone("queuedFrameEvent");
+			quint64 frameStartTime = getUsecSinceExec();
 
 			// Emit signals for every frame that hasn't processed yet if we
 			// need to (E.g. rendering a video) or just otherwise the last
@@ -625,8 +899,11 @@ void Application::processOurEvents(bool fromQtExecTimer)
 				m_nextQFrameNum = m_nextRTFrameNum;
 				//appLog() << "*** Queued frame (With drops) ***";
 				emit queuedFrameEvent(m_nextQFrameNum - 1, dropped);
+				m_metrics->addToCounter(QUEUED_FRAMES_DROPPED_METRIC, dropped);
 			}
 			processedSomething = true;
+			m_metrics->observe(
+				QUEUED_FRAME_USEC_METRIC, getUsecSinceExec() - frameStartTime);
 
 			// Flush the graphics context after every frame so that shared
 			// textures in graphics hooks can be reused without causing
@@ -660,12 +937,43 @@ void Application::processOurEvents(bool fromQtExecTimer)
 	}
 }
 
+/// <summary>
+/// Processes pending Qt events within the time that is remaining until the
+/// next real-time tick so that heavy user interface work cannot delay our
+/// real-time events. If there isn't enough time left then the events are
+/// deferred and processed together during a later call.
+/// </summary>
 void Application::processQtNonblocking()
 {
-	beginQtExecTimer();
-	processEvents();
+	// Calculate our time budget
+	quint64 now = getUsecSinceExec();
+	quint64 deadline =
+		calcTimeOfEvent(m_nextRTTickNum, m_mainLoopFreq) + m_tickTimeOrigin;
+	quint64 budget = 0;
+	if(deadline > now + QT_EVENTS_TICK_MARGIN_USEC)
+		budget = deadline - now - QT_EVENTS_TICK_MARGIN_USEC;
+	if(budget < QT_EVENTS_MIN_SLICE_USEC &&
+		now < m_lastQtProcessTime + QT_EVENTS_MAX_DEFER_USEC)
+	{
+		return; // Not enough time, defer until later
+	}
+	int budgetMsec = qMax(1, (int)(budget / 1000ULL));
+
+	// Process events. Qt checks the time limit between each batch of events
+	// so we also make sure that our Qt timer fires at our deadline in case
+	// Qt blocks for an extended period of time.
+	TraceZone zone("processQtEvents");
+	beginQtExecTimer(budgetMsec);
+	processEvents(QEventLoop::AllEvents, budgetMsec);
 	sendPostedEvents(NULL, QEvent::DeferredDelete);
 	stopQtExecTimer();
+	m_lastQtProcessTime = getUsecSinceExec();
+
+	// Record if we missed the next tick due to user interface work
+	if(m_lastQtProcessTime > deadline) {
+		m_metrics->addToCounter(TICKS_DELAYED_BY_QT_METRIC);
+	}
+	m_metrics->observe(QT_EVENTS_USEC_METRIC, m_lastQtProcessTime - now);
 }
 
 /// <summary>
@@ -705,11 +1013,37 @@ void Application::miscRealTimeTickEvent(int numDropped, int lateByUsec)
 	if(m_timeSinceProfileSave > PROFILE_SAVE_PERIOD) {
 		//appLog() << "*** Profile save ***";
 		if(m_profile != NULL)
-			m_profile->saveToDisk();
-		m_appSettings->saveToDisk();
+			m_profile->saveToDisk(true);
+		m_appSettings->saveToDisk(true);
 		m_timeSinceProfileSave = 0;
 	}
 
+	// Sample CPU usage and file IO statistics every second
+	const int CPU_UPDATE_PERIOD = 1000; // 1 second
+	m_timeSinceCpuUpdate += msecSinceLastProcess;
+	if(m_timeSinceCpuUpdate >= CPU_UPDATE_PERIOD) {
+		updateCPUUsage();
+		m_asyncIo->reportMetrics(m_metrics);
+		m_timeSinceCpuUpdate = 0;
+	}
+
+	// Log how many frames were repeated so far every X minutes while
+	// broadcasting so that long broadcasts can be diagnosed from the log
+	// without waiting for them to end. The metric is updated continuously.
+	const int REPEAT_STATS_LOG_PERIOD = 10 * 60 * 1000; // 10 minutes
+	if(m_isBroadcasting && m_profile != NULL) {
+		m_metrics->setGauge(REPEATED_FRAME_RATIO_METRIC,
+			m_profile->getRepeatedFrameFraction());
+		m_timeSinceRepeatStatsLog += msecSinceLastProcess;
+		if(m_timeSinceRepeatStatsLog > REPEAT_STATS_LOG_PERIOD) {
+			appLog() << QStringLiteral(
+				"Frames repeated without rendering so far during "
+				"broadcast = %1%")
+				.arg(qRound(m_profile->getRepeatedFrameFraction() * 100.0f));
+			m_timeSinceRepeatStatsLog = 0;
+		}
+	}
+
 	// When changing profiles or scenes we disable updates on the main window
 	// to make it repaint nicer. Once the graphics context is created and is
 	// ready to be rendered on we know that the profile is now fully loaded.
@@ -730,6 +1064,66 @@ void Application::enableUpdatesTimeout()
 	}
 }
 
+/// <summary>
+/// Records a new CPU usage sample and reports the usage over the rolling
+/// window to our metrics registry. We also warn the user if the main thread
+/// is saturated as it will result in dropped frames regardless of how much
+/// CPU time is available on the other cores.
+/// </summary>
+void Application::updateCPUUsage()
+{
+	m_cpuUsage->update();
+
+	float totalUsage = 0.0f;
+	float procUsage = m_cpuUsage->getRecentUsage(&totalUsage);
+	m_metrics->setGauge(
+		QStringLiteral("mishira_cpu_process_usage_ratio"), procUsage);
+	m_metrics->setGauge(
+		QStringLiteral("mishira_cpu_system_usage_ratio"), totalUsage);
+
+	// Report every thread. Unregistered threads (E.g. encoder or capture
+	// threads that were created by a library) are identified by their ID.
+	float mainUsage = 0.0f;
+	QStringList threadMetrics;
+	CPUThreadUsageList threads = m_cpuUsage->getRecentThreadUsage();
+	for(int i = 0; i < threads.size(); i++) {
+		const CPUThreadUsage &thread = threads.at(i);
+		QString name = thread.name;
+		if(name.isEmpty())
+			name = QString::number(thread.threadId);
+		if(name == QStringLiteral("Main"))
+			mainUsage = thread.usage;
+		const QString metric = MetricsRegistry::withLabel(
+			QStringLiteral("mishira_cpu_thread_usage_ratio"),
+			QStringLiteral("thread"), name);
+		m_metrics->setGauge(metric, thread.usage);
+		threadMetrics.append(metric);
+	}
+
+	// Stop exporting threads that have exited so that thread IDs don't
+	// accumulate forever
+	for(int i = 0; i < m_cpuThreadMetrics.size(); i++) {
+		const QString &metric = m_cpuThreadMetrics.at(i);
+		if(!threadMetrics.contains(metric))
+			m_metrics->remove(metric);
+	}
+	m_cpuThreadMetrics = threadMetrics;
+
+	// Log when the main thread becomes saturated
+	const float SATURATED_USAGE = 0.95f;
+	bool saturated = (mainUsage >= SATURATED_USAGE);
+	if(saturated != m_mainThreadSaturated) {
+		m_mainThreadSaturated = saturated;
+		if(saturated) {
+			appLog(Log::Warning) << QStringLiteral(
+				"Main thread is saturated (%1% of a CPU core)")
+				.arg(qRound(mainUsage * 100.0f));
+		} else {
+			appLog() << QStringLiteral("Main thread is no longer saturated");
+		}
+	}
+}
+
 /// <summary>
 /// Processes the miscellaneous things that should be done once per frame.
 /// </summary>
@@ -746,19 +1140,14 @@ void Application::miscRealTimeFrameEvent(int numDropped, int lateByUsec)
 /// <returns>The ID of the latest tick</returns>
 uint Application::calcLatestTickForTime(quint64 curTime, quint64 &lateByOut)
 {
-	// Calculate the latest tick that can be processed right now. We do this
-	// by incrementing our tick number until the tick time stamp is in the
-	// future then decrement one.
-	quint64 nextTick = m_nextRTTickNum; // We do 64-bit maths below
-	for(;;nextTick++) {
-		quint64 tickTime =
-			(nextTick * 1000000 * m_mainLoopFreq.denominator) /
-			m_mainLoopFreq.numerator + m_tickTimeOrigin;
-		if(tickTime > curTime)
-			break;
+	// Calculate the latest tick that can be processed right now. This is done
+	// in constant time so that we don't spin after a long stall.
+	quint64 nextTick = 0; // We do 64-bit maths below
+	if(curTime >= m_tickTimeOrigin) {
+		nextTick = calcLatestEventAtTime(
+			curTime - m_tickTimeOrigin, m_mainLoopFreq);
 	}
-	nextTick--;
-	if(nextTick < m_nextRTTickNum) {
+	if(curTime < m_tickTimeOrigin || nextTick < m_nextRTTickNum) {
 		// No new ticks to process
 		lateByOut = 0;
 		return m_nextRTTickNum - 1;
@@ -773,8 +1162,7 @@ uint Application::calcLatestTickForTime(quint64 curTime, quint64 &lateByOut)
 
 	// Determine how late this tick is. Up to 25% late is okay
 	quint64 tickTime =
-		(nextTick * 1000000 * m_mainLoopFreq.denominator) /
-		m_mainLoopFreq.numerator + m_tickTimeOrigin;
+		calcTimeOfEvent(nextTick, m_mainLoopFreq) + m_tickTimeOrigin;
 	//quint64 allowedLate =
 	//	(1000000 * m_mainLoopFreq.denominator) / m_mainLoopFreq.numerator / 4;
 	quint64 lateBy = curTime - tickTime;
@@ -792,19 +1180,14 @@ uint Application::calcLatestTickForTime(quint64 curTime, quint64 &lateByOut)
 /// <returns>The ID of the latest frame</returns>
 uint Application::calcLatestFrameForTime(quint64 curTime, quint64 &lateByOut)
 {
-	// Calculate the latest frame that can be processed right now. We do this
-	// by incrementing our frame number until the frame time stamp is in the
-	// future then decrement one.
-	quint64 nextFrame = m_nextRTFrameNum; // We do 64-bit maths below
-	for(;;nextFrame++) {
-		quint64 frameTime =
-			(nextFrame * 1000000 * m_curVideoFreq.denominator) /
-			m_curVideoFreq.numerator + m_tickTimeOrigin;
-		if(frameTime > curTime)
-			break;
+	// Calculate the latest frame that can be processed right now. This is
+	// done in constant time so that we don't spin after a long stall.
+	quint64 nextFrame = 0; // We do 64-bit maths below
+	if(curTime >= m_tickTimeOrigin) {
+		nextFrame = calcLatestEventAtTime(
+			curTime - m_tickTimeOrigin, m_curVideoFreq);
 	}
-	nextFrame--;
-	if(nextFrame < m_nextRTFrameNum) {
+	if(curTime < m_tickTimeOrigin || nextFrame < m_nextRTFrameNum) {
 		// No new frames to process
 		lateByOut = 0;
 		return m_nextRTFrameNum - 1;
@@ -819,8 +1202,7 @@ uint Application::calcLatestFrameForTime(quint64 curTime, quint64 &lateByOut)
 
 	// Determine how late this frame is. Up to 25% late is okay
 	quint64 frameTime =
-		(nextFrame * 1000000 * m_curVideoFreq.denominator) /
-		m_curVideoFreq.numerator + m_tickTimeOrigin;
+		calcTimeOfEvent(nextFrame, m_curVideoFreq) + m_tickTimeOrigin;
 	//quint64 allowedLate =
 	//	(1000000 * m_curVideoFreq.denominator) / m_curVideoFreq.numerator / 4;
 	quint64 lateBy = curTime - frameTime;
@@ -831,6 +1213,31 @@ uint Application::calcLatestFrameForTime(quint64 curTime, quint64 &lateByOut)
 	return nextFrame;
 }
 
+/// <summary>
+/// Calculates the time in microseconds relative to the main loop origin that
+/// the event number `num` of an event that repeats at the frequency `freq` is
+/// scheduled for. The result is rounded down to the nearest microsecond.
+/// </summary>
+quint64 Application::calcTimeOfEvent(quint64 num, const Fraction &freq)
+{
+	return (num * 1000000ULL * (quint64)freq.denominator) /
+		(quint64)freq.numerator;
+}
+
+/// <summary>
+/// Calculates the number of the latest event that repeats at the frequency
+/// `freq` that is scheduled at or before `time` microseconds after the main
+/// loop origin. This is the exact inverse of `calcTimeOfEvent()`: Event `n` is
+/// due when `floor(n * 1000000 * den / num) <= time` which is equivalent to
+/// `n * 1000000 * den < (time + 1) * num`. As we only use integer maths the
+/// result never drifts no matter how long the main loop has been running.
+/// </summary>
+quint64 Application::calcLatestEventAtTime(quint64 time, const Fraction &freq)
+{
+	return ((time + 1ULL) * (quint64)freq.numerator - 1ULL) /
+		(1000000ULL * (quint64)freq.denominator);
+}
+
 /// <summary>
 /// As we use our own custom main loop instead of Qt's we need to handle
 /// specific OS oddities ourselves. Sometimes Qt's `processEvents()` blocks for
@@ -841,9 +1248,9 @@ uint Application::calcLatestFrameForTime(quint64 curTime, quint64 &lateByOut)
 /// responsive. One example of when this happens is when the user drags a
 /// window or dialog around the screen with the mouse.
 /// </summary>
-void Application::beginQtExecTimer()
+void Application::beginQtExecTimer(int firstMsec)
 {
-	m_qtExecTimer.start(10); // 10ms for first event
+	m_qtExecTimer.start(firstMsec); // 10ms by default for first event
 }
 
 void Application::processQtExecTimer()
@@ -947,6 +1354,23 @@ int Application::shutdown(int returnCode)
 		delete factory;
 	}
 
+	// Destroy shared script execution threads. Must be after every scriptable
+	// layer has been deleted.
+	delete m_scriptService;
+	m_scriptService = NULL;
+
+	// Destroy shared image cache
+	delete m_imageCache;
+	m_imageCache = NULL;
+
+	// Destroy CPU usage monitor
+	delete m_cpuUsage;
+	m_cpuUsage = NULL;
+
+	// Destroy performance metrics registry
+	delete m_metrics;
+	m_metrics = NULL;
+
 	// Destroy asynchronous IO worker thread
 	AsyncIO::destroyWorker();
 	m_asyncIo = NULL;
@@ -959,6 +1383,7 @@ int Application::shutdown(int returnCode)
 	appLog()
 		<< LOG_DOUBLE_LINE
 		<< "\nCleanly shut down with return code " << returnCode;
+	Log::stopThread(); // Processes all pending messages
 	delete LogFileManager::getSingleton(); // Flushes and closes file
 
 	// Free the shared memory segment manager after making sure that the
@@ -1423,6 +1848,8 @@ void Application::setBroadcasting(bool broadcasting)
 		appLog()
 			<< LOG_SINGLE_LINE << "\n Broadcast begin\n" << LOG_SINGLE_LINE;
 		m_broadcastCpuUsage = createCPUUsage();
+		m_profile->resetRepeatedFrameStats();
+		m_timeSinceRepeatStatsLog = 0;
 	}
 
 	// Forward to enabled profile targets
@@ -1459,9 +1886,34 @@ void Application::setBroadcasting(bool broadcasting)
 		appLog() << QStringLiteral(
 			"Average Mishira CPU usage during broadcast = %1%")
 			.arg(qRound(procUsage * 100.0f));
+
+		// Log the busiest threads over the entire broadcast
+		const int NUM_THREADS_TO_LOG = 5;
+		m_broadcastCpuUsage->update();
+		CPUThreadUsageList threads =
+			m_broadcastCpuUsage->getRecentThreadUsage();
+		for(int i = 0; i < qMin(threads.size(), NUM_THREADS_TO_LOG); i++) {
+			const CPUThreadUsage &thread = threads.at(i);
+			QString name = thread.name;
+			if(name.isEmpty())
+				name = QStringLiteral("Thread %1").arg(thread.threadId);
+			appLog() << QStringLiteral(
+				"Average CPU usage of \"%1\" during broadcast = %2% of a core")
+				.arg(name)
+				.arg(qRound(thread.usage * 100.0f));
+		}
 		delete m_broadcastCpuUsage;
 		m_broadcastCpuUsage = NULL;
 
+		// Get static frame statistics
+		appLog() << QStringLiteral(
+			"Frames repeated without rendering during broadcast = %1%")
+			.arg(qRound(m_profile->getRepeatedFrameFraction() * 100.0f));
+		appLog() << QStringLiteral(
+			"Prepared image texture cache hits = %1, misses = %2")
+			.arg(FileImageTexture::getPreparedHits())
+			.arg(FileImageTexture::getPreparedMisses());
+
 		appLog()
 			<< LOG_SINGLE_LINE << "\n Broadcast end\n" << LOG_SINGLE_LINE;
 	}
@@ -1787,6 +2239,12 @@ void Application::updateMenuBar()
 	connect(action, &QAction::triggered,
 		this, &Application::logDirectoryClicked);
 
+	if(Tracer::isEnabled()) {
+		action = menu->addAction(tr("Save performance &trace..."));
+		connect(action, &QAction::triggered,
+			this, &Application::saveTraceClicked);
+	}
+
 	menu->addSeparator();
 
 	action = menu->addAction(tr("View &online manual..."));
@@ -2089,6 +2547,21 @@ void Application::logDirectoryClicked()
 		.arg(getDataDirectory().absolutePath())));
 }
 
+/// <summary>
+/// Saves the recent performance timeline next to the log file and opens the
+/// directory so that the user can send it to us.
+/// </summary>
+void Application::saveTraceClicked()
+{
+	QString filename = getUniqueFilename(
+		getDataDirectory().filePath(QStringLiteral("Trace.json")))
+		.filePath();
+	appLog() << "Saving performance trace to \"" << filename << "\"";
+	m_asyncIo->saveToFile(m_asyncIo->newOperationId(),
+		Tracer::toChromeTraceJson(), filename, false);
+	logDirectoryClicked();
+}
+
 void Application::onlineManualClicked()
 {
 	QDesktopServices::openUrl(
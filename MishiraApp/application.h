@@ -21,6 +21,7 @@
 #include "common.h"
 #include "Widgets/styledmenubar.h"
 #include <QtCore/QDir>
+#include <QtCore/QStringList>
 #include <QtCore/QTimer>
 #include <QtWidgets/QApplication>
 
@@ -33,14 +34,17 @@ class BitrateCalcWindow;
 class CaptureManager;
 class CPUUsage;
 class DarkStyle;
+class ImageCache;
 class Layer;
 class LayerDialog;
 class LayerDialogWindow;
 class LayerFactory;
 class MainWindow;
+class MetricsRegistry;
 class Profile;
 class Scene;
 class SceneItem;
+class ScriptService;
 class VideoSourceManager;
 class WizardWindow;
 class QAbstractButton;
@@ -81,11 +85,17 @@ protected: // Members ---------------------------------------------------------
 	AudioSourceManager *	m_audioManager;
 	VideoSourceManager *	m_videoManager;
 	AsyncIO *				m_asyncIo;
+	ImageCache *			m_imageCache;
+	ScriptService *			m_scriptService;
+	MetricsRegistry *		m_metrics;
 	Qt::CursorShape			m_activeCursor;
 	QDir					m_dataDir;
 	bool					m_isBroadcasting;
 	bool					m_isBroadcastingChanging;
 	CPUUsage *				m_broadcastCpuUsage;
+	CPUUsage *				m_cpuUsage; // Rolling window, always active
+	bool					m_mainThreadSaturated;
+	QStringList				m_cpuThreadMetrics; // Currently exported
 	bool					m_isInLowCPUMode;
 
 	// Main loop
@@ -102,8 +112,11 @@ protected: // Members ---------------------------------------------------------
 	int						m_tickFrameMultiple;
 	int						m_timeSinceLogFileFlush; // msec
 	int						m_timeSinceProfileSave; // msec
+	int						m_timeSinceCpuUpdate; // msec
+	int						m_timeSinceRepeatStatsLog; // msec
 	float					m_averageFrameJitter; // usec
 	QTimer					m_qtExecTimer;
+	quint64					m_lastQtProcessTime; // usec
 	bool					m_exiting;
 	int						m_exitCode;
 	bool					m_deleteSettingsOnExit; // Used by first time setup
@@ -155,6 +168,10 @@ public: // Methods ------------------------------------------------------------
 	AudioSourceManager *	getAudioSourceManager() const;
 	VideoSourceManager *	getVideoSourceManager() const;
 	AsyncIO *				getAsyncIO() const;
+	ImageCache *			getImageCache() const;
+	ScriptService *			getScriptService() const;
+	MetricsRegistry *		getMetrics() const;
+	CPUUsage *				getCPUUsage() const;
 
 	// Factories
 	void				registerLayerFactory(LayerFactory *factory);
@@ -203,13 +220,18 @@ protected:
 
 	// main()
 	bool				initialize();
+	void				describeMetrics();
+	void				updateCPUUsage();
 	void				processOurEvents(bool fromQtExecTimer = false);
 	void				processQtNonblocking();
 	uint				calcLatestTickForTime(
 		quint64 curTime, quint64 &lateByOut);
 	uint				calcLatestFrameForTime(
 		quint64 curTime, quint64 &lateByOut);
-	void				beginQtExecTimer();
+	static quint64		calcTimeOfEvent(quint64 num, const Fraction &freq);
+	static quint64		calcLatestEventAtTime(
+		quint64 time, const Fraction &freq);
+	void				beginQtExecTimer(int firstMsec = 10);
 	void				processQtExecTimer();
 	void				stopQtExecTimer();
 	int					shutdown(int returnCode);
@@ -278,6 +300,7 @@ Q_SLOTS: // Private slots -----------------------------------------------------
 	void				startStopBroadcastDialogClosed(
 		QAbstractButton *button);
 	void				logDirectoryClicked();
+	void				saveTraceClicked();
 	void				onlineManualClicked();
 
 	void				capEnterLowJitterMode();
@@ -310,6 +333,26 @@ inline AsyncIO *Application::getAsyncIO() const
 	return m_asyncIo;
 }
 
+inline ImageCache *Application::getImageCache() const
+{
+	return m_imageCache;
+}
+
+inline ScriptService *Application::getScriptService() const
+{
+	return m_scriptService;
+}
+
+inline MetricsRegistry *Application::getMetrics() const
+{
+	return m_metrics;
+}
+
+inline CPUUsage *Application::getCPUUsage() const
+{
+	return m_cpuUsage;
+}
+
 inline void Application::registerLayerFactory(LayerFactory *factory)
 {
 	m_layerFactoryList.push_back(factory);
@@ -16,6 +16,10 @@
 //*****************************************************************************
 
 #include "appsettings.h"
+#include "application.h"
+#include "asyncio.h"
+#include "constants.h"
+#include <QtCore/QBuffer>
 #include <QtCore/QDataStream>
 #include <QtCore/QFile>
 #include <QtWidgets/QColorDialog>
@@ -31,6 +35,11 @@ AppSettings::AppSettings(const QString &filename)
 	, m_mainWinGeom()
 	, m_mainWinGeomMaxed(false)
 	, m_activeProfile()
+	, m_encoderCoreMask(0)
+	, m_textStrokeTechnique(TxtDistanceStroke)
+	, m_metricsEnabled(false)
+	, m_metricsPort(DEFAULT_METRICS_PORT)
+	, m_tracingEnabled(false)
 {
 	loadFromDisk();
 	setupColorDialog();
@@ -49,7 +58,7 @@ void AppSettings::serialize(QDataStream *stream) const
 {
 	// Write header and file version
 	*stream << (quint32)0xFB6634A8;
-	*stream << (quint32)3; // Version
+	*stream << (quint32)7; // Version
 
 	// Write settings
 	*stream << m_clientId;
@@ -57,6 +66,11 @@ void AppSettings::serialize(QDataStream *stream) const
 	*stream << m_mainWinGeomMaxed;
 	*stream << m_activeProfile;
 	*stream << m_customColors;
+	*stream << m_encoderCoreMask;
+	*stream << (quint32)m_textStrokeTechnique;
+	*stream << m_metricsEnabled;
+	*stream << m_metricsPort;
+	*stream << m_tracingEnabled;
 }
 
 /// <summary>
@@ -67,7 +81,9 @@ void AppSettings::serialize(QDataStream *stream) const
 bool AppSettings::unserialize(QDataStream *stream)
 {
 	bool		boolData;
+	quint16		uint16Data;
 	quint32		uint32Data;
+	quint64		uint64Data;
 	QByteArray	byteArrayData;
 	QString		stringData;
 
@@ -85,7 +101,7 @@ bool AppSettings::unserialize(QDataStream *stream)
 	// Read file version
 	quint32 version;
 	*stream >> version;
-	if(version >= 0 && version <= 3) {
+	if(version >= 0 && version <= 7) {
 		// Read our data
 		if(version >= 2) {
 			*stream >> m_clientId;
@@ -101,6 +117,24 @@ bool AppSettings::unserialize(QDataStream *stream)
 		if(version >= 1 && version <= 2)
 			*stream >> uint32Data; // Unused
 		*stream >> m_customColors;
+		if(version >= 4) {
+			*stream >> uint64Data;
+			setEncoderCoreMask(uint64Data);
+		}
+		if(version >= 5) {
+			*stream >> uint32Data;
+			setTextStrokeTechnique((TxtStrokeTechnique)uint32Data);
+		}
+		if(version >= 6) {
+			*stream >> boolData;
+			setMetricsEnabled(boolData);
+			*stream >> uint16Data;
+			setMetricsPort(uint16Data);
+		}
+		if(version >= 7) {
+			*stream >> boolData;
+			setTracingEnabled(boolData);
+		}
 	} else {
 		appLog(Log::Warning)
 			<< "Unknown application settings file version, "
@@ -186,6 +220,11 @@ void AppSettings::loadDefaults()
 	m_mainWinGeom = QByteArray();
 	m_mainWinGeomMaxed = false;
 	m_activeProfile = QStringLiteral("Default");
+	m_encoderCoreMask = 0; // All cores
+	m_textStrokeTechnique = TxtDistanceStroke;
+	m_metricsEnabled = false; // Only serve metrics when asked to
+	m_metricsPort = DEFAULT_METRICS_PORT;
+	m_tracingEnabled = false; // Tracing has a cost so only when asked to
 
 	m_dirty = false;
 }
@@ -224,28 +263,54 @@ void AppSettings::loadFromDisk()
 }
 
 /// <summary>
-/// Saves the current settings to disk.
+/// Saves the current settings to disk. If `async` is true then the file is
+/// written in the IO thread so that waiting for the disk doesn't stall the
+/// main loop. The existing file is atomically replaced in both cases so a
+/// crash during the save never corrupts it.
 /// </summary>
 /// <returns>True if the settings were successfully saved</returns>
-bool AppSettings::saveToDisk()
+bool AppSettings::saveToDisk(bool async)
 {
 	if(!m_dirty)
 		return true; // Nothing to do
 
-	QFile file(m_filename);
-	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
-		return false;
-	QDataStream stream(&file);
+	// Serialize to a temporary buffer
+	QByteArray data;
+	QBuffer buffer(&data);
+	if(!buffer.open(QIODevice::WriteOnly))
+		return false; // Should never happen
+	QDataStream stream(&buffer);
 	stream.setByteOrder(QDataStream::LittleEndian);
 	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
 	stream.setVersion(12);
 	serialize(&stream);
 	if(stream.status() != QDataStream::Ok) {
 		appLog(Log::Warning)
-			<< "An error occurred while writing to the application settings "
-			<< "file";
+			<< "An error occurred while serializing the application settings";
+		return false;
+	}
+	buffer.close();
+
+	AsyncIO *asyncIo = App->getAsyncIO();
+	if(async && asyncIo != NULL) {
+		// Errors are logged by the IO thread
+		asyncIo->saveToFile(asyncIo->newOperationId(), data, m_filename, true);
+		m_fileExists = true; // File is about to be created
+		m_dirty = false;
+		return true;
+	}
+
+	// Make sure that an earlier asynchronous save cannot replace our file with
+	// older data after we have written it
+	if(asyncIo != NULL)
+		asyncIo->waitForPending();
+
+	QString error;
+	if(!writeFileAtomically(m_filename, data, &error)) {
+		appLog(Log::Warning)
+			<< "Failed to save application settings file: " << error;
+		return false;
 	}
-	file.close();
 
 	m_fileExists = true;
 	m_dirty = false;
@@ -281,3 +346,50 @@ void AppSettings::setActiveProfile(const QString &activeProfile)
 	m_activeProfile = activeProfile;
 	m_dirty = true;
 }
+
+void AppSettings::setEncoderCoreMask(quint64 mask)
+{
+	if(m_encoderCoreMask == mask)
+		return; // No change
+	// All masks are valid
+	m_encoderCoreMask = mask;
+	m_dirty = true;
+}
+
+void AppSettings::setTextStrokeTechnique(TxtStrokeTechnique technique)
+{
+	if(m_textStrokeTechnique == technique)
+		return; // No change
+	if(technique < 0 || technique >= NUM_TXT_STROKE_TECHNIQUES)
+		return; // Invalid technique
+	m_textStrokeTechnique = technique;
+	m_dirty = true;
+}
+
+void AppSettings::setMetricsEnabled(bool enabled)
+{
+	if(m_metricsEnabled == enabled)
+		return; // No change
+	// Booleans are always valid
+	m_metricsEnabled = enabled;
+	m_dirty = true;
+}
+
+void AppSettings::setMetricsPort(quint16 port)
+{
+	if(m_metricsPort == port)
+		return; // No change
+	if(port == 0)
+		return; // Invalid port
+	m_metricsPort = port;
+	m_dirty = true;
+}
+
+void AppSettings::setTracingEnabled(bool enabled)
+{
+	if(m_tracingEnabled == enabled)
+		return; // No change
+	// Booleans are always valid
+	m_tracingEnabled = enabled;
+	m_dirty = true;
+}
@@ -35,6 +35,11 @@ private: // Members -----------------------------------------------------------
 	QByteArray		m_mainWinGeom;
 	bool			m_mainWinGeomMaxed;
 	QString			m_activeProfile;
+	quint64			m_encoderCoreMask; // Bit N = Core N, zero = All cores
+	TxtStrokeTechnique	m_textStrokeTechnique;
+	bool			m_metricsEnabled;
+	quint16			m_metricsPort;
+	bool			m_tracingEnabled;
 
 public: // Constructor/destructor ---------------------------------------------
 	AppSettings(const QString &filename);
@@ -45,7 +50,7 @@ public: // Methods ------------------------------------------------------------
 	bool		doesFileExist() const;
 	void		loadDefaults();
 	void		loadFromDisk();
-	bool		saveToDisk();
+	bool		saveToDisk(bool async = false);
 
 private:
 	void		serialize(QDataStream *stream) const;
@@ -66,6 +71,21 @@ public: // Accessors ----------------------------------------------------------
 
 	QString		getActiveProfile() const;
 	void		setActiveProfile(const QString &activeProfile);
+
+	quint64		getEncoderCoreMask() const;
+	void		setEncoderCoreMask(quint64 mask);
+
+	TxtStrokeTechnique	getTextStrokeTechnique() const;
+	void		setTextStrokeTechnique(TxtStrokeTechnique technique);
+
+	bool		getMetricsEnabled() const;
+	void		setMetricsEnabled(bool enabled);
+
+	quint16		getMetricsPort() const;
+	void		setMetricsPort(quint16 port);
+
+	bool		getTracingEnabled() const;
+	void		setTracingEnabled(bool enabled);
 };
 //=============================================================================
 
@@ -99,4 +119,29 @@ inline QString AppSettings::getActiveProfile() const
 	return m_activeProfile;
 }
 
+inline quint64 AppSettings::getEncoderCoreMask() const
+{
+	return m_encoderCoreMask;
+}
+
+inline TxtStrokeTechnique AppSettings::getTextStrokeTechnique() const
+{
+	return m_textStrokeTechnique;
+}
+
+inline bool AppSettings::getMetricsEnabled() const
+{
+	return m_metricsEnabled;
+}
+
+inline quint16 AppSettings::getMetricsPort() const
+{
+	return m_metricsPort;
+}
+
+inline bool AppSettings::getTracingEnabled() const
+{
+	return m_tracingEnabled;
+}
+
 #endif // APPSETTINGS_H
@@ -16,13 +16,94 @@
 //*****************************************************************************
 
 #include "asyncio.h"
+#include "common.h"
+#include "cpuusage.h"
+#include "filemuxer.h"
+#include "threadpolicy.h"
 #include "log.h"
 #include "logfilemanager.h"
+#include "metrics.h"
+#include <QtCore/QBuffer>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRunnable>
 #include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImageReader>
 
 const QString LOG_CAT = QStringLiteral("FileIO");
 
+// Files that are larger than this are memory mapped instead of being read
+// into a buffer when possible
+const qint64 MMAP_MIN_FILE_SIZE = 1024 * 1024; // 1 MB
+
+// Maximum number of threads that process reads at the same time
+const int MAX_READ_THREADS = 4;
+
+//=============================================================================
+// AsyncSnapshot class
+
+AsyncSnapshot::~AsyncSnapshot()
+{
+}
+
+//=============================================================================
+// AsyncReadTask class
+
+/// <summary>
+/// A single read operation that is queued in our read thread pool.
+/// </summary>
+class AsyncReadTask : public QRunnable
+{
+private: // Members -----------------------------------------------------------
+	AsyncIO *			m_io;
+	int					m_id;
+	QString				m_filename;
+	AsyncIO::ReadType	m_type;
+	quint64				m_queuedTime; // usec
+
+public: // Constructor/destructor ---------------------------------------------
+	AsyncReadTask(
+		AsyncIO *io, int id, const QString &filename, AsyncIO::ReadType type,
+		quint64 queuedTime)
+		: QRunnable()
+		, m_io(io)
+		, m_id(id)
+		, m_filename(filename)
+		, m_type(type)
+		, m_queuedTime(queuedTime)
+	{
+	}
+
+public: // Methods ------------------------------------------------------------
+	virtual void run()
+	{
+		ThreadPolicy::applyToCurrentThread(
+			ThrdBackgroundClass, QStringLiteral("Async IO reader"));
+		if(!m_io->beginRead(m_id, m_queuedTime))
+			return; // Cancelled before it began
+		switch(m_type) {
+		default:
+		case AsyncIO::DataRead:
+			m_io->processLoadFromFile(m_id, m_filename);
+			break;
+		case AsyncIO::ImageRead:
+			m_io->processLoadImageFromFile(m_id, m_filename);
+			break;
+		case AsyncIO::VersionRead:
+			m_io->processGetFileVersion(m_id, m_filename);
+			break;
+		}
+	}
+};
+
+//=============================================================================
+// AsyncIO class
+
 QThread *AsyncIO::s_thread = NULL;
 AsyncIO *AsyncIO::s_worker = NULL;
 
@@ -35,6 +116,9 @@ AsyncIO *AsyncIO::createWorker()
 
 	s_worker = new AsyncIO();
 	s_worker->moveToThread(s_thread);
+	QMetaObject::invokeMethod(
+		s_worker, "setThreadRegistered", Qt::QueuedConnection,
+		Q_ARG(bool, true));
 
 	return s_worker;
 }
@@ -43,6 +127,18 @@ void AsyncIO::destroyWorker()
 {
 	if(!s_thread)
 		return;
+
+	// Don't lose any queued operations such as the final profile save. Any
+	// reads that haven't started yet are no longer needed.
+	s_worker->waitForPending();
+	s_worker->m_mutex.lock();
+	s_worker->m_cancelledReads = s_worker->m_pendingReads;
+	s_worker->m_mutex.unlock();
+	s_worker->m_readPool->waitForDone();
+	QMetaObject::invokeMethod(
+		s_worker, "setThreadRegistered", Qt::BlockingQueuedConnection,
+		Q_ARG(bool, false));
+
 	s_thread->exit();
 	s_thread->wait(); // TODO: Timeout?
 	delete s_thread;
@@ -56,11 +152,27 @@ AsyncIO::AsyncIO()
 	: QObject()
 	, m_nextId(1) // Never use "0" so slots can easily ignore events
 	, m_mutex(QMutex::Recursive)
+	, m_readPool(new QThreadPool())
+	, m_clock()
+	, m_pendingReads()
+	, m_cancelledReads()
+	, m_bytesRead(0)
+	, m_bytesMapped(0)
+	, m_numCancelled(0)
+	, m_queueLatencies()
+	, m_readTimes()
 {
+	qRegisterMetaType<FileMuxer *>();
+	qRegisterMetaType<AsyncSnapshot *>();
+	m_clock.start();
+	m_readPool->setMaxThreadCount(
+		qBound(2, QThread::idealThreadCount() / 2, MAX_READ_THREADS));
 }
 
 AsyncIO::~AsyncIO()
 {
+	m_readPool->waitForDone();
+	delete m_readPool;
 }
 
 /// <summary>
@@ -76,6 +188,101 @@ int AsyncIO::newOperationId()
 	return id;
 }
 
+/// <summary>
+/// Blocks the calling thread until every write operation that was queued
+/// before this call has completed. As writes are processed in order this can
+/// be used to make sure that a synchronous write to a file doesn't race with
+/// an earlier asynchronous one. Reads are not waited for.
+/// </summary>
+void AsyncIO::waitForPending()
+{
+	if(QThread::currentThread() == s_thread)
+		return; // Everything before us has already been processed
+	QMetaObject::invokeMethod(
+		this, "pendingBarrier", Qt::BlockingQueuedConnection);
+}
+
+/// <summary>
+/// Cancels a read operation that is no longer needed. If the operation has
+/// not been started yet then it is skipped entirely, otherwise it is aborted
+/// as soon as possible. If this method returns true then the completion
+/// signal of the operation is never emitted. If it returns false then the
+/// operation has already completed and its completion signal may still be
+/// waiting to be delivered.
+/// </summary>
+/// <returns>False if the operation has already completed.</returns>
+bool AsyncIO::cancel(int id)
+{
+	QMutexLocker locker(&m_mutex);
+	if(!m_pendingReads.contains(id))
+		return false;
+	m_cancelledReads.insert(id);
+	return true;
+}
+
+/// <summary>
+/// Reports our read statistics since the last call to the metrics registry.
+/// Must be called from the main thread.
+/// </summary>
+void AsyncIO::reportMetrics(MetricsRegistry *metrics)
+{
+	m_mutex.lock();
+	quint64 bytesRead = m_bytesRead;
+	quint64 bytesMapped = m_bytesMapped;
+	int numCancelled = m_numCancelled;
+	int numPending = m_pendingReads.size();
+	QVector<quint64> queueLatencies = m_queueLatencies;
+	QVector<quint64> readTimes = m_readTimes;
+	m_bytesRead = 0;
+	m_bytesMapped = 0;
+	m_numCancelled = 0;
+	m_queueLatencies.clear();
+	m_readTimes.clear();
+	m_mutex.unlock();
+
+	metrics->addToCounter(
+		QStringLiteral("mishira_io_read_bytes_total"), bytesRead);
+	metrics->addToCounter(
+		QStringLiteral("mishira_io_mapped_bytes_total"), bytesMapped);
+	metrics->addToCounter(
+		QStringLiteral("mishira_io_cancelled_reads_total"), numCancelled);
+	metrics->setGauge(QStringLiteral("mishira_io_pending_reads"), numPending);
+	for(int i = 0; i < queueLatencies.size(); i++) {
+		metrics->observe(
+			QStringLiteral("mishira_io_queue_latency_usec"),
+			queueLatencies.at(i));
+	}
+	for(int i = 0; i < readTimes.size(); i++) {
+		metrics->observe(
+			QStringLiteral("mishira_io_read_usec"), readTimes.at(i));
+	}
+}
+
+void AsyncIO::pendingBarrier()
+{
+	// Nothing to do, see `waitForPending()`
+}
+
+/// <summary>
+/// Applies the thread policy to our worker thread and names it in CPU usage
+/// statistics. Must be executed in the worker thread.
+/// </summary>
+void AsyncIO::setThreadRegistered(bool registered)
+{
+	if(registered) {
+		ThreadPolicy::applyToCurrentThread(
+			ThrdBackgroundClass, QStringLiteral("Async IO"));
+	} else
+		CPUUsage::unregisterThread();
+}
+
+/// <summary>
+/// Writes the data to the specified file. If `safeSave` is true then the
+/// existing file is atomically replaced so that it is never left in a partially
+/// written state. If the file cannot be written `errorCode` is 1. The amount of
+/// time that the write took is also returned so that callers can track how
+/// long saves take on the user's system.
+/// </summary>
 void AsyncIO::saveToFile(
 	int id, const QByteArray &data, const QString &filename, bool safeSave)
 {
@@ -91,25 +298,179 @@ void AsyncIO::saveToFile(
 		return;
 	}
 
-	// TODO: Use `QSaveFile` if "safeSave == true"
-	abort(); // Unimplemented
+	QElapsedTimer timer;
+	timer.start();
+
+	int code = 0;
+	if(safeSave) {
+		QString error;
+		if(!writeFileAtomically(filename, data, &error)) {
+			code = 1;
+			appLog(LOG_CAT, Log::Warning)
+				<< "Cannot save file \"" << filename << "\": " << error;
+		}
+	} else {
+		QFile file(filename);
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+			file.write(data) != data.size())
+		{
+			code = 1;
+			appLog(LOG_CAT, Log::Warning)
+				<< "Cannot save file \"" << filename << "\": "
+				<< file.errorString();
+		}
+		file.close();
+	}
 
-	emit saveToFileComplete(id, 0);
+	emit saveToFileComplete(id, code, (int)timer.elapsed());
 }
 
-void AsyncIO::loadFromFile(int id, const QString &filename)
+/// <summary>
+/// Serializes the snapshot and writes the result to the specified file in the
+/// same way as `saveToFile()`. Takes ownership of the snapshot which is
+/// deleted once it has been serialized. If the snapshot cannot be serialized
+/// then `errorCode` is 1. The time reported with `saveToFileComplete()` only
+/// includes the write.
+/// </summary>
+void AsyncIO::saveSnapshotToFile(
+	int id, AsyncSnapshot *snapshot, const QString &filename, bool safeSave)
 {
 	if(QThread::currentThread() != s_thread) {
 		// Method was called from outside of the resource thread. Invoke this
 		// method again in the correct thread automatically.
 		QMetaObject::invokeMethod(
-			this, "loadFromFile",
+			this, "saveSnapshotToFile",
 			Q_ARG(int, id),
-			Q_ARG(const QString &, filename));
+			Q_ARG(AsyncSnapshot *, snapshot),
+			Q_ARG(const QString &, filename),
+			Q_ARG(bool, safeSave));
 		return;
 	}
 
-	//_sleep(3000);
+	QByteArray data;
+	bool serialized = snapshot->serialize(&data);
+	delete snapshot;
+	if(!serialized) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot save file \"" << filename << "\": "
+			<< "An error occurred while serializing its data";
+		emit saveToFileComplete(id, 1, 0);
+		return;
+	}
+	saveToFile(id, data, filename, safeSave);
+}
+
+/// <summary>
+/// Reads an entire file into memory. If the file cannot be read `errorCode`
+/// is 1. Reads are not executed in the order that they are queued in.
+/// </summary>
+void AsyncIO::loadFromFile(
+	int id, const QString &filename, IOPriority priority)
+{
+	queueRead(id, filename, priority, DataRead);
+}
+
+/// <summary>
+/// Reads an image file and decodes its first frame so that the main thread
+/// doesn't stall while large images are decompressed. If the image is
+/// animated then the raw file data is also returned so that the caller can
+/// decode the remaining frames, otherwise `data` is empty. `version` is the
+/// version of the file that was read as returned by `getFileVersion()`. If
+/// the file cannot be read `errorCode` is 1, if it is not a recognised image
+/// it is 2. Reads are not executed in the order that they are queued in.
+/// </summary>
+void AsyncIO::loadImageFromFile(
+	int id, const QString &filename, IOPriority priority)
+{
+	queueRead(id, filename, priority, ImageRead);
+}
+
+/// <summary>
+/// Returns a string that identifies the current version of a file without
+/// reading it. The string contains the canonical path, modification time and
+/// size of the file so that the same file that is referenced using different
+/// paths has the same version while a file that was modified does not. If the
+/// file doesn't exist then `version` is empty. Querying file information can
+/// block for a noticeable amount of time on slow or network drives which is
+/// why we do it here instead of the main thread.
+/// </summary>
+void AsyncIO::getFileVersion(
+	int id, const QString &filename, IOPriority priority)
+{
+	queueRead(id, filename, priority, VersionRead);
+}
+
+void AsyncIO::queueRead(
+	int id, const QString &filename, IOPriority priority, ReadType type)
+{
+	m_mutex.lock();
+	m_pendingReads.insert(id);
+	m_mutex.unlock();
+	AsyncReadTask *task = new AsyncReadTask(
+		this, id, filename, type, (quint64)(m_clock.nsecsElapsed() / 1000));
+	m_readPool->start(task, (int)priority);
+}
+
+/// <summary>
+/// Called by a read worker thread immediately before it begins processing a
+/// read operation.
+/// </summary>
+/// <returns>False if the operation was cancelled.</returns>
+bool AsyncIO::beginRead(int id, quint64 queuedTime)
+{
+	quint64 now = (quint64)(m_clock.nsecsElapsed() / 1000);
+	QMutexLocker locker(&m_mutex);
+	m_queueLatencies.append(now - queuedTime);
+	if(!m_cancelledReads.contains(id))
+		return true;
+	m_cancelledReads.remove(id);
+	m_pendingReads.remove(id);
+	m_numCancelled++;
+	return false;
+}
+
+/// <summary>
+/// Tests if the specified read operation was cancelled while it was being
+/// processed. If it was then the operation is removed from our pending list
+/// and the caller must not emit its result.
+/// </summary>
+bool AsyncIO::isReadCancelled(int id)
+{
+	QMutexLocker locker(&m_mutex);
+	if(!m_cancelledReads.contains(id))
+		return false;
+	m_cancelledReads.remove(id);
+	m_pendingReads.remove(id);
+	m_numCancelled++;
+	return true;
+}
+
+/// <summary>
+/// Called by a read worker thread once it has finished processing a read
+/// operation. The cancellation test is done under the same lock as removing
+/// the operation from our pending list so that `cancel()` can never succeed
+/// after this point. If the operation was cancelled then the caller must not
+/// emit its result.
+/// </summary>
+/// <returns>False if the operation was cancelled.</returns>
+bool AsyncIO::endRead(int id, quint64 startTime, quint64 numBytes)
+{
+	quint64 now = (quint64)(m_clock.nsecsElapsed() / 1000);
+	QMutexLocker locker(&m_mutex);
+	m_pendingReads.remove(id);
+	if(m_cancelledReads.contains(id)) {
+		m_cancelledReads.remove(id);
+		m_numCancelled++;
+		return false;
+	}
+	m_bytesRead += numBytes;
+	m_readTimes.append(now - startTime);
+	return true;
+}
+
+void AsyncIO::processLoadFromFile(int id, const QString &filename)
+{
+	quint64 startTime = (quint64)(m_clock.nsecsElapsed() / 1000);
 
 	// Read all file data into memory
 	int code = 0;
@@ -124,9 +485,330 @@ void AsyncIO::loadFromFile(int id, const QString &filename)
 			<< "Cannot open file \"" << filename << "\" for reading";
 	}
 
+	if(!endRead(id, startTime, data.size()))
+		return; // Cancelled
 	emit loadFromFileComplete(id, code, data);
 }
 
+void AsyncIO::processLoadImageFromFile(int id, const QString &filename)
+{
+	quint64 startTime = (quint64)(m_clock.nsecsElapsed() / 1000);
+
+	// Open the file
+	QByteArray data;
+	QImage img;
+	QFile file(filename);
+	if(!file.open(QIODevice::ReadOnly)) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot open file \"" << filename << "\" for reading";
+		if(!endRead(id, startTime, 0))
+			return; // Cancelled
+		emit loadImageFromFileComplete(id, 1, data, img, QString());
+		return;
+	}
+	const QString version = getVersionOfFile(QFileInfo(file));
+
+	// `QByteArray` and `QImageReader` cannot handle files that are 2 GB or
+	// larger
+	qint64 fileSize = file.size();
+	if(fileSize > (qint64)INT_MAX) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot read file \"" << filename << "\" as it is too large";
+		file.close();
+		if(!endRead(id, startTime, 0))
+			return; // Cancelled
+		emit loadImageFromFileComplete(id, 1, data, img, version);
+		return;
+	}
+
+	// Large files are memory mapped and decoded directly from the mapping so
+	// that we never have a second copy of the file data in memory unless the
+	// image is animated and the caller needs to keep the data around
+	uchar *mapped = NULL;
+	if(fileSize >= MMAP_MIN_FILE_SIZE)
+		mapped = file.map(0, fileSize);
+	if(mapped != NULL) {
+		data = QByteArray::fromRawData(
+			reinterpret_cast<const char *>(mapped), (int)fileSize);
+	} else
+		data = file.readAll();
+
+	// Decode the first frame unless the caller no longer wants the image
+	bool hasAnimation = false;
+	if(!isReadCancelled(id)) {
+		QBuffer buf(&data);
+		QImageReader reader(&buf);
+		if(reader.canRead()) {
+			hasAnimation = (reader.imageCount() > 1);
+			img = reader.read();
+			if(hasAnimation && !reader.canRead())
+				hasAnimation = false; // 1 frame animation
+		}
+		reader.setDevice(NULL);
+		buf.close();
+	} else {
+		data = QByteArray();
+		if(mapped != NULL)
+			file.unmap(mapped);
+		return;
+	}
+
+	// Only animated images need to keep the file data around. The mapping is
+	// released when we close the file so make a real copy of it.
+	int code = 0;
+	quint64 numBytes = data.size();
+	if(img.format() == QImage::Format_Invalid) {
+		code = 2;
+		data = QByteArray();
+	} else if(!hasAnimation)
+		data = QByteArray();
+	else if(mapped != NULL)
+		data = QByteArray(data.constData(), data.size());
+	if(mapped != NULL) {
+		file.unmap(mapped);
+		m_mutex.lock();
+		m_bytesMapped += numBytes;
+		m_mutex.unlock();
+	}
+	file.close();
+
+	if(!endRead(id, startTime, numBytes))
+		return; // Cancelled
+	if(code != 0) {
+		emit loadImageFromFileComplete(
+			id, code, QByteArray(), QImage(), version);
+	} else
+		emit loadImageFromFileComplete(id, 0, data, img, version);
+}
+
+void AsyncIO::processGetFileVersion(int id, const QString &filename)
+{
+	quint64 startTime = (quint64)(m_clock.nsecsElapsed() / 1000);
+	const QString version = getVersionOfFile(QFileInfo(filename));
+	if(!endRead(id, startTime, 0))
+		return; // Cancelled
+	emit getFileVersionComplete(id, version);
+}
+
+/// <summary>
+/// Must only be called from a read worker thread as it accesses the disk.
+/// </summary>
+QString AsyncIO::getVersionOfFile(const QFileInfo &info)
+{
+	if(!info.exists())
+		return QString();
+	return QStringLiteral("%1|%2|%3")
+		.arg(info.canonicalFilePath())
+		.arg(info.lastModified().toMSecsSinceEpoch())
+		.arg(info.size());
+}
+
+/// <summary>
+/// Creates and opens a new file for writing. If the file already exists then
+/// a unique filename is used instead. Opening a file can block for a
+/// noticeable amount of time on slow or network drives which is why we do it
+/// here instead of the main thread.
+///
+/// The opened file is moved to the main thread and ownership is passed to
+/// the receiver of the `openFileForWritingComplete()` signal. If the file
+/// could not be opened then `file` is NULL. NOTE: If there is more than one
+/// receiver connected only the one that issued the operation should use it.
+/// </summary>
+void AsyncIO::openFileForWriting(int id, const QString &filename)
+{
+	if(QThread::currentThread() != s_thread) {
+		// Method was called from outside of the resource thread. Invoke this
+		// method again in the correct thread automatically.
+		QMetaObject::invokeMethod(
+			this, "openFileForWriting",
+			Q_ARG(int, id),
+			Q_ARG(const QString &, filename));
+		return;
+	}
+
+	int code = 0;
+	QFile *file = new QFile(getUniqueFilename(filename).filePath());
+	if(file->open(QIODevice::WriteOnly | QIODevice::Truncate))
+		file->moveToThread(QCoreApplication::instance()->thread());
+	else {
+		code = 1;
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot open file \"" << file->fileName() << "\" for writing: "
+			<< file->errorString();
+		delete file;
+		file = NULL;
+	}
+
+	emit openFileForWritingComplete(id, code, file);
+}
+
+/// <summary>
+/// Prepares the files of a recording that is split into multiple files. A
+/// base name is derived from `filename` that isn't used by any existing
+/// recording, the manifest is created with `manifestHeader` as its contents
+/// and the file of the first segment is opened for writing. The filenames
+/// are the ones returned by `getSegmentFilename()` and
+/// `getSegmentManifestFilename()`.
+///
+/// The first file is passed to the receiver of the
+/// `beginSegmentedFileComplete()` signal in the same way as
+/// `openFileForWriting()`. If an error occurs then `file` is NULL.
+/// </summary>
+void AsyncIO::beginSegmentedFile(
+	int id, const QString &filename, const QString &extension,
+	const QByteArray &manifestHeader)
+{
+	if(QThread::currentThread() != s_thread) {
+		// Method was called from outside of the resource thread. Invoke this
+		// method again in the correct thread automatically.
+		QMetaObject::invokeMethod(
+			this, "beginSegmentedFile",
+			Q_ARG(int, id),
+			Q_ARG(const QString &, filename),
+			Q_ARG(const QString &, extension),
+			Q_ARG(const QByteArray &, manifestHeader));
+		return;
+	}
+
+	// Find a base name that isn't used by any existing recording
+	QFileInfo info(filename);
+	info.makeAbsolute();
+	QString origBaseName = info.dir().filePath(info.completeBaseName());
+	QString baseName = origBaseName;
+	for(int i = 1; ; i++) {
+		if(!QFileInfo(getSegmentManifestFilename(baseName)).exists() &&
+			!QFileInfo(getSegmentFilename(baseName, 1, extension)).exists())
+		{
+			break;
+		}
+		baseName = QStringLiteral("%1 (%2)").arg(origBaseName).arg(i);
+	}
+
+	// Create the manifest
+	QFile manifest(getSegmentManifestFilename(baseName));
+	if(!manifest.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+		manifest.write(manifestHeader) != manifestHeader.size())
+	{
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot create segment manifest \"" << manifest.fileName()
+			<< "\": " << manifest.errorString();
+		emit beginSegmentedFileComplete(id, 1, baseName, NULL);
+		return;
+	}
+	manifest.close();
+
+	// Open the file of the first segment
+	QFile *file = new QFile(getSegmentFilename(baseName, 1, extension));
+	if(!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot open file \"" << file->fileName() << "\" for writing: "
+			<< file->errorString();
+		delete file;
+		emit beginSegmentedFileComplete(id, 2, baseName, NULL);
+		return;
+	}
+	file->moveToThread(QCoreApplication::instance()->thread());
+
+	emit beginSegmentedFileComplete(id, 0, baseName, file);
+}
+
+/// <summary>
+/// Finalizes and closes the file of a muxer and then deletes the muxer. This
+/// is done in the background as muxers that write an index when they are
+/// closed can take a noticeable amount of time to do so. We take ownership of
+/// the muxer and it must not be used by the caller again. Must be called from
+/// the thread that owns the muxer's file.
+///
+/// If `manifestFilename` is not empty then `manifestLine` followed by the
+/// final size of the file in bytes and a line break is appended to the
+/// manifest once the file was closed successfully. Doing this here makes sure
+/// that other applications never see a file in the manifest that is still
+/// being written to.
+/// </summary>
+void AsyncIO::closeMuxer(
+	int id, FileMuxer *muxer, const QString &manifestFilename,
+	const QByteArray &manifestLine)
+{
+	muxer->moveFileToThread(s_thread);
+	QMetaObject::invokeMethod(
+		this, "processCloseMuxer",
+		Q_ARG(int, id),
+		Q_ARG(FileMuxer *, muxer),
+		Q_ARG(const QString &, manifestFilename),
+		Q_ARG(const QByteArray &, manifestLine));
+}
+
+void AsyncIO::processCloseMuxer(
+	int id, FileMuxer *muxer, const QString &manifestFilename,
+	const QByteArray &manifestLine)
+{
+	QString filename = muxer->getFilename();
+	bool wroteHeader = muxer->hasWrittenHeader();
+	if(!muxer->close()) {
+		QString error = muxer->getLastError();
+		appLog(LOG_CAT, Log::Warning)
+			<< "Failed to finalize file \"" << filename << "\": " << error;
+		delete muxer;
+		emit closeMuxerComplete(id, 1, error);
+		return;
+	}
+	quint64 filesize = muxer->getBytesWritten();
+	delete muxer;
+
+	// Empty files never make it into the manifest
+	if(manifestFilename.isEmpty() || !wroteHeader) {
+		emit closeMuxerComplete(id, 0, QString());
+		return;
+	}
+	QByteArray line = manifestLine;
+	line.append(QByteArray::number(filesize));
+	line.append('\n');
+	QFile manifest(manifestFilename);
+	if(!manifest.open(QIODevice::WriteOnly | QIODevice::Append) ||
+		manifest.write(line) != line.size())
+	{
+		QString error = manifest.errorString();
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot write to segment manifest \"" << manifestFilename
+			<< "\": " << error;
+		emit closeMuxerComplete(id, 2, error);
+		return;
+	}
+	manifest.close();
+
+	emit closeMuxerComplete(id, 0, QString());
+}
+
+/// <summary>
+/// Makes sure that all data that has been written to the file so far
+/// survives a power loss without blocking the calling thread. The file must
+/// have already been flushed with `QFile::flush()` and can continue to be
+/// written to or even be closed while the operation is pending. Failures are
+/// logged only.
+/// </summary>
+void AsyncIO::syncFileToDisk(QFile *file)
+{
+	quint64 handle = duplicateFileHandle(file);
+	if(handle == 0) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot duplicate handle of \"" << file->fileName()
+			<< "\" for syncing to disk";
+		return;
+	}
+	QMetaObject::invokeMethod(
+		this, "processSyncFile",
+		Q_ARG(quint64, handle),
+		Q_ARG(const QString &, file->fileName()));
+}
+
+void AsyncIO::processSyncFile(quint64 handle, const QString &filename)
+{
+	if(!syncFileHandle(handle)) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Failed to sync file \"" << filename << "\" to disk";
+	}
+}
+
 void AsyncIO::flushLogFile()
 {
 	if(QThread::currentThread() != s_thread) {
@@ -18,14 +18,61 @@
 #ifndef ASYNCIO_H
 #define ASYNCIO_H
 
+#include "common.h"
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QMutex>
 #include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+#include <QtGui/QImage>
+
+class FileMuxer;
+class MetricsRegistry;
+class QFile;
+class QFileInfo;
+class QThreadPool;
+
+//=============================================================================
+/// <summary>
+/// A copy of some data that can be serialized without referencing anything
+/// that another thread can modify. Snapshots are taken on the main thread and
+/// then serialized by the IO thread with `AsyncIO::saveSnapshotToFile()` so
+/// that serializing large amounts of data never stalls the main loop.
+/// </summary>
+class AsyncSnapshot
+{
+public: // Constructor/destructor ---------------------------------------------
+	virtual ~AsyncSnapshot();
+
+public: // Interface ----------------------------------------------------------
+	virtual bool	serialize(QByteArray *dataOut) const = 0;
+};
+//=============================================================================
+
+Q_DECLARE_METATYPE(AsyncSnapshot *);
 
 //=============================================================================
+/// <summary>
+/// Performs file operations without blocking the main thread. Writes are
+/// executed in order on a single dedicated thread so that they never race
+/// with each other while reads are executed on a pool of worker threads in
+/// order of priority so that files that are needed immediately are not
+/// delayed by background prefetching. Reads that are no longer needed can be
+/// cancelled if they have not completed yet.
+/// </summary>
 class AsyncIO : public QObject
 {
 	Q_OBJECT
 
+	friend class AsyncReadTask;
+
+private: // Datatypes ---------------------------------------------------------
+	enum ReadType {
+		DataRead = 0,
+		ImageRead,
+		VersionRead
+	};
+
 private: // Static members ----------------------------------------------------
 	static QThread *	s_thread;
 	static AsyncIO *	s_worker;
@@ -33,6 +80,19 @@ private: // Static members ----------------------------------------------------
 private: // Members -----------------------------------------------------------
 	int					m_nextId;
 	QMutex				m_mutex;
+	QThreadPool *		m_readPool;
+	QElapsedTimer		m_clock;
+
+	// Read state, protected by `m_mutex`
+	QSet<int>			m_pendingReads;
+	QSet<int>			m_cancelledReads;
+
+	// Statistics, protected by `m_mutex`
+	quint64				m_bytesRead;
+	quint64				m_bytesMapped;
+	int					m_numCancelled;
+	QVector<quint64>	m_queueLatencies; // usec
+	QVector<quint64>	m_readTimes; // usec
 
 public: // Static methods -----------------------------------------------------
 	static AsyncIO *	createWorker();
@@ -44,16 +104,72 @@ private: // Constructor/destructor --------------------------------------------
 
 public: // Methods ------------------------------------------------------------
 	int					newOperationId();
+	void				waitForPending();
+	bool				cancel(int id);
+	void				reportMetrics(MetricsRegistry *metrics);
 	Q_INVOKABLE void	saveToFile(
 		int id, const QByteArray &data, const QString &filename,
 		bool safeSave);
-	Q_INVOKABLE void	loadFromFile(int id, const QString &filename);
+	Q_INVOKABLE void	saveSnapshotToFile(
+		int id, AsyncSnapshot *snapshot, const QString &filename,
+		bool safeSave);
+	void				loadFromFile(
+		int id, const QString &filename,
+		IOPriority priority = IOVisiblePriority);
+	void				loadImageFromFile(
+		int id, const QString &filename,
+		IOPriority priority = IOVisiblePriority);
+	void				getFileVersion(
+		int id, const QString &filename,
+		IOPriority priority = IOPrefetchPriority);
+	Q_INVOKABLE void	openFileForWriting(int id, const QString &filename);
+	Q_INVOKABLE void	beginSegmentedFile(
+		int id, const QString &filename, const QString &extension,
+		const QByteArray &manifestHeader);
+	void				closeMuxer(
+		int id, FileMuxer *muxer,
+		const QString &manifestFilename = QString(),
+		const QByteArray &manifestLine = QByteArray());
+	void				syncFileToDisk(QFile *file);
 	Q_INVOKABLE void	flushLogFile();
 
+private:
+	Q_INVOKABLE void	pendingBarrier();
+	Q_INVOKABLE void	setThreadRegistered(bool registered);
+	Q_INVOKABLE void	processSyncFile(
+		quint64 handle, const QString &filename);
+	Q_INVOKABLE void	processCloseMuxer(
+		int id, FileMuxer *muxer, const QString &manifestFilename,
+		const QByteArray &manifestLine);
+	void				queueRead(
+		int id, const QString &filename, IOPriority priority,
+		ReadType type);
+	bool				beginRead(int id, quint64 queuedTime);
+	bool				isReadCancelled(int id);
+	bool				endRead(int id, quint64 startTime, quint64 numBytes);
+	void				processLoadFromFile(int id, const QString &filename);
+	void				processLoadImageFromFile(
+		int id, const QString &filename);
+	void				processGetFileVersion(
+		int id, const QString &filename);
+	static QString		getVersionOfFile(const QFileInfo &info);
+
 Q_SIGNALS: // Signals ---------------------------------------------------------
-	void				saveToFileComplete(int id, int errorCode);
+	void				saveToFileComplete(
+		int id, int errorCode, int msecTaken);
 	void				loadFromFileComplete(
 		int id, int errorCode, const QByteArray &data);
+	void				loadImageFromFileComplete(
+		int id, int errorCode, const QByteArray &data, const QImage &img,
+		const QString &version);
+	void				getFileVersionComplete(
+		int id, const QString &version);
+	void				openFileForWritingComplete(
+		int id, int errorCode, QFile *file);
+	void				beginSegmentedFileComplete(
+		int id, int errorCode, const QString &baseName, QFile *file);
+	void				closeMuxerComplete(
+		int id, int errorCode, const QString &error);
 };
 //=============================================================================
 
@@ -20,6 +20,7 @@
 #include "audiomixer.h"
 #include "audiosource.h"
 #include "audiosourcemanager.h"
+#include "metrics.h"
 #include "Widgets/infowidget.h"
 #include <QtCore/QDataStream>
 
@@ -41,6 +42,8 @@ AudioInput::AudioInput(AudioMixer *mixer, quint64 sourceId, PrflAudioMode mode)
 	, m_isCalcInputStats(false)
 	, m_inStats(mixer->getSampleRate(), mixer->getNumChannels())
 	, m_outStats(mixer->getSampleRate(), mixer->getNumChannels())
+	, m_rmsMetric()
+	, m_peakMetric()
 
 	// Serialized data
 	, m_name(tr("Unnamed"))
@@ -49,6 +52,7 @@ AudioInput::AudioInput(AudioMixer *mixer, quint64 sourceId, PrflAudioMode mode)
 	, m_isMuted(false)
 	, m_delayUsec(0)
 {
+	updateMetricNames();
 }
 
 AudioInput::~AudioInput()
@@ -57,6 +61,13 @@ AudioInput::~AudioInput()
 		m_source->dereference();
 		m_source = NULL;
 	}
+
+	// Stop exporting our volume levels
+	MetricsRegistry *metrics = App->getMetrics();
+	if(metrics != NULL) {
+		metrics->remove(m_rmsMetric);
+		metrics->remove(m_peakMetric);
+	}
 }
 
 void AudioInput::setInitialized()
@@ -76,11 +87,39 @@ void AudioInput::setName(const QString &name)
 		return;
 	QString oldName = m_name;
 	m_name = str;
+	updateMetricNames();
 	m_mixer->inputChanged(this); // Remote emit
 	if(!m_isInitializing)
 		appLog(LOG_CAT) << "Renamed audio input " << getIdString();
 }
 
+/// <summary>
+/// Rebuilds the names of our metrics so that they are labeled with our
+/// current name. Metrics that used our previous name are no longer exported.
+/// </summary>
+void AudioInput::updateMetricNames()
+{
+	MetricsRegistry *metrics = App->getMetrics();
+	if(metrics != NULL && !m_rmsMetric.isEmpty()) {
+		metrics->remove(m_rmsMetric);
+		metrics->remove(m_peakMetric);
+	}
+	const QString key = QStringLiteral("input");
+	m_rmsMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_audio_input_rms_volume"), key, m_name);
+	m_peakMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_audio_input_peak_volume"), key, m_name);
+}
+
+/// <summary>
+/// Reports the volume levels of our output to the metrics registry.
+/// </summary>
+void AudioInput::reportMetrics(MetricsRegistry *metrics) const
+{
+	metrics->setGauge(m_rmsMetric, m_outStats.getRmsVolume());
+	metrics->setGauge(m_peakMetric, m_outStats.getPeakVolume());
+}
+
 void AudioInput::setCalcInputStats(bool calcInput)
 {
 	m_isCalcInputStats = calcInput;
@@ -28,6 +28,7 @@
 class AudioInputInfoWidget;
 class AudioMixer;
 class AudioSource;
+class MetricsRegistry;
 
 //=============================================================================
 /// <summary>
@@ -55,6 +56,8 @@ protected: // Members ---------------------------------------------------------
 	bool				m_isCalcInputStats;
 	AudioStats			m_inStats;
 	AudioStats			m_outStats;
+	QString				m_rmsMetric;
+	QString				m_peakMetric;
 
 	// Serialized data
 	QString				m_name;
@@ -103,9 +106,11 @@ public: // Methods ------------------------------------------------------------
 	void			reduceBufferBy(int numReadFloats);
 
 	void			setupInputInfo(AudioInputInfoWidget *widget) const;
+	void			reportMetrics(MetricsRegistry *metrics) const;
 
 private:
 	void			initializedEvent();
+	void			updateMetricNames();
 
 	public
 Q_SLOTS: // Slots -------------------------------------------------------------
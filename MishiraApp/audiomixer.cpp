@@ -20,11 +20,19 @@
 #include "audiomixer.h"
 #include "audioinput.h"
 #include "application.h"
+#include "metrics.h"
 #include "profile.h"
+#include "tracer.h"
 #include <QtCore/QBuffer>
 
 const QString LOG_CAT = QStringLiteral("Audio");
 
+// Names of the metrics that are reported every frame
+const QString OUTPUT_RMS_METRIC =
+	QStringLiteral("mishira_audio_output_rms_volume");
+const QString OUTPUT_PEAK_METRIC =
+	QStringLiteral("mishira_audio_output_peak_volume");
+
 //=============================================================================
 // Helpers
 
@@ -392,6 +400,11 @@ void AudioMixer::logInputs() const
 
 void AudioMixer::realTimeFrameEvent(int numDropped, int lateByUsec)
 {
+	TraceZone zone("AudioMixer::realTimeFrameEvent");
+
+	// Report the volume levels that were calculated during the previous frame
+	reportMetrics();
+
 	// Process audio inputs no more than once per video frame. We want to
 	// always process the audio even if the user isn't broadcasting as we need
 	// to update the mixer UI to let the user know that audio is being
@@ -589,6 +602,19 @@ void AudioMixer::realTimeFrameEvent(int numDropped, int lateByUsec)
 #endif // OUTPUT_TEST_SIGNAL
 }
 
+/// <summary>
+/// Reports the volume levels of our output and of every input to the metrics
+/// registry.
+/// </summary>
+void AudioMixer::reportMetrics()
+{
+	MetricsRegistry *metrics = App->getMetrics();
+	metrics->setGauge(OUTPUT_RMS_METRIC, m_outStats.getRmsVolume());
+	metrics->setGauge(OUTPUT_PEAK_METRIC, m_outStats.getPeakVolume());
+	for(int i = 0; i < m_inputs.count(); i++)
+		m_inputs.at(i)->reportMetrics(metrics);
+}
+
 void AudioMixer::audioModeChanged(PrflAudioMode mode)
 {
 	// As we are constantly mixing even when we are not broadcasting the only
@@ -91,6 +91,7 @@ public: // Methods ------------------------------------------------------------
 
 private:
 	void				calcMinInputDelay();
+	void				reportMetrics();
 	AudioInputList &	getInputsMutable();
 
 Q_SIGNALS: // Signals ---------------------------------------------------------
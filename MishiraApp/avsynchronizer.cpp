@@ -42,96 +42,155 @@ const QString LOG_CAT = QStringLiteral("AVSync");
 //*****************************************************************************
 // WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING
 
-AVSynchronizer::AVSynchronizer(VideoEncoder *vEnc, AudioEncoder *aEnc)
+//=============================================================================
+// AVSyncCore::StepClock struct
+
+void AVSyncCore::StepClock::reset(const Fraction &timeBase, qint64 n)
+{
+	quint64 total = (quint64)n * 1000000ULL * (quint64)timeBase.numerator;
+	den = (quint64)timeBase.denominator;
+	usec = total / den;
+	rem = total % den;
+	stepUsec = (1000000ULL * (quint64)timeBase.numerator) / den;
+	stepRem = (1000000ULL * (quint64)timeBase.numerator) % den;
+}
+
+void AVSyncCore::StepClock::step()
+{
+	usec += stepUsec;
+	rem += stepRem;
+	if(rem >= den) {
+		usec++;
+		rem -= den;
+	}
+}
+
+//=============================================================================
+// AVSyncCore class
+
+QVector<AVSyncCore *> AVSyncCore::s_cores;
+
+/// <summary>
+/// Returns the shared synchroniser of the specified encoder pair creating it
+/// if it doesn't already exist. Every call must be matched with a call to
+/// `derefCore()`.
+/// </summary>
+AVSyncCore *AVSyncCore::refCore(VideoEncoder *vEnc, AudioEncoder *aEnc)
+{
+	for(int i = 0; i < s_cores.count(); i++) {
+		AVSyncCore *core = s_cores.at(i);
+		if(core->m_videoEnc == vEnc && core->m_audioEnc == aEnc) {
+			core->m_ref++;
+			return core;
+		}
+	}
+	AVSyncCore *core = new AVSyncCore(vEnc, aEnc);
+	s_cores.append(core);
+	return core;
+}
+
+void AVSyncCore::derefCore(AVSyncCore *core)
+{
+	if(core == NULL)
+		return;
+	core->m_ref--;
+	if(core->m_ref > 0)
+		return;
+	s_cores.remove(s_cores.indexOf(core));
+	delete core;
+}
+
+AVSyncCore::AVSyncCore(VideoEncoder *vEnc, AudioEncoder *aEnc)
 	: QObject()
 	, m_videoEnc(vEnc)
 	, m_audioEnc(aEnc)
-	, m_isActive(false)
+	, m_ref(1)
+	, m_outputs()
 	, m_isSynced(false)
 	, m_waitingForVideoKeyframe(false)
 	, m_waitingForAudioKeyframe(true)
 	, m_firstVideoPts(0)
 	, m_nextAudioPts(0)
+	, m_nextAudioTime()
+	, m_firstVideoPtsUsec(0)
 	, m_firstAudioTimestamp(0)
-	, m_videoFrames()
-	, m_audioPkts()
+	, m_videoFrames(64)
+	, m_audioPkts(256)
 	, m_syncError(0)
 	, m_beginTime(0)
 {
 	// Connect encoder signals
 	if(m_videoEnc != NULL) {
 		connect(m_videoEnc, &VideoEncoder::frameEncoded,
-			this, &AVSynchronizer::frameEncoded);
+			this, &AVSyncCore::frameEncoded);
 	}
 	if(m_audioEnc != NULL) {
 		connect(m_audioEnc, &AudioEncoder::segmentEncoded,
-			this, &AVSynchronizer::segmentEncoded);
+			this, &AVSyncCore::segmentEncoded);
 	}
 }
 
-AVSynchronizer::~AVSynchronizer()
+AVSyncCore::~AVSyncCore()
 {
-	// Make sure to dereference the encoders if they are referenced
-	setActive(false);
+	Q_ASSERT(m_outputs.isEmpty());
 }
 
 /// <summary>
-/// Activate or deactivate the synchronizer output.
+/// Begins giving our output to the specified synchroniser. If this is the
+/// first output then we begin synchronising from scratch.
 /// </summary>
-/// <returns>True if successfully changed state</returns>
-bool AVSynchronizer::setActive(bool active)
+void AVSyncCore::addOutput(AVSynchronizer *output)
 {
-	if(m_isActive == active)
-		return true; // Nothing to do
-	if(active) {
-		if(m_videoEnc == NULL)
-			return false; // We need a video encoder to work
-		if(!m_videoEnc->refActivate())
-			return false;
-		if(m_audioEnc != NULL) {
-			if(!m_audioEnc->refActivate()) {
-				m_videoEnc->derefActivate();
-				return false;
-			}
-		}
-		m_isActive = true;
+	if(m_outputs.contains(output))
+		return;
+	if(m_outputs.isEmpty())
+		reset();
+	m_outputs.append(output);
+}
 
-		// Reset state
-		m_isSynced = false;
-		m_waitingForVideoKeyframe = false;
-		m_waitingForAudioKeyframe = true;
-		m_firstVideoPts = 0;
-		m_nextAudioPts = 0;
-		m_firstAudioTimestamp = 0;
+void AVSyncCore::removeOutput(AVSynchronizer *output)
+{
+	int index = m_outputs.indexOf(output);
+	if(index < 0)
+		return;
+	m_outputs.remove(index);
+	if(m_outputs.isEmpty()) {
+		// Release our buffers as soon as possible
 		m_videoFrames.clear();
 		m_audioPkts.clear();
-		m_syncError = 0;
-		m_beginTime = App->getUsecSinceExec();
-	} else {
-		m_videoEnc->derefActivate();
-		if(m_audioEnc != NULL)
-			m_audioEnc->derefActivate();
-		m_isActive = false;
 	}
-	return true;
+}
+
+void AVSyncCore::reset()
+{
+	m_isSynced = false;
+	m_waitingForVideoKeyframe = false;
+	m_waitingForAudioKeyframe = true;
+	m_firstVideoPts = 0;
+	m_nextAudioPts = 0;
+	m_firstVideoPtsUsec = 0;
+	m_firstAudioTimestamp = 0;
+	m_videoFrames.clear();
+	m_audioPkts.clear();
+	m_syncError = 0;
+	m_beginTime = App->getUsecSinceExec();
 }
 
 /// <summary>
 /// Returns the index of the audio frame that the specified video frame
 /// synchronises with or -1 if no such frame was found.
 /// </summary>
-int AVSynchronizer::findFirstAudioForVideo(EncodedFrame frame)
+int AVSyncCore::findFirstAudioForVideo(const EncodedFrame &frame) const
 {
 	Fraction vTBase = m_videoEnc->getTimeBase();
 	Fraction aTBase = m_audioEnc->getTimeBase();
 	quint64 vTimeStart = frame.getTimestampMsec();
 	quint64 vTimeEnd = vTimeStart + (1000ULL * (quint64)vTBase.numerator) /
 		(quint64)vTBase.denominator;
-	for(int i = 0; i < m_audioPkts.count(); i++) {
-		const EncodedPacket &pkt = m_audioPkts.at(i);
-		quint64 aTime = m_firstAudioTimestamp +
-			((quint64)i * (quint64)aTBase.numerator * 1000ULL) /
-			(quint64)aTBase.denominator;
+	StepClock aClock;
+	aClock.reset(aTBase, 0);
+	for(int i = 0; i < m_audioPkts.count(); i++, aClock.step()) {
+		quint64 aTime = m_firstAudioTimestamp + aClock.usec / 1000ULL;
 		if(aTime >= vTimeStart) {
 			if(i == 0) {
 				// If this is the first audio frame then there is a chance that
@@ -142,8 +201,8 @@ int AVSynchronizer::findFirstAudioForVideo(EncodedFrame frame)
 				// If the audio time base is less than half that of the video
 				// time base then we need to check to see if it's possible that
 				// we are missing another audio frame before this one.
-				qint64 aPrevTime = (qint64)m_firstAudioTimestamp +
-					((qint64)(i - 1) * (qint64)aTBase.numerator * 1000LL) /
+				qint64 aPrevTime = (qint64)m_firstAudioTimestamp -
+					((qint64)aTBase.numerator * 1000LL) /
 					(qint64)aTBase.denominator;
 				if(aPrevTime >= (qint64)vTimeStart) {
 					// We are missing at least one audio frame so we cannot
@@ -165,19 +224,19 @@ int AVSynchronizer::findFirstAudioForVideo(EncodedFrame frame)
 /// first video frame). If there is no overlap between video and audio then
 /// this method does nothing.
 /// </summary>
-void AVSynchronizer::trimBuffers()
+void AVSyncCore::trimBuffers()
 {
 	// Attempt to trim the video stream first as it is the more important one
 	// and we may need to drop some audio frames as well this iteration.
 	for(int i = 0; i < m_videoFrames.count(); i++) {
-		const EncodedFrame &frame = m_videoFrames.at(i);
+		const EncodedFrame &frame = m_videoFrames.at(i).frame;
 		int audIndex = findFirstAudioForVideo(frame);
 		if(audIndex >= 0) {
 			// We found the first valid frame, trim the rest
 			if(i > 0) {
 				//appLog(LOG_CAT)
 				//	<< QStringLiteral("Trimming %1 video frames").arg(i);
-				m_videoFrames.remove(0, i);
+				m_videoFrames.removeFirst(i);
 			}
 			break;
 		}
@@ -187,7 +246,7 @@ void AVSynchronizer::trimBuffers()
 	// Attempt to trim the audio stream. Even if the video stream begins before
 	// the audio we might still need to trim the audio due to the potential
 	// one-to-many nature of frames.
-	int audIndex = findFirstAudioForVideo(m_videoFrames.first());
+	int audIndex = findFirstAudioForVideo(m_videoFrames.first().frame);
 	if(audIndex > 0) {
 		//appLog(LOG_CAT)
 		//	<< QStringLiteral("Trimming %1 audio packets").arg(audIndex);
@@ -195,7 +254,7 @@ void AVSynchronizer::trimBuffers()
 		m_firstAudioTimestamp = m_firstAudioTimestamp +
 			((quint64)audIndex * (quint64)aTBase.numerator * 1000ULL) /
 			(quint64)aTBase.denominator;
-		m_audioPkts.remove(0, audIndex);
+		m_audioPkts.removeFirst(audIndex);
 	}
 	Q_ASSERT(!m_audioPkts.isEmpty());
 }
@@ -204,7 +263,7 @@ void AVSynchronizer::trimBuffers()
 /// Synchronise the first audio frame with the first video frame.
 /// </summary>
 /// <returns>True if the streams have been successfully synchronised.</returns>
-bool AVSynchronizer::doInitialSync()
+bool AVSyncCore::doInitialSync()
 {
 	if(m_isSynced)
 		return true; // Already synchronised
@@ -222,7 +281,7 @@ bool AVSynchronizer::doInitialSync()
 
 	// If the first video frame doesn't have a corrosponding audio frame then
 	// it means we cannot synchronise right now as there is no overlap
-	if(findFirstAudioForVideo(m_videoFrames.first()) == -1)
+	if(findFirstAudioForVideo(m_videoFrames.first().frame) == -1)
 		return false;
 
 	// If we reach here then it means that we are essentially synchronised but
@@ -234,17 +293,17 @@ bool AVSynchronizer::doInitialSync()
 	// several times and we only want to ever force a single keyframe.
 	bool hasKeyframe = false;
 	for(int i = 0; i < m_videoFrames.count(); i++) {
-		EncodedFrame frame = m_videoFrames.at(i);
-		if(frame.isKeyframe()) {
+		const QueuedFrame &queued = m_videoFrames.at(i);
+		if(queued.frame.isKeyframe()) {
 			hasKeyframe = true;
 			m_waitingForVideoKeyframe = false;
-			m_firstVideoPts = frame.getPTS();
+			m_firstVideoPts = queued.frame.getPTS();
 			//appLog(LOG_CAT) << "Found keyframe at " << m_firstVideoPts;
 			if(i > 0) {
 				//appLog(LOG_CAT) <<
 				//	QStringLiteral("Trimming %1 video frames for keyframe")
 				//	.arg(i);
-				m_videoFrames.remove(0, i);
+				m_videoFrames.removeFirst(i);
 			}
 			break;
 		}
@@ -263,7 +322,7 @@ bool AVSynchronizer::doInitialSync()
 	// longer overlap. Test if this happened. While we do this we can also see
 	// if we need to do any additional trimming on the audio stream so the
 	// first audio frame in the stream corrosponds to the beginning keyframe.
-	int audIndex = findFirstAudioForVideo(m_videoFrames.first());
+	int audIndex = findFirstAudioForVideo(m_videoFrames.first().frame);
 	if(audIndex == -1)
 		return false; // No longer overlapping
 	else if(audIndex > 0) {
@@ -280,9 +339,8 @@ bool AVSynchronizer::doInitialSync()
 	// time that the audio will be moved forward so that PTS 0 of both channels
 	// occur at the exact same time during playback. We also store the error in
 	// case any targets want to take it into account for frame dropping.
-	m_syncError =
-		(m_firstAudioTimestamp - m_videoFrames.first().getTimestampMsec()) *
-		1000000ULL;
+	m_syncError = (m_firstAudioTimestamp -
+		m_videoFrames.first().frame.getTimestampMsec()) * 1000000ULL;
 	appLog(LOG_CAT) <<
 		QStringLiteral("Audio/video synchronisation error = %L1 ms")
 		.arg(m_syncError / 1000000LL);
@@ -297,7 +355,7 @@ bool AVSynchronizer::doInitialSync()
 	appLog(LOG_CAT) <<
 		QStringLiteral("Video pipeline lags %L1 ms behind the audio pipeline")
 		.arg((qint64)lastAudioTimestamp -
-		(qint64)m_videoFrames.last().getTimestampMsec());
+		(qint64)m_videoFrames.last().frame.getTimestampMsec());
 
 	// How long did it take to synchronise?
 	appLog(LOG_CAT) <<
@@ -328,24 +386,33 @@ bool AVSynchronizer::doInitialSync()
 ///        -----------+-+---------+-----------+---+-------+-----
 /// Audio:              |            1            |      4
 ///        -------------+-------------------------+-------------
+///
+/// The timestamp of each video frame is converted to microseconds once when
+/// it is queued and the audio timestamps are calculated incrementally so no
+/// 64-bit divisions are done for packets that we have already looked at.
 /// </summary>
-/// <returns>True if the last video frame in our buffer was emitted</returns>
-void AVSynchronizer::emitDataInterleaved()
+void AVSyncCore::emitDataInterleaved()
 {
 	// If we have no audio to synchronise with then we can output all our video
 	// data immediately
 	if(m_audioEnc == NULL) {
 		for(int i = 0; i < m_videoFrames.count(); i++)
-			emit frameReady(m_videoFrames.at(i));
+			emitFrame(m_videoFrames.at(i).frame);
 		m_videoFrames.clear();
 		return;
 	}
 
+	// Everything is relative to the first video frame that we emit
+	if(m_nextAudioPts == 0) {
+		Fraction vTBase = m_videoEnc->getTimeBase();
+		m_firstVideoPtsUsec = (m_firstVideoPts * 1000000LL *
+			(qint64)vTBase.numerator) / (qint64)vTBase.denominator;
+		m_nextAudioTime.reset(m_audioEnc->getTimeBase(), 0);
+	}
+
 	// In order to guarantee that the packet timestamps are always increasing
 	// we must have at least one packet from each stream in our buffers.
 	// TODO: This is not true as we know what the next DTS will be
-	Fraction vTBase = m_videoEnc->getTimeBase();
-	Fraction aTBase = m_audioEnc->getTimeBase();
 	while(m_videoFrames.count() != 0 && m_audioPkts.count() != 0) {
 		// All timestamps are in microseconds since video start. If this isn't
 		// enough resolution then we need to redesign this loop as we're using
@@ -353,66 +420,95 @@ void AVSynchronizer::emitDataInterleaved()
 		// non-stop for over a week (Awesome Games Done Quick is 5 days
 		// straight) at maximum framerate and audio frequency.
 		quint64 vTime = 0;
-		quint64 nextATime = ((quint64)m_nextAudioPts * 1000000ULL *
-			(quint64)aTBase.numerator) / (quint64)aTBase.denominator;
+		quint64 nextATime = m_nextAudioTime.usec;
 
 		// Emit all video frames that begin before the next audio packet begins
 		int processedFrames = 0;
 		for(; processedFrames < m_videoFrames.count(); processedFrames++) {
-			EncodedFrame frame = m_videoFrames.at(processedFrames);
+			const QueuedFrame &queued = m_videoFrames.at(processedFrames);
+			const EncodedFrame &frame = queued.frame;
 			qint64 adjDTS = frame.getDTS() - m_firstVideoPts;
 			if(adjDTS > 0) {
 				// Don't use `getDTSTimestampMsec()` as it's not reliable
-				vTime = ((quint64)adjDTS * 1000000ULL *
-					(quint64)vTBase.numerator) /
-					(quint64)vTBase.denominator;
+				vTime = (quint64)qMax<qint64>(
+					0, queued.dtsUsec - m_firstVideoPtsUsec);
 				if(vTime > nextATime)
 					break; // Cannot emit this frame
 			}
 			// Emit the frame with adjusted DTS and PTS
-			emit frameReady(EncodedFrame(frame.encoder(), frame.getPackets(),
+			emitFrame(EncodedFrame(frame.encoder(), frame.getPackets(),
 				frame.isKeyframe(), frame.getPriority(),
 				frame.getTimestampMsec(), frame.getPTS() - m_firstVideoPts,
 				frame.getDTS() - m_firstVideoPts));
 		}
 		if(processedFrames > 0) {
-			m_videoFrames.remove(0, processedFrames);
+			m_videoFrames.removeFirst(processedFrames);
 			if(m_videoFrames.count() == 0)
 				break; // Not safe to continue
 		}
 
 		// Emit all audio packets that begin before the next video frame begins
 		EncodedPacketList pkts;
+		StepClock aClock = m_nextAudioTime;
 		for(int i = 0; i < m_audioPkts.count(); i++) {
-			quint64 aTime = ((quint64)(m_nextAudioPts + i) *
-				1000000ULL * (quint64)aTBase.numerator) /
-				(quint64)aTBase.denominator;
-			if(aTime > vTime)
+			if(aClock.usec > vTime)
 				break; // Cannot emit this packet
 			pkts.append(m_audioPkts.at(i));
+			aClock.step();
 		}
 		if(pkts.count() > 0) {
 			// Emit reconstructed audio segment object
 			EncodedSegment segment(
 				m_audioEnc, pkts, true,
 				m_firstAudioTimestamp + nextATime / 1000ULL, m_nextAudioPts);
-			emit segmentReady(segment);
-			m_audioPkts.remove(0, pkts.count());
+			emitSegment(segment);
+			m_audioPkts.removeFirst(pkts.count());
 			m_nextAudioPts += pkts.count();
+			m_nextAudioTime = aClock;
 			if(m_audioPkts.count() == 0)
 				break; // Not safe to continue
 		}
 	}
 }
 
-void AVSynchronizer::frameEncoded(EncodedFrame frame)
+/// <summary>
+/// Gives the frame to every active synchroniser. Synchronisers can be
+/// deactivated or deleted while we are doing this so we iterate over a copy of
+/// the list and make sure that each one is still active before using it.
+/// </summary>
+void AVSyncCore::emitFrame(const EncodedFrame &frame)
 {
-	if(!m_isActive)
+	QVector<AVSynchronizer *> outputs = m_outputs;
+	for(int i = 0; i < outputs.count(); i++) {
+		AVSynchronizer *output = outputs.at(i);
+		if(m_outputs.contains(output))
+			output->coreFrameReady(frame);
+	}
+}
+
+void AVSyncCore::emitSegment(const EncodedSegment &segment)
+{
+	QVector<AVSynchronizer *> outputs = m_outputs;
+	for(int i = 0; i < outputs.count(); i++) {
+		AVSynchronizer *output = outputs.at(i);
+		if(m_outputs.contains(output))
+			output->coreSegmentReady(segment);
+	}
+}
+
+void AVSyncCore::frameEncoded(EncodedFrame frame)
+{
+	if(m_outputs.isEmpty())
 		return;
 	//appLog() << "Synchroniser: " << frame.getDebugString();
 
 	// Add the video frame to our buffer
-	m_videoFrames += frame;
+	Fraction vTBase = m_videoEnc->getTimeBase();
+	QueuedFrame queued;
+	queued.frame = frame;
+	queued.dtsUsec = (frame.getDTS() * 1000000LL * (qint64)vTBase.numerator) /
+		(qint64)vTBase.denominator;
+	m_videoFrames.append(queued);
 
 	if(doInitialSync()) {
 		// Our streams are synchronised, do interleaving
@@ -425,15 +521,17 @@ void AVSynchronizer::frameEncoded(EncodedFrame frame)
 	}
 }
 
-void AVSynchronizer::segmentEncoded(EncodedSegment segment)
+void AVSyncCore::segmentEncoded(EncodedSegment segment)
 {
-	if(!m_isActive)
+	if(m_outputs.isEmpty())
 		return;
 	// Our code assumes that every segment is a keyframe
 	//appLog() << "Synchroniser: " << segment.getDebugString();
 
 	// Add the audio segment to our buffer
-	m_audioPkts += segment.getPackets();
+	EncodedPacketList pkts = segment.getPackets();
+	for(int i = 0; i < pkts.count(); i++)
+		m_audioPkts.append(pkts.at(i));
 
 	// As we only buffer the actual packet data we need to keep track of the
 	// initial timing data so we can reconstruct it later based on the packet's
@@ -455,3 +553,138 @@ void AVSynchronizer::segmentEncoded(EncodedSegment segment)
 		segment.makePersistent();
 	}
 }
+
+//=============================================================================
+// AVSynchronizer class
+
+AVSynchronizer::AVSynchronizer(VideoEncoder *vEnc, AudioEncoder *aEnc)
+	: QObject()
+	, m_core(AVSyncCore::refCore(vEnc, aEnc))
+	, m_isActive(false)
+	, m_waitingForKeyframe(false)
+	, m_waitingForAudio(false)
+	, m_videoPtsOffset(0)
+	, m_audioPtsOffset(0)
+	, m_audioStartUsec(0)
+{
+}
+
+AVSynchronizer::~AVSynchronizer()
+{
+	// Make sure to dereference the encoders if they are referenced
+	setActive(false);
+	AVSyncCore::derefCore(m_core);
+}
+
+/// <summary>
+/// Activate or deactivate the synchronizer output.
+/// </summary>
+/// <returns>True if successfully changed state</returns>
+bool AVSynchronizer::setActive(bool active)
+{
+	if(m_isActive == active)
+		return true; // Nothing to do
+	VideoEncoder *vEnc = m_core->getVideoEncoder();
+	AudioEncoder *aEnc = m_core->getAudioEncoder();
+	if(active) {
+		if(vEnc == NULL)
+			return false; // We need a video encoder to work
+		if(!vEnc->refActivate())
+			return false;
+		if(aEnc != NULL) {
+			if(!aEnc->refActivate()) {
+				vEnc->derefActivate();
+				return false;
+			}
+		}
+		m_isActive = true;
+
+		// Reset state. If other targets are already receiving output from the
+		// shared synchroniser then we join them at the next keyframe.
+		m_waitingForKeyframe = m_core->isEmitting();
+		m_waitingForAudio = m_waitingForKeyframe && aEnc != NULL;
+		m_videoPtsOffset = 0;
+		m_audioPtsOffset = 0;
+		m_audioStartUsec = 0;
+		if(m_waitingForKeyframe)
+			vEnc->forceKeyframe();
+		m_core->addOutput(this);
+	} else {
+		m_core->removeOutput(this);
+		vEnc->derefActivate();
+		if(aEnc != NULL)
+			aEnc->derefActivate();
+		m_isActive = false;
+	}
+	return true;
+}
+
+void AVSynchronizer::coreFrameReady(const EncodedFrame &frame)
+{
+	if(m_waitingForKeyframe) {
+		if(!frame.isKeyframe())
+			return;
+
+		// This keyframe becomes PTS 0 of our output. Audio that begins before
+		// this frame is discarded.
+		Fraction vTBase = frame.encoder()->getTimeBase();
+		m_waitingForKeyframe = false;
+		m_videoPtsOffset = frame.getPTS();
+		m_audioStartUsec = ((quint64)qMax<qint64>(0, frame.getPTS()) *
+			1000000ULL * (quint64)vTBase.numerator) /
+			(quint64)vTBase.denominator;
+	}
+
+	// In the common case all targets were activated at the same time and we
+	// can forward the exact same object
+	if(m_videoPtsOffset == 0) {
+		emit frameReady(frame);
+		return;
+	}
+	emit frameReady(EncodedFrame(frame.encoder(), frame.getPackets(),
+		frame.isKeyframe(), frame.getPriority(), frame.getTimestampMsec(),
+		frame.getPTS() - m_videoPtsOffset, frame.getDTS() - m_videoPtsOffset));
+}
+
+void AVSynchronizer::coreSegmentReady(const EncodedSegment &segment)
+{
+	if(m_waitingForKeyframe)
+		return; // The video must always begin first
+	if(m_waitingForAudio) {
+		// Find the first packet that doesn't begin before our first video
+		// frame and make it PTS 0 of our audio output
+		Fraction aTBase = segment.encoder()->getTimeBase();
+		EncodedPacketList pkts = segment.getPackets();
+		int first = 0;
+		for(; first < pkts.count(); first++) {
+			quint64 aTime = ((quint64)(segment.getPTS() + first) *
+				1000000ULL * (quint64)aTBase.numerator) /
+				(quint64)aTBase.denominator;
+			if(aTime >= m_audioStartUsec)
+				break;
+		}
+		if(first >= pkts.count())
+			return; // Entire segment is before our video
+		m_waitingForAudio = false;
+		m_audioPtsOffset = segment.getPTS() + first;
+		if(first > 0) {
+			pkts.remove(0, first);
+			emit segmentReady(EncodedSegment(
+				segment.encoder(), pkts, segment.isKeyframe(),
+				segment.getTimestampMsec() +
+				((quint64)first * (quint64)aTBase.numerator * 1000ULL) /
+				(quint64)aTBase.denominator, 0));
+			return;
+		}
+	}
+
+	// In the common case all targets were activated at the same time and we
+	// can forward the exact same object
+	if(m_audioPtsOffset == 0) {
+		emit segmentReady(segment);
+		return;
+	}
+	emit segmentReady(EncodedSegment(
+		segment.encoder(), segment.getPackets(), segment.isKeyframe(),
+		segment.getTimestampMsec(), segment.getPTS() - m_audioPtsOffset));
+}
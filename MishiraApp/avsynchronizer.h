@@ -20,33 +20,148 @@
 
 #include "encodedframe.h"
 #include "encodedsegment.h"
+#include "ringbuffer.h"
 #include <QtCore/QObject>
 
+class AVSynchronizer;
+
+//=============================================================================
+/// <summary>
+/// The shared part of `AVSynchronizer` that does the actual synchronisation
+/// of a single encoded video and audio stream based on their real-time
+/// timestamps. It guarantees that video and audio data are correctly
+/// interweaved based on their DTS and that the first video frame is a
+/// keyframe with a PTS of 0.
+///
+/// There is only ever one object for each pair of encoders no matter how many
+/// targets use them. The interleaved output is calculated once and then given
+/// to every active `AVSynchronizer` of the pair.
+/// </summary>
+class AVSyncCore : public QObject
+{
+	Q_OBJECT
+
+private: // Datatypes ---------------------------------------------------------
+	/// <summary>
+	/// Converts an incrementing timestamp into microseconds without doing a
+	/// 64-bit multiplication and division for every step. The result is
+	/// identical to `(n * 1000000 * num) / den`.
+	/// </summary>
+	struct StepClock {
+		quint64	usec;
+		quint64	rem;
+		quint64	stepUsec;
+		quint64	stepRem;
+		quint64	den;
+
+		void	reset(const Fraction &timeBase, qint64 n);
+		void	step();
+	};
+
+	struct QueuedFrame {
+		EncodedFrame	frame;
+		qint64			dtsUsec; // Calculated once when queued
+	};
+
+private: // Static members ----------------------------------------------------
+	static QVector<AVSyncCore *>	s_cores;
+
+protected: // Members ---------------------------------------------------------
+	VideoEncoder *				m_videoEnc;
+	AudioEncoder *				m_audioEnc;
+	int							m_ref;
+	QVector<AVSynchronizer *>	m_outputs; // Active synchronisers
+	bool						m_isSynced;
+	bool						m_waitingForVideoKeyframe;
+	bool						m_waitingForAudioKeyframe;
+	qint64						m_firstVideoPts;
+	qint64						m_nextAudioPts;
+	StepClock					m_nextAudioTime; // Time of `m_nextAudioPts`
+	qint64						m_firstVideoPtsUsec;
+	quint64						m_firstAudioTimestamp;
+	RingBuffer<QueuedFrame>		m_videoFrames;
+	RingBuffer<EncodedPacket>	m_audioPkts;
+	qint64						m_syncError; // Nsec that audio is behind video
+	quint64						m_beginTime; // How long does it take to sync?
+
+public: // Static methods -----------------------------------------------------
+	static AVSyncCore *	refCore(VideoEncoder *vEnc, AudioEncoder *aEnc);
+	static void			derefCore(AVSyncCore *core);
+
+private: // Constructor/destructor --------------------------------------------
+	AVSyncCore(VideoEncoder *vEnc, AudioEncoder *aEnc);
+	virtual ~AVSyncCore();
+
+public: // Methods ------------------------------------------------------------
+	VideoEncoder *	getVideoEncoder() const;
+	AudioEncoder *	getAudioEncoder() const;
+	bool			isSynchronized() const;
+	bool			isEmitting() const;
+	void			addOutput(AVSynchronizer *output);
+	void			removeOutput(AVSynchronizer *output);
+
+private:
+	void			reset();
+	int				findFirstAudioForVideo(const EncodedFrame &frame) const;
+	void			trimBuffers();
+	bool			doInitialSync();
+	void			emitDataInterleaved();
+	void			emitFrame(const EncodedFrame &frame);
+	void			emitSegment(const EncodedSegment &segment);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void			frameEncoded(EncodedFrame frame);
+	void			segmentEncoded(EncodedSegment segment);
+};
+//=============================================================================
+
+inline VideoEncoder *AVSyncCore::getVideoEncoder() const
+{
+	return m_videoEnc;
+}
+
+inline AudioEncoder *AVSyncCore::getAudioEncoder() const
+{
+	return m_audioEnc;
+}
+
+inline bool AVSyncCore::isSynchronized() const
+{
+	return !m_outputs.isEmpty() && m_isSynced;
+}
+
+inline bool AVSyncCore::isEmitting() const
+{
+	return !m_outputs.isEmpty() && m_isSynced && !m_waitingForVideoKeyframe;
+}
+
 //=============================================================================
 /// <summary>
-/// A class that handles the synchronising of a single encoded video and audio
-/// stream based on their real-time timestamps. It guarantees that video and
-/// audio data are correctly interweaved based on their DTS and that the first
-/// video frame is a keyframe with a PTS of 0.
+/// Provides a target with the synchronised output of a single encoded video
+/// and audio stream. See `AVSyncCore` for the guarantees that are made about
+/// the output.
+///
+/// As all targets that use the same encoders share the same `AVSyncCore` a
+/// target that is activated while other targets are already broadcasting
+/// joins the existing output at the next keyframe. The timestamps of such a
+/// target are then offset so that its output still begins at PTS 0. Targets
+/// that are activated at the same time receive the exact same objects.
 /// </summary>
 class AVSynchronizer : public QObject
 {
+	friend class AVSyncCore;
+
 	Q_OBJECT
 
 protected: // Members ---------------------------------------------------------
-	VideoEncoder *		m_videoEnc;
-	AudioEncoder *		m_audioEnc;
-	bool				m_isActive;
-	bool				m_isSynced;
-	bool				m_waitingForVideoKeyframe;
-	bool				m_waitingForAudioKeyframe;
-	qint64				m_firstVideoPts;
-	qint64				m_nextAudioPts;
-	quint64				m_firstAudioTimestamp;
-	EncodedFrameList	m_videoFrames; // TODO: Use a more efficient queue
-	EncodedPacketList	m_audioPkts; // TODO: Use a more efficient queue
-	qint64				m_syncError; // Number of nsec that audio is behind video
-	quint64				m_beginTime; // How long does it take to sync?
+	AVSyncCore *	m_core;
+	bool			m_isActive;
+	bool			m_waitingForKeyframe;
+	bool			m_waitingForAudio;
+	qint64			m_videoPtsOffset;
+	qint64			m_audioPtsOffset;
+	quint64			m_audioStartUsec; // Drop audio that begins before this
 
 public: // Constructor/destructor ---------------------------------------------
 	AVSynchronizer(VideoEncoder *vEnc, AudioEncoder *aEnc);
@@ -59,19 +174,12 @@ public: // Methods ------------------------------------------------------------
 	bool	isEmitting() const;
 
 private:
-	int		findFirstAudioForVideo(EncodedFrame frame);
-	void	trimBuffers();
-	bool	doInitialSync();
-	void	emitDataInterleaved();
+	void	coreFrameReady(const EncodedFrame &frame);
+	void	coreSegmentReady(const EncodedSegment &segment);
 
 Q_SIGNALS: // Signals ---------------------------------------------------------
 	void	frameReady(EncodedFrame frame);
 	void	segmentReady(EncodedSegment segment);
-
-	private
-Q_SLOTS: // Slots -------------------------------------------------------------
-	void	frameEncoded(EncodedFrame frame);
-	void	segmentEncoded(EncodedSegment segment);
 };
 //=============================================================================
 
@@ -82,12 +190,12 @@ inline bool AVSynchronizer::isActive() const
 
 inline bool AVSynchronizer::isSynchronized() const
 {
-	return m_isActive && m_isSynced;
+	return m_isActive && m_core->isSynchronized();
 }
 
 inline bool AVSynchronizer::isEmitting() const
 {
-	return m_isActive && m_isSynced && !m_waitingForVideoKeyframe;
+	return m_isActive && m_core->isEmitting() && !m_waitingForKeyframe;
 }
 
 #endif // AVSYNCHRONIZER_H
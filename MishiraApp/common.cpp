@@ -19,6 +19,7 @@
 #include "application.h"
 #include "constants.h"
 #include "stylehelper.h"
+#include <QtCore/QFile>
 #include <QtCore/QSize>
 #include <QtCore/QStandardPaths>
 #include <QtGui/QPalette>
@@ -28,6 +29,9 @@ extern "C" {
 }
 #ifdef Q_OS_WIN
 #include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
 #endif
 
 //=============================================================================
@@ -127,6 +131,157 @@ QFileInfo getUniqueFilename(const QString &filename)
 	return info;
 }
 
+/// <summary>
+/// Returns the filename of a single file of a recording that is split into
+/// multiple files. `baseName` is the full path without an extension.
+/// </summary>
+QString getSegmentFilename(
+	const QString &baseName, int segmentNum, const QString &extension)
+{
+	return QDir::toNativeSeparators(QStringLiteral("%1 - %2.%3")
+		.arg(baseName)
+		.arg(segmentNum, 3, 10, QChar('0'))
+		.arg(extension));
+}
+
+/// <summary>
+/// Returns the filename of the CSV file that lists the files of a split
+/// recording.
+/// </summary>
+QString getSegmentManifestFilename(const QString &baseName)
+{
+	return QDir::toNativeSeparators(
+		QStringLiteral("%1 - Segments.csv").arg(baseName));
+}
+
+/// <summary>
+/// Writes the specified data to a file in a way that either completely
+/// replaces the existing file or leaves it untouched. The data is written to
+/// a temporary file next to the destination, flushed all the way to the disk
+/// and then renamed over the top of the existing file. This means that a crash
+/// or power loss in the middle of the save never loses the previous file.
+/// </summary>
+/// <returns>True if the file was successfully written</returns>
+bool writeFileAtomically(
+	const QString &filename, const QByteArray &data, QString *errorOut)
+{
+	const QString tmpFilename = filename + QStringLiteral(".tmp");
+	QFile file(tmpFilename);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		if(errorOut != NULL)
+			*errorOut = file.errorString();
+		return false;
+	}
+	if(file.write(data) != data.size() || !file.flush()) {
+		if(errorOut != NULL)
+			*errorOut = file.errorString();
+		file.close();
+		QFile::remove(tmpFilename);
+		return false;
+	}
+
+	// `QFile::flush()` only empties Qt's buffer, make sure the OS has written
+	// the data to the disk before we replace the old file with it
+	if(!syncFileToDisk(&file)) {
+		if(errorOut != NULL)
+			*errorOut = QStringLiteral("Failed to flush file to disk");
+		file.close();
+		QFile::remove(tmpFilename);
+		return false;
+	}
+	file.close();
+
+	// Replace the existing file. `QFile::rename()` cannot overwrite files.
+#ifdef Q_OS_WIN
+	wchar_t *src = QStringToWChar(QDir::toNativeSeparators(tmpFilename));
+	wchar_t *dst = QStringToWChar(QDir::toNativeSeparators(filename));
+	BOOL res = MoveFileEx(
+		src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	delete[] src;
+	delete[] dst;
+	if(!res) {
+		if(errorOut != NULL) {
+			*errorOut = QStringLiteral("Rename failed with error %1")
+				.arg(GetLastError());
+		}
+		QFile::remove(tmpFilename);
+		return false;
+	}
+#else
+	if(rename(QFile::encodeName(tmpFilename).constData(),
+		QFile::encodeName(filename).constData()) != 0)
+	{
+		if(errorOut != NULL)
+			*errorOut = QStringLiteral("Rename failed");
+		QFile::remove(tmpFilename);
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+/// <summary>
+/// Makes sure that the operating system has written all the data of an open
+/// file to the disk so that it survives a power loss. `QFile::flush()` only
+/// empties Qt's own buffer. This can take a long time and should never be
+/// called from the main thread.
+/// </summary>
+/// <returns>True if the data is on the disk</returns>
+bool syncFileToDisk(QFile *file)
+{
+#ifdef Q_OS_WIN
+	return FlushFileBuffers((HANDLE)_get_osfhandle(file->handle())) != 0;
+#else
+	return fsync(file->handle()) == 0;
+#endif
+}
+
+/// <summary>
+/// Duplicates the operating system handle of an open file so that the file
+/// can be synchronized to disk with `syncFileHandle()` from another thread
+/// while the original file continues to be written to and even closed.
+/// </summary>
+/// <returns>The new handle or 0 if the handle could not be duplicated</returns>
+quint64 duplicateFileHandle(QFile *file)
+{
+#ifdef Q_OS_WIN
+	HANDLE process = GetCurrentProcess();
+	HANDLE dup = NULL;
+	if(!DuplicateHandle(process, (HANDLE)_get_osfhandle(file->handle()),
+		process, &dup, 0, FALSE, DUPLICATE_SAME_ACCESS))
+	{
+		return 0;
+	}
+	return (quint64)dup;
+#else
+	int fd = dup(file->handle());
+	if(fd < 0)
+		return 0;
+	return (quint64)fd + 1; // Never return 0 for a valid handle
+#endif
+}
+
+/// <summary>
+/// Writes all the data of a handle that was returned by
+/// `duplicateFileHandle()` to the disk and then closes the handle.
+/// </summary>
+/// <returns>True if the data is on the disk</returns>
+bool syncFileHandle(quint64 handle)
+{
+	if(handle == 0)
+		return false;
+#ifdef Q_OS_WIN
+	bool ret = (FlushFileBuffers((HANDLE)handle) != 0);
+	CloseHandle((HANDLE)handle);
+#else
+	int fd = (int)(handle - 1);
+	bool ret = (fsync(fd) == 0);
+	close(fd);
+#endif
+	return ret;
+}
+
 /// <summary>
 /// Produces a 64-bit hash of the input string that is consistent across
 /// different bit widths and Qt versions.
@@ -474,6 +629,9 @@ void WizTargetSettings::setTargetSettingsToDefault()
 {
 	// Default filename for local files
 	fileType = FileTrgtMp4Type;
+	fileFragDuration = DEFAULT_FILE_TARGET_FRAG_DURATION;
+	fileSplitDuration = 0;
+	fileSplitSize = 0;
 	QDir defaultDir(
 		QStandardPaths::writableLocation(QStandardPaths::DesktopLocation));
 	fileFilename = QStringLiteral("%1.%2")
@@ -482,6 +640,10 @@ void WizTargetSettings::setTargetSettingsToDefault()
 	fileFilename = QDir::toNativeSeparators(
 		defaultDir.absoluteFilePath(fileFilename));
 
+	// Default replay settings
+	replayDuration = DEFAULT_REPLAY_TARGET_DURATION;
+	replayMaxMemory = DEFAULT_REPLAY_TARGET_MAX_MEMORY;
+
 	// Default other RTMP settings
 	rtmpUrl = QStringLiteral("rtmp://");
 	rtmpStreamName = QString();
@@ -46,6 +46,15 @@ void		imgDataCopy(
 	quint8 *dst, quint8 *src, uint dstStride, uint srcStride,
 	const QSize &size);
 QFileInfo	getUniqueFilename(const QString &filename);
+QString		getSegmentFilename(
+	const QString &baseName, int segmentNum, const QString &extension);
+QString		getSegmentManifestFilename(const QString &baseName);
+bool		writeFileAtomically(
+	const QString &filename, const QByteArray &data,
+	QString *errorOut = NULL);
+bool		syncFileToDisk(QFile *file);
+quint64		duplicateFileHandle(QFile *file);
+bool		syncFileHandle(quint64 handle);
 quint64		hashQString64(const QString &str);
 quint32		qrand32();
 quint64		qrand64();
@@ -84,6 +93,16 @@ float		linearToMb(float linear);
 //-----------------------------------------------------------------------------
 // WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING WARNING
 
+//-----------------------------------------------------------------------------
+// AsyncIO
+
+enum IOPriority {
+	IOPrefetchPriority = 0, // Might be needed in the future
+	IOVisiblePriority // Needed to display something right now
+
+	// Higher numbers are processed first
+};
+
 //-----------------------------------------------------------------------------
 // AudioEncoder
 
@@ -219,26 +238,42 @@ struct FdkAacOptions {
 enum FileTrgtType {
 	FileTrgtMp4Type = 0,
 	FileTrgtMkvType = 1,
-	//FileTrgtFlvType = 2,
+	FileTrgtFlvType = 2,
+	FileTrgtFragMp4Type = 3,
 
 	NUM_FILE_TARGET_TYPES // Must be last
 };
 static const char * const FileTrgtTypeStrings[] = {
 	".mp4 (MPEG-4 Part 14)",
 	".mkv (Matroska)",
-	//".flv (Flash video)"
+	".flv (Flash video)",
+	".mp4 (Fragmented MPEG-4, crash-safe)"
 };
 static const char * const FileTrgtTypeExtStrings[] = {
 	"mp4",
 	"mkv",
-	//"flv"
+	"flv",
+	"mp4"
 };
 static const char * const FileTrgtTypeFilterStrings[] = {
 	"MPEG-4 Part 14 (*.mp4)",
 	"Matroska (*.mkv)",
-	//"Flash video (*.flv)"
+	"Flash video (*.flv)",
+	"MPEG-4 Part 14 (*.mp4)"
 };
 
+// Default length of each fragment of a fragmented MPEG-4 file in seconds
+const int DEFAULT_FILE_TARGET_FRAG_DURATION = 2;
+
+//-----------------------------------------------------------------------------
+// ReplayTarget
+
+// Default amount of video that is kept in memory in seconds
+const int DEFAULT_REPLAY_TARGET_DURATION = 30;
+
+// Default maximum amount of memory that the buffer can use in MB
+const int DEFAULT_REPLAY_TARGET_MAX_MEMORY = 256;
+
 //-----------------------------------------------------------------------------
 // Profile
 
@@ -349,7 +384,8 @@ enum TrgtType {
 	TrgtTwitchType = 2,
 	//TrgtJustinType = 3, // Removed
 	TrgtUstreamType = 4,
-	TrgtHitboxType = 5
+	TrgtHitboxType = 5,
+	TrgtReplayType = 6
 };
 
 struct FileTrgtOptions {
@@ -357,6 +393,17 @@ struct FileTrgtOptions {
 	quint32			audioEncId;
 	QString			filename;
 	FileTrgtType	fileType;
+	int				fragDuration; // Seconds, fragmented MP4 only
+	int				splitDuration; // Minutes, 0 = Never split
+	int				splitSize; // MB, 0 = Never split
+};
+
+struct ReplayTrgtOptions {
+	quint32	videoEncId;
+	quint32	audioEncId;
+	QString	filename; // Saved replays are numbered based on this
+	int		bufferDuration; // Seconds
+	int		maxMemory; // MB
 };
 
 struct RTMPTrgtOptions {
@@ -386,6 +433,45 @@ struct UstreamTrgtOptions {
 	bool	padVideo;
 };
 
+//-----------------------------------------------------------------------------
+// TextLayer
+
+// WARNING: This is used in the application settings. Treat it as a public API.
+enum TxtStrokeTechnique {
+	TxtOutlineStroke = 0, // QTextDocument's built-in text outliner
+	TxtPathStroke, // Stroke a single QPainterPath of the whole document
+	TxtBlockPathStroke, // Stroke a QPainterPath of each text block
+	TxtBruteForceStroke, // Search for the closest covered pixel
+	TxtDistanceStroke, // Linear-time Euclidean distance transform
+
+	NUM_TXT_STROKE_TECHNIQUES // Must be last
+};
+static const char * const TxtStrokeTechniqueStrings[] = {
+	"Text outline",
+	"Painter path",
+	"Painter path per block",
+	"Brute-force raster",
+	"Distance transform"
+};
+
+//-----------------------------------------------------------------------------
+// ThreadPolicy
+
+enum ThrdClass {
+	ThrdRealTimeClass = 0, // Main loop: Rendering, audio mixing, networking
+	ThrdEncodeClass,
+	ThrdScriptClass,
+	ThrdBackgroundClass, // File IO, logging
+
+	NUM_THREAD_CLASSES // Must be last
+};
+static const char * const ThrdClassStrings[] = {
+	"Real-time",
+	"Encode",
+	"Script",
+	"Background"
+};
+
 //-----------------------------------------------------------------------------
 // VideoEncoder
 
@@ -450,6 +536,7 @@ enum WizPage {
 	WizTwitchTargetSettingsPage,
 	WizUstreamTargetSettingsPage,
 	WizHitboxTargetSettingsPage,
+	WizReplayTargetSettingsPage,
 
 	WIZ_NUM_PAGES // Must be last
 };
@@ -482,6 +569,13 @@ struct WizTargetSettings {
 	// File target settings
 	QString			fileFilename;
 	FileTrgtType	fileType;
+	int				fileFragDuration;
+	int				fileSplitDuration;
+	int				fileSplitSize;
+
+	// Replay target settings (Also uses `fileFilename`)
+	int				replayDuration;
+	int				replayMaxMemory;
 
 	// Other RTMP target settings
 	QString			rtmpUrl;
@@ -514,6 +608,11 @@ struct WizTargetSettings {
 		// `setTargetSettingsToDefault()` method
 		, fileFilename()
 		, fileType((FileTrgtType)0)
+		, fileFragDuration(0)
+		, fileSplitDuration(0)
+		, fileSplitSize(0)
+		, replayDuration(0)
+		, replayMaxMemory(0)
 		, rtmpUrl()
 		, rtmpStreamName()
 		, rtmpHideStreamName(false)
@@ -42,4 +42,8 @@
 const int	MIN_MB = -14400;
 const float	MIN_MB_F = -14400.0f;
 
+// Performance metrics are served over HTTP on this port of the loopback
+// interface unless the user has configured another one
+const int	DEFAULT_METRICS_PORT = 9474;
+
 #endif // CONSTANTS_H
@@ -15,12 +15,181 @@
 // more details.
 //*****************************************************************************
 
+
 #include "cpuusage.h"
+#include <QtCore/QThread>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+QMutex CPUUsage::s_threadNamesMutex;
+QHash<quint64, QString> CPUUsage::s_threadNames;
+
+/// <summary>
+/// Gives the calling thread a human-readable name so that it can be
+/// identified in the per-thread CPU usage breakdown. Must be called from
+/// within the thread itself.
+/// </summary>
+void CPUUsage::registerThread(const QString &name)
+{
+	registerThread(getCurrentThreadId(), name);
+}
+
+void CPUUsage::registerThread(quint64 threadId, const QString &name)
+{
+	s_threadNamesMutex.lock();
+	s_threadNames[threadId] = name;
+	s_threadNamesMutex.unlock();
+}
+
+/// <summary>
+/// Removes the calling thread's name. Should be called just before a thread
+/// that was registered exits as OS thread IDs are reused.
+/// </summary>
+void CPUUsage::unregisterThread()
+{
+	unregisterThread(getCurrentThreadId());
+}
+
+void CPUUsage::unregisterThread(quint64 threadId)
+{
+	s_threadNamesMutex.lock();
+	s_threadNames.remove(threadId);
+	s_threadNamesMutex.unlock();
+}
+
+QString CPUUsage::getThreadName(quint64 threadId)
+{
+	s_threadNamesMutex.lock();
+	QString name = s_threadNames.value(threadId);
+	s_threadNamesMutex.unlock();
+	return name;
+}
+
+/// <summary>
+/// Returns the OS-level ID of the calling thread. This is not the same as
+/// `QThread::currentThreadId()` on every platform.
+/// </summary>
+quint64 CPUUsage::getCurrentThreadId()
+{
+#ifdef Q_OS_WIN
+	return (quint64)GetCurrentThreadId();
+#else
+	return (quint64)QThread::currentThreadId();
+#endif
+}
 
-CPUUsage::CPUUsage()
+/// <summary>
+/// Creates a new CPU usage monitor. `windowSize` is the number of `update()`
+/// calls that the rolling window spans.
+/// </summary>
+CPUUsage::CPUUsage(int windowSize)
+	: m_windowSize(qMax(1, windowSize))
+	, m_samples()
 {
 }
 
 CPUUsage::~CPUUsage()
 {
 }
+
+/// <summary>
+/// Records a new sample and discards any samples that are no longer within
+/// the rolling window.
+/// </summary>
+void CPUUsage::update()
+{
+	m_samples.append(takeSample());
+	while(m_samples.size() > m_windowSize + 1)
+		m_samples.removeFirst();
+}
+
+/// <summary>
+/// Calculates the CPU usage of our process over the rolling window as a
+/// fraction of the total CPU time of the system.
+/// </summary>
+/// <returns>Zero if less than two samples have been recorded.</returns>
+float CPUUsage::getRecentUsage(float *totalUsage) const
+{
+	if(totalUsage != NULL)
+		*totalUsage = 0.0f;
+	if(m_samples.size() < 2)
+		return 0.0f;
+	const Sample &first = m_samples.first();
+	const Sample &last = m_samples.last();
+	quint64 sysTime = last.sysTime - first.sysTime;
+	if(sysTime == 0)
+		return 0.0f;
+
+	// Calculate the total CPU usage if the caller requested it
+	if(totalUsage != NULL) {
+		quint64 idleTime = last.sysIdleTime - first.sysIdleTime;
+		*totalUsage = 1.0f - (float)((double)idleTime / (double)sysTime);
+	}
+
+	quint64 procTime = last.procTime - first.procTime;
+	return (float)((double)procTime / (double)sysTime);
+}
+
+/// <summary>
+/// Calculates the CPU usage of every thread in our process over the rolling
+/// window. Threads that were created during the window are measured from
+/// when they were first seen. The returned list is sorted so that the
+/// busiest thread is first.
+/// </summary>
+CPUThreadUsageList CPUUsage::getRecentThreadUsage() const
+{
+	CPUThreadUsageList list;
+	if(m_samples.size() < 2)
+		return list;
+	const Sample &last = m_samples.last();
+
+	QHashIterator<quint64, quint64> it(last.threadTimes);
+	while(it.hasNext()) {
+		it.next();
+
+		// Find the oldest sample that contains this thread
+		int firstIndex = 0;
+		for(; firstIndex < m_samples.size() - 1; firstIndex++) {
+			if(m_samples.at(firstIndex).threadTimes.contains(it.key()))
+				break;
+		}
+		if(firstIndex >= m_samples.size() - 1)
+			continue; // Thread is too new to measure
+		const Sample &first = m_samples.at(firstIndex);
+		quint64 wallTime = last.wallTime - first.wallTime;
+		if(wallTime == 0)
+			continue;
+		quint64 threadTime = it.value() - first.threadTimes.value(it.key());
+
+		CPUThreadUsage usage;
+		usage.name = getThreadName(it.key());
+		usage.threadId = it.key();
+		usage.usage = (float)((double)threadTime / (double)wallTime);
+
+		// Insertion sort, busiest first
+		int i = 0;
+		for(; i < list.size(); i++) {
+			if(usage.usage > list.at(i).usage)
+				break;
+		}
+		list.insert(i, usage);
+	}
+
+	return list;
+}
+
+/// <summary>
+/// Returns the recent usage of the registered thread with the specified
+/// name. If multiple threads share the same name then the busiest one is
+/// returned.
+/// </summary>
+float CPUUsage::getRecentThreadUsage(const QString &name) const
+{
+	CPUThreadUsageList list = getRecentThreadUsage();
+	for(int i = 0; i < list.size(); i++) {
+		if(list.at(i).name == name)
+			return list.at(i).usage;
+	}
+	return 0.0f;
+}
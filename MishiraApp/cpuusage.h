@@ -15,25 +15,84 @@
 // more details.
 //*****************************************************************************
 
+
 #ifndef CPUUSAGE_H
 #define CPUUSAGE_H
 
 #include "common.h"
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
 
 //=============================================================================
 /// <summary>
-/// Used to get the average CPU usage of the current process since the creation
-/// of this object.
+/// The recent CPU usage of a single thread of our process. The usage is
+/// relative to a single CPU core so a value of 1.0 means that the thread is
+/// saturated.
+/// </summary>
+struct CPUThreadUsage {
+	QString	name; // Empty if the thread was not registered
+	quint64	threadId; // OS thread ID
+	float	usage;
+};
+typedef QVector<CPUThreadUsage> CPUThreadUsageList;
+
+//=============================================================================
+/// <summary>
+/// Measures the CPU usage of our process and the system as a whole. Averages
+/// since the object was created are available from `getAvgUsage()`. Calling
+/// `update()` periodically records samples so that the usage over a rolling
+/// window of the last few samples, including a breakdown of every thread in
+/// our process, can also be retrieved.
+///
+/// Threads can be given a human-readable name by calling `registerThread()`
+/// from within the thread itself so that they can be identified in the
+/// per-thread breakdown.
 /// </summary>
 class CPUUsage
 {
+protected: // Datatypes -------------------------------------------------------
+	struct Sample {
+		// All times are in the same platform-specific unit
+		quint64					wallTime;
+		quint64					sysTime; // Includes idle time
+		quint64					sysIdleTime;
+		quint64					procTime;
+		QHash<quint64, quint64>	threadTimes; // OS thread ID -> time
+	};
+
+private: // Static members ----------------------------------------------------
+	static QMutex					s_threadNamesMutex;
+	static QHash<quint64, QString>	s_threadNames;
+
+private: // Members -----------------------------------------------------------
+	int				m_windowSize;
+	QList<Sample>	m_samples;
+
+public: // Static methods -----------------------------------------------------
+	static void		registerThread(const QString &name);
+	static void		registerThread(quint64 threadId, const QString &name);
+	static void		unregisterThread();
+	static void		unregisterThread(quint64 threadId);
+	static QString	getThreadName(quint64 threadId);
+	static quint64	getCurrentThreadId();
+
 public: // Constructor/destructor ---------------------------------------------
-	CPUUsage();
+	CPUUsage(int windowSize = 5);
 	virtual ~CPUUsage();
 
+public: // Methods ------------------------------------------------------------
+	void				update();
+	float				getRecentUsage(float *totalUsage = NULL) const;
+	CPUThreadUsageList	getRecentThreadUsage() const;
+	float				getRecentThreadUsage(const QString &name) const;
+
 public: // Interface ----------------------------------------------------------
 	virtual float	getAvgUsage(float *totalUsage = NULL) = 0;
+
+protected:
+	virtual Sample	takeSample() = 0;
 };
-//=============================================================================
 
 #endif // CPUUSAGE_H
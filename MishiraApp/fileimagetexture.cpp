@@ -17,46 +17,72 @@
 
 #include "fileimagetexture.h"
 #include "application.h"
-#include "asyncio.h"
+#include "imagecache.h"
+#include "metrics.h"
 #include "profile.h"
 
 const QString LOG_CAT = QStringLiteral("Scene");
 
-FileImageTexture::FileImageTexture(const QString &filename)
+// Names of the metrics that are reported when preparing textures. They are
+// created once so that reporting them doesn't construct new strings.
+const QString PREPARED_HITS_METRIC =
+	QStringLiteral("mishira_image_prepared_texture_hits_total");
+const QString PREPARED_MISSES_METRIC =
+	QStringLiteral("mishira_image_prepared_texture_misses_total");
+
+quint64 FileImageTexture::s_preparedHits = 0;
+quint64 FileImageTexture::s_preparedMisses = 0;
+
+FileImageTexture::FileImageTexture(
+	const QString &filename, IOPriority priority)
 	: QObject()
 	, m_filename(filename)
 	, m_animationPaused(false)
 
 	// Image data
+	, m_image(NULL)
+	, m_isLoading(false)
 	, m_imgData()
-	, m_imgLoadOperation(0)
 	, m_imgBuffer(&m_imgData)
 	, m_imgReader()
 	, m_tex(NULL)
+	, m_memUsage(0)
 
 	// Image state
 	, m_hasAlpha(false)
 	, m_hasAnimation(false)
 	, m_loopCount(0)
 	, m_usecToNextFrame(0)
+	, m_frameStep(0)
+	, m_uploadedFrame(-1)
 	, m_isFirstFrameAfterLoad(false)
+
+	// Prepared texture cache
+	, m_preparedTex(NULL)
+	, m_preparedSize()
+	, m_preparedFilter(GfxBilinearFilter)
+	, m_preparedPxSize()
+	, m_preparedBotRight()
 {
 	if(m_filename.isEmpty())
 		return; // No file specified, should never happen
 
-	// Read all file data into memory without blocking
-	AsyncIO *asyncIo = App->getAsyncIO();
-	connect(asyncIo, &AsyncIO::loadFromFileComplete,
-		this, &FileImageTexture::imgLoadComplete);
-	m_imgLoadOperation = asyncIo->newOperationId();
-	asyncIo->loadFromFile(m_imgLoadOperation, m_filename);
-
-	// Continued in `imgLoadComplete()`
+	// Get the image from the cache. If it isn't already loaded then the cache
+	// will load it without blocking.
+	m_image = App->getImageCache()->refImage(m_filename, priority);
+	m_isLoading = m_image->isLoading();
+	if(m_isLoading) {
+		connect(m_image, &CachedImage::loadComplete,
+			this, &FileImageTexture::imgLoadComplete);
+		return; // Continued in `imgLoadComplete()`
+	}
+	imgLoadComplete(m_image); // Already in the cache
 }
 
 FileImageTexture::~FileImageTexture()
 {
-	if(m_tex != NULL) {
+	releasePreparedTexture();
+	if(m_tex != NULL && m_hasAnimation) {
 		VidgfxContext *gfx = App->getGraphicsContext();
 		if(vidgfx_context_is_valid(gfx)) {
 			vidgfx_context_destroy_tex(gfx, m_tex);
@@ -68,6 +94,15 @@ FileImageTexture::~FileImageTexture()
 	m_imgReader.setDevice(NULL);
 	m_imgBuffer.close();
 	m_imgData = QByteArray();
+
+	// Release our reference to the shared image
+	if(m_image != NULL) {
+		disconnect(m_image, &CachedImage::loadComplete,
+			this, &FileImageTexture::imgLoadComplete);
+		App->getImageCache()->derefImage(m_image);
+		m_image = NULL;
+	}
+	m_tex = NULL;
 }
 
 void FileImageTexture::setAnimationPaused(bool paused)
@@ -81,6 +116,18 @@ bool FileImageTexture::resetAnimation(bool fullReset, bool updateTexture)
 	if(m_tex == NULL || !m_hasAnimation)
 		return false; // Nothing to process
 
+	// Decoded animations can jump straight to the first frame
+	if(m_image->hasDecodedFrames()) {
+		m_frameStep = 0;
+		if(fullReset)
+			m_loopCount = 0;
+		if(updateTexture) {
+			m_usecToNextFrame = m_image->getDelayForStep(0) * 1000;
+			return uploadFrameStep();
+		}
+		return false;
+	}
+
 	// Qt's internal QGifHandler doesn't support frame jumping meaning the only
 	// way we can return to the start of the animation is to completely reload
 	// the image reader. :(
@@ -104,6 +151,79 @@ bool FileImageTexture::resetAnimation(bool fullReset, bool updateTexture)
 	return false;
 }
 
+/// <summary>
+/// Returns our texture prepared for rendering at the specified size with the
+/// specified filter. This is the same as calling `prepare_tex()` on the
+/// context except that the prepared texture of static images is cached and
+/// shared with every other user of the same image so that it is only scaled
+/// once instead of every frame. Animated images are always prepared like
+/// normal as their texture changes.
+/// </summary>
+VidgfxTex *FileImageTexture::getPreparedTexture(
+	VidgfxContext *gfx, const QSize &size, VidgfxTexFilter filter,
+	QPointF &pxSizeOut, QPointF &botRightOut)
+{
+	if(m_tex == NULL)
+		return NULL;
+	if(m_hasAnimation) {
+		return vidgfx_context_prepare_tex(
+			gfx, m_tex, size, filter, true, pxSizeOut, botRightOut);
+	}
+
+	// Forget the previous texture if the layer has been resized
+	if(m_preparedTex != NULL &&
+		(m_preparedSize != size || m_preparedFilter != filter))
+	{
+		releasePreparedTexture();
+	}
+
+	if(m_preparedTex == NULL) {
+		bool wasCached = false;
+		m_preparedTex = m_image->refPreparedTexture(
+			gfx, size, filter, m_preparedPxSize, m_preparedBotRight,
+			wasCached);
+		if(m_preparedTex == NULL) {
+			// Cannot cache the texture, prepare it every frame instead
+			s_preparedMisses++;
+			App->getMetrics()->addToCounter(PREPARED_MISSES_METRIC);
+			return vidgfx_context_prepare_tex(
+				gfx, m_tex, size, filter, true, pxSizeOut, botRightOut);
+		}
+		m_preparedSize = size;
+		m_preparedFilter = filter;
+
+		// Only count the lookup, not every frame that the result is reused
+		if(wasCached) {
+			s_preparedHits++;
+			App->getMetrics()->addToCounter(PREPARED_HITS_METRIC);
+		} else {
+			s_preparedMisses++;
+			App->getMetrics()->addToCounter(PREPARED_MISSES_METRIC);
+		}
+	}
+
+	// The context only sets the filter when it prepares the texture itself
+	vidgfx_context_set_tex_filter(gfx,
+		filter == GfxPointFilter ? GfxPointFilter : GfxBilinearFilter);
+
+	pxSizeOut = m_preparedPxSize;
+	botRightOut = m_preparedBotRight;
+	return m_preparedTex;
+}
+
+/// <summary>
+/// Releases our reference to the shared prepared texture. Should be called
+/// whenever the size that the texture is displayed at might have changed.
+/// </summary>
+void FileImageTexture::releasePreparedTexture()
+{
+	if(m_preparedTex == NULL)
+		return;
+	m_image->derefPreparedTexture(
+		App->getGraphicsContext(), m_preparedSize, m_preparedFilter);
+	m_preparedTex = NULL;
+}
+
 /// <summary>
 /// Should be called in `queuedFrameEvent()` so that animations can be
 /// processed correctly.
@@ -126,6 +246,8 @@ bool FileImageTexture::processFrameEvent(uint frameNum, int numDropped)
 		return ret; // Nothing to process
 
 	// Process animations
+	if(m_image->hasDecodedFrames())
+		return processDecodedFrames(numDropped) || ret;
 	int maxLoops = m_imgReader.loopCount();
 	if(maxLoops < 0 || m_loopCount <= maxLoops) {
 		// Get the current frame
@@ -152,20 +274,61 @@ bool FileImageTexture::processFrameEvent(uint frameNum, int numDropped)
 	return ret;
 }
 
-void FileImageTexture::imgLoadComplete(
-	int id, int errorCode, const QByteArray &data)
+/// <summary>
+/// Advances a decoded animation. Unlike when decoding during playback the
+/// only work that needs to be done is to upload the new frame.
+/// </summary>
+/// <returns>True of the image's texture has changed</returns>
+bool FileImageTexture::processDecodedFrames(int numDropped)
 {
-	// Process result
-	if(m_imgLoadOperation != id || id == 0)
-		return; // Not our signal
-	m_imgLoadOperation = 0;
-	if(errorCode != 0) {
-		appLog(LOG_CAT, Log::Warning)
-			<< "Cannot open image file \"" << m_filename << "\". "
-			<< "Reason = " << errorCode;
-		return;
+	int maxLoops = m_image->getLoopCount();
+	if(maxLoops >= 0 && m_loopCount > maxLoops)
+		return false; // Animation has finished
+
+	// Find the current frame
+	Fraction freq = App->getProfile()->getVideoFramerate();
+	int numFrames = numDropped + 1;
+	m_usecToNextFrame -=
+		(numFrames * 1000000 * freq.denominator) / freq.numerator;
+	const int numSteps = m_image->getNumFrameSteps();
+	while(m_usecToNextFrame < 0) {
+		m_frameStep++;
+		if(m_frameStep >= numSteps) {
+			// At end of animation, loop around to the start
+			m_frameStep = 0;
+			m_loopCount++;
+		}
+		m_usecToNextFrame +=
+			qMax(1, m_image->getDelayForStep(m_frameStep)) * 1000;
 	}
 
+	return uploadFrameStep();
+}
+
+/// <summary>
+/// Uploads the frame of the current step of a decoded animation to our
+/// texture if it isn't already displayed.
+/// </summary>
+/// <returns>True of the image's texture has changed</returns>
+bool FileImageTexture::uploadFrameStep()
+{
+	int index = m_image->getFrameIndexForStep(m_frameStep);
+	if(index == m_uploadedFrame)
+		return false; // Frame is already in the texture
+	// Decoded frames are already in a format that can be uploaded as-is
+	vidgfx_tex_update_data(m_tex, m_image->getFrameForStep(m_frameStep));
+	m_uploadedFrame = index;
+	return true;
+}
+
+void FileImageTexture::imgLoadComplete(CachedImage *image)
+{
+	if(image != m_image)
+		return; // Not our signal
+	m_isLoading = false;
+	if(!m_image->isLoaded())
+		return; // Error already logged by the cache
+
 	// No point continuing processing if we can't create the texture. This
 	// should never happen as this object should only exist while a context
 	// already exists.
@@ -173,51 +336,48 @@ void FileImageTexture::imgLoadComplete(
 	if(!vidgfx_context_is_valid(gfx))
 		return;
 
-	// Keep the raw file data in memory until we don't need it anymore
-	m_imgData = data;
-
-	// Create image reader
-	m_imgReader.setDevice(&m_imgBuffer);
-	if(!m_imgReader.canRead()) {
-		appLog(LOG_CAT, Log::Warning)
-			<< "Unrecognised image file \"" << m_filename << "\"";
+	m_hasAlpha = m_image->hasTransparency();
+	m_hasAnimation = m_image->hasAnimation();
+	if(!m_hasAnimation) {
+		// Static images share the texture with everyone else
+		m_tex = m_image->getTexture();
+		m_memUsage = m_image->getMemoryUsage();
+		m_isFirstFrameAfterLoad = true;
 		return;
 	}
-	//QSize texSize = m_imgReader.size();
-	m_hasAnimation = (m_imgReader.imageCount() > 1);
-	if(m_hasAnimation) {
-		appLog(LOG_CAT)
-			<< "Image file \"" << m_filename << "\" has animation";
+
+	// Animated images need their own texture as every user can be displaying
+	// a different frame
+	if(m_image->hasDecodedFrames()) {
+		// Every frame has already been decoded and is shared with the cache
+		QImage img = m_image->getFrameForStep(0);
+		m_tex = vidgfx_context_new_tex(gfx, img, true);
+		m_frameStep = 0;
+		m_uploadedFrame = m_image->getFrameIndexForStep(0);
+		m_usecToNextFrame = m_image->getDelayForStep(0) * 1000;
+		m_memUsage = (quint64)img.width() * (quint64)img.height() * 4ULL +
+			m_image->getMemoryUsage();
+		m_isFirstFrameAfterLoad = true;
+		return;
 	}
 
-	// Read first frame
-	QImage img = m_imgReader.read();
-	if(img.format() == QImage::Format_Invalid)
-		return; // Silently fail
-	m_hasAlpha = img.hasAlphaChannel(); // TODO: Actually test pixels if no animation
+	// Keep the raw file data in memory until we don't need it anymore. The
+	// data is implicitly shared with the cache.
+	m_imgData = m_image->getData();
 
-	if(m_hasAnimation) {
-		// Get delay until the next frame. We don't really care for
-		// synchronization so the small timing errors due to doing it this
-		// way is acceptable (See main loop to see how to do it properly)
-		m_usecToNextFrame = m_imgReader.nextImageDelay() * 1000;
-		if(!m_imgReader.canRead())
-			m_hasAnimation = false; // 1 frame animation
-	}
+	// Create image reader and skip over the first frame which has already been
+	// decoded
+	m_imgReader.setDevice(&m_imgBuffer);
+	m_imgReader.read();
 
-	// If the image has no animation we can unload the buffer from memory
-	if(!m_hasAnimation) {
-		m_imgReader.setDevice(NULL);
-		m_imgBuffer.close();
-		m_imgData = QByteArray();
-	}
+	// Get delay until the next frame. We don't really care for synchronization
+	// so the small timing errors due to doing it this way is acceptable (See
+	// main loop to see how to do it properly)
+	m_usecToNextFrame = m_imgReader.nextImageDelay() * 1000;
 
-	// Create new texture object
-	if(m_hasAlpha && !m_hasAnimation) {
-		// Prevent colour fringing around fully transparent pixels due to
-		// bilinear filtering by diluting the colour information
-		vidgfx_context_dilute_img(gfx, img);
-	}
-	m_tex = vidgfx_context_new_tex(gfx, img, m_hasAnimation);
+	QImage img = m_image->getFirstFrame();
+	m_tex = vidgfx_context_new_tex(gfx, img, true);
+	m_memUsage = (quint64)img.width() * (quint64)img.height() * 4ULL +
+		(quint64)m_imgData.size();
 	m_isFirstFrameAfterLoad = true;
 }
@@ -18,18 +18,25 @@
 #ifndef FILEIMAGETEXTURE_H
 #define FILEIMAGETEXTURE_H
 
+#include "common.h"
 #include <Libvidgfx/libvidgfx.h>
 #include <QtCore/QByteArray>
 #include <QtCore/QBuffer>
 #include <QtCore/QString>
 #include <QtGui/QImageReader>
 
+class CachedImage;
+
 //=============================================================================
 /// <summary>
 /// A helper class for managing textures that are loaded directly out of a file
 /// on the filesystem. Handles filesystem IO, animations and memory management.
-/// This object should only be created when a graphics context already exists
-/// and should be deleted before the graphics context is invalidated.
+/// Files are loaded through the application's `ImageCache` so that static
+/// images that are used in multiple places share the same texture and the
+/// first frame is decoded without blocking the main thread. Animated images
+/// share the file data but each object has its own texture. This object
+/// should only be created when a graphics context already exists and should
+/// be deleted before the graphics context is invalidated.
 /// </summary>
 class FileImageTexture : public QObject
 {
@@ -40,21 +47,40 @@ private: // Members -----------------------------------------------------------
 	bool			m_animationPaused;
 
 	// Image data
+	CachedImage *	m_image;
+	bool			m_isLoading;
 	QByteArray		m_imgData;
-	int				m_imgLoadOperation;
 	QBuffer			m_imgBuffer;
 	QImageReader	m_imgReader;
-	VidgfxTex *		m_tex;
+	VidgfxTex *		m_tex; // Owned by the cache if the image isn't animated
+	quint64			m_memUsage;
 
 	// Image state
 	bool			m_hasAlpha;
 	bool			m_hasAnimation;
 	int				m_loopCount;
 	int				m_usecToNextFrame;
+	int				m_frameStep; // Decoded animations only
+	int				m_uploadedFrame; // Decoded animations only
 	bool			m_isFirstFrameAfterLoad;
 
+	// Prepared texture cache (Static images only)
+	VidgfxTex *		m_preparedTex; // Owned by the cache
+	QSize			m_preparedSize;
+	VidgfxTexFilter	m_preparedFilter;
+	QPointF			m_preparedPxSize;
+	QPointF			m_preparedBotRight;
+
+	static quint64	s_preparedHits;
+	static quint64	s_preparedMisses;
+
+public: // Static methods -----------------------------------------------------
+	static quint64	getPreparedHits();
+	static quint64	getPreparedMisses();
+
 public: // Constructor/destructor ---------------------------------------------
-	FileImageTexture(const QString &filename);
+	FileImageTexture(
+		const QString &filename, IOPriority priority = IOVisiblePriority);
 	~FileImageTexture();
 
 public: // Methods ------------------------------------------------------------
@@ -64,19 +90,42 @@ public: // Methods ------------------------------------------------------------
 	bool	resetAnimation(bool fullReset = true, bool updateTexture = true);
 
 	bool		isLoaded() const;
+	bool		isLoading() const;
+	quint64		getMemoryUsage() const;
 	bool		hasTransparency() const;
 	bool		hasAnimation() const;
 	VidgfxTex *	getTexture() const;
+	VidgfxTex *	getPreparedTexture(
+		VidgfxContext *gfx, const QSize &size, VidgfxTexFilter filter,
+		QPointF &pxSizeOut, QPointF &botRightOut);
+	void		releasePreparedTexture();
 
 	bool	processFrameEvent(uint frameNum, int numDropped);
 
+private:
+	bool	processDecodedFrames(int numDropped);
+	bool	uploadFrameStep();
+
 	private
 Q_SLOTS: // Slots -------------------------------------------------------------
-	void	imgLoadComplete(
-		int id, int errorCode, const QByteArray &data);
+	void	imgLoadComplete(CachedImage *image);
 };
 //=============================================================================
 
+/// <summary>
+/// Returns the number of times that a layer looked up a prepared texture and
+/// was able to reuse one that already existed instead of preparing it again.
+/// </summary>
+inline quint64 FileImageTexture::getPreparedHits()
+{
+	return s_preparedHits;
+}
+
+inline quint64 FileImageTexture::getPreparedMisses()
+{
+	return s_preparedMisses;
+}
+
 inline QString FileImageTexture::getFilename() const
 {
 	return m_filename;
@@ -92,6 +141,20 @@ inline bool FileImageTexture::isLoaded() const
 	return m_tex != NULL;
 }
 
+inline bool FileImageTexture::isLoading() const
+{
+	return m_isLoading;
+}
+
+/// <summary>
+/// Returns the approximate amount of memory in bytes that is used by the
+/// texture and any image data that is kept in memory for animations.
+/// </summary>
+inline quint64 FileImageTexture::getMemoryUsage() const
+{
+	return m_memUsage;
+}
+
 inline bool FileImageTexture::hasTransparency() const
 {
 	return m_hasAlpha;
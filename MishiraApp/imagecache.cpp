@@ -0,0 +1,661 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#include "imagecache.h"
+#include "application.h"
+#include "asyncio.h"
+#include "threadpolicy.h"
+#include <QtCore/QBuffer>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImageReader>
+
+const QString LOG_CAT = QStringLiteral("Scene");
+
+// The maximum amount of memory that images that are no longer used by anyone
+// can use before they are released
+const quint64 MAX_UNUSED_MEMORY = 64ULL * 1024ULL * 1024ULL;
+
+// Decoded animations cannot use more memory than this
+const quint64 MAX_ANIM_MEMORY = 64ULL * 1024ULL * 1024ULL;
+
+//=============================================================================
+// AnimationDecoder class
+
+AnimationDecoder::AnimationDecoder(const QByteArray &data)
+	: QObject()
+	, QRunnable()
+	, m_data(data)
+	, m_abort(0)
+	, m_success(false)
+	, m_stateMutex()
+	, m_isDone(false)
+	, m_isReleased(false)
+
+	// Output
+	, m_frames()
+	, m_frameSeq()
+	, m_frameDelays()
+	, m_loopCount(0)
+	, m_memUsage(0)
+{
+	setAutoDelete(false); // We manage our own lifetime
+}
+
+AnimationDecoder::~AnimationDecoder()
+{
+}
+
+/// <summary>
+/// Stops decoding as soon as possible and releases the decoder. The object
+/// deletes itself once it is no longer running and must not be used by the
+/// caller again.
+/// </summary>
+void AnimationDecoder::release()
+{
+	m_abort.store(1);
+	m_stateMutex.lock();
+	m_isReleased = true;
+	bool isDone = m_isDone;
+	m_stateMutex.unlock();
+	if(isDone)
+		delete this;
+}
+
+uint AnimationDecoder::hashFrame(const QImage &img)
+{
+	return qHash(QByteArray::fromRawData(
+		reinterpret_cast<const char *>(img.constBits()), img.byteCount()));
+}
+
+void AnimationDecoder::run()
+{
+	// We run on a shared thread pool thread so restore its policy afterwards
+	ScopedThreadPolicy policy(
+		ThrdBackgroundClass, QStringLiteral("Animation decoder"));
+	decode();
+
+	// Notify our owner unless it no longer exists. The signal is emitted
+	// while holding the lock so that we cannot be deleted before it has been
+	// queued.
+	m_stateMutex.lock();
+	m_isDone = true;
+	if(m_isReleased) {
+		m_stateMutex.unlock();
+		delete this;
+		return;
+	}
+	emit finished();
+	m_stateMutex.unlock();
+}
+
+void AnimationDecoder::decode()
+{
+	QBuffer buf(&m_data);
+	QImageReader reader(&buf);
+	if(!reader.canRead())
+		return;
+	m_loopCount = reader.loopCount();
+
+	QVector<uint> hashes;
+	while(reader.canRead()) {
+		if(m_abort.load())
+			return;
+		QImage img = reader.read();
+		if(img.format() == QImage::Format_Invalid)
+			break; // Corrupt frame, keep what we have
+		int delay = reader.nextImageDelay();
+
+		// Convert the frame to the format that our textures use so that it
+		// can be uploaded as-is. Palettised GIF frames would otherwise need
+		// to be converted on the main thread every time they are displayed.
+		if(img.format() != QImage::Format_ARGB32)
+			img = img.convertToFormat(QImage::Format_ARGB32);
+
+		// Merge consecutive identical frames
+		uint hash = hashFrame(img);
+		if(!m_frameSeq.isEmpty()) {
+			int prev = m_frameSeq.last();
+			if(hashes.at(prev) == hash && m_frames.at(prev) == img) {
+				m_frameDelays.last() += delay;
+				continue;
+			}
+		}
+
+		// Only store identical frames once
+		int index = -1;
+		for(int i = 0; i < m_frames.count(); i++) {
+			if(hashes.at(i) == hash && m_frames.at(i) == img) {
+				index = i;
+				break;
+			}
+		}
+		if(index < 0) {
+			m_frames.append(img);
+			hashes.append(hash);
+			m_memUsage += (quint64)img.byteCount();
+			index = m_frames.count() - 1;
+		}
+		m_frameSeq.append(index);
+		m_frameDelays.append(delay);
+
+		if(m_memUsage > MAX_ANIM_MEMORY) {
+			// Too large to keep in memory, give up
+			m_frames.clear();
+			m_frameSeq.clear();
+			m_frameDelays.clear();
+			m_memUsage = 0;
+			return;
+		}
+	}
+	m_success = (m_frameSeq.count() > 1);
+}
+
+//=============================================================================
+// CachedImage class
+
+CachedImage::CachedImage(const QString &key, const QString &filename)
+	: QObject()
+	, m_key(key)
+	, m_filename(filename)
+	, m_ref(1)
+	, m_lastUsed(0)
+	, m_loadOperation(0)
+	, m_failed(false)
+	, m_decoder(NULL)
+
+	// Image data
+	, m_tex(NULL)
+	, m_data()
+	, m_firstFrame()
+	, m_frames()
+	, m_frameSeq()
+	, m_frameDelays()
+	, m_loopCount(0)
+	, m_size()
+	, m_hasAlpha(false)
+	, m_hasAnimation(false)
+	, m_memUsage(0)
+	, m_prepared()
+	, m_preparedMemUsage(0)
+{
+}
+
+CachedImage::~CachedImage()
+{
+	if(m_decoder != NULL) {
+		// Don't wait for the decoder to finish, it deletes itself
+		disconnect(m_decoder, &AnimationDecoder::finished,
+			this, &CachedImage::decodeFinished);
+		m_decoder->release();
+		m_decoder = NULL;
+	}
+	VidgfxContext *gfx = App->getGraphicsContext();
+	if(!m_prepared.isEmpty()) {
+		// Should never happen as every user releases its texture first
+		if(vidgfx_context_is_valid(gfx)) {
+			QHashIterator<QString, PreparedTex> it(m_prepared);
+			while(it.hasNext()) {
+				it.next();
+				destroyPreparedTex(gfx, it.value());
+			}
+		}
+		m_prepared.clear();
+		m_preparedMemUsage = 0;
+	}
+	if(m_tex != NULL) {
+		if(vidgfx_context_is_valid(gfx)) {
+			vidgfx_context_destroy_tex(gfx, m_tex);
+			m_tex = NULL;
+		}
+	}
+}
+
+/// <summary>
+/// Returns a copy of our static texture that has already been prepared for
+/// rendering at the specified size and filter so that layers that display the
+/// image at the same size don't need to scale it again every frame. The
+/// prepared texture is shared between every user that requests the same size
+/// and filter and every successful call must be matched with a call to
+/// `derefPreparedTexture()`.
+/// </summary>
+/// <returns>NULL if the prepared texture cannot be cached</returns>
+VidgfxTex *CachedImage::refPreparedTexture(
+	VidgfxContext *gfx, const QSize &size, VidgfxTexFilter filter,
+	QPointF &pxSizeOut, QPointF &botRightOut, bool &wasCachedOut)
+{
+	if(m_tex == NULL || !vidgfx_context_is_valid(gfx))
+		return NULL;
+
+	const QString key = getPreparedKey(size, filter);
+	if(m_prepared.contains(key)) {
+		PreparedTex &prep = m_prepared[key];
+		prep.ref++;
+		pxSizeOut = prep.pxSize;
+		botRightOut = prep.botRight;
+		wasCachedOut = true;
+		return prep.tex;
+	}
+	wasCachedOut = false;
+
+	// Prepare the texture like normal. If the context needed to scale the
+	// texture then the result is in a scratch texture that is reused by the
+	// next preparation so we need to keep our own copy of it. The scratch
+	// texture is usually larger than the scaled image so we only copy the
+	// area that is actually used and adjust the texture coordinates to match.
+	PreparedTex prep;
+	prep.ref = 1;
+	prep.memUsage = 0;
+	VidgfxTex *tex = vidgfx_context_prepare_tex(
+		gfx, m_tex, size, filter, true, prep.pxSize, prep.botRight);
+	if(tex == m_tex) {
+		prep.tex = m_tex;
+		prep.owned = false;
+	} else {
+		const QSize texSize = vidgfx_tex_get_size(tex);
+		const QSize usedSize(
+			qBound(1, (int)ceil(prep.botRight.x() * texSize.width()),
+			texSize.width()),
+			qBound(1, (int)ceil(prep.botRight.y() * texSize.height()),
+			texSize.height()));
+		prep.tex = vidgfx_context_new_tex(gfx, usedSize, false, true);
+		if(prep.tex == NULL)
+			return NULL; // Caller falls back to preparing every frame
+		prep.owned = true;
+		prep.memUsage =
+			(quint64)usedSize.width() * (quint64)usedSize.height() * 4ULL;
+		vidgfx_context_copy_tex_data(
+			gfx, prep.tex, tex, QPoint(0, 0), QRect(QPoint(0, 0), usedSize));
+		const qreal scaleX = (qreal)texSize.width() / (qreal)usedSize.width();
+		const qreal scaleY =
+			(qreal)texSize.height() / (qreal)usedSize.height();
+		prep.pxSize = QPointF(
+			prep.pxSize.x() * scaleX, prep.pxSize.y() * scaleY);
+		prep.botRight = QPointF(
+			prep.botRight.x() * scaleX, prep.botRight.y() * scaleY);
+	}
+	m_prepared[key] = prep;
+	m_preparedMemUsage += prep.memUsage;
+
+	pxSizeOut = prep.pxSize;
+	botRightOut = prep.botRight;
+	return prep.tex;
+}
+
+void CachedImage::derefPreparedTexture(
+	VidgfxContext *gfx, const QSize &size, VidgfxTexFilter filter)
+{
+	const QString key = getPreparedKey(size, filter);
+	if(!m_prepared.contains(key))
+		return; // Should never happen
+	PreparedTex &prep = m_prepared[key];
+	prep.ref--;
+	if(prep.ref > 0)
+		return; // Still in use
+	if(vidgfx_context_is_valid(gfx))
+		destroyPreparedTex(gfx, prep);
+	m_preparedMemUsage -= prep.memUsage;
+	m_prepared.remove(key);
+}
+
+void CachedImage::destroyPreparedTex(
+	VidgfxContext *gfx, const PreparedTex &prep)
+{
+	if(prep.owned && prep.tex != NULL)
+		vidgfx_context_destroy_tex(gfx, prep.tex);
+}
+
+QString CachedImage::getPreparedKey(
+	const QSize &size, VidgfxTexFilter filter)
+{
+	return QStringLiteral("%1x%2|%3")
+		.arg(size.width())
+		.arg(size.height())
+		.arg((int)filter);
+}
+
+/// <summary>
+/// Begins decoding every frame of our animation in the global thread pool.
+/// </summary>
+void CachedImage::decodeAnimation()
+{
+	if(m_decoder != NULL)
+		return; // Already decoding
+	m_decoder = new AnimationDecoder(m_data);
+	connect(m_decoder, &AnimationDecoder::finished,
+		this, &CachedImage::decodeFinished);
+	QThreadPool::globalInstance()->start(m_decoder);
+}
+
+void CachedImage::decodeFinished()
+{
+	if(m_decoder == NULL)
+		return; // Should never happen
+	if(m_decoder->wasSuccessful()) {
+		// We no longer need the raw file data or the separate first frame
+		m_frames = m_decoder->getFrames();
+		m_frameSeq = m_decoder->getFrameSequence();
+		m_frameDelays = m_decoder->getFrameDelays();
+		m_loopCount = m_decoder->getLoopCount();
+		m_data = QByteArray();
+		m_firstFrame = QImage();
+		m_memUsage = m_decoder->getMemoryUsage();
+		appLog(LOG_CAT) << QStringLiteral(
+			"Decoded %L1 frames (%L2 unique) of image file \"%3\" using %L4 KB")
+			.arg(m_frameSeq.count())
+			.arg(m_frames.count())
+			.arg(m_filename)
+			.arg(m_memUsage / 1024ULL);
+	} else {
+		// Animation is too large to keep decoded, every user must decode it
+		// itself
+		appLog(LOG_CAT) << "Image file \"" << m_filename
+			<< "\" is too large to decode in advance";
+	}
+	m_decoder->release();
+	m_decoder = NULL;
+
+	App->getImageCache()->imageReady(this);
+}
+
+//=============================================================================
+// ImageCache class
+
+ImageCache::ImageCache()
+	: QObject()
+	, m_images()
+	, m_loading()
+	, m_useCounter(0)
+	, m_fileKeys()
+	, m_revalidating()
+{
+	connect(App->getAsyncIO(), &AsyncIO::loadImageFromFileComplete,
+		this, &ImageCache::imgLoadComplete);
+	connect(App->getAsyncIO(), &AsyncIO::getFileVersionComplete,
+		this, &ImageCache::fileVersionComplete);
+}
+
+ImageCache::~ImageCache()
+{
+	QHashIterator<QString, CachedImage *> it(m_images);
+	while(it.hasNext()) {
+		it.next();
+		delete it.value();
+	}
+	m_images.clear();
+	m_loading.clear();
+	m_fileKeys.clear();
+	m_revalidating.clear();
+}
+
+/// <summary>
+/// Returns the shared image of the specified file, beginning to load it in the
+/// background if it isn't already in the cache. If the image is still loading
+/// then the caller should wait for `CachedImage::loadComplete()` to be
+/// emitted. Every call must be matched with a call to `derefImage()`.
+/// `priority` is only used if the image needs to be loaded.
+/// </summary>
+CachedImage *ImageCache::refImage(
+	const QString &filename, IOPriority priority)
+{
+	// Use the last version of the file that we know about. If the file has
+	// since been modified then the background revalidation will make sure
+	// that the next reference reloads it.
+	QString key = m_fileKeys.value(filename);
+	CachedImage *image = NULL;
+	if(!key.isEmpty())
+		image = m_images.value(key, NULL);
+	if(image != NULL) {
+		image->m_ref++;
+		revalidateKey(filename);
+		return image;
+	}
+
+	// Images are stored under their filename until the IO thread has
+	// resolved their key so that a load that is already in progress is
+	// shared. Filenames can never contain "|" so they can never collide with
+	// a resolved key.
+	image = m_images.value(filename, NULL);
+	if(image != NULL) {
+		image->m_ref++;
+		return image;
+	}
+
+	// Image isn't in the cache, read and decode it without blocking
+	image = new CachedImage(filename, filename);
+	m_images[filename] = image;
+	AsyncIO *asyncIo = App->getAsyncIO();
+	image->m_loadOperation = asyncIo->newOperationId();
+	m_loading[image->m_loadOperation] = image;
+	asyncIo->loadImageFromFile(image->m_loadOperation, filename, priority);
+
+	// Continued in `imgLoadComplete()`
+	return image;
+}
+
+void ImageCache::derefImage(CachedImage *image)
+{
+	if(image == NULL)
+		return;
+	image->m_ref--;
+	if(image->m_ref > 0)
+		return;
+	m_useCounter++;
+	image->m_lastUsed = m_useCounter;
+
+	// There is no point keeping failed images around as we will just try to
+	// load them again next time anyway
+	if(image->m_failed) {
+		destroyImage(image);
+		return;
+	}
+
+	purgeUnused(MAX_UNUSED_MEMORY);
+}
+
+/// <summary>
+/// Returns the approximate amount of memory in bytes that is used by every
+/// image in the cache.
+/// </summary>
+quint64 ImageCache::getMemoryUsage() const
+{
+	quint64 usage = 0;
+	QHashIterator<QString, CachedImage *> it(m_images);
+	while(it.hasNext()) {
+		it.next();
+		usage += it.value()->getMemoryUsage();
+	}
+	return usage;
+}
+
+/// <summary>
+/// Returns the approximate amount of memory in bytes that is used by images
+/// that are in the cache but are no longer used by anyone.
+/// </summary>
+quint64 ImageCache::getUnusedMemoryUsage() const
+{
+	quint64 usage = 0;
+	QHashIterator<QString, CachedImage *> it(m_images);
+	while(it.hasNext()) {
+		it.next();
+		if(it.value()->m_ref <= 0)
+			usage += it.value()->m_memUsage;
+	}
+	return usage;
+}
+
+/// <summary>
+/// Releases the least recently used images that are no longer referenced until
+/// they use at most `maxMemory` bytes. Must be called with a `maxMemory` of 0
+/// before the graphics context is destroyed.
+/// </summary>
+void ImageCache::purgeUnused(quint64 maxMemory)
+{
+	quint64 usage = getUnusedMemoryUsage();
+	while(usage > maxMemory) {
+		CachedImage *lruImage = NULL;
+		QHashIterator<QString, CachedImage *> it(m_images);
+		while(it.hasNext()) {
+			it.next();
+			CachedImage *image = it.value();
+			if(image->m_ref > 0 || image->isLoading())
+				continue; // Still in use
+			if(lruImage == NULL || image->m_lastUsed < lruImage->m_lastUsed)
+				lruImage = image;
+		}
+		if(lruImage == NULL)
+			break; // Nothing left to release
+		usage -= lruImage->m_memUsage;
+		destroyImage(lruImage);
+	}
+}
+
+/// <summary>
+/// Queries the current version of the specified file in the background so
+/// that we notice if it was modified since we last loaded it.
+/// </summary>
+void ImageCache::revalidateKey(const QString &filename)
+{
+	QHashIterator<int, QString> it(m_revalidating);
+	while(it.hasNext()) {
+		it.next();
+		if(it.value() == filename)
+			return; // Already in progress
+	}
+	AsyncIO *asyncIo = App->getAsyncIO();
+	int id = asyncIo->newOperationId();
+	m_revalidating[id] = filename;
+	asyncIo->getFileVersion(id, filename, IOPrefetchPriority);
+
+	// Continued in `fileVersionComplete()`
+}
+
+void ImageCache::fileVersionComplete(int id, const QString &version)
+{
+	if(!m_revalidating.contains(id))
+		return; // Not our signal
+	const QString filename = m_revalidating.take(id);
+
+	// If the file has been deleted then the next reference attempts to load
+	// it again which will fail just like it would have if we tested it then
+	if(version.isEmpty())
+		m_fileKeys.remove(filename);
+	else
+		m_fileKeys[filename] = version;
+}
+
+void ImageCache::destroyImage(CachedImage *image)
+{
+	m_images.remove(image->m_key);
+	if(image->m_loadOperation != 0) {
+		// Nobody is waiting for the image anymore, don't waste time on it
+		App->getAsyncIO()->cancel(image->m_loadOperation);
+		m_loading.remove(image->m_loadOperation);
+	}
+	delete image;
+}
+
+void ImageCache::imgLoadComplete(
+	int id, int errorCode, const QByteArray &data, const QImage &img,
+	const QString &version)
+{
+	CachedImage *image = m_loading.value(id, NULL);
+	if(image == NULL)
+		return; // Not our signal
+	m_loading.remove(id);
+	image->m_loadOperation = 0;
+
+	// Now that we know the version of the file that was read move the image
+	// to its real key. If the same file was loaded using a different path
+	// then future references use the existing image while this one remains
+	// valid until it is no longer used.
+	if(!version.isEmpty()) {
+		m_fileKeys[image->m_filename] = version;
+		m_images.remove(image->m_key);
+		image->m_key = version;
+		if(m_images.contains(version))
+			image->m_key += QStringLiteral("|%1").arg(id);
+		m_images[image->m_key] = image;
+	}
+
+	// Process result
+	if(errorCode == 2) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Unrecognised image file \"" << image->m_filename << "\"";
+		image->m_failed = true;
+	} else if(errorCode != 0) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Cannot open image file \"" << image->m_filename << "\". "
+			<< "Reason = " << errorCode;
+		image->m_failed = true;
+	}
+
+	// No point continuing processing if we can't create the texture
+	VidgfxContext *gfx = App->getGraphicsContext();
+	if(!image->m_failed && !vidgfx_context_is_valid(gfx))
+		image->m_failed = true;
+
+	if(!image->m_failed) {
+		// The IO thread only returns the file data if the image is animated
+		image->m_size = img.size();
+		image->m_hasAnimation = !data.isEmpty();
+		// TODO: Actually test pixels if no animation
+		image->m_hasAlpha = img.hasAlphaChannel();
+		if(image->m_hasAnimation) {
+			appLog(LOG_CAT) << "Image file \"" << image->m_filename
+				<< "\" has animation";
+
+			// Every user of the image animates it separately. Decode all the
+			// frames in advance so that they can be shared.
+			image->m_data = data;
+			image->m_firstFrame = img;
+			image->m_memUsage = (quint64)data.size() +
+				(quint64)img.byteCount();
+			image->decodeAnimation();
+			return; // Continued in `imageReady()`
+		} else {
+			QImage texImg = img;
+			if(image->m_hasAlpha) {
+				// Prevent colour fringing around fully transparent pixels due
+				// to bilinear filtering by diluting the colour information
+				vidgfx_context_dilute_img(gfx, texImg);
+			}
+			image->m_tex = vidgfx_context_new_tex(gfx, texImg, false);
+			image->m_memUsage = (quint64)img.width() *
+				(quint64)img.height() * 4ULL;
+		}
+	}
+
+	imageReady(image);
+}
+
+/// <summary>
+/// Called once an image has completely loaded or failed to load.
+/// </summary>
+void ImageCache::imageReady(CachedImage *image)
+{
+	// The image might not be used by anyone anymore
+	if(image->m_ref <= 0) {
+		if(image->m_failed)
+			destroyImage(image);
+		else
+			purgeUnused(MAX_UNUSED_MEMORY);
+		return;
+	}
+
+	emit image->loadComplete(image);
+}
@@ -0,0 +1,378 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include "common.h"
+#include <Libvidgfx/libvidgfx.h>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QRunnable>
+#include <QtGui/QImage>
+
+class ImageCache;
+
+//=============================================================================
+/// <summary>
+/// Decodes every frame of an animated image in the global thread pool so that
+/// playback never has to decode or convert anything on the main thread. Every
+/// frame is stored in a format that can be uploaded to a texture as-is.
+/// Identical frames are only stored once and consecutive identical frames are
+/// merged into a single frame with a longer delay. If the decoded frames use
+/// more memory than the limit then decoding is aborted and the image must be
+/// decoded during playback instead.
+///
+/// The decoder is owned by the `CachedImage` that created it until it is
+/// released with `release()` after which it deletes itself as soon as it is
+/// no longer running. `finished()` is never emitted after it was released.
+/// </summary>
+class AnimationDecoder : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	QByteArray		m_data;
+	QAtomicInt		m_abort;
+	bool			m_success;
+	QMutex			m_stateMutex;
+	bool			m_isDone; // Protected by `m_stateMutex`
+	bool			m_isReleased; // Protected by `m_stateMutex`
+
+	// Output
+	QVector<QImage>	m_frames; // Unique frames
+	QVector<int>	m_frameSeq; // Index into `m_frames` for each step
+	QVector<int>	m_frameDelays; // Msec for each step
+	int				m_loopCount;
+	quint64			m_memUsage;
+
+public: // Constructor/destructor ---------------------------------------------
+	AnimationDecoder(const QByteArray &data);
+private:
+	~AnimationDecoder();
+
+public: // Methods ------------------------------------------------------------
+	void			release();
+	bool			wasSuccessful() const;
+	QVector<QImage>	getFrames() const;
+	QVector<int>	getFrameSequence() const;
+	QVector<int>	getFrameDelays() const;
+	int				getLoopCount() const;
+	quint64			getMemoryUsage() const;
+
+private:
+	void			decode();
+	static uint		hashFrame(const QImage &img);
+
+protected:
+	virtual void	run();
+
+Q_SIGNALS: // Signals ---------------------------------------------------------
+	void			finished();
+};
+//=============================================================================
+
+inline bool AnimationDecoder::wasSuccessful() const
+{
+	return m_success;
+}
+
+inline QVector<QImage> AnimationDecoder::getFrames() const
+{
+	return m_frames;
+}
+
+inline QVector<int> AnimationDecoder::getFrameSequence() const
+{
+	return m_frameSeq;
+}
+
+inline QVector<int> AnimationDecoder::getFrameDelays() const
+{
+	return m_frameDelays;
+}
+
+inline int AnimationDecoder::getLoopCount() const
+{
+	return m_loopCount;
+}
+
+inline quint64 AnimationDecoder::getMemoryUsage() const
+{
+	return m_memUsage;
+}
+
+//=============================================================================
+/// <summary>
+/// A single image file that is shared between every object that displays it.
+/// Static images are uploaded to a single texture that everyone can use while
+/// the frames of animated images are decoded once in the background and
+/// then shared so that each user can display them at its own pace. If an
+/// animation is too large to keep decoded then the raw file data is kept in
+/// memory instead so that each user can decode the frames itself.
+/// </summary>
+class CachedImage : public QObject
+{
+	friend class ImageCache;
+
+	Q_OBJECT
+
+private: // Datatypes ---------------------------------------------------------
+	struct PreparedTex {
+		VidgfxTex *	tex;
+		bool		owned; // False if the original texture is used as-is
+		QPointF		pxSize;
+		QPointF		botRight;
+		int			ref;
+		quint64		memUsage; // Zero if not owned
+	};
+
+private: // Members -----------------------------------------------------------
+	QString		m_key;
+	QString		m_filename;
+	int			m_ref;
+	quint64		m_lastUsed;
+	int			m_loadOperation;
+	bool		m_failed;
+
+	AnimationDecoder *	m_decoder;
+
+	// Image data
+	VidgfxTex *		m_tex; // Static images only
+	QByteArray		m_data; // Undecoded animated images only
+	QImage			m_firstFrame; // Undecoded animated images only
+	QVector<QImage>	m_frames; // Decoded animated images only
+	QVector<int>	m_frameSeq;
+	QVector<int>	m_frameDelays;
+	int				m_loopCount;
+	QSize			m_size;
+	bool			m_hasAlpha;
+	bool			m_hasAnimation;
+	quint64			m_memUsage;
+
+	// Prepared textures of static images, keyed by target size and filter
+	QHash<QString, PreparedTex>	m_prepared;
+	quint64						m_preparedMemUsage;
+
+private: // Constructor/destructor --------------------------------------------
+	CachedImage(const QString &key, const QString &filename);
+	~CachedImage();
+
+public: // Methods ------------------------------------------------------------
+	QString		getFilename() const;
+	bool		isLoading() const;
+	bool		isLoaded() const;
+	bool		hasTransparency() const;
+	bool		hasAnimation() const;
+	QSize		getSize() const;
+	VidgfxTex *	getTexture() const;
+	QByteArray	getData() const;
+	QImage		getFirstFrame() const;
+	quint64		getMemoryUsage() const;
+
+	// Prepared textures
+	VidgfxTex *	refPreparedTexture(
+		VidgfxContext *gfx, const QSize &size, VidgfxTexFilter filter,
+		QPointF &pxSizeOut, QPointF &botRightOut, bool &wasCachedOut);
+	void		derefPreparedTexture(
+		VidgfxContext *gfx, const QSize &size, VidgfxTexFilter filter);
+
+	// Decoded animations
+	bool		hasDecodedFrames() const;
+	int			getNumFrameSteps() const;
+	QImage		getFrameForStep(int step) const;
+	int			getFrameIndexForStep(int step) const;
+	int			getDelayForStep(int step) const;
+	int			getLoopCount() const;
+
+private:
+	void		decodeAnimation();
+	void		destroyPreparedTex(VidgfxContext *gfx, const PreparedTex &prep);
+	static QString	getPreparedKey(const QSize &size, VidgfxTexFilter filter);
+
+Q_SIGNALS: // Signals ---------------------------------------------------------
+	void		loadComplete(CachedImage *image);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void		decodeFinished();
+};
+//=============================================================================
+
+inline QString CachedImage::getFilename() const
+{
+	return m_filename;
+}
+
+inline bool CachedImage::isLoading() const
+{
+	return m_loadOperation != 0 || m_decoder != NULL;
+}
+
+inline bool CachedImage::isLoaded() const
+{
+	return !isLoading() && !m_failed;
+}
+
+inline bool CachedImage::hasTransparency() const
+{
+	return m_hasAlpha;
+}
+
+inline bool CachedImage::hasAnimation() const
+{
+	return m_hasAnimation;
+}
+
+inline QSize CachedImage::getSize() const
+{
+	return m_size;
+}
+
+inline VidgfxTex *CachedImage::getTexture() const
+{
+	return m_tex;
+}
+
+inline QByteArray CachedImage::getData() const
+{
+	return m_data;
+}
+
+inline QImage CachedImage::getFirstFrame() const
+{
+	return m_firstFrame;
+}
+
+/// <summary>
+/// Returns the approximate amount of memory in bytes that is used by the image
+/// data and every prepared texture of the image.
+/// </summary>
+inline quint64 CachedImage::getMemoryUsage() const
+{
+	return m_memUsage + m_preparedMemUsage;
+}
+
+inline bool CachedImage::hasDecodedFrames() const
+{
+	return !m_frameSeq.isEmpty();
+}
+
+/// <summary>
+/// Returns the number of frames that are displayed in a single loop of the
+/// decoded animation. Multiple steps can display the same frame.
+/// </summary>
+inline int CachedImage::getNumFrameSteps() const
+{
+	return m_frameSeq.count();
+}
+
+inline QImage CachedImage::getFrameForStep(int step) const
+{
+	return m_frames.at(m_frameSeq.at(step));
+}
+
+/// <summary>
+/// Returns an ID that is the same for every step that displays the same frame
+/// so that the caller can avoid uploading the same frame twice in a row.
+/// </summary>
+inline int CachedImage::getFrameIndexForStep(int step) const
+{
+	return m_frameSeq.at(step);
+}
+
+/// <returns>The number of msec that the step's frame is visible for</returns>
+inline int CachedImage::getDelayForStep(int step) const
+{
+	return m_frameDelays.at(step);
+}
+
+/// <summary>
+/// Returns the number of times that the decoded animation should repeat or -1
+/// if it should repeat forever.
+/// </summary>
+inline int CachedImage::getLoopCount() const
+{
+	return m_loopCount;
+}
+
+//=============================================================================
+/// <summary>
+/// A process-wide cache of decoded image files so that the same image that is
+/// used in multiple layers or scenes is only read, decoded and uploaded once.
+/// Images are identified by the version of their file as returned by
+/// `AsyncIO::getFileVersion()` so that a file that has been modified on disk
+/// is reloaded. As querying the disk can stall the main thread the version of
+/// each filename is resolved by the IO thread when the image is loaded and is
+/// then revalidated in the background every time the cached image is
+/// referenced again. Only a single load is ever in progress for each
+/// filename.
+///
+/// Images are reference counted. Images that are no longer referenced are kept
+/// in the cache so that reloading layers or switching scenes is fast but the
+/// least recently used ones are released once the unreferenced images use more
+/// memory than `MAX_UNUSED_MEMORY`.
+/// </summary>
+class ImageCache : public QObject
+{
+	friend class CachedImage;
+
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	QHash<QString, CachedImage *>	m_images;
+	QHash<int, CachedImage *>		m_loading;
+	quint64							m_useCounter;
+	QHash<QString, QString>			m_fileKeys; // Filename -> key
+	QHash<int, QString>				m_revalidating; // ID -> filename
+
+public: // Constructor/destructor ---------------------------------------------
+	ImageCache();
+	~ImageCache();
+
+public: // Methods ------------------------------------------------------------
+	CachedImage *	refImage(
+		const QString &filename, IOPriority priority = IOVisiblePriority);
+	void			derefImage(CachedImage *image);
+	int				getNumImages() const;
+	quint64			getMemoryUsage() const;
+	quint64			getUnusedMemoryUsage() const;
+	void			purgeUnused(quint64 maxMemory = 0);
+
+private:
+	void			revalidateKey(const QString &filename);
+	void			destroyImage(CachedImage *image);
+	void			imageReady(CachedImage *image);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void			imgLoadComplete(
+		int id, int errorCode, const QByteArray &data, const QImage &img,
+		const QString &version);
+	void			fileVersionComplete(int id, const QString &version);
+};
+//=============================================================================
+
+inline int ImageCache::getNumImages() const
+{
+	return m_images.count();
+}
+
+#endif // IMAGECACHE_H
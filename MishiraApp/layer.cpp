@@ -103,6 +103,7 @@ Layer::Layer(LayerGroup *parent)
 	, m_name(tr("Unnamed"))
 	, m_isLoaded(false)
 	, m_isVisible(false)
+	, m_isOutputDirty(true)
 
 	//, m_rect() // See below
 	, m_visibleRect(0, 0, 0, 0) // Invisible
@@ -133,9 +134,13 @@ void Layer::setInitialized()
 
 	m_isInitializing = false;
 	initializedEvent();
+	if(m_isVisible && !m_isLoaded && m_parent->isVisibleSomewhere()) {
+		// Unserialized layers are only loaded once they are actually needed
+		m_isLoaded = true;
+	}
 	if(m_isLoaded)
 		loadEvent();
-	if(m_isVisible)
+	if(m_isVisible && m_isLoaded)
 		showEvent();
 }
 
@@ -170,8 +175,11 @@ void Layer::setLoaded(bool loaded)
 
 	if(loaded) {
 		m_isLoaded = true;
-		if(!m_isInitializing)
+		if(!m_isInitializing) {
 			loadEvent();
+			if(m_isVisible)
+				showEvent(); // Loading of a visible layer was deferred
+		}
 	} else {
 		if(m_isVisible)
 			setVisible(false);
@@ -179,6 +187,7 @@ void Layer::setLoaded(bool loaded)
 		if(!m_isInitializing)
 			unloadEvent();
 	}
+	m_isOutputDirty = true;
 	m_parent->layerChanged(this); // Remote emit
 }
 
@@ -204,9 +213,10 @@ void Layer::setVisible(bool visible)
 			showEvent();
 	} else {
 		m_isVisible = false;
-		if(!m_isInitializing)
+		if(!m_isInitializing && m_isLoaded)
 			hideEvent();
 	}
+	m_isOutputDirty = true;
 	m_parent->layerChanged(this); // Remote emit
 }
 
@@ -220,6 +230,16 @@ bool Layer::isVisibleSomewhere() const
 	return m_isVisible && m_parent->isVisibleSomewhere();
 }
 
+/// <summary>
+/// Returns true if the output of this layer might be different to what it was
+/// the last time that it was rendered. Layers that don't have static output
+/// are always considered dirty.
+/// </summary>
+bool Layer::isOutputDirty() const
+{
+	return m_isOutputDirty || !hasStaticOutput();
+}
+
 void Layer::setRect(const QRect &rect)
 {
 	if(m_rect == rect)
@@ -382,7 +402,10 @@ bool Layer::unserialize(QDataStream *stream)
 		*stream >> boolData;
 		//setLoaded(boolData); Always begin unloaded
 		*stream >> boolData;
-		setVisible(boolData);
+		// Visible layers are not loaded until their group becomes visible or
+		// the profile loads them in the background so that opening a profile
+		// with lots of scenes is fast. See `Profile::loadDeferredLayers()`
+		m_isVisible = boolData;
 		*stream >> strData;
 		setName(strData);
 		*stream >> rectData;
@@ -445,6 +468,7 @@ QRect Layer::scaledRectFromActualSize(const QSize &size) const
 /// <returns></returns>
 void Layer::updateResourcesIfLoaded()
 {
+	m_isOutputDirty = true;
 	if(m_isLoaded && !m_isInitializing) {
 		VidgfxContext *gfx = App->getGraphicsContext();
 		if(vidgfx_context_is_valid(gfx))
@@ -510,6 +534,17 @@ void Layer::render(
 	Q_UNUSED(numDropped);
 }
 
+/// <summary>
+/// Returns true if the layer's output only ever changes when it is explicitly
+/// marked dirty with `setOutputDirty()`. Layers that capture, animate or
+/// otherwise change their output by themselves must return false which is the
+/// default.
+/// </summary>
+bool Layer::hasStaticOutput() const
+{
+	return false;
+}
+
 bool Layer::hasSettingsDialog()
 {
 	return false;
@@ -43,6 +43,7 @@ protected: // Members ---------------------------------------------------------
 	QString			m_name;
 	bool			m_isLoaded;
 	bool			m_isVisible;
+	bool			m_isOutputDirty;
 
 	QRect			m_rect;
 	QRect			m_visibleRect;
@@ -69,6 +70,9 @@ public: // Methods ------------------------------------------------------------
 	void			setVisible(bool visible);
 	bool			isVisible() const;
 	bool			isVisibleSomewhere() const;
+	void			setOutputDirty();
+	void			clearOutputDirty();
+	bool			isOutputDirty() const;
 
 	void			setRect(const QRect &rect);
 	QRect			getRect() const;
@@ -101,6 +105,7 @@ public: // Interface ----------------------------------------------------------
 	virtual void	destroyResources(VidgfxContext *gfx);
 	virtual void	render(
 		VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped);
+	virtual bool	hasStaticOutput() const;
 
 	virtual quint32	getTypeId() const = 0;
 
@@ -146,6 +151,19 @@ inline bool Layer::isVisible() const
 	return m_isVisible;
 }
 
+/// <summary>
+/// Marks the layer as having different output to what was last rendered.
+/// </summary>
+inline void Layer::setOutputDirty()
+{
+	m_isOutputDirty = true;
+}
+
+inline void Layer::clearOutputDirty()
+{
+	m_isOutputDirty = false;
+}
+
 inline QRect Layer::getRect() const
 {
 	return m_rect;
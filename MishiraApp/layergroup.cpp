@@ -16,13 +16,35 @@
 //*****************************************************************************
 
 #include "layergroup.h"
+#include "application.h"
 #include "layerfactory.h"
 #include "profile.h"
 #include "scene.h"
 #include "sceneitem.h"
+#include <QtGui/QImage>
 
 const QString LOG_CAT = QStringLiteral("Scene");
 
+/// <summary>
+/// The number of consecutive frames that a group must remain unchanged for
+/// before we flatten it into a single texture. This prevents us from wasting
+/// time rebuilding the cache of groups that change frequently.
+/// </summary>
+const int CACHE_DELAY_FRAMES = 30;
+
+/// <summary>
+/// The number of frames to wait after rendering the group into the staging
+/// textures before we read them back. This gives the GPU enough time to
+/// complete the render so that mapping the textures never stalls the CPU.
+/// </summary>
+const int CACHE_READBACK_DELAY_FRAMES = 2;
+
+/// <summary>
+/// Groups with fewer visible layers than this are always rendered directly as
+/// flattening them wouldn't save anything.
+/// </summary>
+const int CACHE_MIN_LAYERS = 2;
+
 LayerGroup::LayerGroup(Profile *profile)
 	: QObject()
 	, m_isInitializing(true)
@@ -30,7 +52,26 @@ LayerGroup::LayerGroup(Profile *profile)
 	, m_name(tr("Unnamed"))
 	, m_layers()
 	, m_visibleRef(0)
+
+	// Render cache
+	, m_isCacheValid(false)
+	, m_numUnchangedFrames(0)
+	, m_cacheRect()
+	, m_cacheTex(NULL)
+	, m_cacheVertBuf(NULL)
+	, m_cacheBlackTex(NULL)
+	, m_cacheWhiteTex(NULL)
+	, m_cacheReadbackDelay(0)
 {
+	// Any change to our layers invalidates the render cache
+	connect(this, &LayerGroup::layerAdded,
+		this, &LayerGroup::invalidateRenderCache);
+	connect(this, &LayerGroup::destroyingLayer,
+		this, &LayerGroup::invalidateRenderCache);
+	connect(this, &LayerGroup::layerMoved,
+		this, &LayerGroup::invalidateRenderCache);
+	connect(this, &LayerGroup::layerChanged,
+		this, &LayerGroup::invalidateRenderCache);
 }
 
 LayerGroup::~LayerGroup()
@@ -38,6 +79,11 @@ LayerGroup::~LayerGroup()
 	// Delete all child layers cleanly
 	while(!m_layers.isEmpty())
 		destroyLayer(m_layers.first());
+
+	// Release the render cache
+	VidgfxContext *gfx = App->getGraphicsContext();
+	if(vidgfx_context_is_valid(gfx))
+		destroyRenderCache(gfx);
 }
 
 void LayerGroup::setInitialized()
@@ -318,6 +364,291 @@ bool LayerGroup::unserialize(QDataStream *stream)
 	return true;
 }
 
+/// <summary>
+/// Returns our visible layers in the order that they are rendered in.
+/// </summary>
+LayerList LayerGroup::getVisibleLayers() const
+{
+	LayerList layers;
+	for(int i = m_layers.count() - 1; i >= 0; i--) {
+		Layer *layer = m_layers.at(i);
+		if(layer->isVisible())
+			layers.append(layer);
+	}
+	return layers;
+}
+
+/// <summary>
+/// Flattens the group into a single texture if all of its visible layers
+/// have static output and they haven't changed for a while. Must be called
+/// before the scene's render target is set as it renders to its own target.
+/// </summary>
+void LayerGroup::updateRenderCache(
+	VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped)
+{
+	if(!vidgfx_context_is_valid(gfx))
+		return; // Context must exist and be usuable
+
+	// Can we cache the group at all and has anything changed?
+	const LayerList layers = getVisibleLayers();
+	bool canCache = (layers.count() >= CACHE_MIN_LAYERS);
+	bool isDirty = false;
+	for(int i = 0; i < layers.count() && canCache; i++) {
+		Layer *layer = layers.at(i);
+		if(!layer->hasStaticOutput())
+			canCache = false;
+		else if(layer->isOutputDirty())
+			isDirty = true;
+	}
+	if(!canCache) {
+		destroyRenderCache(gfx);
+		return;
+	}
+	if(isDirty)
+		invalidateRenderCache();
+	if(m_isCacheValid)
+		return; // Cache is up-to-date
+
+	// If we are waiting to read back a render that was started in an earlier
+	// frame then discard it if the group changed since then
+	if(m_cacheBlackTex != NULL) {
+		if(m_numUnchangedFrames < CACHE_DELAY_FRAMES) {
+			destroyCacheStaging(gfx);
+			return;
+		}
+		m_cacheReadbackDelay--;
+		if(m_cacheReadbackDelay > 0)
+			return;
+		m_isCacheValid = finishRenderCache(gfx);
+		if(!m_isCacheValid)
+			m_numUnchangedFrames = 0; // Try again later
+		return;
+	}
+
+	// Only cache the group once it has settled down
+	m_numUnchangedFrames++;
+	if(m_numUnchangedFrames < CACHE_DELAY_FRAMES)
+		return;
+	m_isCacheValid = beginRenderCache(
+		gfx, scene, layers, frameNum, numDropped);
+}
+
+/// <summary>
+/// Renders every layer in the list into staging textures that cover the
+/// visible area of the layers. As our blending is not premultiplied we cannot
+/// just composite the layers onto a transparent target and then composite
+/// that onto the canvas as partially transparent pixels would be darkened.
+/// Instead we render the layers twice, once over black and once over white,
+/// and calculate the actual colour and opacity of each pixel from the
+/// difference in `finishRenderCache()` a few frames later once the GPU has
+/// completed the render.
+/// </summary>
+/// <returns>True if the cache is complete as nothing is visible</returns>
+bool LayerGroup::beginRenderCache(
+	VidgfxContext *gfx, Scene *scene, const LayerList &layers, uint frameNum,
+	int numDropped)
+{
+	if(m_cacheTex != NULL)
+		vidgfx_context_destroy_tex(gfx, m_cacheTex);
+	m_cacheTex = NULL;
+	destroyCacheStaging(gfx);
+
+	// Determine the area of the canvas that the layers cover
+	QRect rect;
+	for(int i = 0; i < layers.count(); i++)
+		rect |= layers.at(i)->getVisibleRect();
+	rect &= QRect(QPoint(0, 0), m_profile->getCanvasSize());
+	m_cacheRect = rect;
+	if(rect.isEmpty())
+		return true; // Nothing visible
+
+	// Create temporary textures
+	VidgfxTex *target = vidgfx_context_new_tex(gfx, rect.size(), false, true);
+	VidgfxTex *blackTex = vidgfx_context_new_staging_tex(gfx, rect.size());
+	VidgfxTex *whiteTex = vidgfx_context_new_staging_tex(gfx, rect.size());
+	if(target == NULL || blackTex == NULL || whiteTex == NULL) {
+		if(target != NULL)
+			vidgfx_context_destroy_tex(gfx, target);
+		if(blackTex != NULL)
+			vidgfx_context_destroy_tex(gfx, blackTex);
+		if(whiteTex != NULL)
+			vidgfx_context_destroy_tex(gfx, whiteTex);
+		m_numUnchangedFrames = 0; // Try again later
+		return false;
+	}
+
+	// Render the layers over both backgrounds. The render target is no
+	// longer needed once the copies to the staging textures are queued.
+	renderLayersToStaging(
+		gfx, scene, layers, target, blackTex, QColor(0, 0, 0), frameNum,
+		numDropped);
+	renderLayersToStaging(
+		gfx, scene, layers, target, whiteTex, QColor(255, 255, 255),
+		frameNum, numDropped);
+	vidgfx_context_destroy_tex(gfx, target);
+
+	// Read back the result once the GPU has had time to complete it
+	m_cacheBlackTex = blackTex;
+	m_cacheWhiteTex = whiteTex;
+	m_cacheReadbackDelay = CACHE_READBACK_DELAY_FRAMES;
+	return false;
+}
+
+/// <summary>
+/// Calculates the actual pixel values of the cache from the staging textures
+/// that were rendered by `beginRenderCache()` and uploads the result.
+/// </summary>
+/// <returns>True if the cache was successfully created</returns>
+bool LayerGroup::finishRenderCache(VidgfxContext *gfx)
+{
+	VidgfxTex *blackTex = m_cacheBlackTex;
+	VidgfxTex *whiteTex = m_cacheWhiteTex;
+	const QRect rect = m_cacheRect;
+	QImage img;
+	vidgfx_tex_map(blackTex);
+	vidgfx_tex_map(whiteTex);
+	if(vidgfx_tex_is_mapped(blackTex) && vidgfx_tex_is_mapped(whiteTex)) {
+		const quint8 *blackData =
+			static_cast<quint8 *>(vidgfx_tex_get_data_ptr(blackTex));
+		const quint8 *whiteData =
+			static_cast<quint8 *>(vidgfx_tex_get_data_ptr(whiteTex));
+		int blackStride = vidgfx_tex_get_stride(blackTex);
+		int whiteStride = vidgfx_tex_get_stride(whiteTex);
+		img = QImage(rect.size(), QImage::Format_ARGB32);
+		for(int y = 0; y < rect.height(); y++) {
+			const QRgb *blackLine =
+				reinterpret_cast<const QRgb *>(&blackData[y * blackStride]);
+			const QRgb *whiteLine =
+				reinterpret_cast<const QRgb *>(&whiteData[y * whiteStride]);
+			QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+			for(int x = 0; x < rect.width(); x++) {
+				const QRgb b = blackLine[x];
+				const QRgb w = whiteLine[x];
+
+				// The amount of the background that shows through is the
+				// same for every channel, average them to reduce error
+				int diff = (qRed(w) - qRed(b)) + (qGreen(w) - qGreen(b)) +
+					(qBlue(w) - qBlue(b));
+				int a = qBound(0, 255 - (diff + 1) / 3, 255);
+				if(a == 0) {
+					line[x] = qRgba(0, 0, 0, 0);
+					continue;
+				}
+
+				// Black pixels are premultiplied by the opacity
+				line[x] = qRgba(
+					qMin(255, (qRed(b) * 255 + a / 2) / a),
+					qMin(255, (qGreen(b) * 255 + a / 2) / a),
+					qMin(255, (qBlue(b) * 255 + a / 2) / a),
+					a);
+			}
+		}
+	}
+	vidgfx_tex_unmap(blackTex);
+	vidgfx_tex_unmap(whiteTex);
+	destroyCacheStaging(gfx);
+	if(img.isNull())
+		return false;
+
+	// Create the cached texture and the quad that it is displayed with
+	m_cacheTex = vidgfx_context_new_tex(gfx, img);
+	if(m_cacheTex == NULL)
+		return false;
+	if(m_cacheVertBuf == NULL) {
+		m_cacheVertBuf = vidgfx_context_new_vertbuf(
+			gfx, VIDGFX_TEX_DECAL_RECT_BUF_SIZE);
+	}
+	if(m_cacheVertBuf == NULL)
+		return false;
+	vidgfx_create_tex_decal_rect(m_cacheVertBuf, QRectF(rect));
+	return true;
+}
+
+void LayerGroup::renderLayersToStaging(
+	VidgfxContext *gfx, Scene *scene, const LayerList &layers,
+	VidgfxTex *target, VidgfxTex *staging, const QColor &bgColor,
+	uint frameNum, int numDropped)
+{
+	const QSize size = vidgfx_tex_get_size(target);
+
+	// Setup render target so that canvas coordinates map to our texture
+	vidgfx_context_set_user_render_target(gfx, target);
+	vidgfx_context_set_user_render_target_viewport(gfx, size);
+	vidgfx_context_set_render_target(gfx, GfxUserTarget);
+	QMatrix4x4 mat;
+	vidgfx_context_set_view_mat(gfx, mat); // Undefined otherwise
+	mat.ortho(
+		m_cacheRect.left(), m_cacheRect.left() + size.width(),
+		m_cacheRect.top() + size.height(), m_cacheRect.top(), -1.0f, 1.0f);
+	vidgfx_context_set_proj_mat(gfx, mat);
+
+	// Render the layers
+	vidgfx_context_clear(gfx, bgColor);
+	for(int i = 0; i < layers.count(); i++)
+		layers.at(i)->render(gfx, scene, frameNum, numDropped);
+
+	// Copy the result to system memory
+	vidgfx_context_copy_tex_data(
+		gfx, staging, target, QPoint(0, 0),
+		QRect(0, 0, size.width(), size.height()));
+}
+
+/// <summary>
+/// Renders the cached texture of the group to the current render target.
+/// </summary>
+/// <returns>False if the group has no valid cache</returns>
+bool LayerGroup::renderCache(VidgfxContext *gfx)
+{
+	if(!m_isCacheValid)
+		return false;
+	if(m_cacheTex == NULL || m_cacheVertBuf == NULL)
+		return true; // Nothing visible
+
+	vidgfx_context_set_shader(gfx, GfxTexDecalShader);
+	vidgfx_context_set_topology(gfx, GfxTriangleStripTopology);
+	vidgfx_context_set_blending(gfx, GfxAlphaBlending);
+	QColor prevCol = vidgfx_context_get_tex_decal_mod_color(gfx);
+	vidgfx_context_set_tex_decal_mod_color(gfx, QColor(255, 255, 255));
+	vidgfx_context_set_tex(gfx, m_cacheTex);
+	vidgfx_context_set_tex_filter(gfx, GfxBilinearFilter);
+	vidgfx_context_draw_buf(gfx, m_cacheVertBuf);
+	vidgfx_context_set_tex_decal_mod_color(gfx, prevCol);
+	return true;
+}
+
+void LayerGroup::destroyCacheStaging(VidgfxContext *gfx)
+{
+	if(m_cacheBlackTex != NULL)
+		vidgfx_context_destroy_tex(gfx, m_cacheBlackTex);
+	m_cacheBlackTex = NULL;
+	if(m_cacheWhiteTex != NULL)
+		vidgfx_context_destroy_tex(gfx, m_cacheWhiteTex);
+	m_cacheWhiteTex = NULL;
+	m_cacheReadbackDelay = 0;
+}
+
+void LayerGroup::destroyRenderCache(VidgfxContext *gfx)
+{
+	invalidateRenderCache();
+	destroyCacheStaging(gfx);
+	if(m_cacheTex != NULL)
+		vidgfx_context_destroy_tex(gfx, m_cacheTex);
+	m_cacheTex = NULL;
+	if(m_cacheVertBuf != NULL)
+		vidgfx_context_destroy_vertbuf(gfx, m_cacheVertBuf);
+	m_cacheVertBuf = NULL;
+}
+
+/// <summary>
+/// Causes the group to be rendered layer-by-layer until it has been unchanged
+/// long enough to be cached again.
+/// </summary>
+void LayerGroup::invalidateRenderCache()
+{
+	m_isCacheValid = false;
+	m_numUnchangedFrames = 0;
+}
+
 void LayerGroup::initializedEvent()
 {
 	// Make sure all our children are also initialized (Due to unserialization)
@@ -329,9 +660,12 @@ void LayerGroup::initializedEvent()
 
 void LayerGroup::showEvent()
 {
-	// Notify children of visibility change
+	// Notify children of visibility change. Visible layers that haven't been
+	// loaded yet must be loaded immediately as we are about to render them.
 	for(int i = 0; i < m_layers.count(); i++) {
 		Layer *layer = m_layers.at(i);
+		if(layer->isVisible() && !layer->isLoaded())
+			layer->setLoaded(true);
 		layer->parentShowEvent();
 	}
 }
@@ -23,6 +23,7 @@
 #include <QtCore/QVector>
 
 class Profile;
+class Scene;
 
 typedef QVector<Layer *> LayerList;
 
@@ -41,6 +42,16 @@ private: // Members -----------------------------------------------------------
 	LayerList	m_layers;
 	int			m_visibleRef;
 
+	// Render cache
+	bool			m_isCacheValid;
+	int				m_numUnchangedFrames;
+	QRect			m_cacheRect;
+	VidgfxTex *		m_cacheTex;
+	VidgfxVertBuf *	m_cacheVertBuf;
+	VidgfxTex *		m_cacheBlackTex; // Pending readback
+	VidgfxTex *		m_cacheWhiteTex; // Pending readback
+	int				m_cacheReadbackDelay; // Frames
+
 private: // Constructor/destructor --------------------------------------------
 	LayerGroup(Profile *profile);
 	~LayerGroup();
@@ -74,9 +85,24 @@ public: // Methods ------------------------------------------------------------
 	void		serialize(QDataStream *stream) const;
 	bool		unserialize(QDataStream *stream);
 
+	void		updateRenderCache(
+		VidgfxContext *gfx, Scene *scene, uint frameNum, int numDropped);
+	bool		renderCache(VidgfxContext *gfx);
+	void		destroyRenderCache(VidgfxContext *gfx);
+
 private:
 	LayerList &	getLayersMutable();
 	Layer *		constructLayer(quint32 typeId);
+	LayerList	getVisibleLayers() const;
+	bool		beginRenderCache(
+		VidgfxContext *gfx, Scene *scene, const LayerList &layers,
+		uint frameNum, int numDropped);
+	bool		finishRenderCache(VidgfxContext *gfx);
+	void		destroyCacheStaging(VidgfxContext *gfx);
+	void		renderLayersToStaging(
+		VidgfxContext *gfx, Scene *scene, const LayerList &layers,
+		VidgfxTex *target, VidgfxTex *staging, const QColor &bgColor,
+		uint frameNum, int numDropped);
 
 	void		initializedEvent();
 	void		showEvent();
@@ -88,6 +114,10 @@ Q_SIGNALS: // Signals ---------------------------------------------------------
 	void		destroyingLayer(Layer *layer);
 	void		layerMoved(Layer *layer, int before, bool isAdd);
 	void		layerChanged(Layer *layer);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void		invalidateRenderCache();
 };
 //=============================================================================
 
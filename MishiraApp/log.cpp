@@ -16,11 +16,17 @@
 //*****************************************************************************
 
 #include "log.h"
+#include "cpuusage.h"
+#include "threadpolicy.h"
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
 #include <QtCore/QRect>
 #include <QtCore/QRectF>
 #include <QtCore/QSize>
 #include <QtCore/QStringList>
+#include <QtCore/QThread>
 #include <iostream>
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -31,6 +37,9 @@ const char *LOG_SINGLE_LINE =
 const char *LOG_DOUBLE_LINE =
 	"=========================================================";
 
+// How often the log thread processes messages
+const int LOG_THREAD_PERIOD_MSEC = 10;
+
 //=============================================================================
 // LogData class
 
@@ -41,6 +50,8 @@ public: // Members ------------------------------------------------------------
 	QString			cat;
 	Log::LogLevel	lvl;
 	QString			msg;
+	qint64			time; // Msec since epoch
+	LogData *		next; // Pending list only
 
 public: // Constructor/destructor ---------------------------------------------
 	LogData()
@@ -48,10 +59,46 @@ public: // Constructor/destructor ---------------------------------------------
 		, cat()
 		, lvl(Log::Notice)
 		, msg()
+		, time(0)
+		, next(NULL)
 	{
 	}
 };
 
+//=============================================================================
+// LogThread class
+
+/// <summary>
+/// Formats and outputs messages in the background so that threads that log
+/// messages, especially the real-time threads, only need to push the message
+/// onto a lock-free list.
+/// </summary>
+class LogThread : public QThread
+{
+public: // Members ------------------------------------------------------------
+	QAtomicInt	m_stop;
+
+public: // Constructor/destructor ---------------------------------------------
+	LogThread()
+		: QThread()
+		, m_stop(0)
+	{
+	}
+
+protected:
+	virtual void run()
+	{
+		ThreadPolicy::applyToCurrentThread(
+			ThrdBackgroundClass, QStringLiteral("Log"));
+		while(!m_stop.load()) {
+			Log::flush();
+			msleep(LOG_THREAD_PERIOD_MSEC);
+		}
+		Log::flush();
+		CPUUsage::unregisterThread();
+	}
+};
+
 //=============================================================================
 // Log class
 
@@ -59,34 +106,161 @@ LogStringCallback *Log::s_stringCallback = NULL;
 bool Log::s_timestampsEnabled = true;
 QVector<QString> Log::s_criticalMsgs;
 
-Log::Log()
-	: d(new LogData())
+// Messages that have been logged but not yet processed, newest first. Any
+// thread can push onto the list without locking.
+static QAtomicPointer<LogData> s_pending;
+
+// Only one thread can process messages at a time. Producers never lock this.
+// The log thread is started and stopped by the main thread but every producer
+// reads the pointer to decide whether to process its own message.
+static QMutex s_processMutex;
+static QAtomicPointer<LogThread> s_thread;
+
+// The timestamp string only changes once per second so we cache it
+static qint64 s_cachedTimeSec = -1;
+static QString s_cachedTime;
+
+/// <summary>
+/// Begins processing messages in a separate thread. Until this is called, and
+/// after `stopThread()` is called, messages are processed immediately by the
+/// thread that logged them.
+/// </summary>
+void Log::startThread()
 {
-	d->ref++;
+	if(s_thread.loadAcquire() != NULL)
+		return; // Already started
+	LogThread *thread = new LogThread();
+	thread->start(QThread::LowPriority);
+	s_thread.storeRelease(thread);
 }
 
-Log::Log(const Log &log)
-	: d(log.d)
+/// <summary>
+/// Stops the log thread after it has processed every pending message.
+/// </summary>
+void Log::stopThread()
 {
-	d->ref++;
+	// New messages are processed immediately once the pointer is cleared
+	LogThread *thread = s_thread.fetchAndStoreOrdered(NULL);
+	if(thread == NULL)
+		return; // Not started
+	thread->m_stop.store(1);
+	thread->wait();
+	delete thread;
+	flush(); // Messages that were logged while we were stopping
 }
 
-Log::~Log()
+/// <summary>
+/// Immediately processes every pending message on the calling thread. The
+/// string callback is called after `s_processMutex` has been released so that
+/// it can safely log messages itself and so that a slow callback doesn't
+/// block other threads that are flushing.
+/// </summary>
+void Log::flush()
 {
-	QString		time;
-	QStringList	msgs;
+	if(s_pending.load() == NULL)
+		return; // Nothing to do
+	s_processMutex.lock();
+
+	// Take the entire pending list and reverse it so it's oldest first
+	LogData *list = s_pending.fetchAndStoreAcquire(NULL);
+	LogData *ordered = NULL;
+	while(list != NULL) {
+		LogData *next = list->next;
+		list->next = ordered;
+		ordered = list;
+		list = next;
+	}
 
-	d->ref--;
-	if(d->ref)
-		return; // Temporary object
+	// Process every message and write all terminal output in one go so we
+	// only flush stdout once per batch
+	QByteArray terminalOut;
+	QVector<QByteArray> lines;
+	while(ordered != NULL) {
+		LogData *next = ordered->next;
+		processRecord(ordered, terminalOut, lines);
+		delete ordered;
+		ordered = next;
+	}
+	if(!terminalOut.isEmpty()) {
+		std::cout.write(terminalOut.constData(), terminalOut.size());
+		std::cout.flush();
+	}
+
+	s_processMutex.unlock();
+
+	// Forward to the callback
+	if(s_stringCallback != NULL) {
+		for(int i = 0; i < lines.size(); i++)
+			s_stringCallback(lines.at(i));
+	}
+}
 
+/// <summary>
+/// Returns a list of all the critical error messages that occured during the
+/// execution of the application in a format that can be used in a message box.
+/// </summary>
+QVector<QString> Log::getCriticalMessages()
+{
+	flush();
+	s_processMutex.lock();
+	QVector<QString> msgs = s_criticalMsgs;
+	s_processMutex.unlock();
+	return msgs;
+}
+
+/// <summary>
+/// Measures how long it takes the calling thread to log the specified number
+/// of messages both when they are processed immediately and when they are
+/// processed by the log thread. The benchmark messages are only written to
+/// the terminal and log file while the results are logged normally.
+/// </summary>
+void Log::runBenchmark(int numMsgs)
+{
+	const bool wasThreaded = (s_thread.loadAcquire() != NULL);
+	QElapsedTimer timer;
+
+	// Synchronous processing
+	stopThread();
+	timer.start();
+	for(int i = 0; i < numMsgs; i++)
+		appLog(QStringLiteral("Bench")) << "Synchronous message " << i;
+	qint64 syncNsec = timer.nsecsElapsed();
+
+	// Asynchronous processing
+	startThread();
+	timer.restart();
+	for(int i = 0; i < numMsgs; i++)
+		appLog(QStringLiteral("Bench")) << "Asynchronous message " << i;
+	qint64 asyncNsec = timer.nsecsElapsed();
+	flush();
+	qint64 asyncTotalNsec = timer.nsecsElapsed();
+	if(!wasThreaded)
+		stopThread();
+
+	appLog(QStringLiteral("Bench")) << QStringLiteral(
+		"Logged %L1 messages: Synchronous = %L2 nsec/msg, "
+		"asynchronous = %L3 nsec/msg (%L4 nsec/msg including processing)")
+		.arg(numMsgs)
+		.arg(syncNsec / numMsgs)
+		.arg(asyncNsec / numMsgs)
+		.arg(asyncTotalNsec / numMsgs);
+}
+
+/// <summary>
+/// Splits, formats and outputs a single message. Terminal output is appended
+/// to `terminalOut` and the lines for the string callback to `linesOut`
+/// instead of being output immediately. Must only be called while
+/// `s_processMutex` is locked.
+/// </summary>
+void Log::processRecord(
+	LogData *d, QByteArray &terminalOut, QVector<QByteArray> &linesOut)
+{
 	// HACK: Prevent Qt's built-in colour dialog from spamming our log.
 	// Hopefully this gets fixed as our code can cause the same error and we
 	// will never know about it.
 	if(d->msg.startsWith(
 		QStringLiteral("QWindowsNativeInterface::nativeResourceForWindow")))
 	{
-		delete d;
 		return;
 	}
 
@@ -97,51 +271,50 @@ Log::~Log()
 	if(d->msg.startsWith(
 		QStringLiteral("QSocketNotifier: Multiple socket notifiers for same socket")))
 	{
-		delete d;
 		return;
 	}
 
+	// Generate the prefix once for every line of the message
+	QString prefix;
+	if(s_timestampsEnabled) {
+		qint64 sec = d->time / 1000LL;
+		if(sec != s_cachedTimeSec) {
+			s_cachedTimeSec = sec;
+			s_cachedTime = QDateTime::fromMSecsSinceEpoch(sec * 1000LL)
+				.toString(Qt::ISODate);
+		}
+		prefix = QChar('[') + s_cachedTime + QChar(']');
+	}
+	if(!d->cat.isEmpty())
+		prefix += QChar('[') + d->cat + QChar(']');
+	switch(d->lvl) {
+	default:
+	case Notice:
+		if(!prefix.isEmpty())
+			prefix += QChar(' ');
+		break;
+	case Warning:
+		prefix += QStringLiteral("[!!] ");
+		break;
+	case Critical:
+		prefix += QStringLiteral("[!!!!!] ");
+		break;
+	}
+
 	// Split up the string so we can remove empty lines and give each line a
 	// timestamp and category
-	msgs = d->msg.split("\n", QString::SkipEmptyParts);
-	time = QDateTime::currentDateTime().toString(Qt::ISODate);
-
+	QStringList msgs = d->msg.split("\n", QString::SkipEmptyParts);
 	for(int i = 0; i < msgs.size(); i++) {
-		QString	line;
-		QString	formattedLine;
-
 		// Clean up line
-		line = msgs.at(i);
+		QString line = msgs.at(i);
 		if(line.trimmed().isEmpty())
 			continue; // Skip empty lines
 		line.replace("\r", "");
 
-		// Generate log entry string
-		QString prefix;
-		if(s_timestampsEnabled)
-			prefix = QStringLiteral("[%1]").arg(time);
-		if(!d->cat.isEmpty())
-			prefix.append(QStringLiteral("[%1]").arg(d->cat));
-		switch(d->lvl) {
-		default:
-		case Notice:
-			if(!prefix.isEmpty())
-				formattedLine = QStringLiteral("%1 %2").arg(prefix).arg(line);
-			else
-				formattedLine = line;
-			break;
-		case Warning:
-			formattedLine = QStringLiteral("%1[!!] %2").arg(prefix).arg(line);
-			break;
-		case Critical:
-			formattedLine =
-				QStringLiteral("%1[!!!!!] %2").arg(prefix).arg(line);
-			break;
-		}
-
 		// Output to the terminal
-		QByteArray output = formattedLine.toLocal8Bit();
-		std::cout << output.constData() << std::endl;
+		QByteArray output = (prefix + line).toLocal8Bit();
+		terminalOut += output;
+		terminalOut += '\n';
 
 		// Visual Studio does not display stdout in the debug console so we
 		// need to use a special Windows API
@@ -154,19 +327,52 @@ Log::~Log()
 		// Remember critical messages so they can be used in an error dialog on
 		// application exit
 		if(d->lvl == Critical) {
-			prefix.clear();
-			if(!d->cat.isEmpty())
-				prefix = QStringLiteral("[%1] ").arg(d->cat);
-			s_criticalMsgs.append(
-				QStringLiteral("%1%2").arg(prefix).arg(line));
+			if(!d->cat.isEmpty()) {
+				s_criticalMsgs.append(
+					QStringLiteral("[%1] %2").arg(d->cat).arg(line));
+			} else
+				s_criticalMsgs.append(line);
 		}
 
-		// Forward to the callback
+		// Forwarded to the callback once the mutex is released
 		if(s_stringCallback != NULL)
-			s_stringCallback(output);
+			linesOut.append(output);
 	}
+}
+
+Log::Log()
+	: d(new LogData())
+{
+	d->ref++;
+}
+
+Log::Log(const Log &log)
+	: d(log.d)
+{
+	d->ref++;
+}
+
+Log::~Log()
+{
+	d->ref--;
+	if(d->ref)
+		return; // Temporary object
 
-	delete d;
+	// Queue the message for processing. This is the only work that is done on
+	// the calling thread when the log thread is running. `d` can be deleted
+	// by another thread the moment it is queued.
+	const bool isCritical = (d->lvl == Critical);
+	d->time = QDateTime::currentMSecsSinceEpoch();
+	LogData *head;
+	do {
+		head = s_pending.load();
+		d->next = head;
+	} while(!s_pending.testAndSetRelease(head, d));
+
+	// Critical messages are processed immediately just in case we are about to
+	// crash
+	if(s_thread.loadAcquire() == NULL || isCritical)
+		flush();
 }
 
 Log operator<<(Log log, const QString &msg)
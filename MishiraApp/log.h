@@ -57,6 +57,15 @@ public: // Static methods -----------------------------------------------------
 	static void	setTimestampsEnabled(bool enabled);
 	static QVector<QString>	getCriticalMessages();
 
+	static void	startThread();
+	static void	stopThread();
+	static void	flush();
+	static void	runBenchmark(int numMsgs);
+
+private:
+	static void	processRecord(
+		LogData *d, QByteArray &terminalOut, QVector<QByteArray> &linesOut);
+
 public: // Constructor/destructor ---------------------------------------------
 	Log();
 	Log(const Log &log);
@@ -92,13 +101,4 @@ inline void Log::setTimestampsEnabled(bool enabled)
 	s_timestampsEnabled = enabled;
 }
 
-/// <summary>
-/// Returns a list of all the critical error messages that occured during the
-/// execution of the application in a format that can be used in a message box.
-/// </summary>
-inline QVector<QString> Log::getCriticalMessages()
-{
-	return s_criticalMsgs;
-}
-
 #endif // LOG_H
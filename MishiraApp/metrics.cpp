@@ -0,0 +1,367 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#include "metrics.h"
+#include "common.h"
+#include <QtNetwork/QTcpServer>
+#include <QtCore/QTimer>
+#include <QtNetwork/QTcpSocket>
+
+const QString LOG_CAT = QStringLiteral("Metrics");
+
+// Histograms that weren't described before they were first used measure
+// durations in microseconds
+static const double DEFAULT_USEC_BOUNDS[] = {
+	100.0, 250.0, 500.0, 1000.0, 2500.0, 5000.0, 10000.0, 16667.0, 33333.0,
+	50000.0, 100000.0, 250000.0 };
+
+// Clients that haven't sent a request or received our response within this
+// time are disconnected so that idle connections cannot accumulate
+static const int CLIENT_TIMEOUT_MSEC = 5000;
+
+static const char * const MetricTypeStrings[] = {
+	"counter",
+	"gauge",
+	"histogram"
+};
+
+MetricsRegistry::MetricsRegistry()
+	: QObject()
+	, m_families()
+	, m_metrics()
+	, m_server(NULL)
+{
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+	delete m_server;
+	m_server = NULL;
+}
+
+/// <summary>
+/// Begins serving metrics over HTTP on the loopback interface.
+/// </summary>
+/// <returns>True if the server was successfully started</returns>
+bool MetricsRegistry::listen(quint16 port)
+{
+	if(m_server == NULL) {
+		m_server = new QTcpServer(this);
+		connect(m_server, &QTcpServer::newConnection,
+			this, &MetricsRegistry::newConnection);
+	}
+	if(m_server->isListening())
+		m_server->close();
+	if(!m_server->listen(QHostAddress::LocalHost, port)) {
+		appLog(LOG_CAT, Log::Warning)
+			<< "Failed to listen for metrics requests on port " << port
+			<< ": " << m_server->errorString();
+		return false;
+	}
+	appLog(LOG_CAT) << QStringLiteral(
+		"Serving metrics at http://localhost:%1/metrics").arg(port);
+	return true;
+}
+
+/// <summary>
+/// Sets the type and description of a metric family. Histograms should
+/// always be described before they are first used as this also defines the
+/// upper bounds of their buckets.
+/// </summary>
+void MetricsRegistry::describe(
+	const QString &family, MetricType type, const QString &help,
+	const QVector<double> &bounds)
+{
+	Family fam;
+	fam.type = type;
+	fam.help = help;
+	fam.bounds = bounds;
+	m_families[family] = fam;
+}
+
+void MetricsRegistry::addToCounter(const QString &name, double amount)
+{
+	getMetric(name, Counter).value += amount;
+}
+
+void MetricsRegistry::setGauge(const QString &name, double value)
+{
+	getMetric(name, Gauge).value = value;
+}
+
+/// <summary>
+/// Adds a single sample to a histogram.
+/// </summary>
+void MetricsRegistry::observe(const QString &name, double value)
+{
+	Metric &metric = getMetric(name, Histogram);
+	const Family &fam = m_families[getFamilyName(name)];
+	metric.value += value;
+	metric.count++;
+	for(int i = 0; i < fam.bounds.size(); i++) {
+		if(value <= fam.bounds.at(i)) {
+			metric.buckets[i]++;
+			break;
+		}
+	}
+}
+
+/// <summary>
+/// Stops exporting a metric. Used for metrics with labels that refer to
+/// objects that no longer exist.
+/// </summary>
+void MetricsRegistry::remove(const QString &name)
+{
+	m_metrics.remove(name);
+}
+
+MetricsRegistry::Metric &MetricsRegistry::getMetric(
+	const QString &name, MetricType type)
+{
+	QMap<QString, Metric>::iterator it = m_metrics.find(name);
+	if(it != m_metrics.end())
+		return it.value();
+
+	// First time that the metric was used, describe its family if it hasn't
+	// been already
+	const QString family = getFamilyName(name);
+	if(!m_families.contains(family)) {
+		QVector<double> bounds;
+		if(type == Histogram) {
+			const int numBounds =
+				sizeof(DEFAULT_USEC_BOUNDS) / sizeof(DEFAULT_USEC_BOUNDS[0]);
+			for(int i = 0; i < numBounds; i++)
+				bounds.append(DEFAULT_USEC_BOUNDS[i]);
+		}
+		describe(family, type, QString(), bounds);
+	}
+
+	Metric metric;
+	metric.value = 0.0;
+	metric.count = 0;
+	metric.buckets.fill(0, m_families[family].bounds.size());
+	return m_metrics.insert(name, metric).value();
+}
+
+/// <summary>
+/// Returns the metric name `name{key="value"}` with the label value escaped so
+/// that it is always valid in the Prometheus text format.
+/// </summary>
+QString MetricsRegistry::withLabel(
+	const QString &name, const QString &key, const QString &value)
+{
+	QString escaped = value;
+	escaped.replace(QChar('\\'), QStringLiteral("\\\\"));
+	escaped.replace(QChar('"'), QStringLiteral("\\\""));
+	escaped.replace(QChar('\n'), QStringLiteral("\\n"));
+	return QStringLiteral("%1{%2=\"%3\"}").arg(name).arg(key).arg(escaped);
+}
+
+QString MetricsRegistry::getFamilyName(const QString &name)
+{
+	int index = name.indexOf(QChar('{'));
+	if(index < 0)
+		return name;
+	return name.left(index);
+}
+
+QString MetricsRegistry::numberToString(double num)
+{
+	return QString::number(num, 'g', 15);
+}
+
+/// <summary>
+/// Generates the Prometheus text exposition format of every metric.
+/// </summary>
+QByteArray MetricsRegistry::toPrometheusText() const
+{
+	QString out;
+	QString prevFamily;
+	QMapIterator<QString, Metric> it(m_metrics);
+	while(it.hasNext()) {
+		it.next();
+		const QString &name = it.key();
+		const Metric &metric = it.value();
+		const QString familyName = getFamilyName(name);
+		const Family &fam = m_families[familyName];
+
+		// Write the header once for each family
+		if(familyName != prevFamily) {
+			if(!fam.help.isEmpty()) {
+				out += QStringLiteral("# HELP %1 %2\n")
+					.arg(familyName).arg(fam.help);
+			}
+			out += QStringLiteral("# TYPE %1 %2\n")
+				.arg(familyName).arg(MetricTypeStrings[fam.type]);
+			prevFamily = familyName;
+		}
+
+		if(fam.type != Histogram) {
+			out += QStringLiteral("%1 %2\n")
+				.arg(name).arg(numberToString(metric.value));
+			continue;
+		}
+
+		// Histograms are written as cumulative buckets. Labels of the metric
+		// are merged with the bucket's "le" label.
+		QString labels = name.mid(familyName.size());
+		if(labels.isEmpty())
+			labels = QStringLiteral("{");
+		else {
+			labels.chop(1); // Remove "}"
+			labels += QChar(',');
+		}
+		quint64 cumulative = 0;
+		for(int i = 0; i < fam.bounds.size(); i++) {
+			cumulative += metric.buckets.at(i);
+			out += QStringLiteral("%1_bucket%2le=\"%3\"} %4\n")
+				.arg(familyName).arg(labels)
+				.arg(numberToString(fam.bounds.at(i)))
+				.arg(cumulative);
+		}
+		out += QStringLiteral("%1_bucket%2le=\"+Inf\"} %3\n")
+			.arg(familyName).arg(labels).arg(metric.count);
+		const QString suffix = name.mid(familyName.size());
+		out += QStringLiteral("%1_sum%2 %3\n")
+			.arg(familyName).arg(suffix).arg(numberToString(metric.value));
+		out += QStringLiteral("%1_count%2 %3\n")
+			.arg(familyName).arg(suffix).arg(metric.count);
+	}
+
+	return out.toUtf8();
+}
+
+/// <summary>
+/// Generates a JSON snapshot of every metric.
+/// </summary>
+QByteArray MetricsRegistry::toJson() const
+{
+	QString out = QStringLiteral("{");
+	bool first = true;
+	QMapIterator<QString, Metric> it(m_metrics);
+	while(it.hasNext()) {
+		it.next();
+		const Metric &metric = it.value();
+		const Family &fam = m_families[getFamilyName(it.key())];
+		QString name = it.key();
+		name.replace(QChar('\\'), QStringLiteral("\\\\"));
+		name.replace(QChar('"'), QStringLiteral("\\\""));
+
+		if(!first)
+			out += QChar(',');
+		first = false;
+		out += QStringLiteral("\n\"%1\":{\"type\":\"%2\",")
+			.arg(name).arg(MetricTypeStrings[fam.type]);
+		if(fam.type != Histogram) {
+			out += QStringLiteral("\"value\":%1}")
+				.arg(numberToString(metric.value));
+			continue;
+		}
+		out += QStringLiteral("\"count\":%1,\"sum\":%2,\"buckets\":[")
+			.arg(metric.count).arg(numberToString(metric.value));
+		for(int i = 0; i < fam.bounds.size(); i++) {
+			if(i > 0)
+				out += QChar(',');
+			out += QStringLiteral("{\"le\":%1,\"count\":%2}")
+				.arg(numberToString(fam.bounds.at(i)))
+				.arg(metric.buckets.at(i));
+		}
+		out += QStringLiteral("]}");
+	}
+	out += QStringLiteral("\n}\n");
+
+	return out.toUtf8();
+}
+
+void MetricsRegistry::newConnection()
+{
+	while(m_server->hasPendingConnections()) {
+		QTcpSocket *socket = m_server->nextPendingConnection();
+		connect(socket, &QTcpSocket::readyRead,
+			this, &MetricsRegistry::socketReadyRead);
+		connect(socket, &QTcpSocket::disconnected,
+			socket, &QObject::deleteLater);
+
+		// The timer is a child of the socket so it is deleted with it
+		QTimer *timer = new QTimer(socket);
+		timer->setSingleShot(true);
+		connect(timer, &QTimer::timeout,
+			this, &MetricsRegistry::socketTimeout);
+		timer->start(CLIENT_TIMEOUT_MSEC);
+	}
+}
+
+/// <summary>
+/// Called when a client has been connected for too long.
+/// </summary>
+void MetricsRegistry::socketTimeout()
+{
+	QTimer *timer = qobject_cast<QTimer *>(sender());
+	if(timer == NULL)
+		return;
+	QTcpSocket *socket = qobject_cast<QTcpSocket *>(timer->parent());
+	if(socket == NULL)
+		return;
+	socket->abort();
+	socket->deleteLater();
+}
+
+/// <summary>
+/// Responds to a HTTP request. We only care about the request line and
+/// immediately close the connection after responding.
+/// </summary>
+void MetricsRegistry::socketReadyRead()
+{
+	QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+	if(socket == NULL || !socket->canReadLine())
+		return; // Wait for the entire request line
+	disconnect(socket, &QTcpSocket::readyRead,
+		this, &MetricsRegistry::socketReadyRead);
+
+	// Request line is in the format "GET /path HTTP/1.1"
+	QList<QByteArray> parts = socket->readLine().trimmed().split(' ');
+	QByteArray path = (parts.size() >= 2) ? parts.at(1) : QByteArray();
+	int queryIndex = path.indexOf('?');
+	if(queryIndex >= 0)
+		path.truncate(queryIndex);
+
+	QByteArray status = "200 OK";
+	QByteArray type;
+	QByteArray body;
+	if(parts.at(0) != "GET") {
+		status = "405 Method Not Allowed";
+		type = "text/plain";
+	} else if(path == "/metrics") {
+		type = "text/plain; version=0.0.4";
+		body = toPrometheusText();
+	} else if(path == "/metrics.json") {
+		type = "application/json";
+		body = toJson();
+	} else {
+		status = "404 Not Found";
+		type = "text/plain";
+	}
+
+	QByteArray response = "HTTP/1.0 " + status + "\r\n";
+	response += "Content-Type: " + type + "\r\n";
+	response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+	response += "Connection: close\r\n\r\n";
+	response += body;
+	socket->write(response);
+	socket->disconnectFromHost();
+}
@@ -0,0 +1,105 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QObject>
+#include <QtCore/QVector>
+
+class QTcpServer;
+
+//=============================================================================
+/// <summary>
+/// A central registry of performance counters that every subsystem reports
+/// into so that they can be scraped by external monitoring tools. If enabled
+/// in the application settings metrics are exposed over HTTP on the local
+/// machine in the Prometheus text format at "/metrics" and as a JSON snapshot
+/// at "/metrics.json".
+///
+/// Metric names follow the Prometheus conventions and can include labels
+/// (E.g. `mishira_target_bytes_out_total{target="Twitch"}`). Metrics are
+/// created the first time that they are reported and the registry is only
+/// accessed from the main thread.
+/// </summary>
+class MetricsRegistry : public QObject
+{
+	Q_OBJECT
+
+public: // Datatypes ----------------------------------------------------------
+	enum MetricType {
+		Counter = 0,
+		Gauge,
+		Histogram
+	};
+
+private:
+	struct Family {
+		MetricType		type;
+		QString			help;
+		QVector<double>	bounds; // Histograms only
+	};
+	struct Metric {
+		double			value; // Counter or gauge value, histogram sum
+		quint64			count; // Histograms only
+		QVector<quint64>	buckets; // Histograms only, not cumulative
+	};
+
+private: // Members -----------------------------------------------------------
+	QHash<QString, Family>	m_families;
+	QMap<QString, Metric>	m_metrics; // Sorted so families are grouped
+	QTcpServer *			m_server;
+
+public: // Constructor/destructor ---------------------------------------------
+	MetricsRegistry();
+	~MetricsRegistry();
+
+public: // Static methods -----------------------------------------------------
+	static QString	withLabel(
+		const QString &name, const QString &key, const QString &value);
+
+public: // Methods ------------------------------------------------------------
+	bool		listen(quint16 port);
+
+	void		describe(
+		const QString &family, MetricType type, const QString &help,
+		const QVector<double> &bounds = QVector<double>());
+	void		addToCounter(const QString &name, double amount = 1.0);
+	void		setGauge(const QString &name, double value);
+	void		observe(const QString &name, double value);
+	void		remove(const QString &name);
+
+	QByteArray	toPrometheusText() const;
+	QByteArray	toJson() const;
+
+private:
+	Metric &	getMetric(const QString &name, MetricType type);
+	static QString	getFamilyName(const QString &name);
+	static QString	numberToString(double num);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void		newConnection();
+	void		socketReadyRead();
+	void		socketTimeout();
+};
+//=============================================================================
+
+#endif // METRICS_H
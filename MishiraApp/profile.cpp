@@ -20,14 +20,19 @@
 #include "audiomixer.h"
 #include "application.h"
 #include "appsettings.h"
+#include "asyncio.h"
 #include "fdkaacencoder.h"
+#include "imagecache.h"
 #include "layergroup.h"
 #include "logfilemanager.h"
+#include "metrics.h"
 #include "scene.h"
 #include "sceneitem.h"
+#include "tracer.h"
 #include "x264encoder.h"
 #include "Targets/file/filetarget.h"
 #include "Targets/hitbox/hitboxtarget.h"
+#include "Targets/replay/replaytarget.h"
 #include "Targets/rtmp/rtmptarget.h"
 #include "Targets/twitch/twitchtarget.h"
 #include "Targets/ustream/ustreamtarget.h"
@@ -35,6 +40,7 @@
 #include <QtCore/QBuffer>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
+#include <QtCore/QSet>
 
 const QSize DEFAULT_CANVAS_SIZE = QSize(1280, 720); // Never NULL
 
@@ -43,6 +49,17 @@ const QString LOG_CAT_AUD = QStringLiteral("Audio");
 const QString LOG_CAT_TRGT = QStringLiteral("Target");
 const QString LOG_CAT_SCNE = QStringLiteral("Scene");
 
+// The maximum amount of time to spend loading layers of inactive scenes in
+// the background each frame. At least one layer is always loaded.
+const quint64 DEFERRED_LOAD_BUDGET_USEC = 4000;
+
+// Names of the metrics that are reported every frame. They are created once so
+// that reporting them doesn't construct new strings.
+const QString FRAMES_RENDERED_METRIC =
+	QStringLiteral("mishira_canvas_frames_rendered_total");
+const QString FRAMES_REPEATED_METRIC =
+	QStringLiteral("mishira_canvas_frames_repeated_total");
+
 //=============================================================================
 // Serialization helpers
 
@@ -96,6 +113,151 @@ static PrflTransition int32ToTransition(quint32 trans)
 	return PrflInstantTransition; // Should never be reached
 }
 
+static void setupProfileStream(QDataStream *stream)
+{
+	stream->setByteOrder(QDataStream::LittleEndian);
+	stream->setFloatingPointPrecision(QDataStream::SinglePrecision);
+	stream->setVersion(12);
+}
+
+/// <summary>
+/// Serializes a single object of the profile into its own buffer so that it
+/// can be written to the profile file later by appending it as-is.
+/// </summary>
+template<typename T>
+static QByteArray serializeToBuffer(T *obj)
+{
+	QByteArray data;
+	QBuffer buffer(&data);
+	if(!buffer.open(QIODevice::WriteOnly))
+		return data; // Should never happen
+	QDataStream stream(&buffer);
+	setupProfileStream(&stream);
+	obj->serialize(&stream);
+	buffer.close();
+	return data;
+}
+
+//=============================================================================
+// ProfileSnapshot class
+
+/// <summary>
+/// A copy of everything that is saved in a profile file that only consists of
+/// plain values so that it can be serialized in the IO thread while the
+/// profile continues to be modified in the main thread. Every scene, layer
+/// group, encoder and target is stored as the data that its own `serialize()`
+/// method outputs.
+/// </summary>
+class ProfileSnapshot : public AsyncSnapshot
+{
+public: // Members ------------------------------------------------------------
+	QSize				canvasSize;
+	quint32				audioMode;
+	QVector<quint32>	groupIds;
+	QVector<QByteArray>	groups;
+	QVector<QByteArray>	scenes;
+	qint32				activeScene;
+	QVector<quint32>	transitions;
+	QVector<quint32>	transitionDursMsec;
+	quint32				activeTransition;
+	Fraction			videoFramerate;
+	QByteArray			mixer;
+	QVector<quint32>	videoEncoderIds;
+	QVector<quint32>	videoEncoderTypes;
+	QVector<QByteArray>	videoEncoders;
+	QVector<quint32>	audioEncoderIds;
+	QVector<quint32>	audioEncoderTypes;
+	QVector<QByteArray>	audioEncoders;
+	QVector<quint32>	targetTypes;
+	QVector<QByteArray>	targets;
+
+public: // Methods ------------------------------------------------------------
+	void			write(QDataStream *stream) const;
+	virtual bool	serialize(QByteArray *dataOut) const;
+
+private:
+	static void		writeBuffer(QDataStream *stream, const QByteArray &data);
+};
+
+void ProfileSnapshot::writeBuffer(
+	QDataStream *stream, const QByteArray &data)
+{
+	stream->writeRawData(data.constData(), data.size());
+}
+
+void ProfileSnapshot::write(QDataStream *stream) const
+{
+	// Write header and file version
+	*stream << (quint32)0x6AF64620;
+	*stream << (quint32)2;
+
+	// Write top-level data
+	*stream << canvasSize;
+	*stream << audioMode;
+
+	// Write the layer groups
+	*stream << (quint32)groups.count();
+	for(int i = 0; i < groups.count(); i++) {
+		*stream << groupIds.at(i);
+		writeBuffer(stream, groups.at(i));
+	}
+
+	// Write scenes
+	*stream << (quint32)scenes.count();
+	for(int i = 0; i < scenes.count(); i++)
+		writeBuffer(stream, scenes.at(i));
+	*stream << activeScene;
+
+	// Write scene transitions
+	for(int i = 0; i < transitions.count(); i++)
+		*stream << transitions.at(i);
+	for(int i = 0; i < transitionDursMsec.count(); i++)
+		*stream << transitionDursMsec.at(i);
+	*stream << activeTransition;
+
+	// Write the video framerate
+	*stream << (quint32)videoFramerate.numerator;
+	*stream << (quint32)videoFramerate.denominator;
+
+	// Write the audio mixer
+	writeBuffer(stream, mixer);
+
+	// Write video encoders
+	*stream << (quint32)videoEncoders.count();
+	for(int i = 0; i < videoEncoders.count(); i++) {
+		*stream << videoEncoderIds.at(i);
+		*stream << videoEncoderTypes.at(i);
+		writeBuffer(stream, videoEncoders.at(i));
+	}
+
+	// Write audio encoders
+	*stream << (quint32)audioEncoders.count();
+	for(int i = 0; i < audioEncoders.count(); i++) {
+		*stream << audioEncoderIds.at(i);
+		*stream << audioEncoderTypes.at(i);
+		writeBuffer(stream, audioEncoders.at(i));
+	}
+
+	// Write targets
+	*stream << (quint32)targets.count();
+	for(int i = 0; i < targets.count(); i++) {
+		*stream << targetTypes.at(i);
+		writeBuffer(stream, targets.at(i));
+	}
+}
+
+bool ProfileSnapshot::serialize(QByteArray *dataOut) const
+{
+	QBuffer buffer(dataOut);
+	if(!buffer.open(QIODevice::WriteOnly))
+		return false; // Should never happen
+	QDataStream stream(&buffer);
+	setupProfileStream(&stream);
+	write(&stream);
+	buffer.close();
+	return stream.status() == QDataStream::Ok;
+}
+
 //=============================================================================
 // Profile class
 
@@ -173,6 +335,26 @@ Profile::Profile(const QString &filename, QObject *parent)
 	, m_activeTransition(0)
 	//, m_transitions() // Set below
 	//, m_transitionDursMsec() // Set below
+
+	// Static frame detection
+	, m_isCanvasDirty(true)
+	, m_renderedScene(NULL)
+	, m_isFrameRepeated(false)
+	, m_numFramesRendered(0)
+	, m_numFramesRepeated(0)
+
+	// Saving
+	, m_saveOperation(0)
+	, m_saveSnapshotUsec(0)
+	, m_groupSaveCache()
+
+	// Staged loading
+	, m_isUnserializing(false)
+	, m_hasDeferredLayers(false)
+	, m_deferredLayers()
+	, m_numDeferredLoaded(0)
+	, m_loadBeginUsec(App->getUsecSinceExec())
+	, m_firstFrameUsec(0)
 {
 	// WARNING: This constructor can be called before a graphics context exists
 	// or even before the context is fully initialized.
@@ -190,6 +372,10 @@ Profile::Profile(const QString &filename, QObject *parent)
 
 	loadFromDisk();
 
+	// Periodic saves are written to disk in the background
+	connect(App->getAsyncIO(), &AsyncIO::saveToFileComplete,
+		this, &Profile::saveToFileComplete);
+
 	// We want to be notified when the application wants a frame rendered
 	connect(App, &Application::queuedFrameEvent,
 		this, &Profile::queuedFrameEvent);
@@ -368,12 +554,15 @@ void Profile::loadFromDisk()
 	}
 	m_fileExists = true;
 
+	// Only the layers of the active scene are loaded while unserializing,
+	// everything else is loaded in the background after the first frame has
+	// been rendered
 	file.open(QIODevice::ReadOnly);
 	QDataStream stream(&file);
-	stream.setByteOrder(QDataStream::LittleEndian);
-	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
-	stream.setVersion(12);
+	setupProfileStream(&stream);
+	m_isUnserializing = true;
 	bool res = unserialize(&stream);
+	m_isUnserializing = false;
 	if(stream.status() != QDataStream::Ok) {
 		appLog(Log::Warning)
 			<< "An error occurred while reading the profile settings file";
@@ -400,11 +589,87 @@ void Profile::loadFromDisk()
 		loadDefaults();
 	}
 	ensureActiveScene();
+	queueDeferredLayers();
 
+	appLog() << QStringLiteral("Profile loaded in %L1 msec")
+		.arg((App->getUsecSinceExec() - m_loadBeginUsec) / 1000ULL);
 	appLog()
 		<< LOG_SINGLE_LINE << "\n Profile load end\n" << LOG_SINGLE_LINE;
 }
 
+/// <summary>
+/// Queues every visible layer that wasn't loaded while the profile was being
+/// unserialized so that they can be loaded in the background. The user most
+/// often switches to a scene that is next to the active one so scenes are
+/// queued in order of their distance from it, preferring the scene to the
+/// right of it. Layer groups can be in multiple scenes so their layers are
+/// only queued once.
+/// </summary>
+void Profile::queueDeferredLayers()
+{
+	m_deferredLayers.clear();
+	m_hasDeferredLayers = true;
+
+	QSet<LayerGroup *> queuedGroups;
+	int numScenes = m_scenes.size();
+	int activeIndex = qMax(0, indexOfScene(m_activeScene));
+	for(int i = 0; i < numScenes * 2; i++) {
+		// 0, +1, -1, +2, -2, ...
+		int index = activeIndex + (i + 1) / 2 * ((i % 2) ? 1 : -1);
+		if(index < 0 || index >= numScenes)
+			continue;
+		SceneItemList groups = m_scenes.at(index)->getGroupSceneItems();
+		for(int j = 0; j < groups.count(); j++) {
+			LayerGroup *group = groups.at(j)->getGroup();
+			if(queuedGroups.contains(group))
+				continue;
+			queuedGroups.insert(group);
+			LayerList layers = group->getLayers();
+			for(int k = 0; k < layers.count(); k++) {
+				Layer *layer = layers.at(k);
+				if(layer->isVisible() && !layer->isLoaded())
+					m_deferredLayers.append(layer);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Loads the visible layers of inactive scenes that were skipped when the
+/// profile was loaded so that switching scenes remains instant. Only a few
+/// layers are loaded each frame so that we never stall the main loop. If the
+/// user switches to a scene before it was loaded in the background then it is
+/// loaded immediately instead.
+/// </summary>
+void Profile::loadDeferredLayers()
+{
+	if(!m_hasDeferredLayers)
+		return; // Everything has already been loaded
+
+	quint64 startTime = App->getUsecSinceExec();
+	for(;;) {
+		if(m_deferredLayers.isEmpty()) {
+			m_hasDeferredLayers = false;
+			appLog() << QStringLiteral(
+				"Finished loading %L1 layers in the background %L2 msec "
+				"after the profile began loading")
+				.arg(m_numDeferredLoaded)
+				.arg((App->getUsecSinceExec() - m_loadBeginUsec) / 1000ULL);
+			return;
+		}
+
+		// The layer may have been deleted, hidden or loaded by the user since
+		// it was queued
+		Layer *layer = m_deferredLayers.takeFirst();
+		if(layer == NULL || !layer->isVisible() || layer->isLoaded())
+			continue;
+		layer->setLoaded(true);
+		m_numDeferredLoaded++;
+		if(App->getUsecSinceExec() - startTime >= DEFERRED_LOAD_BUDGET_USEC)
+			return; // Continue next frame
+	}
+}
+
 void Profile::unserializeErrorTimeout()
 {
 	QString newPath = CORRUPTED_FILENAME(m_filename);
@@ -424,14 +689,34 @@ void Profile::unserializeErrorTimeout()
 }
 
 /// <summary>
-/// Saves the current profile to disk.
+/// Saves the current profile to disk. If `async` is true then only a snapshot
+/// of the profile is taken on the main thread and both serializing it and the
+/// potentially slow write to the disk are done in the IO thread instead so
+/// that they don't stall the main loop. The existing file is atomically
+/// replaced in both cases so a crash during the save never corrupts it.
 /// </summary>
 /// <returns>True if the profile was successfully saved</returns>
-bool Profile::saveToDisk()
+bool Profile::saveToDisk(bool async)
 {
 	// WARNING: This object can be deleted immediately after this method is
-	// executed so if this method is implemented using asynchronous IO then it
-	// needs to be able to complete the save without referencing this object
+	// executed so the asynchronous write must be able to complete without
+	// referencing this object
+
+	AsyncIO *asyncIo = App->getAsyncIO();
+	if(async) {
+		// Layer groups contain the majority of the profile and rarely change
+		// between periodic saves so we reuse their previous data if they
+		// haven't changed
+		quint64 startTime = App->getUsecSinceExec();
+		ProfileSnapshot *snapshot = new ProfileSnapshot();
+		takeSnapshot(snapshot, &m_groupSaveCache);
+		m_fileExists = true; // File is about to be created
+		m_saveOperation = asyncIo->newOperationId();
+		m_saveSnapshotUsec = App->getUsecSinceExec() - startTime;
+		asyncIo->saveSnapshotToFile(
+			m_saveOperation, snapshot, m_filename, true);
+		return true; // Continued in `saveToFileComplete()`
+	}
 
 	// Serialize to a temporary buffer just in case this causes the program to
 	// crash. If we don't do this then there is a chance that the existing file
@@ -441,9 +726,7 @@ bool Profile::saveToDisk()
 	if(!buffer.open(QIODevice::WriteOnly))
 		return false; // Should never happen
 	QDataStream stream(&buffer);
-	stream.setByteOrder(QDataStream::LittleEndian);
-	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
-	stream.setVersion(12);
+	setupProfileStream(&stream);
 	serialize(&stream);
 	if(stream.status() != QDataStream::Ok) {
 		appLog(Log::Warning)
@@ -452,22 +735,65 @@ bool Profile::saveToDisk()
 	}
 	buffer.close();
 
-	QFile file(m_filename); // TODO: QSaveFile in Qt 5.1
-	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+	// Make sure that an earlier asynchronous save cannot replace our file with
+	// older data after we have written it
+	asyncIo->waitForPending();
+
+	QString error;
+	if(!writeFileAtomically(m_filename, data, &error)) {
 		appLog(Log::Warning)
-			<< "Failed to open profile settings file for saving";
+			<< "Failed to save profile settings file: " << error;
 		return false;
 	}
 	m_fileExists = true; // File has been created
-	if(file.write(data) != data.size()) {
-		appLog(Log::Warning)
-			<< "Failed to write all profile settings data to the filesystem";
-	}
-	file.close();
 
 	return true;
 }
 
+void Profile::saveToFileComplete(int id, int errorCode, int msecTaken)
+{
+	if(id != m_saveOperation)
+		return; // Not our operation
+	m_saveOperation = 0;
+	if(errorCode != 0)
+		return; // Error already logged
+
+	appLog() << QStringLiteral(
+		"Saved profile settings (Snapshot = %L1 usec, write = %L2 msec)")
+		.arg(m_saveSnapshotUsec)
+		.arg(msecTaken);
+}
+
+/// <summary>
+/// Watches the layer group for changes so that its cached save data can be
+/// discarded when it is modified.
+/// </summary>
+void Profile::connectGroupForSave(LayerGroup *group)
+{
+	connect(group, &LayerGroup::groupChanged,
+		this, &Profile::groupModified);
+	connect(group, &LayerGroup::layerAdded,
+		this, &Profile::groupModified);
+	connect(group, &LayerGroup::destroyingLayer,
+		this, &Profile::groupModified);
+	connect(group, &LayerGroup::layerMoved,
+		this, &Profile::groupModified);
+	connect(group, &LayerGroup::layerChanged,
+		this, &Profile::groupModified);
+}
+
+/// <summary>
+/// Called whenever a layer group or any of its layers are modified so that
+/// the group is serialized again during the next periodic save.
+/// </summary>
+void Profile::groupModified()
+{
+	LayerGroup *group = qobject_cast<LayerGroup *>(sender());
+	if(group == NULL)
+		return;
+	m_groupSaveCache.remove(group);
+}
+
 /// <summary>
 /// Get the name of the profile from the filename.
 /// </summary>
@@ -485,6 +811,7 @@ QString Profile::getName() const
 bool Profile::setName(const QString &name)
 {
 	QString newPath = getProfileFilePath(name);
+	App->getAsyncIO()->waitForPending(); // Don't race with a background save
 	if(doesFileExist()) {
 		// File already exists, rename it
 		if(QFile::exists(newPath)) {
@@ -892,6 +1219,7 @@ LayerGroup *Profile::createLayerGroup(const QString &name)
 	if(!name.isEmpty())
 		group->setName(name);
 	m_layerGroups[id] = group;
+	connectGroupForSave(group);
 
 	appLog(LOG_CAT_SCNE) << "Created layer group " << id;
 	group->setInitialized();
@@ -924,6 +1252,7 @@ LayerGroup *Profile::createLayerGroupSerialized(
 		return NULL;
 	}
 	m_layerGroups[id] = group;
+	connectGroupForSave(group);
 
 	appLog(LOG_CAT_SCNE)
 		<< "Created layer group " << id << " from serialized data";
@@ -935,6 +1264,7 @@ void Profile::destroyLayerGroup(LayerGroup *group)
 {
 	if(group == NULL)
 		return;
+	m_groupSaveCache.remove(group);
 	delete group;
 	quint32 id = m_layerGroups.key(group);
 	if(id == 0)
@@ -1101,8 +1431,10 @@ Scene *Profile::createSceneSerialized(QDataStream *stream, int before)
 		.arg(scene->getIdString());
 	scene->setInitialized();
 
+	// When unserializing the whole profile we activate the correct scene once
+	// they have all been created so that we don't load any other scene
 	emit sceneAdded(scene, before);
-	if(m_activeScene == NULL)
+	if(m_activeScene == NULL && !m_isUnserializing)
 		setActiveScene(scene);
 	return scene;
 }
@@ -1128,6 +1460,10 @@ void Profile::destroyScene(Scene *scene)
 			setActiveScene(NULL);
 		m_prevScene = NULL; // Never reference a destroyed scene
 	}
+	if(m_renderedScene == scene) {
+		m_renderedScene = NULL; // Never reference a destroyed scene
+		m_isCanvasDirty = true;
+	}
 	m_scenes.remove(id);
 	delete scene;
 	appLog(LOG_CAT_SCNE) << "Deleted scene " << idString;
@@ -1266,6 +1602,26 @@ Target *Profile::createHitboxTarget(
 	return target;
 }
 
+Target *Profile::createReplayTarget(
+	const QString &name, const ReplayTrgtOptions &opt, int before)
+{
+	if(before < 0) {
+		// Position is relative to the right
+		before += m_targets.count() + 1;
+	}
+	before = qBound(0, before, m_targets.count());
+
+	ReplayTarget *target = new ReplayTarget(this, name, opt);
+	connect(target, &Target::activeChanged,
+		this, &Profile::targetActiveChanged);
+	m_targets.insert(before, target);
+	appLog(LOG_CAT_TRGT) << "Created replay target " << target->getIdString();
+	target->setInitialized();
+
+	emit targetAdded(target, before);
+	return target;
+}
+
 Target *Profile::createTargetSerialized(
 	TrgtType type, QDataStream *stream, int before)
 {
@@ -1286,6 +1642,9 @@ Target *Profile::createTargetSerialized(
 		opt.audioEncId = 0;
 		opt.filename = QStringLiteral("Dummy.mp4");
 		opt.fileType = FileTrgtMp4Type;
+		opt.fragDuration = DEFAULT_FILE_TARGET_FRAG_DURATION;
+		opt.splitDuration = 0;
+		opt.splitSize = 0;
 		target = new FileTarget(this, QStringLiteral("Dummy"), opt);
 		break; }
 	case TrgtRtmpType: {
@@ -1325,6 +1684,15 @@ Target *Profile::createTargetSerialized(
 		opt.username = QString();
 		target = new HitboxTarget(this, QStringLiteral("Dummy"), opt);
 		break; }
+	case TrgtReplayType: {
+		ReplayTrgtOptions opt;
+		opt.videoEncId = 0;
+		opt.audioEncId = 0;
+		opt.filename = QStringLiteral("Dummy.mp4");
+		opt.bufferDuration = DEFAULT_REPLAY_TARGET_DURATION;
+		opt.maxMemory = DEFAULT_REPLAY_TARGET_MAX_MEMORY;
+		target = new ReplayTarget(this, QStringLiteral("Dummy"), opt);
+		break; }
 	}
 	if(target == NULL)
 		return NULL;
@@ -1415,6 +1783,16 @@ void Profile::setupContext(VidgfxContext *gfx)
 		vidgfx_create_tex_decal_rect(
 			m_fadeVertBuf, QRectF(QPointF(0.0f, 0.0f), m_canvasSize));
 	}
+
+	// The canvas targets have been recreated and are undefined
+	m_isCanvasDirty = true;
+
+	// Cached layer groups are clipped to the canvas
+	QHashIterator<quint32, LayerGroup *> it(m_layerGroups);
+	while(it.hasNext()) {
+		it.next();
+		it.value()->destroyRenderCache(gfx);
+	}
 }
 
 void Profile::setCanvasSize(const QSize &size)
@@ -1444,12 +1822,78 @@ void Profile::setAudioMode(PrflAudioMode mode)
 	emit audioModeChanged(m_audioMode);
 }
 
+/// <summary>
+/// Resets the counters that are used to calculate the fraction of frames that
+/// were repeated instead of being rendered.
+/// </summary>
+void Profile::resetRepeatedFrameStats()
+{
+	m_numFramesRendered = 0;
+	m_numFramesRepeated = 0;
+}
+
+/// <summary>
+/// Returns the fraction of frames since the statistics were last reset that
+/// were identical to the previous frame and were therefore not rendered.
+/// </summary>
+float Profile::getRepeatedFrameFraction() const
+{
+	quint64 total = m_numFramesRendered + m_numFramesRepeated;
+	if(total == 0)
+		return 0.0f;
+	return (float)((double)m_numFramesRepeated / (double)total);
+}
+
+/// <summary>
+/// Returns true if the canvas target already contains exactly what would be
+/// rendered to it if we were to render the next frame.
+/// </summary>
+bool Profile::isCanvasStatic() const
+{
+	if(m_isCanvasDirty)
+		return false;
+	if(!m_transitionAni.atEnd())
+		return false; // Transitions animate every frame
+	if(m_renderedScene != m_activeScene)
+		return false;
+	if(m_activeScene != NULL && m_activeScene->isOutputDirty())
+		return false;
+	return true;
+}
+
 void Profile::render(VidgfxContext *gfx, uint frameNum, int numDropped)
 {
+	TraceZone zone("Profile::render");
 	if(!vidgfx_context_is_valid(gfx))
 		return; // Context must exist and be usuable
 
 	VidgfxRendTarget target = GfxCanvas1Target;
+
+	// If nothing has changed since the previous frame then the canvas target
+	// still contains the correct image. Don't waste any time rendering it
+	// again and let everything downstream know that it's a repeat.
+	m_isFrameRepeated = isCanvasStatic();
+	if(m_isFrameRepeated) {
+		m_numFramesRepeated++;
+		App->getMetrics()->addToCounter(FRAMES_REPEATED_METRIC);
+		VidgfxTex *targetTex = vidgfx_context_get_target_tex(gfx, target);
+		emit frameRendered(targetTex, frameNum, numDropped);
+		return;
+	}
+	m_numFramesRendered++;
+	App->getMetrics()->addToCounter(FRAMES_RENDERED_METRIC);
+	m_renderedScene = m_activeScene;
+
+	// The frame after a transition frame is always different
+	m_isCanvasDirty = !m_transitionAni.atEnd();
+
+	// Layer groups that have been flattened into a single texture need to
+	// update their cache before we begin rendering to the canvas
+	if(m_activeScene != NULL)
+		m_activeScene->updateGroupCaches(gfx, frameNum, numDropped);
+	if(!m_transitionAni.atEnd() && m_prevScene != NULL)
+		m_prevScene->updateGroupCaches(gfx, frameNum, numDropped);
+
 	if(m_transitionAni.atEnd()) {
 		// No transition animation is currently active, just render a single
 		// scene as efficiently as possible
@@ -1538,74 +1982,83 @@ void Profile::render(VidgfxContext *gfx, uint frameNum, int numDropped)
 
 void Profile::serialize(QDataStream *stream) const
 {
-	// Write header and file version
-	*stream << (quint32)0x6AF64620;
-	*stream << (quint32)2;
+	ProfileSnapshot snapshot;
+	takeSnapshot(&snapshot);
+	snapshot.write(stream);
+}
 
-	// Write top-level data
-	*stream << m_canvasSize;
-	*stream << audioModeToInt32(m_audioMode);
+/// <summary>
+/// Copies everything that needs to be saved into the snapshot. If
+/// `groupCache` is not NULL then layer groups that are in the cache are not
+/// serialized again and the cache is updated with the groups that were.
+/// </summary>
+void Profile::takeSnapshot(
+	ProfileSnapshot *snapshotOut,
+	QHash<LayerGroup *, QByteArray> *groupCache) const
+{
+	// Top-level data
+	snapshotOut->canvasSize = m_canvasSize;
+	snapshotOut->audioMode = audioModeToInt32(m_audioMode);
 
-	// Write the layer groups
+	// Layer groups
 	QHashIterator<quint32, LayerGroup *> itA(m_layerGroups);
-	*stream << (quint32)m_layerGroups.count();
 	while(itA.hasNext()) {
 		itA.next();
-		*stream << itA.key();
-		itA.value()->serialize(stream);
-	}
-
-	// Write scenes
-	*stream << (quint32)m_scenes.count();
-	for(int i = 0; i < m_scenes.count(); i++) {
-		Scene *scene = m_scenes.at(i);
-		scene->serialize(stream);
+		LayerGroup *group = itA.value();
+		QByteArray data;
+		if(groupCache != NULL && groupCache->contains(group))
+			data = groupCache->value(group);
+		else {
+			data = serializeToBuffer(group);
+			if(groupCache != NULL)
+				groupCache->insert(group, data);
+		}
+		snapshotOut->groupIds.append(itA.key());
+		snapshotOut->groups.append(data);
 	}
-	*stream << (qint32)indexOfScene(m_activeScene);
 
-	// Write scene transitions
-	Q_ASSERT(NumTransitionSettings == 3);
-	*stream << transitionToInt32(m_transitions[0]);
-	*stream << transitionToInt32(m_transitions[1]);
-	*stream << transitionToInt32(m_transitions[2]);
-	*stream << (quint32)m_transitionDursMsec[0];
-	*stream << (quint32)m_transitionDursMsec[1];
-	*stream << (quint32)m_transitionDursMsec[2];
-	*stream << (quint32)m_activeTransition;
+	// Scenes
+	for(int i = 0; i < m_scenes.count(); i++)
+		snapshotOut->scenes.append(serializeToBuffer(m_scenes.at(i)));
+	snapshotOut->activeScene = (qint32)indexOfScene(m_activeScene);
 
-	// Write the video framerate
-	*stream << (quint32)m_videoFramerate.numerator;
-	*stream << (quint32)m_videoFramerate.denominator;
+	// Scene transitions
+	for(int i = 0; i < NumTransitionSettings; i++) {
+		snapshotOut->transitions.append(transitionToInt32(m_transitions[i]));
+		snapshotOut->transitionDursMsec.append(
+			(quint32)m_transitionDursMsec[i]);
+	}
+	snapshotOut->activeTransition = (quint32)m_activeTransition;
 
-	// Write the audio mixer
-	m_mixer->serialize(stream);
+	// Video framerate and audio mixer
+	snapshotOut->videoFramerate = m_videoFramerate;
+	snapshotOut->mixer = serializeToBuffer(m_mixer);
 
-	// Write video encoders
+	// Video encoders
 	QHashIterator<quint32, VideoEncoder *> itB(m_videoEncoders);
-	*stream << (quint32)m_videoEncoders.count();
 	while(itB.hasNext()) {
 		itB.next();
-		*stream << itB.key();
-		*stream << (quint32)itB.value()->getType();
-		itB.value()->serialize(stream);
+		snapshotOut->videoEncoderIds.append(itB.key());
+		snapshotOut->videoEncoderTypes.append(
+			(quint32)itB.value()->getType());
+		snapshotOut->videoEncoders.append(serializeToBuffer(itB.value()));
 	}
 
-	// Write audio encoders
+	// Audio encoders
 	QHashIterator<quint32, AudioEncoder *> itC(m_audioEncoders);
-	*stream << (quint32)m_audioEncoders.count();
 	while(itC.hasNext()) {
 		itC.next();
-		*stream << itC.key();
-		*stream << (quint32)itC.value()->getType();
-		itC.value()->serialize(stream);
+		snapshotOut->audioEncoderIds.append(itC.key());
+		snapshotOut->audioEncoderTypes.append(
+			(quint32)itC.value()->getType());
+		snapshotOut->audioEncoders.append(serializeToBuffer(itC.value()));
 	}
 
-	// Write targets
-	*stream << (quint32)m_targets.count();
+	// Targets
 	for(int i = 0; i < m_targets.count(); i++) {
 		Target *target = m_targets.at(i);
-		*stream << (quint32)target->getType();
-		target->serialize(stream);
+		snapshotOut->targetTypes.append((quint32)target->getType());
+		snapshotOut->targets.append(serializeToBuffer(target));
 	}
 }
 
@@ -1662,8 +2115,8 @@ bool Profile::unserialize(QDataStream *stream)
 		*stream >> int32Data; // Active scene index
 		if(int32Data >= 0 && int32Data < m_scenes.size())
 			setActiveScene(m_scenes.at(int32Data));
-		else
-			setActiveScene(0);
+		else if(!m_scenes.isEmpty())
+			setActiveScene(m_scenes.first());
 
 		// Read scene transitions
 		if(version >= 2) {
@@ -1805,6 +2258,7 @@ void Profile::graphicsContextDestroyed(VidgfxContext *gfx)
 	while(it.hasNext()) {
 		it.next();
 		LayerGroup *group = it.value();
+		group->destroyRenderCache(gfx);
 		LayerList layers = group->getLayers();
 		for(int j = 0; j < layers.count(); j++) {
 			Layer *layer = layers.at(j);
@@ -1812,6 +2266,9 @@ void Profile::graphicsContextDestroyed(VidgfxContext *gfx)
 				layer->destroyResources(gfx);
 		}
 	}
+
+	// Release any cached images that are no longer used by any layer
+	App->getImageCache()->purgeUnused(0);
 }
 
 void Profile::queuedFrameEvent(uint frameNum, int numDropped)
@@ -1836,6 +2293,20 @@ void Profile::queuedFrameEvent(uint frameNum, int numDropped)
 
 	// Repaint the canvas
 	render(gfx, frameNum, numDropped);
+
+	if(m_firstFrameUsec == 0) {
+		// Log how long it took before we had something to show the user
+		m_firstFrameUsec = App->getUsecSinceExec();
+		appLog() << QStringLiteral(
+			"First frame rendered %L1 msec after the profile began loading "
+			"(%L2 msec after launch)")
+			.arg((m_firstFrameUsec - m_loadBeginUsec) / 1000ULL)
+			.arg(m_firstFrameUsec / 1000ULL);
+		return; // Don't delay the first frame reaching the screen
+	}
+
+	// Continue loading the rest of the profile in the background
+	loadDeferredLayers();
 }
 
 void Profile::targetActiveChanged(Target *target, bool active)
@@ -22,12 +22,15 @@
 #include "animatedfloat.h"
 #include <QtCore/QObject>
 #include <QtCore/QHash>
+#include <QtCore/QPointer>
 #include <QtCore/QSize>
 #include <QtCore/QVector>
 
 class AudioEncoder;
 class AudioMixer;
+class Layer;
 class LayerGroup;
+class ProfileSnapshot;
 class Scene;
 class Target;
 class VideoEncoder;
@@ -70,6 +73,26 @@ private: // Members -----------------------------------------------------------
 	PrflTransition		m_transitions[NumTransitionSettings];
 	uint				m_transitionDursMsec[NumTransitionSettings];
 
+	// Static frame detection
+	bool				m_isCanvasDirty;
+	Scene *				m_renderedScene;
+	bool				m_isFrameRepeated;
+	quint64				m_numFramesRendered;
+	quint64				m_numFramesRepeated;
+
+	// Saving
+	int					m_saveOperation;
+	quint64				m_saveSnapshotUsec;
+	QHash<LayerGroup *, QByteArray>	m_groupSaveCache;
+
+	// Staged loading
+	bool				m_isUnserializing;
+	bool				m_hasDeferredLayers;
+	QList<QPointer<Layer> >	m_deferredLayers;
+	int					m_numDeferredLoaded;
+	quint64				m_loadBeginUsec;
+	quint64				m_firstFrameUsec;
+
 public: // Static methods -----------------------------------------------------
 	static QVector<QString>	queryAvailableProfiles();
 	static QString			getProfileFilePath(const QString &name);
@@ -84,7 +107,7 @@ public: // Methods ------------------------------------------------------------
 	void			clear();
 	void			loadDefaults();
 	void			loadFromDisk();
-	bool			saveToDisk();
+	bool			saveToDisk(bool async = false);
 
 	QString			getName() const;
 	bool			setName(const QString &name);
@@ -105,6 +128,9 @@ public: // Methods ------------------------------------------------------------
 	Fraction		getVideoFramerate() const;
 	void			setVideoFramerate(Fraction framerate);
 	AudioMixer *	getAudioMixer();
+	bool			isFrameRepeated() const;
+	void			resetRepeatedFrameStats();
+	float			getRepeatedFrameFraction() const;
 
 	VideoEncoder *		getOrCreateX264VideoEncoder(
 		QSize size, SclrScalingMode scaling, VidgfxFilter scaleFilter,
@@ -155,6 +181,8 @@ public: // Methods ------------------------------------------------------------
 		const QString &name, const UstreamTrgtOptions &opt, int before = -1);
 	Target *		createHitboxTarget(
 		const QString &name, const HitboxTrgtOptions &opt, int before = -1);
+	Target *		createReplayTarget(
+		const QString &name, const ReplayTrgtOptions &opt, int before = -1);
 	Target *		createTargetSerialized(
 		TrgtType type, QDataStream *stream, int before = -1);
 	void			destroyTarget(Target *target);
@@ -169,13 +197,20 @@ private:
 		quint32 id, AencType type, QDataStream *stream);
 
 	void			ensureActiveScene();
+	void			queueDeferredLayers();
+	void			loadDeferredLayers();
 
 	void			setupContext(VidgfxContext *gfx);
+	bool			isCanvasStatic() const;
 	void			render(
 		VidgfxContext *gfx, uint frameNum, int numDropped);
 
 	void			serialize(QDataStream *stream) const;
 	bool			unserialize(QDataStream *stream);
+	void			takeSnapshot(
+		ProfileSnapshot *snapshotOut,
+		QHash<LayerGroup *, QByteArray> *groupCache = NULL) const;
+	void			connectGroupForSave(LayerGroup *group);
 
 Q_SIGNALS: // Signals ---------------------------------------------------------
 	void			sceneAdded(Scene *scene, int before);
@@ -202,6 +237,8 @@ Q_SLOTS: // Slots -------------------------------------------------------------
 	void			queuedFrameEvent(uint frameNum, int numDropped);
 	void			targetActiveChanged(Target *target, bool active);
 	void			unserializeErrorTimeout();
+	void			saveToFileComplete(int id, int errorCode, int msecTaken);
+	void			groupModified();
 };
 //=============================================================================
 
@@ -210,6 +247,15 @@ inline bool Profile::doesFileExist() const
 	return m_fileExists;
 }
 
+/// <summary>
+/// Returns true if the most recently rendered frame is identical to the frame
+/// before it and was not actually rendered.
+/// </summary>
+inline bool Profile::isFrameRepeated() const
+{
+	return m_isFrameRepeated;
+}
+
 inline QSize Profile::getCanvasSize() const
 {
 	return m_canvasSize;
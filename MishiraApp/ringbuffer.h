@@ -0,0 +1,116 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QtCore/QVector>
+
+//=============================================================================
+/// <summary>
+/// A FIFO queue that is stored in a circular array so that removing items
+/// from the front doesn't need to move the remaining items like
+/// `QVector::remove()` does. The capacity is always a power of two and grows
+/// automatically when full. Released slots are reset to a default-constructed
+/// item so that reference counted items are dereferenced immediately.
+/// </summary>
+template <typename T>
+class RingBuffer
+{
+private: // Members -----------------------------------------------------------
+	QVector<T>	m_items;
+	int			m_head; // Index of the first item
+	int			m_count;
+
+public: // Constructor/destructor ---------------------------------------------
+	inline RingBuffer(int capacity = 16)
+		: m_items()
+		, m_head(0)
+		, m_count(0)
+	{
+		int size = 1;
+		while(size < capacity)
+			size <<= 1;
+		m_items.resize(size);
+	};
+
+public: // Methods ------------------------------------------------------------
+	inline int count() const
+	{
+		return m_count;
+	};
+
+	inline bool isEmpty() const
+	{
+		return m_count == 0;
+	};
+
+	inline const T &at(int i) const
+	{
+		Q_ASSERT(i >= 0 && i < m_count);
+		return m_items.at((m_head + i) & (m_items.size() - 1));
+	};
+
+	inline const T &first() const
+	{
+		return at(0);
+	};
+
+	inline const T &last() const
+	{
+		return at(m_count - 1);
+	};
+
+	void append(const T &item)
+	{
+		if(m_count == m_items.size())
+			grow();
+		m_items[(m_head + m_count) & (m_items.size() - 1)] = item;
+		m_count++;
+	};
+
+	void removeFirst(int n = 1)
+	{
+		Q_ASSERT(n >= 0 && n <= m_count);
+		int mask = m_items.size() - 1;
+		for(int i = 0; i < n; i++)
+			m_items[(m_head + i) & mask] = T();
+		m_head = (m_head + n) & mask;
+		m_count -= n;
+		if(m_count == 0)
+			m_head = 0;
+	};
+
+	void clear()
+	{
+		removeFirst(m_count);
+	};
+
+private:
+	void grow()
+	{
+		// Unwrap the items into a new array that is twice the size
+		QVector<T> items(m_items.size() * 2);
+		for(int i = 0; i < m_count; i++)
+			items[i] = at(i);
+		m_items = items;
+		m_head = 0;
+	};
+};
+//=============================================================================
+
+#endif // RINGBUFFER_H
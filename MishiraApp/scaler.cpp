@@ -19,6 +19,7 @@
 #include "application.h"
 #include "scene.h"
 #include "profile.h"
+#include "tracer.h"
 
 //=============================================================================
 // Helpers
@@ -130,6 +131,8 @@ Scaler::Scaler(
 	//, m_stagingUVTex()
 	//, m_delayedFrameNum()
 	//, m_delayedNumDropped()
+	//, m_delayedIsRepeat()
+	, m_hasConvertedFrame(false)
 	, m_prevStagingTex(0)
 	, m_startDelay(SCALER_DELAY)
 {
@@ -144,6 +147,10 @@ Scaler::Scaler(
 	m_delayedFrameNum[1] = 0;
 	m_delayedNumDropped[0] = 0;
 	m_delayedNumDropped[1] = 0;
+	m_delayedIsRepeat[0] = false;
+	m_delayedIsRepeat[1] = false;
+	m_stagingIsCurrent[0] = false;
+	m_stagingIsCurrent[1] = false;
 
 	// Watch the profile for rendered frames
 	connect(m_profile, &Profile::frameRendered,
@@ -201,6 +208,13 @@ void Scaler::release()
 
 void Scaler::frameRendered(VidgfxTex *tex, uint frameNum, int numDropped)
 {
+	TraceZone zone("Scaler::frameRendered");
+
+	// If we skip this frame then our scratch textures no longer match the
+	// canvas and must be recreated the next time that we process a frame
+	bool hasConvertedFrame = m_hasConvertedFrame;
+	m_hasConvertedFrame = false;
+
 	// If the user is only previewing, don't waste any resources transferring
 	// the frames to system memory
 	if(!App->processAllFramesEnabled())
@@ -227,6 +241,7 @@ void Scaler::frameRendered(VidgfxTex *tex, uint frameNum, int numDropped)
 	frame.uvPlane = uvBuf;
 	frame.yStride = m_size.width();
 	frame.uvStride = m_size.width();
+	frame.isRepeat = false;
 	testNV12Image(&frame, frameNum, m_size.width(), m_size.height());
 
 	emit nv12FrameReady(frame, frameNum, numDropped);
@@ -263,6 +278,7 @@ void Scaler::frameRendered(VidgfxTex *tex, uint frameNum, int numDropped)
 				static_cast<quint8 *>(vidgfx_tex_get_data_ptr(uvTex));
 			frame.yStride = vidgfx_tex_get_stride(yTex);
 			frame.uvStride = vidgfx_tex_get_stride(uvTex);
+			frame.isRepeat = m_delayedIsRepeat[curStagingTex];
 			emit nv12FrameReady(
 				frame, m_delayedFrameNum[curStagingTex],
 				m_delayedNumDropped[curStagingTex]);
@@ -277,6 +293,54 @@ void Scaler::frameRendered(VidgfxTex *tex, uint frameNum, int numDropped)
 	if(m_startDelay > 0)
 		m_startDelay--;
 
+	//-------------------------------------------------------------------------
+	// If the canvas is identical to the last frame that we processed then our
+	// scratch textures already contain the converted image and we can skip
+	// straight to copying it to the staging textures
+
+	const QSize nv16Size = vidgfx_tex_get_size(m_yuvScratchTex[0]);
+	const QSize nv12Size = vidgfx_tex_get_size(m_yuvScratchTex[2]);
+	bool isRepeat = hasConvertedFrame && m_profile->isFrameRepeated();
+	if(!isRepeat) {
+		convertFrame(gfx, tex, nv16Size, nv12Size);
+		m_stagingIsCurrent[0] = false;
+		m_stagingIsCurrent[1] = false;
+	}
+	m_hasConvertedFrame = true;
+
+	//-------------------------------------------------------------------------
+	// Copy the output to our staging textures so they are ready to be read at
+	// a later time in the future. If the frame is a repeat and this staging
+	// texture already contains the converted image from an earlier frame then
+	// there is nothing to copy.
+
+	if(!m_stagingIsCurrent[curStagingTex]) {
+		vidgfx_context_copy_tex_data(
+			gfx, m_stagingYTex[curStagingTex], m_yuvScratchTex[0],
+			QPoint(0, 0), QRect(0, 0, nv16Size.width(), nv16Size.height()));
+		vidgfx_context_copy_tex_data(
+			gfx, m_stagingUVTex[curStagingTex], m_yuvScratchTex[2],
+			QPoint(0, 0), QRect(0, 0, nv12Size.width(), nv12Size.height()));
+		m_stagingIsCurrent[curStagingTex] = true;
+	}
+
+	// We need to delay the frame data as well
+	m_delayedFrameNum[curStagingTex] = frameNum;
+	m_delayedNumDropped[curStagingTex] = numDropped;
+	m_delayedIsRepeat[curStagingTex] = isRepeat;
+
+	// Swap staging textures for next time
+	m_prevStagingTex = curStagingTex;
+}
+
+/// <summary>
+/// Scales and converts the specified RGB texture into our NV12 scratch
+/// textures.
+/// </summary>
+void Scaler::convertFrame(
+	VidgfxContext *gfx, VidgfxTex *tex, const QSize &nv16Size,
+	const QSize &nv12Size)
+{
 	//-------------------------------------------------------------------------
 	// Do scaling and texture preparation for the first pass
 
@@ -328,24 +392,6 @@ void Scaler::frameRendered(VidgfxTex *tex, uint frameNum, int numDropped)
 	vidgfx_context_set_tex_filter(gfx, GfxBilinearFilter);
 	vidgfx_context_set_tex(gfx, m_yuvScratchTex[1]);
 	vidgfx_context_draw_buf(gfx, m_nv12Buf);
-
-	//-------------------------------------------------------------------------
-	// Copy the output to our staging textures so they are ready to be read at
-	// a later time in the future
-
-	vidgfx_context_copy_tex_data(
-		gfx, m_stagingYTex[curStagingTex], m_yuvScratchTex[0], QPoint(0, 0),
-		QRect(0, 0, nv16Size.width(), nv16Size.height()));
-	vidgfx_context_copy_tex_data(
-		gfx, m_stagingUVTex[curStagingTex], m_yuvScratchTex[2], QPoint(0, 0),
-		QRect(0, 0, nv12Size.width(), nv12Size.height()));
-
-	// We need to delay the frame data as well
-	m_delayedFrameNum[curStagingTex] = frameNum;
-	m_delayedNumDropped[curStagingTex] = numDropped;
-
-	// Swap staging textures for next time
-	m_prevStagingTex = curStagingTex;
 }
 
 void Scaler::updateVertBuf(VidgfxContext *gfx, const QPointF &brUv)
@@ -491,6 +537,9 @@ void Scaler::destroyResources(VidgfxContext *gfx)
 	m_stagingYTex[1] = NULL;
 	m_stagingUVTex[0] = NULL;
 	m_stagingUVTex[1] = NULL;
+	m_stagingIsCurrent[0] = false;
+	m_stagingIsCurrent[1] = false;
+	m_hasConvertedFrame = false;
 }
 
 //=============================================================================
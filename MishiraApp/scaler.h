@@ -55,6 +55,13 @@ struct NV12Frame
 	/// adjacent rows in the buffer.
 	/// </summary>
 	int			uvStride;
+
+	/// <summary>
+	/// True if the frame is identical to the previous frame that was emitted.
+	/// The buffers are still valid but receivers can use this to skip
+	/// processing the image data.
+	/// </summary>
+	bool		isRepeat;
 };
 //=============================================================================
 
@@ -82,6 +89,9 @@ private: // Members -----------------------------------------------------------
 	VidgfxTex *		m_stagingUVTex[2];
 	uint			m_delayedFrameNum[2];
 	int				m_delayedNumDropped[2];
+	bool			m_delayedIsRepeat[2];
+	bool			m_stagingIsCurrent[2]; // Staging matches the scratch
+	bool			m_hasConvertedFrame; // Scratch matches the canvas
 	int				m_prevStagingTex;
 	int				m_startDelay;
 
@@ -107,6 +117,9 @@ public: // Methods ------------------------------------------------------------
 	void			release();
 
 private:
+	void			convertFrame(
+		VidgfxContext *gfx, VidgfxTex *tex, const QSize &nv16Size,
+		const QSize &nv12Size);
 	void			updateVertBuf(VidgfxContext *gfx, const QPointF &brUv);
 	LyrScalingMode	convertScaling(SclrScalingMode scaling) const;
 
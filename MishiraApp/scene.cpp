@@ -33,6 +33,7 @@ Scene::Scene(Profile *profile)
 	, m_layerSceneItems()
 	, m_isVisible(false)
 	, m_activeItem(NULL)
+	, m_renderedLayers()
 {
 }
 
@@ -473,25 +474,87 @@ bool Scene::unserialize(QDataStream *stream)
 	return true;
 }
 
+/// <summary>
+/// Returns true if rendering the scene would result in different output to
+/// the last time that it was rendered.
+/// </summary>
+bool Scene::isOutputDirty() const
+{
+	// Have any layers been added, removed, rearranged or hidden?
+	const QVector<Layer *> layers = getRenderedLayers();
+	if(layers != m_renderedLayers)
+		return true;
+
+	// Has the output of any of the visible layers changed?
+	for(int i = 0; i < layers.count(); i++) {
+		if(layers.at(i)->isOutputDirty())
+			return true;
+	}
+	return false;
+}
+
+/// <summary>
+/// Flattens any visible layer groups that haven't changed in a while. Must be
+/// called before the render target for the scene is set.
+/// </summary>
+void Scene::updateGroupCaches(
+	VidgfxContext *gfx, uint frameNum, int numDropped)
+{
+	if(!vidgfx_context_is_valid(gfx))
+		return; // Context must exist and be usuable
+
+	for(int i = m_groups.count() - 1; i >= 0; i--) {
+		const GroupInfo &group = m_groups.at(i);
+		if(group.isVisible)
+			group.group->updateRenderCache(gfx, this, frameNum, numDropped);
+	}
+}
+
 void Scene::render(VidgfxContext *gfx, uint frameNum, int numDropped)
 {
 	if(!vidgfx_context_is_valid(gfx))
 		return; // Context must exist and be usuable
 
-	// Forward to visible layers only in reverse order
+	// Forward to visible layers only in reverse order. Groups that have been
+	// flattened are rendered with a single draw instead.
+	m_renderedLayers = getRenderedLayers();
 	for(int i = m_groups.count() - 1; i >= 0; i--) {
 		const GroupInfo &group = m_groups.at(i);
 		if(!group.isVisible)
 			continue;
+		bool isCached = group.group->renderCache(gfx);
 		LayerList layers = group.group->getLayers();
 		for(int j = layers.count() - 1; j >= 0; j--) {
 			Layer *layer = layers.at(j);
-			if(layer->isVisible())
+			if(!layer->isVisible())
+				continue;
+			if(!isCached)
 				layer->render(gfx, this, frameNum, numDropped);
+			layer->clearOutputDirty();
 		}
 	}
 }
 
+/// <summary>
+/// Returns the list of visible layers in the order that they are rendered.
+/// </summary>
+QVector<Layer *> Scene::getRenderedLayers() const
+{
+	QVector<Layer *> ret;
+	for(int i = m_groups.count() - 1; i >= 0; i--) {
+		const GroupInfo &group = m_groups.at(i);
+		if(!group.isVisible)
+			continue;
+		LayerList layers = group.group->getLayers();
+		for(int j = layers.count() - 1; j >= 0; j--) {
+			Layer *layer = layers.at(j);
+			if(layer->isVisible())
+				ret.append(layer);
+		}
+	}
+	return ret;
+}
+
 void Scene::groupChanged(LayerGroup *group)
 {
 	// One of our groups was modified
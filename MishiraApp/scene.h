@@ -56,6 +56,7 @@ private: // Members -----------------------------------------------------------
 	LayerSceneItemHash	m_layerSceneItems;
 	bool				m_isVisible;
 	SceneItem *			m_activeItem;
+	QVector<Layer *>	m_renderedLayers; // Layers in the last render
 
 public: // Constructor/destructor ---------------------------------------------
 	Scene(Profile *profile);
@@ -98,9 +99,15 @@ public: // Methods ------------------------------------------------------------
 	void			serialize(QDataStream *stream) const;
 	bool			unserialize(QDataStream *stream);
 
+	bool			isOutputDirty() const;
+	void			updateGroupCaches(
+		VidgfxContext *gfx, uint frameNum, int numDropped);
 	void			render(
 		VidgfxContext *gfx, uint frameNum, int numDropped);
 
+private:
+	QVector<Layer *>	getRenderedLayers() const;
+
 Q_SIGNALS: // Signals ---------------------------------------------------------
 	void			activeItemChanged(SceneItem *item, SceneItem *prev);
 
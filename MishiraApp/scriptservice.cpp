@@ -0,0 +1,927 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#include "scriptservice.h"
+#include "constants.h"
+#include "cpuusage.h"
+#include "threadpolicy.h"
+#include <QtCore/QFile>
+#include <QtCore/QPointer>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+#include <QtScript/QScriptEngine>
+
+const QString LOG_CAT = QStringLiteral("Script");
+
+// The maximum number of worker threads that scripts are distributed over
+const int MAX_SCRIPT_WORKERS = 2;
+
+// The maximum amount of time that a script can wait for a HTTP reply
+const int HTTP_TIMEOUT_MSEC = 30000;
+
+// How often to abort the scripts of a worker again while waiting for it to
+// exit when shutting down
+const int SHUTDOWN_ABORT_INTERVAL_MSEC = 100;
+
+//=============================================================================
+// Script callbacks
+
+QScriptValue jsLog(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 1) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 1 argument"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isString()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a string"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	obj->log(context->argument(0).toString());
+	return QScriptValue(QScriptValue::UndefinedValue);
+}
+
+QScriptValue jsSetTimeout(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 2) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 2 arguments"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isString() &&
+		!context->argument(0).isFunction())
+	{
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a string or a function"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+	if(!context->argument(1).isNumber()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 2 should be a number"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	int ret = obj->setTimeout(
+		context->argument(0), context->argument(1).toInt32());
+	return QScriptValue(ret);
+}
+
+QScriptValue jsClearTimeout(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 1) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 1 argument"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isNumber()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a number"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	obj->clearTimeout(context->argument(0).toInt32());
+	return QScriptValue(QScriptValue::UndefinedValue);
+}
+
+QScriptValue jsSetInterval(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 2) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 2 arguments"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isString() &&
+		!context->argument(0).isFunction())
+	{
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a string or a function"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+	if(!context->argument(1).isNumber()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 2 should be a number"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	int ret = obj->setInterval(
+		context->argument(0), context->argument(1).toInt32());
+	return QScriptValue(ret);
+}
+
+QScriptValue jsClearInterval(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 1) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 1 argument"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isNumber()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a number"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	obj->clearInterval(context->argument(0).toInt32());
+	return QScriptValue(QScriptValue::UndefinedValue);
+}
+
+QScriptValue jsReadFile(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 1) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 1 argument"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isString()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a string"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	QString ret = obj->readFile(context->argument(0).toString());
+	return QScriptValue(ret);
+}
+
+QScriptValue jsReadHttpGet(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 2) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 2 arguments"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isString()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a string"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+	if(!context->argument(1).isFunction()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 2 should be a function"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	obj->readHttpGet(context->argument(0).toString(), context->argument(1));
+	return QScriptValue(QScriptValue::UndefinedValue);
+}
+
+QScriptValue jsUpdateText(QScriptContext *context, QScriptEngine *engine)
+{
+	ScriptContext *obj = static_cast<ScriptContext *>(engine->parent());
+
+	// Verify argument count
+	if(context->argumentCount() < 1) {
+		context->throwError(QScriptContext::SyntaxError,
+			"Function expects 1 argument"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	// Verify argument types
+	if(!context->argument(0).isString()) {
+		context->throwError(QScriptContext::TypeError,
+			"Argument 1 should be a string"); // TODO: `tr()`
+		return QScriptValue(QScriptValue::UndefinedValue);
+	}
+
+	obj->updateText(context->argument(0).toString());
+	return QScriptValue(QScriptValue::UndefinedValue);
+}
+
+//=============================================================================
+// ScriptContext class
+
+ScriptContext::ScriptContext(
+	ScriptWorker *worker, ScriptHttpClient *http, const QString &script)
+	: QObject()
+	, m_worker(worker)
+	, m_http(http)
+	, m_script(script)
+	, m_engine(NULL)
+	, m_mutex()
+	, m_cancelled(0)
+	, m_timeoutTimers()
+	, m_intervalTimers()
+	, m_httpCallbacks()
+{
+	// The HTTP client broadcasts the result of every request to every script
+	connect(m_http, &ScriptHttpClient::getComplete,
+		this, &ScriptContext::httpGetComplete);
+}
+
+ScriptContext::~ScriptContext()
+{
+	// WARNING: Object is destructed in the worker thread
+
+	// Remove ourselves from the worker first so that `abort()` cannot be
+	// called while we are being destroyed
+	m_worker->removeContext(this);
+	if(m_worker->getTimerQueue() != NULL)
+		m_worker->getTimerQueue()->removeAllTimers(this);
+
+	m_mutex.lock();
+	delete m_engine;
+	m_engine = NULL;
+	m_mutex.unlock();
+}
+
+/// <summary>
+/// Creates the script engine and evaluates the script.
+/// </summary>
+void ScriptContext::start()
+{
+	if(isCancelled() || m_engine != NULL)
+		return;
+
+	QScriptEngine *engine = new QScriptEngine(this);
+
+	// Add our callback functions to the global object
+	QScriptValue value;
+	value = engine->newFunction(jsLog);
+	engine->globalObject().setProperty(
+		"log", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsSetTimeout);
+	engine->globalObject().setProperty(
+		"setTimeout", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsClearTimeout);
+	engine->globalObject().setProperty(
+		"clearTimeout", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsSetInterval);
+	engine->globalObject().setProperty(
+		"setInterval", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsClearInterval);
+	engine->globalObject().setProperty(
+		"clearInterval", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsReadFile);
+	engine->globalObject().setProperty(
+		"readFile", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsReadHttpGet);
+	engine->globalObject().setProperty(
+		"readHttpGet", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+	value = engine->newFunction(jsUpdateText);
+	engine->globalObject().setProperty(
+		"updateText", value,
+		QScriptValue::ReadOnly | QScriptValue::Undeletable);
+
+	m_mutex.lock();
+	m_engine = engine;
+	m_mutex.unlock();
+
+	// We might have been aborted while the engine was being created
+	if(isCancelled())
+		return;
+
+	// Evaluate the script
+	m_engine->evaluate(m_script);
+	testForException();
+}
+
+/// <summary>
+/// Stops all timers and forgets any pending requests and deletes the context
+/// once it is safe to do so.
+/// </summary>
+void ScriptContext::shutdown()
+{
+	m_cancelled.store(1);
+	m_worker->getTimerQueue()->removeAllTimers(this);
+	m_timeoutTimers.clear();
+	m_intervalTimers.clear();
+	m_httpCallbacks.clear();
+	deleteLater();
+}
+
+/// <summary>
+/// Aborts any script code that is currently executing and prevents any more
+/// from being executed. Unlike every other method this is safe to call from
+/// any thread. If the script was just about to begin executing then it might
+/// not notice so callers that need to be certain that the script has stopped
+/// should call this repeatedly until the worker has exited.
+/// </summary>
+void ScriptContext::abort()
+{
+	m_mutex.lock();
+	m_cancelled.store(1);
+	if(m_engine != NULL)
+		m_engine->abortEvaluation();
+	m_mutex.unlock();
+}
+
+void ScriptContext::testForException() const
+{
+	if(m_engine == NULL)
+		return;
+	if(m_engine->hasUncaughtException()) {
+		int line = m_engine->uncaughtExceptionLineNumber();
+		appLog(LOG_CAT, Log::Warning)
+			<< "Uncaught exception at line " << line << ": "
+			<< m_engine->uncaughtException().toString();
+		m_engine->clearExceptions();
+	}
+}
+
+/// <summary>
+/// Called by the timer queue when one of our timers has expired.
+/// </summary>
+void ScriptContext::timerFired(int timerId)
+{
+	if(isCancelled())
+		return;
+	evaluateTimer(timerId);
+}
+
+void ScriptContext::evaluateTimer(int timerId)
+{
+	if(m_engine == NULL)
+		return;
+
+	// Get corresponding timer expression. `setTimeout()` only triggers once.
+	QScriptValue expression = m_intervalTimers.value(timerId);
+	if(!expression.isValid())
+		expression = m_timeoutTimers.take(timerId);
+
+	// Evaluate expression
+	if(expression.isString())
+		m_engine->evaluate(expression.toString());
+	else if(expression.isFunction())
+		expression.call();
+
+	testForException();
+}
+
+void ScriptContext::log(const QString &text)
+{
+	// TODO: "Script:0x____" category
+	//if(!text.isEmpty())
+	appLog(LOG_CAT) << text;
+	// TODO: Status bar as well?
+}
+
+int ScriptContext::setTimeout(const QScriptValue &expression, int delay)
+{
+	if(isCancelled())
+		return -1;
+	if(expression.isString() || expression.isFunction()) {
+		int timerId =
+			m_worker->getTimerQueue()->addTimer(this, delay, false);
+		m_timeoutTimers.insert(timerId, expression);
+		return timerId;
+	}
+	return -1;
+}
+
+void ScriptContext::clearTimeout(int timerId)
+{
+	if(!m_timeoutTimers.contains(timerId))
+		return; // Not one of our timers
+	m_worker->getTimerQueue()->removeTimer(timerId);
+	m_timeoutTimers.remove(timerId);
+}
+
+int ScriptContext::setInterval(const QScriptValue &expression, int delay)
+{
+	if(isCancelled())
+		return -1;
+	if(expression.isString() || expression.isFunction()) {
+		int timerId =
+			m_worker->getTimerQueue()->addTimer(this, delay, true);
+		m_intervalTimers.insert(timerId, expression);
+		return timerId;
+	}
+	return -1;
+}
+
+void ScriptContext::clearInterval(int timerId)
+{
+	if(!m_intervalTimers.contains(timerId))
+		return; // Not one of our timers
+	m_worker->getTimerQueue()->removeTimer(timerId);
+	m_intervalTimers.remove(timerId);
+}
+
+QString ScriptContext::readFile(const QString &filename)
+{
+	QFile file(filename);
+	if(!file.open(QIODevice::ReadOnly)) {
+		appLog(LOG_CAT, Log::Warning) << QStringLiteral(
+			"Error reading file \"%1\"")
+			.arg(filename);
+		// TODO: Status bar as well?
+		return QString();
+	}
+	QString data = QString::fromUtf8(file.readAll());
+	file.close();
+	return data;
+}
+
+/// <summary>
+/// Begins a HTTP GET request of the specified URL and calls `callback` with
+/// the body of the reply once it has been received. If the request fails or
+/// times out then the callback receives an empty string.
+/// </summary>
+void ScriptContext::readHttpGet(
+	const QString &url, const QScriptValue &callback)
+{
+	if(isCancelled())
+		return;
+
+	// The reply can never arrive before we have remembered the callback as
+	// it is queued to our thread
+	int id = m_http->get(url);
+	m_httpCallbacks.insert(id, callback);
+}
+
+void ScriptContext::httpGetComplete(int id, const QString &data)
+{
+	if(!m_httpCallbacks.contains(id))
+		return; // Not our request
+	QScriptValue callback = m_httpCallbacks.take(id);
+	if(isCancelled() || m_engine == NULL)
+		return;
+	callback.call(QScriptValue(), QScriptValueList() << QScriptValue(data));
+	testForException();
+}
+
+void ScriptContext::updateText(const QString &text)
+{
+	emit textUpdated(text);
+}
+
+//=============================================================================
+// ScriptTimerQueue class
+
+ScriptTimerQueue::ScriptTimerQueue(QObject *parent)
+	: QObject(parent)
+	, m_timer(this)
+	, m_clock()
+	, m_queue()
+	, m_dueTimes()
+	, m_nextId(1)
+{
+	m_clock.start();
+	m_timer.setSingleShot(true);
+	connect(&m_timer, &QTimer::timeout,
+		this, &ScriptTimerQueue::timeout);
+}
+
+ScriptTimerQueue::~ScriptTimerQueue()
+{
+}
+
+/// <summary>
+/// Creates a new timer for the specified script and returns its ID. IDs are
+/// unique within the worker thread.
+/// </summary>
+int ScriptTimerQueue::addTimer(
+	ScriptContext *context, int interval, bool repeat)
+{
+	TimerEntry entry;
+	entry.context = context;
+	entry.id = m_nextId++;
+	entry.interval = qMax(0, interval);
+	entry.repeat = repeat;
+	insertTimer(m_clock.elapsed() + (qint64)entry.interval, entry);
+	scheduleNextTimeout();
+	return entry.id;
+}
+
+void ScriptTimerQueue::removeTimer(int id)
+{
+	if(!m_dueTimes.contains(id))
+		return; // Unknown timer
+	qint64 due = m_dueTimes.take(id);
+	QMultiMap<qint64, TimerEntry>::iterator it = m_queue.find(due);
+	while(it != m_queue.end() && it.key() == due) {
+		if(it.value().id == id) {
+			m_queue.erase(it);
+			break;
+		}
+		it++;
+	}
+	scheduleNextTimeout();
+}
+
+void ScriptTimerQueue::removeAllTimers(ScriptContext *context)
+{
+	QMultiMap<qint64, TimerEntry>::iterator it = m_queue.begin();
+	while(it != m_queue.end()) {
+		if(it.value().context == context) {
+			m_dueTimes.remove(it.value().id);
+			it = m_queue.erase(it);
+		} else
+			it++;
+	}
+	scheduleNextTimeout();
+}
+
+void ScriptTimerQueue::insertTimer(qint64 due, const TimerEntry &entry)
+{
+	m_queue.insert(due, entry);
+	m_dueTimes[entry.id] = due;
+}
+
+void ScriptTimerQueue::scheduleNextTimeout()
+{
+	if(m_queue.isEmpty()) {
+		m_timer.stop();
+		return;
+	}
+	qint64 delay = m_queue.firstKey() - m_clock.elapsed();
+	m_timer.start((int)qMax((qint64)0, delay));
+}
+
+void ScriptTimerQueue::timeout()
+{
+	// Remove every timer that has expired from the queue, rescheduling
+	// intervals, before executing any of them so that scripts can safely
+	// modify their timers from within the callbacks
+	qint64 now = m_clock.elapsed();
+	QVector<QPointer<ScriptContext> > expiredContexts;
+	QVector<int> expiredIds;
+	while(!m_queue.isEmpty() && m_queue.firstKey() <= now) {
+		QMultiMap<qint64, TimerEntry>::iterator it = m_queue.begin();
+		qint64 due = it.key();
+		TimerEntry entry = it.value();
+		m_queue.erase(it);
+		m_dueTimes.remove(entry.id);
+		expiredContexts.append(entry.context);
+		expiredIds.append(entry.id);
+		if(entry.repeat) {
+			// Don't attempt to catch up if we were delayed for longer than
+			// the interval
+			qint64 nextDue = due + (qint64)qMax(1, entry.interval);
+			if(nextDue <= now)
+				nextDue = now + (qint64)qMax(1, entry.interval);
+			insertTimer(nextDue, entry);
+		}
+	}
+	scheduleNextTimeout();
+
+	// Scripts can be deleted while other scripts are executing if they block
+	for(int i = 0; i < expiredIds.count(); i++) {
+		ScriptContext *context = expiredContexts.at(i);
+		if(context != NULL)
+			context->timerFired(expiredIds.at(i));
+	}
+}
+
+//=============================================================================
+// ScriptHttpClient class
+
+ScriptHttpClient::ScriptHttpClient()
+	: QObject()
+	, m_nextId(1)
+	, m_network(NULL)
+	, m_replies()
+{
+}
+
+ScriptHttpClient::~ScriptHttpClient()
+{
+	// WARNING: Object is destructed in the main thread after our thread has
+	// exited and `shutdown()` has been called
+}
+
+/// <summary>
+/// Queues a HTTP GET request of the specified URL and returns its ID. The
+/// body of the reply is emitted with `getComplete()` once it has been
+/// received or an empty string if the request fails or times out. Can be
+/// called from any thread.
+/// </summary>
+int ScriptHttpClient::get(const QString &url)
+{
+	int id = m_nextId.fetchAndAddOrdered(1);
+	QMetaObject::invokeMethod(this, "processGet", Qt::QueuedConnection,
+		Q_ARG(int, id), Q_ARG(QString, url));
+	return id;
+}
+
+void ScriptHttpClient::processGet(int id, const QString &url)
+{
+	// The network manager must be created in the thread that uses it
+	if(m_network == NULL) {
+		ThreadPolicy::applyToCurrentThread(
+			ThrdScriptClass, QStringLiteral("Script HTTP"));
+		m_network = new QNetworkAccessManager(this);
+	}
+
+	// Setup the request and transmit it
+	QNetworkRequest req;
+	req.setUrl(QUrl(url));
+	req.setRawHeader("User-Agent",
+		QStringLiteral("%1/%2").arg(APP_NAME).arg(APP_VER_STR).toUtf8());
+	QNetworkReply *reply = m_network->get(req);
+	m_replies.insert(reply, id);
+	connect(reply, &QNetworkReply::finished,
+		this, &ScriptHttpClient::replyFinished);
+
+	// Aborting the reply emits `finished()`
+	QTimer *timeoutTimer = new QTimer(reply);
+	timeoutTimer->setSingleShot(true);
+	connect(timeoutTimer, &QTimer::timeout,
+		reply, &QNetworkReply::abort);
+	timeoutTimer->start(HTTP_TIMEOUT_MSEC);
+}
+
+void ScriptHttpClient::replyFinished()
+{
+	QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+	if(reply == NULL || !m_replies.contains(reply))
+		return;
+	int id = m_replies.take(reply);
+
+	// Read the reply
+	QString data;
+	if(reply->error() == QNetworkReply::OperationCanceledError) {
+		appLog(LOG_CAT, Log::Warning) << QStringLiteral(
+			"Timed out during HTTP GET of \"%1\"")
+			.arg(reply->url().toString());
+	} else if(reply->error() != QNetworkReply::NoError) {
+		appLog(LOG_CAT, Log::Warning) << QStringLiteral(
+			"Error during HTTP GET of \"%1\": %2")
+			.arg(reply->url().toString())
+			.arg(reply->errorString());
+		// TODO: Status bar as well?
+	} else
+		data = QString::fromUtf8(reply->readAll());
+	reply->deleteLater();
+
+	emit getComplete(id, data);
+}
+
+/// <summary>
+/// Aborts every pending request without notifying anyone and releases the
+/// network manager. Must be called from within our thread before it exits.
+/// </summary>
+void ScriptHttpClient::shutdown()
+{
+	QHashIterator<QNetworkReply *, int> it(m_replies);
+	while(it.hasNext()) {
+		it.next();
+		QNetworkReply *reply = it.key();
+		disconnect(reply, 0, this, 0);
+		reply->abort();
+		delete reply;
+	}
+	m_replies.clear();
+	if(m_network != NULL) {
+		delete m_network;
+		m_network = NULL;
+		CPUUsage::unregisterThread();
+	}
+}
+
+//=============================================================================
+// ScriptWorker class
+
+ScriptWorker::ScriptWorker()
+	: QThread()
+	, m_timers(NULL)
+	, m_mutex()
+	, m_contexts()
+{
+}
+
+ScriptWorker::~ScriptWorker()
+{
+	// WARNING: Object is destructed in the main thread
+}
+
+int ScriptWorker::getNumContexts()
+{
+	m_mutex.lock();
+	int num = m_contexts.count();
+	m_mutex.unlock();
+	return num;
+}
+
+void ScriptWorker::addContext(ScriptContext *context)
+{
+	m_mutex.lock();
+	m_contexts.append(context);
+	m_mutex.unlock();
+}
+
+void ScriptWorker::removeContext(ScriptContext *context)
+{
+	m_mutex.lock();
+	int index = m_contexts.indexOf(context);
+	if(index >= 0)
+		m_contexts.remove(index);
+	m_mutex.unlock();
+}
+
+/// <summary>
+/// Aborts the execution of every script in this worker. Can be called from
+/// any thread.
+/// </summary>
+void ScriptWorker::abortAllContexts()
+{
+	m_mutex.lock();
+	for(int i = 0; i < m_contexts.count(); i++)
+		m_contexts.at(i)->abort();
+	m_mutex.unlock();
+}
+
+void ScriptWorker::run()
+{
+	ThreadPolicy::applyToCurrentThread(
+		ThrdScriptClass, QStringLiteral("Script"));
+	m_timers = new ScriptTimerQueue();
+
+	// Enter the thread main loop
+	exec();
+
+	// Delete any scripts that still exist. Their destructors remove them
+	// from our list.
+	for(;;) {
+		m_mutex.lock();
+		ScriptContext *context =
+			m_contexts.isEmpty() ? NULL : m_contexts.last();
+		m_mutex.unlock();
+		if(context == NULL)
+			break;
+		delete context;
+	}
+
+	// Clean up
+	delete m_timers;
+	m_timers = NULL;
+	CPUUsage::unregisterThread();
+}
+
+//=============================================================================
+// ScriptService class
+
+ScriptService::ScriptService(int numWorkers)
+	: QObject()
+	, m_workers()
+	, m_httpThread(NULL)
+	, m_http(NULL)
+{
+	if(numWorkers <= 0) {
+		numWorkers =
+			qBound(1, QThread::idealThreadCount() / 2, MAX_SCRIPT_WORKERS);
+	}
+	m_workers.reserve(numWorkers);
+	for(int i = 0; i < numWorkers; i++) {
+		ScriptWorker *worker = new ScriptWorker();
+		worker->start(QThread::LowPriority);
+		m_workers.append(worker);
+	}
+
+	m_httpThread = new QThread();
+	m_http = new ScriptHttpClient();
+	m_http->moveToThread(m_httpThread);
+	m_httpThread->start(QThread::LowPriority);
+}
+
+ScriptService::~ScriptService()
+{
+	QVector<ScriptWorker *> workers = m_workers;
+	m_workers.clear();
+	stopWorkers(workers);
+
+	// No script can make any more requests
+	QMetaObject::invokeMethod(
+		m_http, "shutdown", Qt::BlockingQueuedConnection);
+	m_httpThread->quit();
+	m_httpThread->wait();
+	delete m_http;
+	m_http = NULL;
+	delete m_httpThread;
+	m_httpThread = NULL;
+}
+
+/// <summary>
+/// Asks every script in the specified workers to stop and waits for the
+/// workers to exit. As no script can block this only takes as long as the
+/// longest evaluation that is currently in progress takes to notice that it
+/// was aborted. The workers are deleted.
+/// </summary>
+void ScriptService::stopWorkers(const QVector<ScriptWorker *> &workers)
+{
+	for(int i = 0; i < workers.count(); i++) {
+		workers.at(i)->abortAllContexts();
+		workers.at(i)->quit();
+	}
+	for(int i = 0; i < workers.count(); i++) {
+		ScriptWorker *worker = workers.at(i);
+
+		// A script that was just about to begin evaluating when we aborted
+		// it might not have noticed so keep aborting until it exits
+		while(!worker->wait(SHUTDOWN_ABORT_INTERVAL_MSEC))
+			worker->abortAllContexts();
+		delete worker;
+	}
+}
+
+/// <summary>
+/// Creates a new script in the worker that has the least scripts. The script
+/// does not execute until `startScript()` is called so that the caller can
+/// connect to its signals first.
+/// </summary>
+ScriptContext *ScriptService::createScript(const QString &script)
+{
+	if(m_workers.isEmpty())
+		return NULL;
+	ScriptWorker *worker = m_workers.first();
+	int numContexts = worker->getNumContexts();
+	for(int i = 1; i < m_workers.count(); i++) {
+		int num = m_workers.at(i)->getNumContexts();
+		if(num < numContexts) {
+			worker = m_workers.at(i);
+			numContexts = num;
+		}
+	}
+
+	ScriptContext *context = new ScriptContext(worker, m_http, script);
+	context->moveToThread(worker);
+	worker->addContext(context);
+	return context;
+}
+
+void ScriptService::startScript(ScriptContext *context)
+{
+	if(context == NULL)
+		return;
+	QMetaObject::invokeMethod(context, "start", Qt::QueuedConnection);
+}
+
+/// <summary>
+/// Stops the specified script and deletes it. The script is deleted
+/// asynchronously by its worker and the context must not be used after this
+/// method is called.
+/// </summary>
+void ScriptService::destroyScript(ScriptContext *context)
+{
+	if(context == NULL)
+		return;
+	context->disconnect();
+	context->abort();
+	QMetaObject::invokeMethod(context, "shutdown", Qt::QueuedConnection);
+}
+
+int ScriptService::getNumScripts() const
+{
+	int num = 0;
+	for(int i = 0; i < m_workers.count(); i++)
+		num += m_workers.at(i)->getNumContexts();
+	return num;
+}
@@ -0,0 +1,280 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+#ifndef SCRIPTSERVICE_H
+#define SCRIPTSERVICE_H
+
+#include "common.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include <QtScript/QScriptValue>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QScriptEngine;
+class ScriptHttpClient;
+class ScriptWorker;
+
+//=============================================================================
+/// <summary>
+/// A single running script and its JavaScript engine. Contexts are created by
+/// `ScriptService` and live in one of its worker threads which is shared with
+/// other scripts. Scripts can never block their worker: HTTP requests are
+/// sent to the shared HTTP client and their result is passed to a callback.
+/// All methods except `abort()` must only be called from within the worker
+/// thread.
+/// </summary>
+class ScriptContext : public QObject
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	ScriptWorker *				m_worker;
+	ScriptHttpClient *			m_http;
+	QString						m_script;
+	QScriptEngine *				m_engine;
+	QMutex						m_mutex; // Protects `m_engine`
+	QAtomicInt					m_cancelled;
+	QHash<int, QScriptValue>	m_timeoutTimers;
+	QHash<int, QScriptValue>	m_intervalTimers;
+	QHash<int, QScriptValue>	m_httpCallbacks;
+
+public: // Constructor/destructor ---------------------------------------------
+	ScriptContext(
+		ScriptWorker *worker, ScriptHttpClient *http, const QString &script);
+	~ScriptContext();
+
+public: // Methods ------------------------------------------------------------
+	ScriptWorker *	getWorker() const;
+	bool			isCancelled() const;
+	void			abort();
+	void			timerFired(int timerId);
+
+private:
+	void			testForException() const;
+	void			evaluateTimer(int timerId);
+
+public: // Scriptable methods -------------------------------------------------
+	void	log(const QString &text);
+
+	int		setTimeout(const QScriptValue &expression, int delay);
+	void	clearTimeout(int timerId);
+	int		setInterval(const QScriptValue &expression, int delay);
+	void	clearInterval(int timerId);
+
+	QString	readFile(const QString &filename);
+	void	readHttpGet(const QString &url, const QScriptValue &callback);
+
+	void	updateText(const QString &text);
+
+Q_SIGNALS: // Signals ---------------------------------------------------------
+	void	textUpdated(const QString &text);
+
+	public
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void	start();
+	void	shutdown();
+
+	private
+Q_SLOTS:
+	void	httpGetComplete(int id, const QString &data);
+};
+//=============================================================================
+
+inline ScriptWorker *ScriptContext::getWorker() const
+{
+	return m_worker;
+}
+
+inline bool ScriptContext::isCancelled() const
+{
+	return m_cancelled.load() != 0;
+}
+
+//=============================================================================
+/// <summary>
+/// Executes the `setTimeout()` and `setInterval()` timers of every script in
+/// a worker thread using a single Qt timer that is always scheduled for the
+/// timer that is due next.
+/// </summary>
+class ScriptTimerQueue : public QObject
+{
+	Q_OBJECT
+
+private: // Datatypes ---------------------------------------------------------
+	struct TimerEntry {
+		ScriptContext *	context;
+		int				id;
+		int				interval; // Msec
+		bool			repeat;
+	};
+
+private: // Members -----------------------------------------------------------
+	QTimer							m_timer;
+	QElapsedTimer					m_clock;
+	QMultiMap<qint64, TimerEntry>	m_queue; // Sorted by due time in msec
+	QHash<int, qint64>				m_dueTimes;
+	int								m_nextId;
+
+public: // Constructor/destructor ---------------------------------------------
+	ScriptTimerQueue(QObject *parent = NULL);
+	~ScriptTimerQueue();
+
+public: // Methods ------------------------------------------------------------
+	int		addTimer(ScriptContext *context, int interval, bool repeat);
+	void	removeTimer(int id);
+	void	removeAllTimers(ScriptContext *context);
+	int		getNumTimers() const;
+
+private:
+	void	insertTimer(qint64 due, const TimerEntry &entry);
+	void	scheduleNextTimeout();
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void	timeout();
+};
+//=============================================================================
+
+inline int ScriptTimerQueue::getNumTimers() const
+{
+	return m_queue.count();
+}
+
+//=============================================================================
+/// <summary>
+/// Performs the HTTP requests of every script using a single HTTP client so
+/// that connections to the same host are reused by all scripts. The client
+/// lives in its own thread and never blocks: the result of each request is
+/// broadcast with `getComplete()` and the script that made the request
+/// recognises it by its ID. `get()` can be called from any thread.
+/// </summary>
+class ScriptHttpClient : public QObject
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	QAtomicInt					m_nextId;
+	QNetworkAccessManager *		m_network; // Created in our own thread
+	QHash<QNetworkReply *, int>	m_replies;
+
+public: // Constructor/destructor ---------------------------------------------
+	ScriptHttpClient();
+	~ScriptHttpClient();
+
+public: // Methods ------------------------------------------------------------
+	int					get(const QString &url);
+	Q_INVOKABLE void	shutdown();
+
+private:
+	Q_INVOKABLE void	processGet(int id, const QString &url);
+
+Q_SIGNALS: // Signals ---------------------------------------------------------
+	void				getComplete(int id, const QString &data);
+
+	private
+Q_SLOTS: // Slots -------------------------------------------------------------
+	void				replyFinished();
+};
+//=============================================================================
+
+//=============================================================================
+/// <summary>
+/// A thread that executes multiple scripts. Each worker has a single timer
+/// queue that is shared between all of its scripts.
+/// </summary>
+class ScriptWorker : public QThread
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	ScriptTimerQueue *			m_timers;
+	QMutex						m_mutex; // Protects `m_contexts`
+	QVector<ScriptContext *>	m_contexts;
+
+public: // Constructor/destructor ---------------------------------------------
+	ScriptWorker();
+	~ScriptWorker();
+
+public: // Methods ------------------------------------------------------------
+	ScriptTimerQueue *		getTimerQueue() const;
+	int						getNumContexts();
+	void					addContext(ScriptContext *context);
+	void					removeContext(ScriptContext *context);
+	void					abortAllContexts();
+
+protected:
+	virtual void	run();
+};
+//=============================================================================
+
+/// <summary>
+/// Must only be called from within the worker thread.
+/// </summary>
+inline ScriptTimerQueue *ScriptWorker::getTimerQueue() const
+{
+	return m_timers;
+}
+
+//=============================================================================
+/// <summary>
+/// Executes the scripts of every scriptable layer using a small pool of
+/// shared worker threads. Stopping a script never blocks the main thread: the
+/// script is asked to abort and is deleted by its worker once it has done so.
+///
+/// None of the functions that are available to scripts block so a script can
+/// never delay the execution of the other scripts in the same worker. HTTP
+/// requests are performed by a single client in its own thread that is
+/// shared by every script.
+/// </summary>
+class ScriptService : public QObject
+{
+	Q_OBJECT
+
+private: // Members -----------------------------------------------------------
+	QVector<ScriptWorker *>	m_workers;
+	QThread *				m_httpThread;
+	ScriptHttpClient *		m_http;
+
+public: // Constructor/destructor ---------------------------------------------
+	ScriptService(int numWorkers = 0);
+	~ScriptService();
+
+public: // Methods ------------------------------------------------------------
+	ScriptContext *	createScript(const QString &script);
+	void			startScript(ScriptContext *context);
+	void			destroyScript(ScriptContext *context);
+	int				getNumWorkers() const;
+	int				getNumScripts() const;
+
+private:
+	void			stopWorkers(const QVector<ScriptWorker *> &workers);
+};
+//=============================================================================
+
+inline int ScriptService::getNumWorkers() const
+{
+	return m_workers.count();
+}
+
+#endif // SCRIPTSERVICE_H
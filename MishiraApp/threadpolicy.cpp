@@ -0,0 +1,326 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#include "threadpolicy.h"
+#include "cpuusage.h"
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <tlhelp32.h>
+#endif
+
+const QString LOG_CAT = QStringLiteral("Threads");
+
+#ifdef Q_OS_WIN
+// `NtQueryInformationThread()` is not in the SDK's import libraries so it is
+// resolved at runtime
+typedef LONG (WINAPI *NtQueryInformationThreadFunc)(
+	HANDLE thread, LONG infoClass, PVOID info, ULONG infoSize, PULONG retSize);
+const LONG ThreadQuerySetWin32StartAddress = 9;
+
+// The OS priority of each thread class. The main loop is raised above normal
+// so that it is never delayed by our own encoder threads while everything
+// that isn't time critical is lowered below the game that we are capturing.
+static const int ThrdClassPriorities[] = {
+	THREAD_PRIORITY_ABOVE_NORMAL, // ThrdRealTimeClass
+	THREAD_PRIORITY_NORMAL, // ThrdEncodeClass
+	THREAD_PRIORITY_BELOW_NORMAL, // ThrdScriptClass
+	THREAD_PRIORITY_BELOW_NORMAL // ThrdBackgroundClass
+};
+#endif
+
+QMutex ThreadPolicy::s_mutex;
+quint64 ThreadPolicy::s_encoderCoreMask = 0;
+
+//=============================================================================
+// Helpers
+
+#ifdef Q_OS_WIN
+/// <summary>
+/// Returns true if the specified thread was started by Windows itself (E.g.
+/// thread pool and DLL loader workers) instead of by a library that we use.
+/// The handle must have been opened with `THREAD_QUERY_INFORMATION` access.
+/// </summary>
+static bool isSystemThread(HANDLE thread)
+{
+	HMODULE ntdll = GetModuleHandle(TEXT("ntdll.dll"));
+	if(ntdll == NULL)
+		return false;
+	NtQueryInformationThreadFunc queryInfo =
+		(NtQueryInformationThreadFunc)GetProcAddress(
+		ntdll, "NtQueryInformationThread");
+	if(queryInfo == NULL)
+		return false;
+	PVOID startAddr = NULL;
+	if(queryInfo(thread, ThreadQuerySetWin32StartAddress, &startAddr,
+		sizeof(startAddr), NULL) != 0)
+	{
+		return false;
+	}
+	HMODULE module = NULL;
+	if(!GetModuleHandleEx(
+		GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+		GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		(LPCTSTR)startAddr, &module))
+	{
+		return false;
+	}
+	return module == ntdll;
+}
+#endif
+
+//=============================================================================
+// ThreadPolicy class
+
+/// <summary>
+/// Sets the CPU cores that encoder threads are allowed to run on as a bit
+/// mask where bit N is core N. A mask of zero allows every core. Only affects
+/// threads that have their policy applied after this call.
+/// </summary>
+void ThreadPolicy::setEncoderCoreMask(quint64 mask)
+{
+	s_mutex.lock();
+	s_encoderCoreMask = mask;
+	s_mutex.unlock();
+}
+
+quint64 ThreadPolicy::getEncoderCoreMask()
+{
+	s_mutex.lock();
+	quint64 mask = s_encoderCoreMask;
+	s_mutex.unlock();
+	return mask;
+}
+
+/// <summary>
+/// Returns the number of cores that encoder threads are allowed to run on
+/// taking into account the cores that are available to our process.
+/// </summary>
+int ThreadPolicy::getNumEncoderCores()
+{
+	quint64 mask = getCoreMask(ThrdEncodeClass);
+	if(mask == 0)
+		return QThread::idealThreadCount();
+	int count = 0;
+	for(; mask != 0; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+/// <summary>
+/// Applies the policy of the specified class to the calling thread and names
+/// it in CPU usage statistics.
+/// </summary>
+void ThreadPolicy::applyToCurrentThread(
+	ThrdClass thrdClass, const QString &name)
+{
+	CPUUsage::registerThread(name);
+#ifdef Q_OS_WIN
+	HANDLE thread = GetCurrentThread();
+	SetThreadPriority(thread, getPriority(thrdClass));
+
+	// Always set the affinity so that a thread that was mistaken for a
+	// library thread by `applyToNewThreads()` before it could apply its own
+	// policy doesn't stay pinned to the encoder cores
+	quint64 mask = getCoreMask(thrdClass);
+	DWORD_PTR procMask, sysMask;
+	if(mask == 0 &&
+		GetProcessAffinityMask(GetCurrentProcess(), &procMask, &sysMask))
+	{
+		mask = (quint64)procMask;
+	}
+	if(mask != 0)
+		SetThreadAffinityMask(thread, (DWORD_PTR)mask);
+#endif
+}
+
+/// <summary>
+/// Returns the OS thread IDs of every thread that currently exists in our
+/// process.
+/// </summary>
+QSet<quint64> ThreadPolicy::getProcessThreadIds()
+{
+	QSet<quint64> ids;
+#ifdef Q_OS_WIN
+	// Windows doesn't provide a way to list the threads of a single process
+	// so we need to walk every thread in the system
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if(snapshot == INVALID_HANDLE_VALUE)
+		return ids;
+	DWORD procId = GetCurrentProcessId();
+	THREADENTRY32 entry;
+	entry.dwSize = sizeof(entry);
+	for(BOOL ok = Thread32First(snapshot, &entry); ok;
+		ok = Thread32Next(snapshot, &entry))
+	{
+		if(entry.th32OwnerProcessID == procId)
+			ids.insert(entry.th32ThreadID);
+	}
+	CloseHandle(snapshot);
+#endif
+	return ids;
+}
+
+/// <summary>
+/// Applies the policy of the specified class to every thread in our process
+/// that is not in `existingIds`. Used for threads that are created by
+/// libraries that we have no other control over.
+///
+/// Threads that have already applied their own policy (E.g. our thread pool
+/// workers) and threads that were started by Windows are skipped. WARNING:
+/// One of our own threads that was created at the same time but hasn't
+/// applied its policy yet is still affected until it does so.
+/// </summary>
+/// <returns>The IDs of the threads that the policy was applied to.</returns>
+QSet<quint64> ThreadPolicy::applyToNewThreads(
+	ThrdClass thrdClass, const QSet<quint64> &existingIds,
+	const QString &name)
+{
+	QSet<quint64> newIds = getProcessThreadIds() - existingIds;
+	QSet<quint64> appliedIds;
+#ifdef Q_OS_WIN
+	int priority = getPriority(thrdClass);
+	quint64 mask = getCoreMask(thrdClass);
+	QSetIterator<quint64> it(newIds);
+	while(it.hasNext()) {
+		quint64 id = it.next();
+		if(!CPUUsage::getThreadName(id).isEmpty())
+			continue; // Already applied its own policy
+		HANDLE thread = OpenThread(
+			THREAD_SET_INFORMATION | THREAD_QUERY_INFORMATION, FALSE,
+			(DWORD)id);
+		if(thread == NULL)
+			continue;
+		if(isSystemThread(thread)) {
+			CloseHandle(thread);
+			continue;
+		}
+		SetThreadPriority(thread, priority);
+		if(mask != 0)
+			SetThreadAffinityMask(thread, (DWORD_PTR)mask);
+		CloseHandle(thread);
+		CPUUsage::registerThread(id, name);
+		appliedIds.insert(id);
+	}
+#endif
+	return appliedIds;
+}
+
+/// <summary>
+/// Removes the names of threads that were returned by `applyToNewThreads()`
+/// once they have exited. Threads that have since been renamed by applying
+/// their own policy are left alone.
+/// </summary>
+void ThreadPolicy::forgetThreads(
+	const QSet<quint64> &threadIds, const QString &name)
+{
+	QSetIterator<quint64> it(threadIds);
+	while(it.hasNext()) {
+		quint64 id = it.next();
+		if(CPUUsage::getThreadName(id) == name)
+			CPUUsage::unregisterThread(id);
+	}
+}
+
+/// <summary>
+/// Writes the effective policy of every thread class to the log.
+/// </summary>
+void ThreadPolicy::logPolicy()
+{
+	for(int i = 0; i < NUM_THREAD_CLASSES; i++) {
+		ThrdClass thrdClass = (ThrdClass)i;
+		quint64 mask = getCoreMask(thrdClass);
+		QString cores = QStringLiteral("All");
+		if(mask != 0) {
+			QStringList list;
+			for(int core = 0; core < 64; core++) {
+				if(mask & (1ULL << core))
+					list.append(QString::number(core));
+			}
+			cores = list.join(QStringLiteral(", "));
+		}
+		appLog(LOG_CAT) << QStringLiteral(
+			"%1 thread policy: Priority = %2; Cores = %3")
+			.arg(ThrdClassStrings[i])
+			.arg(getPriority(thrdClass))
+			.arg(cores);
+	}
+}
+
+/// <summary>
+/// Returns the CPU cores that the specified thread class is allowed to run on
+/// limited to the cores that our process can use. Zero means that the thread
+/// should not be pinned.
+/// </summary>
+quint64 ThreadPolicy::getCoreMask(ThrdClass thrdClass)
+{
+	if(thrdClass != ThrdEncodeClass)
+		return 0;
+	quint64 mask = getEncoderCoreMask();
+#ifdef Q_OS_WIN
+	DWORD_PTR procMask, sysMask;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &procMask, &sysMask))
+		mask &= (quint64)procMask;
+#endif
+	return mask;
+}
+
+/// <summary>
+/// Returns the OS-specific scheduling priority of the specified thread class.
+/// </summary>
+int ThreadPolicy::getPriority(ThrdClass thrdClass)
+{
+#ifdef Q_OS_WIN
+	return ThrdClassPriorities[thrdClass];
+#else
+	return 0;
+#endif
+}
+
+//=============================================================================
+// ScopedThreadPolicy class
+
+ScopedThreadPolicy::ScopedThreadPolicy(
+	ThrdClass thrdClass, const QString &name)
+	: m_prevName(CPUUsage::getThreadName(CPUUsage::getCurrentThreadId()))
+	, m_prevPriority(0)
+{
+#ifdef Q_OS_WIN
+	m_prevPriority = GetThreadPriority(GetCurrentThread());
+#endif
+	ThreadPolicy::applyToCurrentThread(thrdClass, name);
+}
+
+ScopedThreadPolicy::~ScopedThreadPolicy()
+{
+	if(m_prevName.isEmpty())
+		CPUUsage::unregisterThread();
+	else
+		CPUUsage::registerThread(m_prevName);
+#ifdef Q_OS_WIN
+	HANDLE thread = GetCurrentThread();
+	if(m_prevPriority != THREAD_PRIORITY_ERROR_RETURN)
+		SetThreadPriority(thread, m_prevPriority);
+
+	// Threads that we don't own use every core of the process by default
+	DWORD_PTR procMask, sysMask;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &procMask, &sysMask))
+		SetThreadAffinityMask(thread, procMask);
+#endif
+}
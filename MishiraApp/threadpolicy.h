@@ -0,0 +1,86 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#ifndef THREADPOLICY_H
+#define THREADPOLICY_H
+
+#include "common.h"
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+
+//=============================================================================
+/// <summary>
+/// Assigns every thread of our process a scheduling priority and CPU core
+/// set based on the class of work that it does so that the real-time main
+/// loop is not delayed by less important work and so that encoder threads can
+/// be kept away from the cores that a game is using. Applying a policy to a
+/// thread also names it in CPU usage statistics.
+///
+/// Threads that we create ourselves apply their policy from within the thread
+/// by calling `applyToCurrentThread()`. Threads that are created internally
+/// by libraries (E.g. x264) are detected by comparing the list of threads in
+/// our process before and after the library creates them. Libdeskcap creates
+/// its capture threads on demand from within the library so they are not
+/// detected and keep the default OS policy.
+/// </summary>
+class ThreadPolicy
+{
+private: // Static members ----------------------------------------------------
+	static QMutex	s_mutex;
+	static quint64	s_encoderCoreMask; // Zero = All cores
+
+public: // Static methods -----------------------------------------------------
+	static void				setEncoderCoreMask(quint64 mask);
+	static quint64			getEncoderCoreMask();
+	static int				getNumEncoderCores();
+	static void				applyToCurrentThread(
+		ThrdClass thrdClass, const QString &name);
+	static QSet<quint64>	getProcessThreadIds();
+	static QSet<quint64>	applyToNewThreads(
+		ThrdClass thrdClass, const QSet<quint64> &existingIds,
+		const QString &name);
+	static void				forgetThreads(
+		const QSet<quint64> &threadIds, const QString &name);
+	static void				logPolicy();
+
+private:
+	static quint64			getCoreMask(ThrdClass thrdClass);
+	static int				getPriority(ThrdClass thrdClass);
+};
+//=============================================================================
+
+//=============================================================================
+/// <summary>
+/// Applies a thread policy to the calling thread for the lifetime of this
+/// object and then restores the thread's previous priority, name and default
+/// core set. Used by tasks that run on shared thread pool threads that we
+/// don't own so that the policy doesn't leak into unrelated tasks.
+/// </summary>
+class ScopedThreadPolicy
+{
+private: // Members -----------------------------------------------------------
+	QString	m_prevName;
+	int		m_prevPriority;
+
+public: // Constructor/destructor ---------------------------------------------
+	ScopedThreadPolicy(ThrdClass thrdClass, const QString &name);
+	~ScopedThreadPolicy();
+};
+//=============================================================================
+
+#endif // THREADPOLICY_H
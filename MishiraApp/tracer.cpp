@@ -0,0 +1,207 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#include "tracer.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+// The number of events that are kept for each thread. At 60 ticks per second
+// this is around a minute of history for the main thread. Must be a power of
+// two.
+const int TRACE_EVENTS_PER_THREAD = 32768;
+const int TRACE_EVENTS_MASK = TRACE_EVENTS_PER_THREAD - 1;
+
+// The write counter of each buffer jumps back to `TRACE_EVENTS_PER_THREAD`
+// when it reaches this value instead of overflowing. Must be a multiple of
+// `TRACE_EVENTS_PER_THREAD` so that the counter keeps pointing to the same
+// slot after it wraps.
+const int TRACE_COUNTER_WRAP = 1 << 30;
+
+//=============================================================================
+// TraceBuffer class
+
+struct TraceEvent {
+	const char *	name;
+	qint64			startUsec;
+	qint64			durUsec;
+};
+
+static QElapsedTimer s_timer;
+static QMutex s_bufsMutex;
+static QVector<TraceBuffer *> s_bufs;
+static int s_nextBufId = 1;
+
+/// <summary>
+/// The ring buffer of a single thread. Only the owning thread ever writes to
+/// the buffer while any thread can read from it. The buffer is deleted by
+/// `QThreadStorage` when its thread exits.
+/// </summary>
+class TraceBuffer
+{
+public: // Members ------------------------------------------------------------
+	int			id;
+	QString		threadName;
+	QAtomicInt	numWritten; // See `TRACE_COUNTER_WRAP`
+	TraceEvent	events[TRACE_EVENTS_PER_THREAD];
+
+public: // Constructor/destructor ---------------------------------------------
+	TraceBuffer(int bufId, const QString &name)
+		: id(bufId)
+		, threadName(name)
+		, numWritten(0)
+	{
+	}
+
+	~TraceBuffer()
+	{
+		s_bufsMutex.lock();
+		s_bufs.removeOne(this);
+		s_bufsMutex.unlock();
+	}
+};
+
+static QThreadStorage<TraceBuffer *> s_threadBufs;
+
+//=============================================================================
+// Tracer class
+
+bool Tracer::s_enabled = false;
+
+/// <summary>
+/// Begins recording events. Must be called before any threads use the tracer.
+/// </summary>
+void Tracer::initialize()
+{
+	if(s_enabled)
+		return; // Already initialized
+	s_timer.start();
+	s_enabled = true;
+}
+
+qint64 Tracer::getUsec()
+{
+	return s_timer.nsecsElapsed() / 1000LL;
+}
+
+/// <summary>
+/// Records an event that began at `startUsec` and ends now.
+/// </summary>
+void Tracer::record(const char *name, qint64 startUsec)
+{
+	if(!s_enabled)
+		return; // Not recording
+	TraceBuffer *buf = getBufferForThread();
+	int index = buf->numWritten.load();
+	TraceEvent &ev = buf->events[index & TRACE_EVENTS_MASK];
+	ev.name = name;
+	ev.startUsec = startUsec;
+	ev.durUsec = getUsec() - startUsec;
+	index++;
+	if(index == TRACE_COUNTER_WRAP)
+		index = TRACE_EVENTS_PER_THREAD; // The buffer remains full
+	buf->numWritten.storeRelease(index);
+}
+
+TraceBuffer *Tracer::getBufferForThread()
+{
+	if(s_threadBufs.hasLocalData())
+		return s_threadBufs.localData();
+
+	// First event for this thread. IDs are never reused so that the events
+	// of an exited thread are never attributed to a new thread.
+	QThread *thread = QThread::currentThread();
+	s_bufsMutex.lock();
+	int id = s_nextBufId++;
+	QString name = thread->objectName();
+	if(thread == QCoreApplication::instance()->thread())
+		name = QStringLiteral("Main thread");
+	else if(name.isEmpty())
+		name = QStringLiteral("Thread %1").arg(id);
+	TraceBuffer *buf = new TraceBuffer(id, name);
+	s_bufs.append(buf);
+	s_bufsMutex.unlock();
+	s_threadBufs.setLocalData(buf);
+
+	return buf;
+}
+
+/// <summary>
+/// Generates a Chrome trace event JSON document of every event that is
+/// currently in the ring buffers. Can be called from any thread while other
+/// threads continue to record events.
+/// </summary>
+QByteArray Tracer::toChromeTraceJson()
+{
+	QByteArray json;
+	json.reserve(4 * 1024 * 1024);
+	json += "{\"traceEvents\":[\n";
+	bool first = true;
+
+	s_bufsMutex.lock();
+	for(int i = 0; i < s_bufs.size(); i++) {
+		TraceBuffer *buf = s_bufs.at(i);
+
+		// Thread name metadata
+		if(!first)
+			json += ",\n";
+		first = false;
+		QString name = buf->threadName;
+		name.replace(QChar('\\'), QStringLiteral("\\\\"));
+		name.replace(QChar('"'), QStringLiteral("\\\""));
+		json += QStringLiteral(
+			"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%1,"
+			"\"args\":{\"name\":\"%2\"}}")
+			.arg(buf->id)
+			.arg(name)
+			.toUtf8();
+
+		// Copy the events first as the owning thread keeps writing to the
+		// buffer. Any event that was overwritten while we were copying is
+		// discarded afterwards.
+		int end = buf->numWritten.loadAcquire();
+		int begin = qMax(0, end - TRACE_EVENTS_PER_THREAD);
+		QVector<TraceEvent> events;
+		events.reserve(end - begin);
+		for(int j = begin; j < end; j++)
+			events.append(buf->events[j & TRACE_EVENTS_MASK]);
+		int numNew = buf->numWritten.loadAcquire() - end;
+		if(numNew < 0) // Counter wrapped while we were copying
+			numNew += TRACE_COUNTER_WRAP - TRACE_EVENTS_PER_THREAD;
+		int skip = qMax(0, end - begin + numNew - TRACE_EVENTS_PER_THREAD);
+
+		for(int j = skip; j < events.size(); j++) {
+			const TraceEvent &ev = events.at(j);
+			json += QStringLiteral(
+				",\n{\"name\":\"%1\",\"ph\":\"X\",\"ts\":%2,\"dur\":%3,"
+				"\"pid\":1,\"tid\":%4}")
+				.arg(QLatin1String(ev.name))
+				.arg(ev.startUsec)
+				.arg(ev.durUsec)
+				.arg(buf->id)
+				.toUtf8();
+		}
+	}
+	s_bufsMutex.unlock();
+
+	json += "\n]}\n";
+	return json;
+}
@@ -0,0 +1,93 @@
+//*****************************************************************************
+// Mishira: An audiovisual production tool for broadcasting live video
+//
+// Copyright (C) 2014 Lucas Murray <lucas@polyflare.com>
+// All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 2 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//*****************************************************************************
+
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+class TraceBuffer;
+
+//=============================================================================
+/// <summary>
+/// Records a timeline of how long the main loop, rendering, encoding and
+/// output stages take so that intermittent stutters can be investigated after
+/// the fact. Every thread records into its own fixed-size ring buffer so
+/// recording never blocks and only the most recent events are kept. The
+/// buffer of a thread is discarded when the thread exits. Nothing is recorded
+/// unless tracing is enabled in the application settings. The timeline can be
+/// saved at any time in the Chrome trace event format which can be viewed in
+/// "chrome://tracing" or Perfetto.
+///
+/// Events are recorded with the `TraceZone` helper which measures the time
+/// between its construction and destruction.
+/// </summary>
+class Tracer
+{
+private: // Static members ----------------------------------------------------
+	static bool		s_enabled;
+
+public: // Static methods -----------------------------------------------------
+	static void			initialize();
+	static bool			isEnabled();
+	static qint64		getUsec();
+	static void			record(const char *name, qint64 startUsec);
+	static QByteArray	toChromeTraceJson();
+
+private:
+	static TraceBuffer *	getBufferForThread();
+};
+//=============================================================================
+
+inline bool Tracer::isEnabled()
+{
+	return s_enabled;
+}
+
+//=============================================================================
+/// <summary>
+/// Records a trace event that covers the lifetime of this object. `name` must
+/// be a string literal as only the pointer is stored.
+/// </summary>
+class TraceZone
+{
+private: // Members -----------------------------------------------------------
+	const char *	m_name;
+	qint64			m_startUsec;
+
+public: // Constructor/destructor ---------------------------------------------
+	TraceZone(const char *name);
+	~TraceZone();
+};
+//=============================================================================
+
+inline TraceZone::TraceZone(const char *name)
+	: m_name(name)
+	, m_startUsec(Tracer::isEnabled() ? Tracer::getUsec() : -1)
+{
+}
+
+inline TraceZone::~TraceZone()
+{
+	if(m_startUsec >= 0)
+		Tracer::record(m_name, m_startUsec);
+}
+
+#endif // TRACER_H
@@ -17,6 +17,7 @@
 
 #include "winapplication.h"
 #include "appsettings.h"
+#include "metrics.h"
 #include "profile.h"
 #include "versionhelpers.h"
 #include "wincpuusage.h"
@@ -27,6 +28,20 @@
 #include <QtCore/QSettings>
 #include <QtGui/QImage>
 
+// Only available in Windows 10 version 1803 and later. Older versions of
+// Windows fail to create the timer if this flag is specified.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// How early to wake up when in "low jitter mode" and we have a high
+// resolution timer available
+const quint64 PRECISE_SLEEP_MARGIN_USEC = 250;
+
+// Created once as it is reported every time that the main loop wakes up
+const QString WAKE_LATENESS_METRIC =
+	QStringLiteral("mishira_main_loop_wake_lateness_usec");
+
 // Undocumented Qt helper functions that are exported from the QtGui library
 //extern QPixmap qt_pixmapFromWinHICON(HICON icon);
 extern QImage qt_imageFromWinHBITMAP(HDC hdc, HBITMAP bitmap, int w, int h);
@@ -322,6 +337,7 @@ WinApplication::WinApplication(
 
 	// OS Scheduler
 	, m_schedulerPeriod(0)
+	, m_sleepTimer(NULL)
 
 	// System cursor
 	, m_cursorDirty(true)
@@ -588,6 +604,16 @@ int WinApplication::execute()
 		return 1;
 	}
 
+	// Create a high resolution timer so that we can sleep until exactly the
+	// next scheduled tick instead of being limited to the scheduler period.
+	// If it's unavailable we fall back to `Sleep()`.
+	m_sleepTimer = CreateWaitableTimerExW(
+		NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if(m_sleepTimer == NULL) {
+		appLog() << QStringLiteral(
+			"High resolution timer unavailable, using scheduler period for sleeping");
+	}
+
 	// Begin main loop
 	appLog() << LOG_DOUBLE_LINE << "\n Main loop begin\n" << LOG_DOUBLE_LINE;
 	while(!m_exiting) {
@@ -647,13 +673,16 @@ int WinApplication::execute()
 			// `[ActualSchedulerPeriod] * 1.5` milliseconds before our next
 			// scheduled tick so that we don't miss the exact time, otherwise
 			// we sleep until after the scheduled time to prevent wasting CPU.
+			// If we have a high resolution timer then we only need to wake up
+			// slightly early as we are not limited by the scheduler period.
 			// WARNING: Remember that we are dealing with unsigned numbers!
 			//continue; // Spin
 			quint64 sleepTarget =
-				((quint64)m_nextRTTickNum * 1000000 *
-				m_mainLoopFreq.denominator) / m_mainLoopFreq.numerator +
+				calcTimeOfEvent(m_nextRTTickNum, m_mainLoopFreq) +
 				m_tickTimeOrigin;
 			quint64 targetBuf = (quint64)m_schedulerPeriod * 1500; // ms->usec
+			if(m_sleepTimer != NULL)
+				targetBuf = PRECISE_SLEEP_MARGIN_USEC;
 			if(!isInLowJitterMode())
 				targetBuf = 0; // Always sleep if it isn't time yet
 			quint64 curTime = getUsecSinceExec();
@@ -665,12 +694,24 @@ int WinApplication::execute()
 			if(sleepTarget < targetBuf)
 				continue; // If we sleep now we might not wake up in time
 			sleepTarget -= targetBuf; // Now the max usec we can safely sleep
+			quint64 wakeTime = curTime + sleepTarget;
 			int sleepMs;
-			if(isInLowJitterMode())
-				sleepMs = sleepTarget / 1000; // Always wake up early
-			else
-				sleepMs = (sleepTarget + 999) / 1000; // Always wake up late
-			Sleep(sleepMs);
+			if(m_sleepTimer != NULL) {
+				sleepMs = sleepTarget / 1000; // Only used for logging
+				preciseSleep(sleepTarget);
+			} else {
+				if(isInLowJitterMode())
+					sleepMs = sleepTarget / 1000; // Always wake up early
+				else
+					sleepMs = (sleepTarget + 999) / 1000; // Always wake up late
+				Sleep(sleepMs);
+			}
+
+			// Record how late we woke up compared to when we asked to be
+			curTime = getUsecSinceExec();
+			getMetrics()->observe(
+				WAKE_LATENESS_METRIC,
+				curTime > wakeTime ? curTime - wakeTime : 0);
 
 #define LOG_SLEEP_BEHAVIOUR 0
 #if LOG_SLEEP_BEHAVIOUR
@@ -679,9 +720,8 @@ int WinApplication::execute()
 				//appLog() << "Slept for 0ms";
 			} else {
 				sleepTarget =
-					(m_nextRTTickNum * 1000000 * m_mainLoopFreq.denominator) /
-					m_mainLoopFreq.numerator + m_tickTimeOrigin;
-				curTime = getUsecSinceExec();
+					calcTimeOfEvent(m_nextRTTickNum, m_mainLoopFreq) +
+					m_tickTimeOrigin;
 				if(sleepTarget < curTime) {
 					appLog() << "  Overslept by "
 						<< (curTime - sleepTarget) << " usec! Slept for "
@@ -696,6 +736,12 @@ int WinApplication::execute()
 	}
 	appLog() << LOG_DOUBLE_LINE << "\n Main loop end\n" << LOG_DOUBLE_LINE;
 
+	// Destroy high resolution timer
+	if(m_sleepTimer != NULL) {
+		CloseHandle(m_sleepTimer);
+		m_sleepTimer = NULL;
+	}
+
 	// Return the OS scheduler to its original frequency
 	releaseOsSchedulerPeriod();
 
@@ -842,6 +888,21 @@ qint64 WinApplication::qpcPosToUsecSinceFrameOrigin(
 		m_tickTimeOrigin;
 }
 
+/// <summary>
+/// Blocks the main thread for `usec` microseconds using our high resolution
+/// waitable timer. Must only be called if the timer was successfully created.
+/// </summary>
+void WinApplication::preciseSleep(quint64 usec)
+{
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -(LONGLONG)(usec * 10ULL); // Relative, 100ns units
+	if(!SetWaitableTimer(m_sleepTimer, &dueTime, 0, NULL, NULL, FALSE)) {
+		Sleep((DWORD)(usec / 1000ULL));
+		return;
+	}
+	WaitForSingleObject(m_sleepTimer, INFINITE);
+}
+
 int WinApplication::detectOsSchedulerPeriod()
 {
 	// Force scheduler refresh by sleeping for more than 1/64 sec (Which is the
@@ -44,6 +44,7 @@ private: // Members -----------------------------------------------------------
 
 	// OS Scheduler
 	uint			m_schedulerPeriod; // ms
+	HANDLE			m_sleepTimer; // High resolution waitable timer
 
 	// System cursor
 	bool			m_cursorDirty;
@@ -62,6 +63,9 @@ public: // Methods ------------------------------------------------------------
 	void			refDisableAero();
 	void			derefDisableAero();
 
+private:
+	void			preciseSleep(quint64 usec);
+
 public: // Interface ----------------------------------------------------------
 	virtual void		logSystemInfo();
 	virtual void		hideLauncherSplash();
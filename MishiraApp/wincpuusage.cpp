@@ -17,9 +17,10 @@
 
 #include "wincpuusage.h"
 #include "winapplication.h"
+#include <tlhelp32.h>
 
-WinCPUUsage::WinCPUUsage()
-	: CPUUsage()
+WinCPUUsage::WinCPUUsage(int windowSize)
+	: CPUUsage(windowSize)
 	, m_startSysIdle()
 	, m_startSysKernel()
 	, m_startSysUser()
@@ -31,6 +32,9 @@ WinCPUUsage::WinCPUUsage()
 	GetSystemTimes(&m_startSysIdle, &m_startSysKernel, &m_startSysUser);
 	GetProcessTimes(GetCurrentProcess(), &createTime, &exitTime,
 		&m_startProcKernel, &m_startProcUser);
+
+	// Record the first sample of the rolling window
+	update();
 }
 
 WinCPUUsage::~WinCPUUsage()
@@ -77,6 +81,54 @@ float WinCPUUsage::getAvgUsage(float *totalUsage)
 	return (float)((double)totalProcTime / (double)totalTime);
 }
 
+/// <summary>
+/// Fetches the current CPU statistics of the system, our process and every
+/// thread that belongs to our process. All times are in 100ns units.
+/// </summary>
+CPUUsage::Sample WinCPUUsage::takeSample()
+{
+	Sample sample;
+	FILETIME now, sysIdle, sysKernel, sysUser, procKernel, procUser;
+	FILETIME createTime, exitTime;
+	GetSystemTimeAsFileTime(&now);
+	GetSystemTimes(&sysIdle, &sysKernel, &sysUser);
+	GetProcessTimes(GetCurrentProcess(), &createTime, &exitTime,
+		&procKernel, &procUser);
+	sample.wallTime = fileTimeToUInt64(now);
+	sample.sysTime = fileTimeToUInt64(sysKernel) + fileTimeToUInt64(sysUser);
+	sample.sysIdleTime = fileTimeToUInt64(sysIdle);
+	sample.procTime =
+		fileTimeToUInt64(procKernel) + fileTimeToUInt64(procUser);
+
+	// Windows doesn't provide a way to list the threads of a single process
+	// so we need to walk every thread in the system
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if(snapshot == INVALID_HANDLE_VALUE)
+		return sample;
+	DWORD procId = GetCurrentProcessId();
+	THREADENTRY32 entry;
+	entry.dwSize = sizeof(entry);
+	for(BOOL ok = Thread32First(snapshot, &entry); ok;
+		ok = Thread32Next(snapshot, &entry))
+	{
+		if(entry.th32OwnerProcessID != procId)
+			continue;
+		HANDLE thread = OpenThread(
+			THREAD_QUERY_INFORMATION, FALSE, entry.th32ThreadID);
+		if(thread == NULL)
+			continue;
+		FILETIME kernel, user;
+		if(GetThreadTimes(thread, &createTime, &exitTime, &kernel, &user)) {
+			sample.threadTimes[entry.th32ThreadID] =
+				fileTimeToUInt64(kernel) + fileTimeToUInt64(user);
+		}
+		CloseHandle(thread);
+	}
+	CloseHandle(snapshot);
+
+	return sample;
+}
+
 quint64 WinCPUUsage::fileTimeToUInt64(const FILETIME &fileTime)
 {
 	ULARGE_INTEGER ret;
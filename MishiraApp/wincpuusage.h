@@ -32,12 +32,15 @@ private: // Members -----------------------------------------------------------
 	FILETIME	m_startProcUser;
 
 public: // Constructor/destructor ---------------------------------------------
-	WinCPUUsage();
+	WinCPUUsage(int windowSize = 5);
 	virtual ~WinCPUUsage();
 
 public: // Methods ------------------------------------------------------------
 	virtual float	getAvgUsage(float *totalUsage = NULL);
 
+protected:
+	virtual Sample	takeSample();
+
 private:
 	quint64			fileTimeToUInt64(const FILETIME &fileTime);
 };
@@ -20,6 +20,7 @@
 #include "wizardcontroller.h"
 #include "Targets/file/filetargetsettingspage.h"
 #include "Targets/hitbox/hitboxtargetsettingspage.h"
+#include "Targets/replay/replaytargetsettingspage.h"
 #include "Targets/rtmp/rtmptargetsettingspage.h"
 #include "Targets/twitch/twitchtargetsettingspage.h"
 #include "Targets/ustream/ustreamtargetsettingspage.h"
@@ -169,6 +170,7 @@ WizardWindow::WizardWindow(QWidget *parent)
 	m_pages[index++] = new TwitchTargetSettingsPage(this);
 	m_pages[index++] = new UstreamTargetSettingsPage(this);
 	m_pages[index++] = new HitboxTargetSettingsPage(this);
+	m_pages[index++] = new ReplayTargetSettingsPage(this);
 	Q_ASSERT(index == WIZ_NUM_PAGES);
 	for(int i = 0; i < WIZ_NUM_PAGES; i++) {
 		if(m_pages[i] != NULL)
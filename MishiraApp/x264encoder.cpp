@@ -17,6 +17,9 @@
 
 #include "x264encoder.h"
 #include "application.h"
+#include "metrics.h"
+#include "threadpolicy.h"
+#include "tracer.h"
 #include <QtCore/qglobal.h>
 
 #define DUMP_STREAM_TO_FILE 0
@@ -304,12 +307,21 @@ X264Encoder::X264Encoder(
 	, m_forceIdr(-1)
 	//, m_pics() // Custom x264 allocation method
 	, m_prevPic(0)
+	, m_prevPicIsLatest(false)
 	, m_picInfoStack()
 	, m_numPicInfoAllocated(0)
 	, m_inLowCpuMode(false)
 	, m_lowCpuModeCount(0)
 	, m_lowCpuModeFrameCount(0)
 	, m_encodeErrorCount(0)
+	, m_threadIds()
+
+	// Metric names
+	, m_framesMetric()
+	, m_bytesMetric()
+	, m_frameUsecMetric()
+	, m_lowCpuEntriesMetric()
+	, m_lowCpuFramesMetric()
 {
 	memset(&m_params, 0, sizeof(m_params));
 
@@ -465,6 +477,11 @@ bool X264Encoder::initializeEncoder()
 	m_params.pf_log = x264LogHandler;
 	m_params.p_log_private = this;
 
+	// If the encoder is pinned to a subset of cores then only create as many
+	// threads as x264 would if those were the only cores in the system
+	if(ThreadPolicy::getEncoderCoreMask() != 0)
+		m_params.i_threads = ThreadPolicy::getNumEncoderCores() * 3 / 2;
+
 #define FORCE_SINGLE_THREADED 0
 #if FORCE_SINGLE_THREADED
 	// Force single threaded operation for testing thread synchronization
@@ -522,23 +539,46 @@ bool X264Encoder::initializeEncoder()
 
 	//-------------------------------------------------------------------------
 
-	// Initialize x264
+	// Initialize x264. x264 creates its worker threads during initialization
+	// so this is our only opportunity to apply our thread policy to them.
+	QSet<quint64> prevThreadIds = ThreadPolicy::getProcessThreadIds();
 	m_x264 = x264_encoder_open(&m_params);
 	if(m_x264 == NULL) {
 		appLog(LOG_CAT, Log::Warning)
 			<< "x264_encoder_open() failed, cannot enable encoder";
 		return false;
 	}
+	m_threadIds = ThreadPolicy::applyToNewThreads(
+		ThrdEncodeClass, prevThreadIds, QStringLiteral("x264"));
+	appLog(LOG_CAT) << QStringLiteral(
+		"Applied encoder thread policy to %L1 x264 threads")
+		.arg(m_threadIds.size());
 
 	// Reset state
 	m_nextPts = 0;
 	m_forceIdr = -1;
 	m_prevPic = 0;
+	m_prevPicIsLatest = false;
 	m_inLowCpuMode = false;
 	m_lowCpuModeCount = 0;
 	m_lowCpuModeFrameCount = 0;
 	m_encodeErrorCount = 0;
 
+	// Our ID is only known once we have been added to the profile so build
+	// the names of our metrics here instead of every frame
+	const QString id = QString::number(getId());
+	const QString key = QStringLiteral("encoder");
+	m_framesMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_encoder_frames_total"), key, id);
+	m_bytesMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_encoder_bytes_total"), key, id);
+	m_frameUsecMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_encoder_frame_usec"), key, id);
+	m_lowCpuEntriesMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_encoder_low_cpu_mode_entries_total"), key, id);
+	m_lowCpuFramesMetric = MetricsRegistry::withLabel(
+		QStringLiteral("mishira_encoder_low_cpu_mode_frames_total"), key, id);
+
 	// Allocate picture memory
 	if(x264_picture_alloc(
 		&m_pics[0], X264_CSP_NV12, m_size.width(), m_size.height()) < 0)
@@ -616,6 +656,8 @@ void X264Encoder::shutdownEncoder(bool flush)
 	x264_picture_clean(&m_pics[1]);
 	x264_encoder_close(m_x264);
 	m_x264 = NULL;
+	ThreadPolicy::forgetThreads(m_threadIds, QStringLiteral("x264"));
+	m_threadIds.clear();
 
 	// Notify the application that we are are no longer encoding and that it
 	// should not process every frame if there is no other active encoders.
@@ -826,13 +868,17 @@ bool X264Encoder::encodeNV12Frame(const NV12Frame &frame, uint frameNum)
 {
 	if(!m_isRunning)
 		return false;
+	TraceZone zone("X264Encoder::encodeNV12Frame");
 	//appLog() << "**FRAME**";
+	quint64 startTime = App->getUsecSinceExec();
 
 	// Is the application in low CPU usage mode? If so obey it
+	MetricsRegistry *metrics = App->getMetrics();
 	bool appLowCpu = App->isInLowCPUMode();
 	if(m_inLowCpuMode != appLowCpu) {
 		if(appLowCpu) {
 			m_lowCpuModeCount++;
+			metrics->addToCounter(m_lowCpuEntriesMetric);
 			//if(m_lowCpuModeCount <= 1) {
 			//	appLog(LOG_CAT) << QStringLiteral(
 			//		"Entering low CPU usage mode for the first time");
@@ -846,16 +892,22 @@ bool X264Encoder::encodeNV12Frame(const NV12Frame &frame, uint frameNum)
 		}
 		setLowCPUUsageMode(appLowCpu);
 	}
-	if(m_inLowCpuMode)
+	if(m_inLowCpuMode) {
 		m_lowCpuModeFrameCount++;
+		metrics->addToCounter(m_lowCpuFramesMetric);
+	}
 
 	//-------------------------------------------------------------------------
 	// Prepare our `x264_picture_t`. WARNING: Due to memory sharing the picture
 	// initially has partially undefined settings! Make sure that every
 	// parameter that gets changed is changed in every possible branch.
 
-	// Get our picture structure
-	m_prevPic ^= 1; // Swap pictures
+	// Get our picture structure. If the frame is identical to the previous
+	// one then we reuse the previous picture as it already contains the
+	// correct image data. This is safe as x264 copies the data internally.
+	bool reusePic = frame.isRepeat && m_prevPicIsLatest;
+	if(!reusePic)
+		m_prevPic ^= 1; // Swap pictures
 	x264_picture_t *inPic = &m_pics[m_prevPic];
 
 	// Define x264 parameters
@@ -876,7 +928,9 @@ bool X264Encoder::encodeNV12Frame(const NV12Frame &frame, uint frameNum)
 		appLog(LOG_CAT, Log::Warning)
 			<< "Failed to allocated a x264 picture info struct, "
 			<< "skipping frame";
-		m_prevPic ^= 1; // Swap pictures back as this one is invalid
+		if(!reusePic)
+			m_prevPic ^= 1; // Swap pictures back as this one is invalid
+		m_prevPicIsLatest = false;
 		return false;
 	}
 	inPic->opaque = info;
@@ -886,13 +940,16 @@ bool X264Encoder::encodeNV12Frame(const NV12Frame &frame, uint frameNum)
 	// x264's API is currently wasteful as it will do an additional (Optimized)
 	// memory copy of this data when we call `x264_encoder_encode`. It needs to
 	// do this because of frame delaying but it's still not optimal.
-	const QSize uvSize = QSize(m_size.width(), m_size.height() / 2);
-	imgDataCopy(
-		inPic->img.plane[0], frame.yPlane, inPic->img.i_stride[0],
-		frame.yStride, m_size);
-	imgDataCopy(
-		inPic->img.plane[1], frame.uvPlane, inPic->img.i_stride[1],
-		frame.uvStride, uvSize);
+	if(!reusePic) {
+		const QSize uvSize = QSize(m_size.width(), m_size.height() / 2);
+		imgDataCopy(
+			inPic->img.plane[0], frame.yPlane, inPic->img.i_stride[0],
+			frame.yStride, m_size);
+		imgDataCopy(
+			inPic->img.plane[1], frame.uvPlane, inPic->img.i_stride[1],
+			frame.uvStride, uvSize);
+	}
+	m_prevPicIsLatest = true;
 
 	//-------------------------------------------------------------------------
 
@@ -921,7 +978,13 @@ bool X264Encoder::encodeNV12Frame(const NV12Frame &frame, uint frameNum)
 		return false;
 	}
 	m_encodeErrorCount = 0; // Successful encode
-	return processNALs(outPic, nals, numNals);
+	bool ret = processNALs(outPic, nals, numNals);
+
+	// Report performance metrics
+	metrics->addToCounter(m_framesMetric);
+	metrics->observe(m_frameUsecMetric, App->getUsecSinceExec() - startTime);
+
+	return ret;
 }
 
 bool X264Encoder::processNALs(
@@ -1051,6 +1114,12 @@ bool X264Encoder::processNALs(
 	}
 #endif
 
+	// Report encoded size
+	int numBytes = 0;
+	for(int i = 0; i < pkts.size(); i++)
+		numBytes += pkts.at(i).data().size();
+	App->getMetrics()->addToCounter(m_bytesMetric, numBytes);
+
 	// Emit our signal
 	emit frameEncoded(frame);
 
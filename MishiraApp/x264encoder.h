@@ -20,6 +20,7 @@
 
 #include "videoencoder.h"
 #include <QtCore/QByteArray>
+#include <QtCore/QSet>
 #include <QtCore/QStack>
 
 // x264 headers
@@ -56,12 +57,21 @@ protected: // Members ---------------------------------------------------------
 	int						m_forceIdr; // -1 = Ignore, 0+ = Delay until force
 	x264_picture_t			m_pics[2];
 	int						m_prevPic;
+	bool					m_prevPicIsLatest; // Contains the last frame
 	QStack<PictureInfo *>	m_picInfoStack; // More efficient than a queue
 	int						m_numPicInfoAllocated;
 	bool					m_inLowCpuMode;
 	int						m_lowCpuModeCount;
 	int						m_lowCpuModeFrameCount;
 	int						m_encodeErrorCount;
+	QSet<quint64>			m_threadIds; // x264's internal threads
+
+	// Metric names that include our encoder ID
+	QString					m_framesMetric;
+	QString					m_bytesMetric;
+	QString					m_frameUsecMetric;
+	QString					m_lowCpuEntriesMetric;
+	QString					m_lowCpuFramesMetric;
 
 public: // Static methods -----------------------------------------------------
 	static int		determineBestBitrate(